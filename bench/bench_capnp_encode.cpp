@@ -0,0 +1,81 @@
+// Compares the previous two-pass capnp payload encoding (build a message to
+// measure it, then build it again to write it) with the single-pass path
+// now used by ChannelWriter.
+
+#include <chrono>
+#include <iostream>
+
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/serialize.h"
+#include "lt/slipstream/testing/integer.h"
+#include "lt/slipstream/writer.h"
+
+using namespace lt::slipstream;
+
+static constexpr size_t iterations = 1000000;
+
+template <typename F>
+static void bench(const std::string& name, F&& f)
+{
+    // Warm up
+    for (size_t i = 0; i < iterations / 10; ++i) {
+        f(i);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < iterations; ++i) {
+        f(i);
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+    std::cout << name << ": " << static_cast<double>(ns) / iterations
+        << " ns/op" << std::endl;
+}
+
+static size_t two_pass(kj::OutputStream& out, const SerialInt64& value)
+{
+    size_t size = 0;
+
+    {
+        ::capnp::MallocMessageBuilder message;
+        auto builder = message.initRoot<lt::slipstream::capnp::SerialInt64>();
+        SerialInt64::encode(builder, value);
+        size = ::capnp::computeSerializedSizeInWords(message) * 8;
+    }
+
+    {
+        ::capnp::MallocMessageBuilder message;
+        auto builder = message.initRoot<lt::slipstream::capnp::SerialInt64>();
+        SerialInt64::encode(builder, value);
+        ::capnp::writeMessage(out, message);
+    }
+
+    return size;
+}
+
+int main(int argc, char *argv[])
+{
+    FrameBuffer frame;
+
+    bench("payload two-pass", [&](size_t i) {
+        frame.clear();
+        two_pass(frame, SerialInt64(i));
+    });
+
+    bench("payload single-pass", [&](size_t i) {
+        frame.clear();
+        SerialInt64::write_impl(frame, SerialInt64(i));
+    });
+
+    auto writer = ChannelWriter<Headerless<SerialInt64>>(&frame, "bench", "int64");
+
+    bench("ChannelWriter::write", [&](size_t i) {
+        frame.clear();
+        writer.write(SerialInt64(i), i + 1);
+    });
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+// Measures the cost per frame of merging many inputs with a ScannerGroup,
+// as `slipstream remix` does when given a day of per-host files.
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/scanner.h"
+#include "lt/slipstream/writer.h"
+
+using namespace lt::slipstream;
+
+static constexpr size_t total_frames = 400000;
+
+class MemoryScanner : public Scanner {
+    // A movable Scanner over frames held in memory
+
+   public:
+    MemoryScanner(std::shared_ptr<const FrameBuffer> frames)
+        : frames_(frames),
+          in_(std::make_unique<kj::ArrayInputStream>(frames_->asBytes())),
+          scanner_(std::make_unique<ScannerWrapper>(*in_))
+    {
+    }
+
+    MemoryScanner(MemoryScanner&& other) = default;
+
+    void reset() override { scanner_->reset(); }
+    bool next() override { return scanner_->next(); }
+    bool skip_frame() override { return scanner_->skip_frame(); }
+
+    bool peek(uint64_t& source_timestamp) override
+    {
+        return scanner_->peek(source_timestamp);
+    }
+
+    bool peek(uint64_t& source_timestamp, Envelope& envelope) override
+    {
+        return scanner_->peek(source_timestamp, envelope);
+    }
+
+    bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope) override
+    {
+        return scanner_->peek(source_timestamp, envelope);
+    }
+
+    size_t copy_frame(kj::OutputStream& out) override
+    {
+        return scanner_->copy_frame(out);
+    }
+
+    size_t tryRead(void* buffer, size_t minBytes, size_t maxBytes) override
+    {
+        return scanner_->tryRead(buffer, minBytes, maxBytes);
+    }
+
+    void skip(size_t bytes) override { scanner_->skip(bytes); }
+
+   private:
+    std::shared_ptr<const FrameBuffer> frames_;
+    std::unique_ptr<kj::ArrayInputStream> in_;
+    std::unique_ptr<ScannerWrapper> scanner_;
+};
+
+static void bench(size_t ninputs)
+{
+    size_t per_input = total_frames / ninputs;
+
+    std::vector<MemoryScanner> inputs;
+
+    for (size_t k = 0; k < ninputs; ++k) {
+        auto frames = std::make_shared<FrameBuffer>();
+        auto writer = ChannelWriter<PlainText>(frames.get(), "bench", "log");
+
+        // Interleaved timestamps, so that the head changes on every frame
+        for (size_t i = 0; i < per_input; ++i) {
+            writer.write(SerialString{"frame"}, 1 + i * ninputs + k);
+        }
+
+        inputs.emplace_back(frames);
+    }
+
+    auto group = ScannerGroup<MemoryScanner>(inputs);
+
+    FrameBuffer out;
+    uint64_t timestamp;
+    size_t n = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    while (group.peek(timestamp)) {
+        out.clear();
+        group.copy_frame(out);
+        n++;
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+    std::cout << ninputs << " inputs: " << n << " frames, "
+        << static_cast<double>(ns) / n << " ns/frame" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    for (size_t ninputs : {10, 100, 1000}) {
+        bench(ninputs);
+    }
+
+    return 0;
+}
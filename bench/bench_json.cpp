@@ -0,0 +1,211 @@
+// Compares the cost per record of formatting frames as JSON: the original
+// json::frame(), which joined key/value strings and formatted every
+// timestamp from scratch, against json::frame() and json::Writer, which
+// append into a reused buffer and cache the formatted second.
+//
+// For capnp channels, also compares decoding each frame and encoding it
+// again with a new message and JsonCodec, as read_json() did, against
+// encoding the message as read with a cached codec, and against a Query
+// that selects one frame in a hundred.
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/json.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/query.h"
+#include "lt/slipstream/reader.h"
+#include "lt/slipstream/testing/integer.h"
+#include "lt/slipstream/writer.h"
+
+using namespace lt::slipstream;
+
+static constexpr size_t records = 1000000;
+
+// The original implementations, for comparison
+
+static std::string legacy_escape(const std::string& input)
+{
+    std::ostringstream ss;
+
+    for (auto&& c : input) {
+        switch (c) {
+            case '\\': ss << "\\\\"; break;
+            case '"': ss << "\\\""; break;
+            case '/': ss << "\\/"; break;
+            case '\b': ss << "\\b"; break;
+            case '\f': ss << "\\f"; break;
+            case '\n': ss << "\\n"; break;
+            case '\r': ss << "\\r"; break;
+            case '\t': ss << "\\t"; break;
+            default: ss << c; break;
+        }
+    }
+    return ss.str();
+}
+
+static std::string legacy_frame(const std::string& data_json,
+    uint64_t source_timestamp, const Envelope& envelope)
+{
+    using namespace json;
+
+    auto timestamp = format_timestamp(source_timestamp);
+    uint64_t epoch_millis = source_timestamp / static_cast<uint64_t>(1000000);
+    int nanos = source_timestamp % static_cast<uint64_t>(1000000);
+
+    return record({
+        kv("timestamp", enclose_quotes(timestamp)),
+        kv("epochMillis", std::to_string(epoch_millis)),
+        kv("nanos", std::to_string(nanos)),
+        kv("host", enclose_quotes(envelope.identifier.host_name)),
+        kv("app", enclose_quotes(envelope.identifier.application_name)),
+        kv("channel", enclose_quotes(envelope.identifier.channel_name)),
+        kv("data", data_json)});
+}
+
+static std::string legacy_capnp_json(const SerialInt64& value)
+{
+    ::capnp::MallocMessageBuilder message;
+
+    auto builder = message.initRoot<lt::slipstream::capnp::SerialInt64>();
+    SerialInt64::encode(builder, value);
+
+    ::capnp::JsonCodec json;
+    return json.encode(builder).cStr();
+}
+
+template <typename F>
+static void bench(const std::string& name, F&& f)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    size_t bytes = f();
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+    std::cout << name << ": " << static_cast<double>(ns) / records << " ns/record, "
+        << static_cast<double>(bytes) / records << " bytes/record" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    Envelope envelope;
+    envelope.identifier = {"host", "bench", "log"};
+
+    // Log lines of a typical length, a few of which need escaping
+    std::vector<SerialString> lines;
+    for (size_t i = 0; i < 64; ++i) {
+        std::string line = "GET /api/v1/orders?id=" + std::to_string(i * 7919) +
+            " 200 OK served in " + std::to_string(i) + "ms by worker-" + std::to_string(i % 8);
+        if (i % 16 == 0) {
+            line += "\t\"slow\"";
+        }
+        lines.emplace_back(line);
+    }
+
+    // One frame every microsecond
+    static constexpr uint64_t first = 1700000000ull * 1000000000;
+
+    bench("legacy frame", [&]() {
+        size_t bytes = 0;
+        for (size_t i = 0; i < records; ++i) {
+            auto data = "{\"text\":\"" + legacy_escape(lines[i % lines.size()].str()) + "\"}";
+            bytes += legacy_frame(data, first + i * 1000, envelope).size();
+        }
+        return bytes;
+    });
+
+    bench("json::frame", [&]() {
+        size_t bytes = 0;
+        for (size_t i = 0; i < records; ++i) {
+            uint64_t timestamp = first + i * 1000;
+            auto data = SerialString::to_json(lines[i % lines.size()]);
+            bytes += json::frame(data, timestamp, envelope).size();
+        }
+        return bytes;
+    });
+
+    bench("json::Writer", [&]() {
+        json::Writer out;
+        size_t bytes = 0;
+        for (size_t i = 0; i < records; ++i) {
+            out.frame(first + i * 1000, envelope.identifier,
+                [&](json::Writer& w) { json::data(w, lines[i % lines.size()]); });
+            out.raw('\n');
+
+            // As slipstream json writes its output, a block at a time
+            if (out.size() >= 64 * 1024) {
+                bytes += out.size();
+                out.clear();
+            }
+        }
+        return bytes + out.size();
+    });
+
+    FrameBuffer frames;
+    {
+        auto writer = ChannelWriter<Headerless<SerialInt64>>(&frames, "bench", "int");
+        for (size_t i = 0; i < records; ++i) {
+            writer.write(SerialInt64(i * 7919), first + i * 1000);
+        }
+    }
+
+    bench("capnp decode + encode", [&]() {
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = ChannelReader<Headerless<SerialInt64>>(&in);
+
+        SerialInt64 value;
+        uint64_t timestamp;
+        Envelope e;
+        size_t bytes = 0;
+
+        while (reader.read(value, timestamp, e)) {
+            bytes += legacy_frame(legacy_capnp_json(value), timestamp, e).size() + 1;
+        }
+        return bytes;
+    });
+
+    bench("capnp direct", [&]() {
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = ChannelReader<Headerless<SerialInt64>>(&in);
+
+        json::Writer out;
+        uint64_t timestamp;
+        size_t bytes = 0;
+
+        while (reader.read_json(out, timestamp)) {
+            out.raw('\n');
+            if (out.size() >= 64 * 1024) {
+                bytes += out.size();
+                out.clear();
+            }
+        }
+        return bytes + out.size();
+    });
+
+    bench("capnp query", [&]() {
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = ChannelReader<Headerless<SerialInt64>>(&in);
+
+        Query query({"value"}, {"value < " + std::to_string(records / 100 * 7919)});
+
+        json::Writer out;
+        uint64_t timestamp;
+        size_t bytes = 0;
+
+        while (reader.read_json(out, timestamp, query)) {
+            out.raw('\n');
+            if (out.size() >= 64 * 1024) {
+                bytes += out.size();
+                out.clear();
+            }
+        }
+        return bytes + out.size();
+    });
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+// Measures the bytes per frame written, and the decode throughput, of delta
+// channels under each KeyframePolicy.
+//
+// BiasedDeltaInt64Stream encodes keyframes and deltas as capnp messages of
+// the same size, so its bytes per frame only move with the envelope; the
+// decimal text channel shows the effect of deltas that are smaller than
+// their keyframes.
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/keyframe_policy.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/reader.h"
+#include "lt/slipstream/testing/biased.h"
+#include "lt/slipstream/writer.h"
+
+using namespace lt::slipstream;
+
+static constexpr size_t frames = 1000000;
+
+class DecimalDeltaInt64 {
+    // Integers as decimal text; deltas are the difference from the last
+    // keyframe, so are short while the value stays close to it
+
+   public:
+    using header_type = SerialInt64;
+    using data_type = SerialString;
+    using delta_type = SerialString;
+
+    DecimalDeltaInt64(SerialInt64 bias) : bias_(bias), keyframe_(0)
+    {
+    }
+
+    const SerialInt64& header() {
+        return bias_;
+    }
+
+    SerialString encode(const SerialString& input) {
+        keyframe_ = std::stoll(input.str());
+        return input;
+    }
+
+    SerialString decode(const SerialString& input) {
+        keyframe_ = std::stoll(input.str());
+        return input;
+    }
+
+    SerialString encode_delta(const SerialString& input) {
+        return std::to_string(std::stoll(input.str()) - keyframe_);
+    }
+
+    SerialString decode_delta(const SerialString& input) {
+        return std::to_string(std::stoll(input.str()) + keyframe_);
+    }
+
+   private:
+    SerialInt64 bias_;
+    int64_t keyframe_;
+};
+
+using DecimalDeltaInt64Stream = HeaderDeltaStream<DecimalDeltaInt64>;
+
+// A random walk, starting far from zero so that keyframes are long
+static std::vector<int64_t> walk()
+{
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int64_t> step(-100, 100);
+
+    std::vector<int64_t> values(frames);
+    int64_t value = 1000000000000;
+
+    for (auto&& v : values) {
+        value += step(rng);
+        v = value;
+    }
+
+    return values;
+}
+
+template <typename T, typename F>
+static void bench(const std::string& name, const KeyframePolicy& policy,
+    const std::vector<int64_t>& values, F&& make)
+{
+    FrameBuffer out;
+
+    {
+        auto writer = ChannelWriter<T>(&out, "bench", "walk", SerialInt64(0));
+        writer.set_keyframe_policy(policy);
+
+        // One frame every microsecond
+        for (size_t i = 0; i < values.size(); ++i) {
+            writer.write(make(values[i]), 1000000 + i * 1000);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto in = kj::ArrayInputStream(out.asBytes());
+    auto reader = ChannelReader<T>(&in);
+    typename T::data_type data;
+    size_t n = 0;
+
+    while (reader.read(data)) {
+        n++;
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+    std::cout << name << ": " << static_cast<double>(out.size()) / values.size()
+        << " bytes/frame, " << static_cast<double>(ns) / n << " ns/frame decode"
+        << (n == values.size() ? "" : " (SHORT READ)") << std::endl;
+}
+
+template <typename T, typename F>
+static void bench_policies(const std::string& stream, const std::vector<int64_t>& values, F&& make)
+{
+    KeyframePolicy alternate;
+
+    KeyframePolicy every_16;
+    every_16.every_frames = 16;
+
+    KeyframePolicy every_256;
+    every_256.every_frames = 256;
+
+    KeyframePolicy every_ms;
+    every_ms.every_frames = 0;
+    every_ms.every_ns = 1000000;
+
+    KeyframePolicy adaptive;
+    adaptive.every_frames = 0;
+    adaptive.max_delta_ratio = 0.5;
+
+    KeyframePolicy first_only;
+    first_only.every_frames = 0;
+
+    bench<T>(stream + " keyframes only", KeyframePolicy{1}, values, make);
+    bench<T>(stream + " alternate", alternate, values, make);
+    bench<T>(stream + " every 16 frames", every_16, values, make);
+    bench<T>(stream + " every 256 frames", every_256, values, make);
+    bench<T>(stream + " every 1ms", every_ms, values, make);
+    bench<T>(stream + " adaptive 0.5", adaptive, values, make);
+    bench<T>(stream + " first only", first_only, values, make);
+}
+
+int main(int argc, char *argv[])
+{
+    auto values = walk();
+
+    bench_policies<BiasedDeltaInt64Stream>("capnp int64", values, [](int64_t v) {
+        return SerialInt64(v);
+    });
+
+    bench_policies<DecimalDeltaInt64Stream>("decimal", values, [](int64_t v) {
+        return SerialString(std::to_string(v));
+    });
+
+    return 0;
+}
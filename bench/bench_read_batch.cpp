@@ -0,0 +1,86 @@
+// Compares the cost per frame of reading a multichannel stream one frame at
+// a time, with read(data, timestamp, envelope), against read_batch() and
+// for_each_frame(), which hand out interned envelopes and decode into
+// reused slots.
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/multichannel_reader.h"
+#include "lt/slipstream/multichannel_writer.h"
+#include "lt/slipstream/testing/biased.h"
+
+using namespace lt::slipstream;
+
+static constexpr size_t frames = 1000000;
+static constexpr size_t batch = 256;
+
+using Reader = MultiChannelReader<BiasedDeltaInt64Stream>;
+
+template <typename F>
+static void bench(const std::string& name, const FrameBuffer& buffer, F&& f)
+{
+    auto in = kj::ArrayInputStream(buffer.asBytes());
+    auto reader = Reader(&in);
+
+    auto start = std::chrono::steady_clock::now();
+
+    size_t n = f(reader);
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+    std::cout << name << ": " << static_cast<double>(ns) / n << " ns/frame"
+        << (n == frames ? "" : " (SHORT READ)") << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    FrameBuffer buffer;
+
+    {
+        MultiChannelWriter<BiasedDeltaInt64Stream>::header_map headers;
+        headers.emplace_back("a", SerialInt64(100));
+        headers.emplace_back("b", SerialInt64(-100));
+        headers.emplace_back("c", SerialInt64(0));
+
+        auto writer = MultiChannelWriter<BiasedDeltaInt64Stream>(&buffer, "bench", headers);
+        const char * channels[] = {"a", "b", "c"};
+
+        for (size_t i = 0; i < frames; ++i) {
+            writer.write(channels[i % 3], SerialInt64(i), i + 1);
+        }
+    }
+
+    bench("read", buffer, [](Reader& reader) {
+        Reader::data_type data;
+        uint64_t timestamp;
+        Envelope envelope;
+        size_t n = 0;
+
+        while (reader.read(data, timestamp, envelope)) {
+            n++;
+        }
+
+        return n;
+    });
+
+    bench("read_batch", buffer, [](Reader& reader) {
+        std::vector<Reader::slot_type> slots(batch);
+        size_t n = 0;
+
+        while (size_t got = reader.read_batch(kj::arrayPtr(slots.data(), slots.size()))) {
+            n += got;
+        }
+
+        return n;
+    });
+
+    bench("for_each_frame", buffer, [](Reader& reader) {
+        return reader.for_each_frame([](const Reader::slot_type&) {});
+    });
+
+    return 0;
+}
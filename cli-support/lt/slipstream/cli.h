@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <limits>
 #include <string>
 #include <thread>
 
@@ -8,6 +9,9 @@
 
 #include "lt/slipstream/plaintext.h"
 #include "lt/slipstream/filter.h"
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/parallel_reader.h"
+#include "lt/slipstream/query.h"
 #include "lt/slipstream/reader.h"
 #include "lt/slipstream/seek.h"
 #include "lt/slipstream/writer.h"
@@ -28,7 +32,7 @@ inline void log(const std::string& path, const std::string& application_name,
     }
 }
 
-inline void dump(const std::string& path, const std::vector<std::string>& channel_names, const std::string& start_time, const std::string& end_time, bool follow)
+inline void dump(const std::string& path, const std::vector<std::string>& channel_names, const std::string& start_time, const std::string& end_time, bool follow, const FollowPolicy& follow_policy = {})
 {
     int64_t start = parse_timestamp(start_time.c_str());
     int64_t end = parse_timestamp(end_time.c_str());
@@ -46,10 +50,16 @@ inline void dump(const std::string& path, const std::vector<std::string>& channe
         channel_reader.seek(0, SEEK_END);
     }
 
+    // Reads wait at the end of the file for the next frame
+    if (follow) {
+        channel_reader.follow(follow_policy);
+    }
+
     while(true) {
         if (!channel_reader.read(s, source_timestamp, envelope)) {
             if (follow) {
-                usleep(100);
+                // Step over a frame that could not be read
+                channel_reader.next();
                 continue;
             } else {
                 break;
@@ -67,11 +77,53 @@ inline void dump(const std::string& path, const std::vector<std::string>& channe
 }
 
 template <typename T>
-inline void dumpjson(const std::string& path, const std::vector<std::string>& channel_names, const std::string& start_time, const std::string& end_time, bool follow)
+inline void dumpjson(const std::string& path, const std::vector<std::string>& channel_names, const std::string& start_time, const std::string& end_time, bool follow, size_t threads = 1, const FollowPolicy& follow_policy = {}, const std::vector<std::string>& fields = {}, const std::vector<std::string>& predicates = {})
 {
     int64_t start = parse_timestamp(start_time.c_str());
     int64_t end = parse_timestamp(end_time.c_str());
 
+    // Fields and predicates are found through a capnp schema, which the
+    // channel must have
+    if constexpr (!reads_dynamic<T>::value) {
+        if (!fields.empty() || !predicates.empty()) {
+            throw QueryError("--select and --where need a channel with a capnp schema");
+        }
+    }
+
+    // Evaluated on each capnp payload as read
+    Query query(fields, predicates);
+
+    // Records are gathered in a buffer and written a block at a time, or
+    // one by one when following
+    static constexpr size_t block_size = 64 * 1024;
+
+    json::Writer out;
+
+    auto flush = [&]() {
+        std::cout.write(out.str().data(), out.size());
+        std::cout.flush();
+        out.clear();
+    };
+
+    // A whole file, read as it stands, can be decoded in parallel
+    if (threads != 1 && start == -1 && end == -1 && !follow && query.empty()) {
+        auto reader = ParallelReader<T>(path, threads);
+
+        // Each worker writes a run of records into one block, which is
+        // written out whole
+        reader.template transform_blocks<json::Writer>([](json::Writer& block,
+                const typename ParallelReader<T>::slot_type& slot) {
+            block.frame(slot.source_timestamp, slot.envelope->envelope.identifier,
+                [&](json::Writer& w) { json::data(w, std::get<typename T::data_type>(slot.data)); });
+            block.raw('\n');
+        }, [&](json::Writer&& block) {
+            std::cout.write(block.str().data(), block.size());
+        });
+
+        std::cout.flush();
+        return;
+    }
+
     auto channel_reader =
         ChannelPathSeeker<T>(path);
 
@@ -81,19 +133,43 @@ inline void dumpjson(const std::string& path, const std::vector<std::string>& ch
         channel_reader.seek(0, SEEK_END);
     }
 
+    // Reads wait at the end of the file for the next frame
+    if (follow) {
+        channel_reader.follow(follow_policy);
+    }
+
+    // Frames that the query passes over still stop the read at `end`
+    uint64_t until = end != -1 ? static_cast<uint64_t>(end) : std::numeric_limits<uint64_t>::max();
+
     uint64_t source_timestamp = 0;
 
     do {
-        while(auto o = channel_reader.read_json(source_timestamp)) {
+        size_t mark = out.size();
+
+        while (channel_reader.read_json(out, source_timestamp, query, until)) {
 
             if (end != -1 && source_timestamp > static_cast<uint64_t>(end)) {
+                out.truncate(mark);
+                flush();
                 return;
             }
 
-            std::cout << *o << std::endl;
+            out.raw('\n');
+
+            if (follow || out.size() >= block_size) {
+                flush();
+            }
+
+            mark = out.size();
+        }
+
+        // Step over a frame that could not be read
+        if (follow) {
+            channel_reader.next();
         }
-        usleep(100);
     } while(follow);
+
+    flush();
 }
 
 inline void count(const std::string& path)
@@ -102,19 +178,31 @@ inline void count(const std::string& path)
 
     int c = 0;
 
-    do {
-        try {
-            scanner.next();
-            scanner.skip(1);
-            c++;
-        } catch (const std::exception&) {
-            break;
-        }
-    } while (true);
+    // Registration frames of a compact stream are passed over by peek
+    if (scanner.next()) {
+        uint64_t timestamp;
+        const InternedEnvelope * envelope;
+
+        do {
+            if (scanner.peek(timestamp, envelope)) {
+                c++;
+            }
+        } while (scanner.skip_frame());
+    }
 
     std::cout << c << std::endl;
 }
 
+inline void build_index(const std::string& path, uint64_t interval)
+{
+    auto index = TimeIndex::build(path, interval);
+    index.write(path);
+
+    std::cerr << index.entries().size() << " entries, "
+        << index.channels().size() << " channels written to "
+        << TimeIndex::sidecar_path(path) << std::endl;
+}
+
 inline void remix(const std::vector<std::string>& input_paths, const std::string& output_path,
 const std::vector<std::string>& channel_names, const std::string& start_time, const std::string& end_time)
 {
@@ -144,6 +232,10 @@ const std::vector<std::string>& channel_names, const std::string& start_time, co
     uint64_t source_timestamp;
     Envelope envelope;
 
+    // Channel ids of compact input frames are renumbered for the output
+    ChannelRegistry registry;
+    FrameBuffer frame;
+
     if (start != -1) {
         filter_seeker.seek_time(start);
     }
@@ -157,7 +249,12 @@ const std::vector<std::string>& channel_names, const std::string& start_time, co
             break;
         }
 
-        filter_seeker.copy_frame(out);
+        frame.clear();
+        filter_seeker.copy_frame(frame);
+
+        if (!registry.copy_frame(out, kj::arrayPtr(frame.data(), frame.size()), envelope)) {
+            continue;
+        }
         c++;
 
         auto timestamp = format_timestamp(source_timestamp);
@@ -224,8 +321,14 @@ int main(int argc, char* argv[])
         dumper.opt<bool>("f follow")
             .desc("Continue dumping as file grows");
 
+    auto &dumper_spin =
+        dumper.opt<uint64_t>("spin", 0)
+            .desc("When following, spin for up to this many microseconds for the next frame before blocking");
+
     dumper.action([&](Dim::Cli &) {
-        cli::dump(*dumper_path, *dumper_channel_names, *dumper_start, *dumper_end, *dumper_follow);
+        FollowPolicy follow_policy;
+        follow_policy.max_spin_ns = *dumper_spin * 1000;
+        cli::dump(*dumper_path, *dumper_channel_names, *dumper_start, *dumper_end, *dumper_follow, follow_policy);
         return true;
     });
 
@@ -253,14 +356,36 @@ int main(int argc, char* argv[])
         dumpjson.opt<bool>("f follow")
             .desc("Continue dumping as file grows");
 
-    dumpjson.action([&](Dim::Cli &) {
-        cli::dumpjson<T>(*dumpjson_path, *dumpjson_channel_names, *dumpjson_start, *dumpjson_end, *dumpjson_follow);
+    auto &dumpjson_threads =
+        dumpjson.opt<size_t>("threads j", 1)
+            .desc("Decode the file on this many threads, or 0 for one per core. Not used with --start, --end, --follow, --select or --where.");
+
+    auto &dumpjson_spin =
+        dumpjson.opt<uint64_t>("spin", 0)
+            .desc("When following, spin for up to this many microseconds for the next frame before blocking");
+
+    auto &dumpjson_fields =
+        dumpjson.optVec<std::string>("select")
+            .desc("Write only this field of capnp payloads, eg. \"pos.x\". This option may be used multiple times to select multiple fields.");
+
+    auto &dumpjson_predicates =
+        dumpjson.optVec<std::string>("where w")
+            .desc("Include only frames whose capnp payload satisfies this comparison, eg. \"value > 100\". This option may be used multiple times; every comparison must hold.");
+
+    dumpjson.action([&](Dim::Cli & c) {
+        FollowPolicy follow_policy;
+        follow_policy.max_spin_ns = *dumpjson_spin * 1000;
+        try {
+            cli::dumpjson<T>(*dumpjson_path, *dumpjson_channel_names, *dumpjson_start, *dumpjson_end, *dumpjson_follow, *dumpjson_threads, follow_policy, *dumpjson_fields, *dumpjson_predicates);
+        } catch (QueryError& e) {
+            return c.fail(Dim::kExitUsage, e.what());
+        }
         return true;
     });
 
     auto &count =
         cli.command("count")
-            .desc("Count frames.");
+            .desc("Count frames, other than the registration frames of a compact stream.");
 
     auto &count_path =
         count.opt<std::string>("<PATH>")
@@ -271,6 +396,28 @@ int main(int argc, char* argv[])
         return true;
     });
 
+    auto &index =
+        cli.command("index")
+            .desc("Write a time index for faster seeking.");
+
+    auto &index_path =
+        index.opt<std::string>("<PATH>")
+            .desc("The file name to index.");
+
+    auto &index_interval =
+        index.opt<uint64_t>("interval i", TimeIndex::default_interval)
+            .desc("The number of bytes between indexed frames");
+
+    index.footer(
+        "The index is written to <PATH>.ssidx, and is used by seeking commands\n"
+        "until <PATH> is modified.\n"
+    );
+
+    index.action([&](Dim::Cli &) {
+        cli::build_index(*index_path, *index_interval);
+        return true;
+    });
+
     auto &remix =
         cli.command("remix")
             .desc("Extract selected frames.");
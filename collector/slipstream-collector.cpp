@@ -0,0 +1,111 @@
+#include <signal.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "dimcli/cli.h"
+
+#include "lt/slipstream/collector.h"
+#include "lt/slipstream/rotating_output.h"
+
+using namespace lt::slipstream;
+
+static std::atomic<bool> running{true};
+
+static void stop(int)
+{
+    running = false;
+}
+
+static void print_stats(const RingCollector& collector)
+{
+    for (auto&& s : collector.stats()) {
+        std::cerr << s.name << "[" << s.pid << "]"
+            << " frames=" << s.frames
+            << " written=" << s.written
+            << " drops=" << s.drops
+            << " lag_bytes=" << s.lag_bytes
+            << " lag_ms=" << s.lag_ns / 1000000
+            << std::endl;
+    }
+
+    if (collector.write_errors()) {
+        std::cerr << "write errors: " << collector.write_errors() << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Dim::Cli cli;
+
+    cli.helpNoArgs();
+
+    auto &output_path =
+        cli.opt<std::string>("<PATH>")
+            .desc("output path; files are written to <PATH>.000000, <PATH>.000001, ...");
+
+    auto &directory =
+        cli.opt<std::string>("directory d", shm_ring_directory)
+            .desc("directory holding the ring files of producers")
+            .valueDesc("DIR");
+
+    auto &max_megabytes =
+        cli.opt<uint64_t>("max-size m", 1024)
+            .desc("start a new output file after this many MiB; 0 for no limit")
+            .valueDesc("MIB");
+
+    auto &interval =
+        cli.opt<uint64_t>("interval i", 0)
+            .desc("start a new output file every SECS seconds, on the multiple")
+            .valueDesc("SECS");
+
+    auto &header_interval =
+        cli.opt<uint64_t>("header-interval", 300)
+            .desc("repeat header frames every SECS seconds; 0 for only at the start of each file")
+            .valueDesc("SECS");
+
+    auto &stats_interval =
+        cli.opt<unsigned>("stats s", 0)
+            .desc("print per-producer frame, drop and lag counts every SECS seconds")
+            .valueDesc("SECS");
+
+    cli.action([&](Dim::Cli &) {
+        signal(SIGINT, stop);
+        signal(SIGTERM, stop);
+
+        RotationPolicy policy;
+        policy.max_bytes = *max_megabytes << 20;
+        policy.interval_ns = *interval * 1000000000;
+        policy.header_interval_ns = *header_interval * 1000000000;
+
+        auto out = RotatingOutputStream(*output_path, policy);
+        auto collector = RingCollector(&out, *directory);
+
+        auto last_stats = std::chrono::steady_clock::now();
+
+        while (running) {
+            if (collector.poll() == 0) {
+                usleep(100);
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (*stats_interval != 0 &&
+                    now - last_stats >= std::chrono::seconds(*stats_interval)) {
+                print_stats(collector);
+                last_stats = now;
+            }
+        }
+
+        // Write out whatever is left
+        while (collector.poll() != 0) {
+        }
+
+        return true;
+    });
+
+    cli.exec(std::cerr, argc, argv);
+    return cli.exitCode();
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/multichannel_writer.h"
+#include "lt/slipstream/ring.h"
+#include "lt/slipstream/stats.h"
+#include "lt/slipstream/writer.h"
+
+namespace lt::slipstream {
+
+struct AsyncWriterStats {
+    uint64_t frames;          // frames accepted into the ring
+    uint64_t drops;           // frames dropped because the ring was full
+    uint64_t bytes;           // bytes written to the output stream
+    uint64_t write_errors;    // batches the output stream failed to write
+    uint64_t enqueue_p50_ns;  // cost of write() on the calling thread
+    uint64_t enqueue_p99_ns;
+    uint64_t enqueue_max_ns;
+};
+
+class AsyncFrameSink {
+    // Hands complete frames to a dedicated I/O thread through an SpscRing.
+    //
+    // push() only copies the frame into the ring; the I/O thread drains the
+    // ring into the output stream, gathering as many frames as are available
+    // into each write. If the ring is full the frame is dropped and counted.
+
+   public:
+    static constexpr size_t default_ring_capacity = 4 << 20;
+
+    AsyncFrameSink(kj::OutputStream * out,
+        size_t ring_capacity = default_ring_capacity);
+
+    KJ_DISALLOW_COPY(AsyncFrameSink);
+
+    // Writes out everything already pushed, then stops the I/O thread.
+    ~AsyncFrameSink() noexcept(false);
+
+    // Producer: enqueue a frame without blocking. Returns false if the frame
+    // was dropped.
+    bool push(const FrameBuffer& frame);
+
+    // Producer: enqueue a frame, waiting for space if necessary. Used for
+    // header frames, which must not be dropped.
+    void push_wait(const FrameBuffer& frame);
+
+    // Producer: account for the cost of one write() call.
+    void record_enqueue(uint64_t ns) { enqueue_.record(ns); }
+
+    // Wait until the I/O thread has written every frame pushed so far.
+    void flush();
+
+    AsyncWriterStats stats() const;
+
+   private:
+    static constexpr size_t max_batch_ = 64;
+    static constexpr std::chrono::microseconds idle_sleep_{50};
+
+    kj::OutputStream * out_;
+    SpscRing ring_;
+
+    std::atomic<bool> running_;
+    std::atomic<uint64_t> frames_;
+    std::atomic<uint64_t> drops_;
+    std::atomic<uint64_t> bytes_;
+    std::atomic<uint64_t> write_errors_;
+    LatencyHistogram enqueue_;
+
+    std::thread thread_;
+
+    void run();
+};
+
+template <typename T>
+class AsyncChannelWriter {
+    // A ChannelWriter whose frames are written to the output stream by a
+    // background thread.
+    //
+    // The calling thread encodes each frame into a reusable buffer and copies
+    // it into the ring; it never touches the output stream. A dropped frame
+    // forces the next frame to be a keyframe, so that delta channels remain
+    // decodable.
+
+   public:
+    using header_type = typename T::header_type;
+    using data_type = typename T::data_type;
+
+    /* Headerless */
+    AsyncChannelWriter(kj::OutputStream * out,
+        const std::string& application_name,
+        const std::string& channel_name,
+        size_t ring_capacity = AsyncFrameSink::default_ring_capacity,
+        std::enable_if<std::is_same_v<header_type, no_type>, T>* = 0)
+        : sink_(out, ring_capacity),
+          channel_writer_(&frame_, application_name, channel_name),
+          force_keyframe_(false)
+    {
+    }
+
+    /* Mandatory header */
+    AsyncChannelWriter(kj::OutputStream * out,
+        const std::string& application_name,
+        const std::string& channel_name,
+        const header_type& header,
+        size_t ring_capacity = AsyncFrameSink::default_ring_capacity,
+        std::enable_if<!std::is_same_v<header_type, no_type>, T>* = 0)
+        : sink_(out, ring_capacity),
+          channel_writer_(&frame_, application_name, channel_name, header),
+          force_keyframe_(false)
+    {
+        sink_.push_wait(frame_);
+    }
+
+    KJ_DISALLOW_COPY(AsyncChannelWriter);
+
+    bool write(const data_type& data, uint64_t source_timestamp=0,
+        bool force_keyframe=false)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        frame_.clear();
+
+        if (!channel_writer_.write(data, source_timestamp,
+                force_keyframe || force_keyframe_)) {
+            return false;
+        }
+
+        bool result = sink_.push(frame_);
+        force_keyframe_ = !result;
+
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        sink_.record_enqueue(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+        return result;
+    }
+
+    void flush()
+    {
+        sink_.flush();
+    }
+
+    AsyncWriterStats stats() const
+    {
+        return sink_.stats();
+    }
+
+   private:
+    AsyncFrameSink sink_;
+    FrameBuffer frame_;
+    ChannelWriter<T> channel_writer_;
+    bool force_keyframe_;
+};
+
+template <typename... Ts>
+class AsyncMultiChannelWriter {
+    // A MultiChannelWriter whose frames are written to the output stream by
+    // a background thread. See AsyncChannelWriter.
+
+   public:
+    using data_type = typename Variant<Ts...>::data_type;
+    using header_map = typename Variant<Ts...>::header_map;
+
+    AsyncMultiChannelWriter(kj::OutputStream * out,
+        const std::string& application_name,
+        const header_map& channel_headers = {},
+        size_t ring_capacity = AsyncFrameSink::default_ring_capacity)
+        : sink_(out, ring_capacity),
+          channel_writer_(&frame_, application_name, channel_headers)
+    {
+        if (!frame_.empty()) {
+            sink_.push_wait(frame_);
+        }
+    }
+
+    KJ_DISALLOW_COPY(AsyncMultiChannelWriter);
+
+    bool write(const std::string& channel_name, const data_type& data,
+        uint64_t source_timestamp=0, bool force_keyframe=false)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        frame_.clear();
+
+        if (!pending_keyframes_.empty()) {
+            auto it = pending_keyframes_.find(channel_name);
+            if (it != pending_keyframes_.end()) {
+                force_keyframe = true;
+                pending_keyframes_.erase(it);
+            }
+        }
+
+        if (!channel_writer_.write(channel_name, data, source_timestamp,
+                force_keyframe)) {
+            return false;
+        }
+
+        bool result = sink_.push(frame_);
+        if (!result) {
+            pending_keyframes_.insert(channel_name);
+        }
+
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        sink_.record_enqueue(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+        return result;
+    }
+
+    void flush()
+    {
+        sink_.flush();
+    }
+
+    AsyncWriterStats stats() const
+    {
+        return sink_.stats();
+    }
+
+   private:
+    AsyncFrameSink sink_;
+    FrameBuffer frame_;
+    MultiChannelWriter<Ts...> channel_writer_;
+    std::unordered_set<std::string> pending_keyframes_;
+};
+
+} // namespace lt::slipstream
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <vector>
+
+#include <kj/io.h>
+
+#include "lt/slipstream/stats.h"
+
+namespace lt::slipstream {
+
+struct FlushPolicy {
+    // Flush once at least this many bytes are buffered. Zero disables
+    // buffering: every write goes straight to the file.
+    size_t max_bytes = 0;
+
+    // Flush on write() or flush_if_due() once the oldest buffered byte is at
+    // least this old. Zero means no time limit.
+    uint64_t max_delay_ns = 0;
+
+    // After a flush, call fdatasync() if at least this long has passed since
+    // the previous sync. Zero disables syncing.
+    uint64_t sync_interval_ns = 0;
+};
+
+struct FlushStats {
+    uint64_t flushes;         // write(2) calls issued to drain the buffer
+    uint64_t bytes;           // total bytes flushed
+    uint64_t syncs;           // fdatasync() calls
+    uint64_t flush_p50_ns;    // time taken by each flush, including any sync
+    uint64_t flush_p99_ns;
+    uint64_t flush_max_ns;
+
+    uint64_t bytes_per_flush() const { return flushes ? bytes / flushes : 0; }
+};
+
+class BufferedFdOutputStream : public kj::OutputStream {
+    // An OutputStream over a file descriptor that batches writes according
+    // to a FlushPolicy.
+    //
+    // The buffer is flushed when it reaches policy.max_bytes, when the oldest
+    // buffered data exceeds policy.max_delay_ns (checked on each write() and
+    // on flush_if_due()), on an explicit flush(), and on destruction.
+    //
+    // Time limits are only evaluated when the stream is called; a writer that
+    // may go idle with data buffered should call flush_if_due() periodically.
+
+   public:
+    BufferedFdOutputStream(kj::AutoCloseFd fd, const FlushPolicy& policy = {});
+
+    KJ_DISALLOW_COPY(BufferedFdOutputStream);
+    virtual ~BufferedFdOutputStream() noexcept(false);
+
+    // implements OutputStream
+    void write(const void* buffer, size_t size) override;
+
+    void write(kj::ArrayPtr<const kj::ArrayPtr<const kj::byte>> pieces) override;
+
+    void flush();
+
+    // Flush if the delay limit has been reached. Returns true if a flush
+    // happened.
+    bool flush_if_due();
+
+    // Flush, then fdatasync() regardless of the sync interval.
+    void sync();
+
+    const FlushPolicy& policy() const { return policy_; }
+
+    FlushStats stats() const;
+
+    int fd() const { return fd_.get(); }
+
+   private:
+    kj::AutoCloseFd fd_;
+    FlushPolicy policy_;
+
+    std::vector<uint8_t> buffer_;
+    size_t buffered_;
+    uint64_t oldest_ns_;
+    uint64_t last_sync_ns_;
+
+    uint64_t flushes_;
+    uint64_t bytes_;
+    uint64_t syncs_;
+    LatencyHistogram flush_latency_;
+
+    // Pieces of a gathered write, kept to reuse their storage
+    std::vector<struct iovec> iov_;
+
+    void write_fd(const void* buffer, size_t size);
+    void writev_fd(struct iovec * iov, size_t count);
+    void maybe_sync(uint64_t now_ns);
+};
+
+} // namespace lt::slipstream
@@ -1,15 +1,55 @@
 #pragma once
 
 #include <capnp/compat/json.h>
+#include <capnp/dynamic.h>
 #include <capnp/message.h>
 #include <capnp/serialize.h>
 #include <kj/io.h>
 #include <string>
 
+#include "lt/slipstream/json_writer.h"
 #include "lt/slipstream/serialize.h"
 
 namespace lt::slipstream {
 
+class ScratchSegment {
+    // A zeroed, thread-local first segment for a MallocMessageBuilder, so
+    // that encoding a typical message does not touch the heap. capnp zeroes
+    // the used part of the segment again when the builder is destroyed.
+    //
+    // Only one ScratchSegment per thread holds the buffer at a time; a nested
+    // one is empty and the builder must allocate as usual.
+
+   public:
+    static constexpr size_t words = 1024;
+
+    ScratchSegment();
+    ~ScratchSegment();
+
+    KJ_DISALLOW_COPY(ScratchSegment);
+
+    bool empty() const { return segment_.size() == 0; }
+
+    kj::ArrayPtr<::capnp::word> get() const { return segment_; }
+
+   private:
+    kj::ArrayPtr<::capnp::word> segment_;
+};
+
+// The next `length` bytes of a buffered stream, eg. a MappedInputStream, as
+// words for a FlatArrayMessageReader. Data that is not word-aligned is copied
+// into a thread-local buffer, which is reused by the next call.
+//
+// Returns an empty array if the stream is not buffered or does not hold
+// `length` bytes; the caller should then read from the stream as usual.
+// Otherwise the stream is not advanced, and the caller must skip(length)
+// once it has finished with the message.
+kj::ArrayPtr<const ::capnp::word> buffered_words(kj::InputStream& in, size_t length);
+
+// A JsonCodec for this thread, kept from one message to the next rather
+// than set up for each
+::capnp::JsonCodec& json_codec();
+
 template <typename T, typename CapnpType, typename RawType>
 class SlipstreamCapnp : public Serialize<T> {
    protected:
@@ -31,54 +71,114 @@ class SlipstreamCapnp : public Serialize<T> {
 
     static size_t size_impl(const data_type& value)
     {
-        ::capnp::MallocMessageBuilder message;
-
-        builder_type capnp_builder = message.initRoot<CapnpType>();
-        encode(capnp_builder, value);
-
-        return ::capnp::computeSerializedSizeInWords(message) * 8;
+        return with_message(value, [](::capnp::MessageBuilder& message) {
+            return ::capnp::computeSerializedSizeInWords(message) * 8;
+        });
     }
 
     static bool read_impl(kj::InputStream& in, data_type& value, size_t length)
     {
-        ::capnp::InputStreamMessageReader message(in);
-        reader_type capnp_reader = message.getRoot<CapnpType>();
-        value = decode(capnp_reader);
+        return read_message(in, length, [&](const reader_type& reader) {
+            value = decode(reader);
+        });
+    }
 
-        return true;
+    // Append the JSON of the message in the next `length` bytes to `out`,
+    // encoding it from the message as read, without decoding a data_type.
+    // The result is as to_json() gives; a type that replaces to_json()
+    // should also replace this.
+    static bool read_json(kj::InputStream& in, json::Writer& out, size_t length)
+    {
+        return read_message(in, length, [&](const reader_type& reader) {
+            write_json(out, reader);
+        });
     }
 
-    static const std::string read_json(kj::InputStream& in)
+    // Call f(reader) with the message in the next `length` bytes as a
+    // DynamicStruct::Reader, eg. to evaluate a Query against it
+    template <typename F>
+    static bool read_dynamic(kj::InputStream& in, size_t length, F&& f)
     {
-        ::capnp::JsonCodec json;
+        return read_message(in, length, [&](const reader_type& reader) {
+            f(::capnp::toDynamic(reader));
+        });
+    }
 
-        ::capnp::InputStreamMessageReader message(in);
-        reader_type capnp_reader = message.getRoot<CapnpType>();
-        return json.encode(capnp_reader).cStr();
+    // Call f(reader) with the message that encodes `value`, as a
+    // DynamicStruct::Reader
+    template <typename F>
+    static bool with_dynamic(const data_type& value, F&& f)
+    {
+        return with_message(value, [&](::capnp::MessageBuilder& message) {
+            f(::capnp::toDynamic(message.getRoot<CapnpType>().asReader()));
+            return true;
+        });
     }
 
     static const std::string to_json(const data_type& value)
     {
-        ::capnp::MallocMessageBuilder message;
-
-        builder_type capnp_builder = message.initRoot<CapnpType>();
-        encode(capnp_builder, value);
-
-        ::capnp::JsonCodec json;
-        return json.encode(capnp_builder).cStr();
+        return with_message(value, [](::capnp::MessageBuilder& message) {
+            auto text = json_codec().encode(message.getRoot<CapnpType>());
+            return std::string(text.cStr(), text.size());
+        });
     }
 
+    // Encodes the value once; the caller takes the size from the number of
+    // bytes written.
     static bool write_impl(kj::OutputStream& out, const data_type& value)
     {
-        ::capnp::MallocMessageBuilder message;
+        return with_message(value, [&](::capnp::MessageBuilder& message) {
+            ::capnp::writeMessage(out, message);
+            return true;
+        });
+    }
 
-        builder_type capnp_builder = message.initRoot<CapnpType>();
-        encode(capnp_builder, value);
+   private:
+    // Call f(reader) with the message in the next `length` bytes, read in
+    // place from a buffered stream where possible
+    template <typename F>
+    static bool read_message(kj::InputStream& in, size_t length, F&& f)
+    {
+        auto words = buffered_words(in, length);
+
+        if (words.size() != 0) {
+            ::capnp::FlatArrayMessageReader message(words);
+            f(message.getRoot<CapnpType>());
+            in.skip(length);
 
-        ::capnp::writeMessage(out, message);
+            return true;
+        }
+
+        ::capnp::InputStreamMessageReader message(in);
+        f(message.getRoot<CapnpType>());
 
         return true;
     }
+
+    template <typename R>
+    static void write_json(json::Writer& out, const R& reader)
+    {
+        auto text = json_codec().encode(reader);
+        out.raw(std::string_view(text.cStr(), text.size()));
+    }
+
+    template <typename F>
+    static auto with_message(const data_type& value, F&& f)
+    {
+        ScratchSegment scratch;
+
+        if (scratch.empty()) {
+            ::capnp::MallocMessageBuilder message;
+            builder_type capnp_builder = message.initRoot<CapnpType>();
+            encode(capnp_builder, value);
+            return f(message);
+        }
+
+        ::capnp::MallocMessageBuilder message(scratch.get());
+        builder_type capnp_builder = message.initRoot<CapnpType>();
+        encode(capnp_builder, value);
+        return f(message);
+    }
 };
 
 
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <kj/io.h>
+
+#include "lt/slipstream/envelope.h"
+#include "lt/slipstream/framing.h"
+
+namespace lt::slipstream {
+
+class ChannelRegistry {
+    // Assigns the channel ids of the compact (version 3) frames written to
+    // one stream, and writes the registration frames that declare them.
+    //
+    // Every writer of the stream must share the registry. An id is
+    // registered before its first use, and again before its first use after
+    // each sync point, which falls every `sync_interval` bytes of output.
+    // A reader that starts part way through the stream, eg. after seeking,
+    // therefore skips at most one sync interval of each channel's frames
+    // before it learns the channel's id.
+
+   public:
+    static constexpr uint64_t default_sync_interval = 1 << 20;
+
+    explicit ChannelRegistry(uint64_t sync_interval = default_sync_interval);
+
+    KJ_DISALLOW_COPY(ChannelRegistry);
+
+    // The id of an envelope, allocating a new one if it has not been seen.
+    // Throws if every id is in use.
+    uint16_t id(const Envelope& envelope);
+
+    // Write the registration frame of `id` to `out`, if it is due. Returns
+    // the number of bytes written.
+    size_t register_if_due(kj::OutputStream& out, uint16_t id, uint64_t source_timestamp);
+
+    // Account for `bytes` of frames written to the stream
+    void written(size_t bytes);
+
+    // Copy a frame taken from another stream, eg. by a Scanner, to `out`.
+    // A compact frame's channel id is renumbered in place to this registry's
+    // id for `envelope`, registering it if due; its own registration frames
+    // are dropped, as the registry writes its own. Returns false if the
+    // frame was dropped.
+    bool copy_frame(kj::OutputStream& out, kj::ArrayPtr<kj::byte> frame,
+        const Envelope& envelope);
+
+   private:
+    struct Channel {
+        Envelope envelope;
+        std::vector<kj::byte> registration;
+        uint64_t registered_epoch;
+        bool registered;
+    };
+
+    uint64_t sync_interval_;
+    uint64_t since_sync_;
+    uint64_t epoch_;
+    std::vector<Channel> channels_; // by id - 1
+};
+
+class ChannelDictionary {
+    // The envelopes read from one stream: those of version 2 frames, and
+    // those declared by the registration frames of a compact stream, indexed
+    // by channel id. Envelopes are interned by an EnvelopeDecoder.
+
+   public:
+    ChannelDictionary() = default;
+
+    KJ_DISALLOW_COPY(ChannelDictionary);
+    ChannelDictionary(ChannelDictionary&&) = default;
+    ChannelDictionary& operator=(ChannelDictionary&&) = default;
+
+    // Read the envelope of a frame whose framing has just been read from
+    // `in`, leaving `in` at the payload.
+    //
+    // `envelope` points into the dictionary, so that no strings are copied.
+    // For a compact frame `channel_id` is set. A registration frame is
+    // recorded, and gives the envelope it declares. For a compact frame
+    // whose id has not been registered yet (eg. after seeking, until the
+    // next sync point), `envelope` is nullptr and the caller should skip the
+    // payload.
+    //
+    // Returns false if the envelope could not be read.
+    bool read(kj::InputStream& in, const Framing& framing,
+        const InternedEnvelope *& envelope, uint16_t& channel_id);
+
+    // The envelope registered for `channel_id`, or nullptr
+    const InternedEnvelope * get(uint16_t channel_id) const;
+
+    const IdentifierTable& identifiers() const { return decoder_.identifiers(); }
+
+   private:
+    EnvelopeDecoder decoder_;
+    std::vector<const InternedEnvelope *> envelopes_;
+};
+
+} // namespace lt::slipstream
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <kj/io.h>
+
+#include "lt/slipstream/shm_ring.h"
+
+namespace lt::slipstream {
+
+struct CollectorProducerStats {
+    std::string path;         // the ring file
+    std::string name;         // the name the producer gave the ring
+    uint32_t pid;
+    uint64_t frames;          // frames the producer pushed
+    uint64_t drops;           // frames the producer dropped, its ring full
+    uint64_t written;         // frames the collector has written out
+    uint64_t lag_bytes;       // bytes waiting in the ring
+    uint64_t lag_ns;          // age of the oldest waiting frame, by its timestamp
+};
+
+class RingCollector {
+    // Drains every ring file in a directory (see ShmRingWriter) into one
+    // output stream, eg. a RotatingOutputStream.
+    //
+    // Each poll() peeks a batch from every ring, merges the batches by
+    // timestamp and writes them in one write. Each producer's frames stay in
+    // order, but frames from a producer that lags by more than a batch can be
+    // written after later frames of another; `slipstream remix` restores
+    // strict order.
+    //
+    // The directory is scanned for new rings every `scan_interval`. A ring
+    // whose producer has closed it or exited is removed, file and all, once
+    // it has been drained. A ring found corrupt is removed at the next scan.
+
+   public:
+    static constexpr std::chrono::nanoseconds default_scan_interval = std::chrono::seconds(1);
+
+    RingCollector(kj::OutputStream * out,
+        const std::string& directory = shm_ring_directory,
+        std::chrono::nanoseconds scan_interval = default_scan_interval);
+
+    KJ_DISALLOW_COPY(RingCollector);
+
+    // Scan for rings if due, then write a batch from each. Returns the number
+    // of frames written.
+    size_t poll();
+
+    // Look for new rings now
+    void scan();
+
+    std::vector<CollectorProducerStats> stats() const;
+
+    size_t producers() const { return rings_.size(); }
+
+    // Batches the output stream failed to write
+    uint64_t write_errors() const { return write_errors_; }
+
+   private:
+    static constexpr size_t max_batch_ = 64;
+
+    struct Producer {
+        std::unique_ptr<ShmRingReader> ring;
+        uint64_t written;
+
+        // Filled by poll()
+        uint64_t lag_ns;
+        kj::ArrayPtr<const kj::byte> records[max_batch_];
+        uint64_t timestamps[max_batch_];
+        size_t n;
+        size_t next;
+    };
+
+    kj::OutputStream * out_;
+    std::string directory_;
+    std::chrono::nanoseconds scan_interval_;
+    std::chrono::steady_clock::time_point last_scan_;
+    uint64_t write_errors_;
+
+    std::vector<std::unique_ptr<Producer>> rings_;
+    std::vector<kj::ArrayPtr<const kj::byte>> pieces_;
+
+    void remove_abandoned();
+};
+
+} // namespace lt::slipstream
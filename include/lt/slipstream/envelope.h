@@ -2,14 +2,23 @@
 
 #include <iostream>
 
+#include <deque>
 #include <functional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <capnp/common.h>
 #include <kj/io.h>
 
 #include "lt/slipstream/types.h"
 
 namespace lt::slipstream {
 
+// The hash of an identifier, as given by std::hash<Identifier>
+size_t identifier_hash(std::string_view host_name, std::string_view application_name,
+    std::string_view channel_name);
+
 struct Identifier {
     std::string host_name;
     std::string application_name;
@@ -51,6 +60,129 @@ struct Envelope {
     void write(kj::OutputStream& out) const;
 
     bool read(kj::InputStream& in, size_t length);
+
+    // The envelope of a registration frame, declaring `channel_id` for this
+    // envelope in a compact stream
+    std::vector<kj::byte> registration(uint16_t channel_id) const;
+
+    // Read the envelope of a registration frame
+    bool read(kj::InputStream& in, size_t length, uint16_t& channel_id);
+};
+
+struct InternedIdentifier {
+    Identifier identifier;
+    size_t hash;
+    uint32_t index; // in its IdentifierTable, from 0
+};
+
+class IdentifierTable {
+    // Interns the identifiers seen by one reader, so that a frame's
+    // identifier can be handled as a pointer with a precomputed hash, and
+    // its index used to look up flat tables, rather than hashing and
+    // comparing three strings for every frame.
+    //
+    // Entries are never removed, and their addresses are stable for the
+    // life of the table.
+
+   public:
+    IdentifierTable() = default;
+
+    KJ_DISALLOW_COPY(IdentifierTable);
+    IdentifierTable(IdentifierTable&&) = default;
+    IdentifierTable& operator=(IdentifierTable&&) = default;
+
+    // The entry for an identifier, adding it if it has not been seen. Only
+    // adding an entry allocates.
+    const InternedIdentifier& intern(std::string_view host_name,
+        std::string_view application_name, std::string_view channel_name);
+
+    const InternedIdentifier& intern(const Identifier& identifier);
+
+    const InternedIdentifier& operator[](uint32_t index) const { return entries_[index]; }
+
+    size_t size() const { return entries_.size(); }
+
+   private:
+    std::deque<InternedIdentifier> entries_;
+    std::unordered_multimap<size_t, uint32_t> by_hash_;
+};
+
+struct InternedEnvelope {
+    Envelope envelope;
+    const InternedIdentifier * identifier;
+};
+
+class EnvelopeDecoder {
+    // Reads the envelopes of one stream without allocating in the steady
+    // state.
+    //
+    // An envelope is decoded in place when the stream is buffered (see
+    // buffered_words()), and otherwise from a scratch buffer that is reused
+    // for every frame. Each distinct envelope is interned, so reading one
+    // that has been seen before returns the same InternedEnvelope rather
+    // than copying its strings. Interned envelopes remain valid for the life
+    // of the decoder, including when it is moved.
+
+   public:
+    EnvelopeDecoder() = default;
+
+    KJ_DISALLOW_COPY(EnvelopeDecoder);
+    EnvelopeDecoder(EnvelopeDecoder&&) = default;
+    EnvelopeDecoder& operator=(EnvelopeDecoder&&) = default;
+
+    // Read an envelope of `length` bytes, also giving the channel id that it
+    // declares, or 0. Returns nullptr if the envelope could not be read.
+    const InternedEnvelope * read(kj::InputStream& in, size_t length, uint16_t& channel_id);
+
+    const IdentifierTable& identifiers() const { return identifiers_; }
+
+   private:
+    std::vector<::capnp::word> scratch_;
+    IdentifierTable identifiers_;
+    std::deque<InternedEnvelope> envelopes_;
+    std::vector<std::vector<uint32_t>> by_identifier_; // envelope indices
+};
+
+class ChannelRegistry;
+
+class EnvelopeCache {
+    // Serialized envelopes for a single channel.
+    //
+    // The identifier of a writer never changes, so the envelope of a frame
+    // depends only on its payload kind and encoding. Each combination is
+    // serialized on first use and the bytes are reused for every later frame.
+    //
+    // Given a ChannelRegistry, the cache is for a compact stream: each
+    // combination is given a channel id by the registry instead, and the
+    // "envelope" of a frame is that id.
+
+   public:
+    EnvelopeCache() = default;
+
+    EnvelopeCache(const Identifier& identifier, ChannelRegistry * registry = nullptr);
+
+    // The serialized envelope for this payload kind and encoding. The bytes
+    // remain valid until the cache is destroyed or moved from.
+    kj::ArrayPtr<const kj::byte> get(const PayloadKind& payload_kind,
+        std::string_view encoding);
+
+    // As above, also giving the channel id for a compact stream, or 0
+    kj::ArrayPtr<const kj::byte> get(const PayloadKind& payload_kind,
+        std::string_view encoding, uint16_t& channel_id);
+
+    const Identifier& identifier() const { return identifier_; }
+
+   private:
+    struct Entry {
+        size_t kind;
+        std::string encoding;
+        std::vector<kj::byte> bytes;
+        uint16_t channel_id;
+    };
+
+    Identifier identifier_;
+    ChannelRegistry * registry_ = nullptr;
+    std::vector<Entry> entries_;
 };
 
 } // namespace lt::slipstream
@@ -62,13 +194,8 @@ struct hash<lt::slipstream::Identifier>
 {
     std::size_t operator()(const lt::slipstream::Identifier& identifier) const
     {
-        using std::size_t;
-        using std::hash;
-        using std::string;
-
-        return ((hash<string>()(identifier.host_name)
-                ^ (hash<string>()(identifier.application_name) << 1)) >> 1)
-                ^ (hash<string>()(identifier.channel_name) << 1);
+        return lt::slipstream::identifier_hash(identifier.host_name,
+            identifier.application_name, identifier.channel_name);
     }
 };
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <unordered_map>
+
 #include "lt/slipstream/seek.h"
 
 namespace lt::slipstream {
@@ -24,14 +26,18 @@ class ChannelFilter {
     }
 
     bool match(const Envelope& envelope) const {
+        return match(envelope.identifier);
+    }
+
+    bool match(const Identifier& identifier) const {
         if (application_name_) {
-            if (envelope.identifier.application_name != *application_name_) {
+            if (identifier.application_name != *application_name_) {
                 return false;
             }
         }
 
         if (channel_name_) {
-            if (envelope.identifier.channel_name != *channel_name_) {
+            if (identifier.channel_name != *channel_name_) {
                 return false;
             }
         }
@@ -57,15 +63,42 @@ class Filter{
     }
 
     bool match(const Envelope& envelope)
+    {
+        return match(envelope.identifier);
+    }
+
+    bool match(const Identifier& identifier)
     {
         return std::any_of(channel_filters_.begin(), channel_filters_.end(),
             [&](const ChannelFilter& cf) {
-                return cf.match(envelope);
+                return cf.match(identifier);
             });
     };
 
+    // As above, remembering the result for each interned identifier, so
+    // that the names of a channel are only compared on its first frame
+    bool match(const InternedIdentifier& identifier)
+    {
+        auto it = matches_.find(&identifier);
+        if (it != matches_.end()) {
+            return it->second;
+        }
+
+        bool result = match(identifier.identifier);
+        matches_.emplace(&identifier, result);
+        return result;
+    }
+
    private:
+    struct InternedHash {
+        size_t operator()(const InternedIdentifier * identifier) const
+        {
+            return identifier->hash;
+        }
+    };
+
     std::vector<ChannelFilter> channel_filters_;
+    std::unordered_map<const InternedIdentifier *, bool, InternedHash> matches_;
 };
 
 class FilterScanner : public Scanner {
@@ -80,9 +113,12 @@ class FilterScanner : public Scanner {
 
     bool next() override;
 
+    bool skip_frame() override;
+
     bool peek(uint64_t& source_timestamp) override;
 
     bool peek(uint64_t& source_timestamp, Envelope& envelope) override;
+    bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope) override;
 
     size_t copy_frame(kj::OutputStream& out) override;
 
@@ -111,9 +147,12 @@ class FilterSeeker : public Seeker {
 
     bool next() override;
 
+    bool skip_frame() override;
+
     bool peek(uint64_t& source_timestamp) override;
 
     bool peek(uint64_t& source_timestamp, Envelope& envelope) override;
+    bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope) override;
 
     size_t copy_frame(kj::OutputStream& out) override;
 
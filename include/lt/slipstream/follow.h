@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+
+#include <kj/common.h>
+
+namespace lt::slipstream {
+
+struct FollowPolicy {
+    // How a FileWatch waits for a file to grow.
+
+    // Before blocking, spin for up to this long checking for new data.
+    // The spin adapts between zero and this limit: it grows while data
+    // arrives soon after a wait begins, and shrinks while spinning finds
+    // nothing. Zero never spins.
+    uint64_t max_spin_ns = 0;
+
+    // While blocked, check for new data at least this often. inotify does
+    // not see writes through a shared mapping, such as a
+    // MappedAppendStream's, so these are found by the recheck.
+    int recheck_ms = 100;
+
+    // Give up waiting after this long; -1 waits indefinitely
+    int timeout_ms = -1;
+};
+
+class FileWatch {
+    // Waits for a file that is being appended to to grow, blocking on
+    // inotify IN_MODIFY events rather than polling.
+
+   public:
+    explicit FileWatch(const std::string& path, const FollowPolicy& policy = {});
+
+    KJ_DISALLOW_COPY(FileWatch);
+    ~FileWatch();
+
+    // Wait until ready() returns true, eg. when there are bytes to read
+    // beyond the current position. Returns false if the policy's timeout
+    // passes first.
+    bool wait(const std::function<bool()>& ready);
+
+    const FollowPolicy& policy() const { return policy_; }
+
+    // The current spin, as adapted by wait()
+    uint64_t spin_ns() const { return spin_ns_; }
+
+   private:
+    int fd_;
+    FollowPolicy policy_;
+    uint64_t spin_ns_;
+
+    // Read and discard the queued events
+    void drain();
+};
+
+} // namespace lt::slipstream
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <kj/io.h>
+
+namespace lt::slipstream {
+
+class FrameBuffer : public kj::OutputStream {
+    // An OutputStream that accumulates whatever is written to it in memory,
+    // eg. to stage a complete frame before handing it on in one piece.
+    //
+    // The underlying storage is retained across clear(), so a FrameBuffer
+    // that is reused for every frame stops allocating once it has grown to
+    // the largest frame size.
+
+   public:
+    FrameBuffer();
+
+    KJ_DISALLOW_COPY(FrameBuffer);
+    FrameBuffer(FrameBuffer&& other) = default;
+    FrameBuffer& operator=(FrameBuffer&& other) = default;
+    virtual ~FrameBuffer() noexcept(false);
+
+    void clear() { size_ = 0; }
+
+    const uint8_t * data() const { return buffer_.data(); }
+
+    // For filling in data whose value is only known after later writes, eg.
+    // a frame header that records the payload length.
+    uint8_t * data() { return buffer_.data(); }
+
+    size_t size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+
+    kj::ArrayPtr<const kj::byte> asBytes() const
+    {
+        return kj::arrayPtr(buffer_.data(), size_);
+    }
+
+    // implements OutputStream
+    void write(const void* buffer, size_t size) override;
+
+   private:
+    std::vector<uint8_t> buffer_;
+    size_t size_;
+};
+
+} // namespace lt::slipstream
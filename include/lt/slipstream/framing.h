@@ -9,8 +9,17 @@
 namespace lt::slipstream {
 
 static constexpr uint8_t frame_version = 2;
+static constexpr uint8_t compact_frame_version = 3;
 static constexpr size_t frame_header_length = 20;
 
+// In a compact frame the envelope is replaced by a channel id
+static constexpr size_t channel_id_length = 2;
+
+enum class FrameFormat {
+    envelope,   // Version 2: every frame carries its full envelope
+    compact,    // Version 3: see below
+};
+
 // 0xff 0xfe is an invliad UTF-8 sequence
 static constexpr uint8_t frame_marker[] = { 0xff, 0xfe, 0xed };
 
@@ -21,6 +30,13 @@ static constexpr uint8_t frame_marker[] = { 0xff, 0xfe, 0xed };
 // zero.
 //
 // Flags: SYNC 0x1
+//
+// Version 3 (compact) frames have the same header. A frame with the SYNC
+// flag set is a registration: its envelope has a channelId, and it has no
+// payload. Any other version 3 frame carries a 16-bit big endian channel id
+// in place of its envelope, standing for the envelope most recently
+// registered with that id. Registrations are repeated after sync points, so
+// that a reader that starts part way through a stream soon learns every id.
 
 /*
      0       4       8      12      16      20      24      28
@@ -37,12 +53,17 @@ static constexpr uint8_t frame_marker[] = { 0xff, 0xfe, 0xed };
     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 */
 
+// The offset of the first complete frame marker in data[0, size), or size if
+// there is none. Uses AVX2 or SSE2 compares where available.
+size_t find_frame_marker(const uint8_t * data, size_t size);
+
 struct Framing {
     uint32_t envelope_length;
     uint32_t payload_length;
     uint64_t source_timestamp;
     uint16_t checksum;
     bool sync;
+    uint8_t version = frame_version;
 
     bool operator==(const Framing& other) const
     {
@@ -51,9 +72,15 @@ struct Framing {
             payload_length == other.payload_length &&
             source_timestamp == other.source_timestamp &&
             checksum == other.checksum &&
-            sync == other.sync;
+            sync == other.sync &&
+            version == other.version;
     }
 
+    bool compact() const { return version == compact_frame_version; }
+
+    // A registration frame of a compact stream
+    bool registration() const { return compact() && sync; }
+
     size_t size() const { return frame_header_length; }
 
     void encode(uint8_t * buf) const;
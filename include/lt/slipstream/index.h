@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "lt/slipstream/envelope.h"
+
+namespace lt::slipstream {
+
+class TimeIndex {
+    // A sparse time index of a slipstream file, kept in a sidecar file next
+    // to it (see sidecar_path()).
+    //
+    // The index holds the timestamp and offset of a frame at least every
+    // `interval` bytes, the last frame in the file, and the first frame of
+    // each channel. For each channel that writes deltas it also holds a
+    // keyframe at least every `interval` bytes, from which a reader can
+    // decode forward. It records the size and modification time of the file
+    // it was built from, and is only used while these still match: a file
+    // that has been appended to since must be indexed again.
+    //
+    // The sidecar is big endian, like the frame headers.
+
+   public:
+    struct Entry {
+        uint64_t timestamp;
+        uint64_t offset;
+    };
+
+    struct ChannelEntry {
+        Identifier identifier;
+        uint64_t timestamp;
+        uint64_t offset;
+    };
+
+    struct KeyframeEntries {
+        Identifier identifier;
+        std::vector<Entry> entries;
+    };
+
+    static constexpr uint64_t default_interval = 1 << 20;
+
+    TimeIndex() = default;
+
+    // The name of the sidecar file for `path`
+    static std::string sidecar_path(const std::string& path);
+
+    // Index the frames in `fd` from the start of the file. The position of
+    // `fd` is not restored.
+    static TimeIndex build(int fd, uint64_t interval = default_interval);
+
+    static TimeIndex build(const std::string& path, uint64_t interval = default_interval);
+
+    // Read the sidecar of `path`. Returns nothing if there is none, if it
+    // cannot be parsed, or if it is out of date.
+    static std::optional<TimeIndex> load(const std::string& path);
+
+    // Write the sidecar of `path`, replacing any that exists
+    void write(const std::string& path) const;
+
+    // Whether the file open on `fd` is the one that was indexed
+    bool fresh(int fd) const;
+
+    // The offset of an indexed frame at or before the last frame with a
+    // timestamp no later than `timestamp`, from which to roll forward.
+    // Returns false if `timestamp` is outside the time range of the file.
+    bool find(uint64_t timestamp, uint64_t& offset) const;
+
+    // The first frame of a channel, or nullptr if it does not appear
+    const ChannelEntry * channel(const Identifier& identifier) const;
+
+    // The offset of the last indexed keyframe of a channel at or before
+    // `offset`. Returns false if there is none, or if the channel has no
+    // deltas and so is not in the keyframe table.
+    bool find_keyframe(const Identifier& identifier, uint64_t offset,
+        uint64_t& keyframe_offset) const;
+
+    // The keyframes of a channel that writes deltas, or nullptr
+    const KeyframeEntries * keyframes(const Identifier& identifier) const;
+
+    const std::vector<Entry>& entries() const { return entries_; }
+
+    const std::vector<ChannelEntry>& channels() const { return channels_; }
+
+    const std::vector<KeyframeEntries>& keyframes() const { return keyframes_; }
+
+    bool empty() const { return entries_.empty(); }
+
+    uint64_t interval() const { return interval_; }
+
+    const Entry& last() const { return last_; }
+
+   private:
+    uint64_t file_size_ = 0;
+    int64_t mtime_sec_ = 0;
+    int64_t mtime_nsec_ = 0;
+    uint64_t interval_ = default_interval;
+    Entry last_ = {0, 0};
+    std::vector<Entry> entries_;
+    std::vector<ChannelEntry> channels_;
+    std::vector<KeyframeEntries> keyframes_;
+
+    bool parse(const std::string& data);
+};
+
+} // namespace lt::slipstream
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "lt/slipstream/json_writer.h"
 #include "lt/slipstream/timestamp.h"
 
 namespace lt::slipstream::json {
@@ -30,18 +31,13 @@ inline std::string record(const std::vector<std::string>& kvs) {
 inline std::string frame(const std::string& data_json,
     uint64_t& source_timestamp, Envelope& envelope)
 {
-    auto timestamp = format_timestamp(source_timestamp);
-    uint64_t epoch_millis = source_timestamp / static_cast<uint64_t>(1000000);
-    int nanos = source_timestamp % static_cast<uint64_t>(1000000);
-
-    return record({
-        kv("timestamp", enclose_quotes(timestamp)),
-        kv("epochMillis", std::to_string(epoch_millis)),
-        kv("nanos", std::to_string(nanos)),
-        kv("host", enclose_quotes(envelope.identifier.host_name)),
-        kv("app", enclose_quotes(envelope.identifier.application_name)),
-        kv("channel", enclose_quotes(envelope.identifier.channel_name)),
-        kv("data", data_json)});
+    // Each thread keeps its writer, and so its buffer and timestamp cache
+    thread_local Writer writer;
+
+    writer.clear();
+    writer.frame(source_timestamp, envelope.identifier, data_json);
+
+    return writer.str();
 }
 
 } // namespace lt::slipstream::json
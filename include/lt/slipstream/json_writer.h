@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "lt/slipstream/envelope.h"
+
+namespace lt::slipstream::json {
+
+// Append `s` to `out`, escaping quotes, backslashes, slashes and control
+// characters. Runs of characters that need no escaping are found a block
+// at a time and copied whole.
+void append_escaped(std::string& out, std::string_view s);
+
+class Writer {
+    // Builds JSON text by appending to a buffer that is kept from one
+    // record to the next: clear() empties it without giving back its
+    // storage, so once it has grown to fit, writing a record does not
+    // allocate.
+    //
+    // Timestamps are formatted as by format_timestamp(), reusing the date
+    // and time of day for as long as frames stay within the same second.
+
+   public:
+    void clear() { out_.clear(); }
+
+    // Drop everything after the first `size` characters
+    void truncate(size_t size) { out_.resize(size); }
+
+    size_t size() const { return out_.size(); }
+
+    const std::string& str() const { return out_; }
+
+    // Append JSON text as it is
+    void raw(std::string_view s) { out_.append(s); }
+
+    void raw(char c) { out_.push_back(c); }
+
+    // Append `s` as a quoted, escaped JSON string
+    void string(std::string_view s)
+    {
+        out_.push_back('"');
+        append_escaped(out_, s);
+        out_.push_back('"');
+    }
+
+    void number(uint64_t value);
+
+    // Append a nanosecond timestamp as a quoted string
+    void timestamp(uint64_t timestamp);
+
+    // Append a frame record, as json::frame() returns, with its data
+    // written by data(*this)
+    template <typename F, typename = std::enable_if_t<std::is_invocable_v<F, Writer&>>>
+    void frame(uint64_t source_timestamp, const Identifier& identifier, F&& data)
+    {
+        frame_begin(source_timestamp, identifier);
+        data(*this);
+        out_.push_back('}');
+    }
+
+    void frame(uint64_t source_timestamp, const Identifier& identifier,
+        std::string_view data_json)
+    {
+        frame(source_timestamp, identifier, [&](Writer& w) { w.raw(data_json); });
+    }
+
+   private:
+    std::string out_;
+
+    // The formatted date and time of day of `second_`
+    int64_t second_ = -1;
+    char prefix_[32];
+    size_t prefix_length_ = 0;
+
+    // Everything up to the value of the data member
+    void frame_begin(uint64_t source_timestamp, const Identifier& identifier);
+};
+
+template <typename D, typename = void>
+struct writes_json : std::false_type {};
+
+template <typename D>
+struct writes_json<D, std::void_t<decltype(D::to_json(std::declval<Writer&>(), std::declval<const D&>()))>>
+    : std::true_type {};
+
+// Append the JSON of `data`, written in place if its type can, as with
+// SerialString, and otherwise from its to_json()
+template <typename D>
+void data(Writer& out, const D& data)
+{
+    if constexpr (writes_json<D>::value) {
+        D::to_json(out, data);
+    } else {
+        out.raw(D::to_json(data));
+    }
+}
+
+} // namespace lt::slipstream::json
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lt::slipstream {
+
+struct KeyframePolicy {
+    // A channel's first frame is always a keyframe, as is any frame written
+    // with force_keyframe. Otherwise a frame is a keyframe when any of the
+    // enabled limits below is reached, and a delta from the last keyframe
+    // if not.
+
+    // Write a keyframe at least every this many frames, counting the
+    // keyframe itself: 1 writes only keyframes, 2 alternates keyframes and
+    // deltas. Zero means no frame limit.
+    uint64_t every_frames = 2;
+
+    // Write a keyframe once this long has passed, by frame timestamps, since
+    // the last one. Zero means no time limit.
+    uint64_t every_ns = 0;
+
+    // Write a keyframe in place of any delta whose payload is larger than
+    // this fraction of the last keyframe's payload, eg. 0.5 once deltas have
+    // grown to half the size of a keyframe. Zero disables.
+    double max_delta_ratio = 0;
+};
+
+class KeyframeSchedule {
+    // Decides, frame by frame, whether a channel writes a keyframe or a
+    // delta, following a KeyframePolicy.
+
+   public:
+    KeyframeSchedule(const KeyframePolicy& policy = {});
+
+    // Whether the frame at `timestamp` must be a keyframe
+    bool due(uint64_t timestamp) const;
+
+    // Whether a delta with a payload of `size` bytes should be written as a
+    // keyframe instead
+    bool oversized(size_t size) const;
+
+    // Record that a keyframe or delta was written
+    void keyframe(uint64_t timestamp, size_t size);
+    void delta();
+
+    // Replace the policy; the next frame is still a delta if one is allowed
+    void set_policy(const KeyframePolicy& policy) { policy_ = policy; }
+
+    const KeyframePolicy& policy() const { return policy_; }
+
+   private:
+    KeyframePolicy policy_;
+
+    bool has_keyframe_;
+    uint64_t frames_;           // frames since the last keyframe, including it
+    uint64_t keyframe_timestamp_;
+    size_t keyframe_size_;
+};
+
+} // namespace lt::slipstream
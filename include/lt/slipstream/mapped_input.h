@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include <kj/io.h>
+
+namespace lt::slipstream {
+
+class MappedInputStream : public kj::BufferedInputStream {
+    // A BufferedInputStream over a read-only memory mapping of a whole file.
+    //
+    // Reads are memory copies rather than system calls, and
+    // tryGetReadBuffer() exposes the rest of the file, so that frames can
+    // be decoded in place. The file's size is fixed when it is mapped; data
+    // appended later is not seen. A file being written by a
+    // MappedAppendStream is read up to its committed length.
+
+   public:
+    explicit MappedInputStream(const std::string& path);
+
+    explicit MappedInputStream(int fd);
+
+    KJ_DISALLOW_COPY(MappedInputStream);
+    virtual ~MappedInputStream() noexcept(false);
+
+    size_t size() const { return size_; }
+
+    size_t position() const { return position_; }
+
+    // implements BufferedInputStream
+    kj::ArrayPtr<const kj::byte> tryGetReadBuffer() override;
+
+    // implements InputStream
+    size_t tryRead(void* buffer, size_t minBytes, size_t maxBytes) override;
+
+    void skip(size_t bytes) override;
+
+   private:
+    const uint8_t * data_;
+    size_t mapped_;
+    size_t size_;
+    size_t position_;
+
+    void map(int fd);
+};
+
+} // namespace lt::slipstream
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <memory>
+#include <string>
+
+#include <kj/io.h>
+
+namespace lt::slipstream {
+
+// The layout of a commit sidecar; see mapped_output.cpp
+struct CommitRecord;
+
+class CommittedLength {
+    // The committed length of a file being written by a MappedAppendStream,
+    // kept in a sidecar file next to it (see sidecar_path()).
+    //
+    // Only the first get() bytes of the file hold complete frames. Beyond
+    // them is preallocated space, or a frame that is still being written.
+    //
+    // A writer removes the sidecar once it has cut the file back, and a
+    // later writer creates a new one, so a reader that outlives a writer
+    // checks current() and opens the sidecar again.
+
+   public:
+    // The name of the sidecar file for `path`
+    static std::string sidecar_path(const std::string& path);
+
+    // Map the sidecar of `path`. Returns nullptr if there is none, or if it
+    // cannot be read.
+    static std::shared_ptr<const CommittedLength> open(const std::string& path);
+
+    // Map the sidecar open on `fd`. Throws if it is not a sidecar.
+    explicit CommittedLength(int fd);
+
+    KJ_DISALLOW_COPY(CommittedLength);
+    ~CommittedLength();
+
+    uint64_t get() const;
+
+    // Whether the sidecar is still the one at its path: false once it has
+    // been removed or replaced. Always true if not opened by path.
+    bool current() const;
+
+   private:
+    const CommitRecord * record_;
+    std::string path_;
+    dev_t dev_;
+    ino_t ino_;
+};
+
+class MappedAppendStream : public kj::OutputStream {
+    // An OutputStream that appends to a file through a shared memory mapping.
+    //
+    // Each write is copied into the mapping, then published by storing the
+    // file's new length in its CommittedLength sidecar. A write that has
+    // returned therefore survives the process crashing, though not the
+    // kernel (see sync()). Each write must hold whole frames, so that readers
+    // which respect the committed length, such as the Seekers and mapped
+    // readers, never see part of a frame.
+    //
+    // The file grows in steps of `chunk_size`, allocated with fallocate. An
+    // existing file is appended to, after cutting it back to its committed
+    // length to discard any preallocated space and torn frame left by a
+    // crash. On destruction the file is cut back to its committed length and
+    // the sidecar is removed.
+
+   public:
+    static constexpr size_t default_chunk_size = 64 << 20;
+
+    MappedAppendStream(const std::string& path, size_t chunk_size = default_chunk_size);
+
+    KJ_DISALLOW_COPY(MappedAppendStream);
+    virtual ~MappedAppendStream() noexcept(false);
+
+    // implements OutputStream
+    void write(const void* buffer, size_t size) override;
+
+    void write(kj::ArrayPtr<const kj::ArrayPtr<const kj::byte>> pieces) override;
+
+    // Write the committed data and length to disk
+    void sync();
+
+    uint64_t committed() const { return committed_; }
+
+    // The size of the file, including preallocated space
+    uint64_t allocated() const { return mapped_; }
+
+   private:
+    std::string path_;
+    size_t chunk_size_;
+    kj::AutoCloseFd fd_;
+
+    uint8_t * data_;
+    size_t mapped_;
+    uint64_t committed_;
+    CommitRecord * record_;
+
+    // Make room for `bytes` more after the committed length
+    void reserve(size_t bytes);
+};
+
+} // namespace lt::slipstream
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+namespace lt::slipstream {
+
+template <typename T>
+class FrameMerge {
+    // Orders a set of scanners by the timestamp of their next frame, for
+    // ScannerGroup and SeekerGroup.
+    //
+    // The inputs are kept in a binary heap keyed on the timestamp from
+    // peek(). Taking a frame from the head with advance() only marks it as
+    // stale: on the next call to head() that one input is peeked again and
+    // re-sifted, so each frame costs O(log n) rather than a sort of every
+    // input. Frames with equal timestamps are taken in input order.
+    //
+    // Inputs that cannot be peeked leave the heap. They are tried again once
+    // every input is exhausted (eg. when following files that are still
+    // being written), or after rebuild(). Inputs removed with drop() are
+    // only tried again after rebuild().
+
+   public:
+    FrameMerge(std::vector<T>& inputs)
+        : inputs_(inputs), built_(false), advanced_(false)
+    {
+    }
+
+    // Forget all cached timestamps, eg. after the inputs are reset or seeked
+    void rebuild()
+    {
+        built_ = false;
+    }
+
+    // The input with the earliest next frame, or nullptr if there is none
+    T* head()
+    {
+        refresh();
+
+        if (heap_.empty()) {
+            return nullptr;
+        }
+
+        return &inputs_[heap_.front().ix];
+    }
+
+    // The head, which the caller is about to move on from
+    T* advance()
+    {
+        T* h = head();
+        advanced_ = (h != nullptr);
+        return h;
+    }
+
+    // Remove the head until rebuild(), eg. if its frame cannot be read
+    void drop()
+    {
+        refresh();
+
+        if (heap_.empty()) {
+            return;
+        }
+
+        std::pop_heap(heap_.begin(), heap_.end(), later);
+        heap_.pop_back();
+    }
+
+   private:
+    struct Node {
+        uint64_t timestamp;
+        size_t ix;
+    };
+
+    std::vector<T>& inputs_;
+    std::vector<Node> heap_;
+    std::vector<size_t> exhausted_;
+    bool built_;
+    bool advanced_;
+
+    // The ordering for std's max-heap functions, putting the earliest frame
+    // at the front
+    static bool later(const Node& a, const Node& b)
+    {
+        return a.timestamp > b.timestamp ||
+            (a.timestamp == b.timestamp && a.ix > b.ix);
+    }
+
+    void push(size_t ix)
+    {
+        uint64_t timestamp;
+
+        if (!inputs_[ix].peek(timestamp)) {
+            exhausted_.push_back(ix);
+            return;
+        }
+
+        heap_.push_back({timestamp, ix});
+        std::push_heap(heap_.begin(), heap_.end(), later);
+    }
+
+    void refresh()
+    {
+        if (!built_) {
+            heap_.clear();
+            exhausted_.clear();
+            for (size_t ix = 0; ix < inputs_.size(); ++ix) {
+                push(ix);
+            }
+            built_ = true;
+            advanced_ = false;
+            return;
+        }
+
+        if (advanced_) {
+            advanced_ = false;
+
+            std::pop_heap(heap_.begin(), heap_.end(), later);
+            size_t ix = heap_.back().ix;
+            heap_.pop_back();
+            push(ix);
+        }
+
+        if (heap_.empty() && !exhausted_.empty()) {
+            std::vector<size_t> retry;
+            retry.swap(exhausted_);
+            for (auto ix : retry) {
+                push(ix);
+            }
+        }
+    }
+};
+
+} // namespace lt::slipstream
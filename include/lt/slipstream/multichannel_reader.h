@@ -1,5 +1,6 @@
 #pragma once
 
+#include <limits>
 #include <optional>
 #include <unordered_map>
 
@@ -23,6 +24,155 @@ class MultiChannelReader {
 
     bool read(data_type& data, uint64_t& source_timestamp,
         Envelope& envelope)
+    {
+        const InternedEnvelope * e;
+
+        if (!read_frame(data, source_timestamp, e)) {
+            return false;
+        }
+
+        envelope = e->envelope;
+
+        return true;
+    }
+
+    bool read(data_type& data)
+    {
+        uint64_t source_timestamp;
+        const InternedEnvelope * envelope;
+        return read_frame(data, source_timestamp, envelope);
+    }
+
+    using slot_type = FrameSlot<data_type>;
+
+    // Decode up to slots.size() frames into `slots`; see
+    // ChannelReader::read_batch
+    size_t read_batch(kj::ArrayPtr<slot_type> slots)
+    {
+        return read_frames(slots, [this](auto&&... args) { return read_frame(args...); });
+    }
+
+    // Call f(const slot_type&) for each remaining frame; see
+    // ChannelReader::for_each_frame
+    template <typename F>
+    size_t for_each_frame(F&& f)
+    {
+        return for_each_read_frame(slot_,
+            [this](auto&&... args) { return read_frame(args...); }, std::forward<F>(f));
+    }
+
+    const std::optional<std::string> read_json(uint64_t& source_timestamp)
+    {
+        static thread_local json::Writer writer;
+
+        writer.clear();
+        if (!read_json(writer, source_timestamp)) {
+            return {};
+        }
+
+        return writer.str();
+    }
+
+    // Append the next frame's JSON record to `out`; see
+    // ChannelReader::read_json. Each channel's frames are written directly
+    // if its ChannelReader is json_direct.
+    bool read_json(json::Writer& out, uint64_t& source_timestamp)
+    {
+        return next_json(out, source_timestamp, nullptr);
+    }
+
+    // As above, for the next frame that matches `query`, or the first
+    // after `end`; see ChannelReader::read_json
+    bool read_json(json::Writer& out, uint64_t& source_timestamp, Query& query,
+        uint64_t end = std::numeric_limits<uint64_t>::max())
+    {
+        return next_json(out, source_timestamp, &query, end);
+    }
+
+    bool header(const Identifier& identifier, header_type& header) {
+        if constexpr (std::is_same_v<header_type, no_type>) {
+            return false;
+        } else {
+            try {
+                return std::visit([&](auto&& inner_channel) -> bool {
+                    if constexpr (std::is_same_v<std::decay_t<decltype(inner_channel)>, std::monostate>) {
+                        throw std::bad_variant_access();
+                    } else {
+                        using H = typename std::decay_t<decltype(inner_channel)>::header_type;
+                        if constexpr (std::is_same_v<H, std::monostate> || std::is_same_v<H, no_type>) {
+                            return false;
+                        } else {
+                            H inner_header;
+                            inner_channel.header(inner_header);
+                            header = inner_header;
+                            return true;
+                        }
+                    }
+                }, channels_.at(identifier));
+            } catch (std::out_of_range&) {
+                return false;
+            }
+        }
+    }
+
+   private:
+    kj::InputStream * in_;
+    std::unordered_map<Identifier, channel_reader> channels_;
+    ChannelDictionary dictionary_;
+    std::vector<channel_reader *> by_identifier_; // by interned index
+    slot_type slot_;
+
+    bool next_json(json::Writer& out, uint64_t& source_timestamp, Query * query,
+        uint64_t end = std::numeric_limits<uint64_t>::max())
+    {
+        while (true) {
+            JsonTarget target{out, query};
+            size_t mark = out.size();
+
+            if (!read_frame(slot_.data, slot_.source_timestamp, slot_.envelope, &target)) {
+                return false;
+            }
+
+            source_timestamp = slot_.source_timestamp;
+
+            if (source_timestamp > end) {
+                out.truncate(mark);
+                return true;
+            }
+
+            if (target.direct) {
+                if (target.matched) {
+                    return true;
+                }
+                continue;
+            }
+
+            // Payloads without a schema match only a query with no
+            // predicates
+            if (query != nullptr && query->has_predicates()) {
+                continue;
+            }
+
+            out.frame(source_timestamp, slot_.envelope->envelope.identifier, [&](json::Writer& w) {
+                std::visit([&](auto&& inner_data) {
+                    using D = std::decay_t<decltype(inner_data)>;
+                    if constexpr (!std::is_same_v<D, std::monostate>) {
+                        json::data(w, inner_data);
+                    }
+                }, slot_.data);
+            });
+
+            return true;
+        }
+    }
+
+    // Read the next data frame, passing over (and acting on) header frames,
+    // and the registration frames of a compact stream. `envelope` points
+    // into the dictionary. If `target` is given, frames of channels that
+    // handle it (see ChannelReader::handles_json) are written there as
+    // JSON instead of decoded.
+    bool read_frame(data_type& data, uint64_t& source_timestamp,
+        const InternedEnvelope *& envelope, JsonTarget * target = nullptr)
     {
         while (true) {
             Framing framing;
@@ -34,21 +184,25 @@ class MultiChannelReader {
 
             source_timestamp = framing.source_timestamp;
 
-            if (!envelope.read(*in_, framing.envelope_length)) {
+            uint16_t channel_id;
+            if (!dictionary_.read(*in_, framing, envelope, channel_id)) {
                 return false;
             }
 
-            if (auto pd = std::get_if<PayloadData>(&envelope.payload_kind)) {
-                channel_reader * channel = nullptr;
-
+            if (envelope == nullptr || framing.registration()) {
                 try {
-                    channel = &channels_.at(envelope.identifier);
-                } catch (std::out_of_range& e) {
-                    channels_.insert_or_assign(envelope.identifier,
-                        channel_reader_new_headerless<Ts..., no_type>(in_, envelope.encoding));
-
-                    channel = &channels_.at(envelope.identifier);
+                    in_->skip(framing.payload_length);
+                } catch (std::exception&) {
+                    return false;
                 }
+                continue;
+            }
+
+            if (auto pd = std::get_if<PayloadData>(&envelope->envelope.payload_kind)) {
+                channel_reader * channel = channel_for(*envelope);
+
+                // Frames are decoded in place when `data` already holds the
+                // channel's type, reusing its storage, eg. in a FrameSlot
 
                 if (std::holds_alternative<PayloadKeyframe>(*pd)) {
                     bool result = std::visit(
@@ -57,9 +211,20 @@ class MultiChannelReader {
                             if constexpr (std::is_same_v<C, std::monostate>) {
                                 return false;
                             } else {
-                                typename C::data_type inner_data;
+                                if constexpr (C::json_direct || C::query_direct) {
+                                    if (target != nullptr && C::handles_json(*target)) {
+                                        return inner_channel.read_json_internal(*target,
+                                            source_timestamp, *envelope, framing.payload_length);
+                                    }
+                                }
+
+                                using D = typename C::data_type;
+                                if (auto existing = std::get_if<D>(&data)) {
+                                    return inner_channel.read_internal(*existing, framing.payload_length);
+                                }
+                                D inner_data;
                                 bool result = inner_channel.read_internal(inner_data, framing.payload_length);
-                                data = inner_data;
+                                data = std::move(inner_data);
                                 return result;
                             }
                         },
@@ -72,9 +237,13 @@ class MultiChannelReader {
                             if constexpr (std::is_same_v<C, std::monostate>) {
                                 return false;
                             } else {
-                                typename C::data_type inner_data;
+                                using D = typename C::data_type;
+                                if (auto existing = std::get_if<D>(&data)) {
+                                    return inner_channel.read_delta_internal(*existing, framing.payload_length);
+                                }
+                                D inner_data;
                                 bool result = inner_channel.read_delta_internal(inner_data, framing.payload_length);
-                                data = inner_data;
+                                data = std::move(inner_data);
                                 return result;
                             }
                         },
@@ -84,70 +253,52 @@ class MultiChannelReader {
                     return false;
                 }
             } else {
-                if (channels_.find(envelope.identifier) == channels_.end()) {
+                auto& identifier = envelope->envelope.identifier;
+                if (channels_.find(identifier) == channels_.end()) {
                     header_type header;
-                    channels_.insert_or_assign(envelope.identifier,
-                        channel_reader_new_header<header_type, Ts..., no_type>(in_, envelope.encoding, header, framing.payload_length));
+                    channels_.insert_or_assign(identifier,
+                        channel_reader_new_header<header_type, Ts..., no_type>(in_, envelope->envelope.encoding, header, framing.payload_length));
+                } else {
+                    // A repeated header, eg. at a RotatingOutputStream's
+                    // header interval
+                    try {
+                        in_->skip(framing.payload_length);
+                    } catch (std::exception&) {
+                        return false;
+                    }
                 }
             }
         }
     }
 
-    bool read(data_type& data)
+    // The reader for a frame's channel, creating it if needed. Readers are
+    // found through a flat table indexed by interned identifier.
+    channel_reader * channel_for(const InternedEnvelope& envelope)
     {
-        uint64_t source_timestamp;
-        Envelope envelope;
-        return read(data, source_timestamp, envelope);
-    }
+        uint32_t index = envelope.identifier->index;
 
-    const std::optional<std::string> read_json(uint64_t& source_timestamp)
-    {
-        Envelope envelope;
-        data_type data;
+        if (index < by_identifier_.size() && by_identifier_[index] != nullptr) {
+            return by_identifier_[index];
+        }
 
-        if (read(data, source_timestamp, envelope)) {
-            // visit data, call its to_json()
-            auto data_json =  std::visit(
-                [](auto&& inner_data) {
-                    return decltype(inner_data)::to_json(inner_data);
-                },
-                data);
+        channel_reader * channel = nullptr;
 
-            return json::frame(data_json, source_timestamp, envelope);
+        auto& identifier = envelope.envelope.identifier;
+        auto it = channels_.find(identifier);
+        if (it != channels_.end()) {
+            channel = &it->second;
         } else {
-            return {};
+            channel = &channels_.insert_or_assign(identifier,
+                channel_reader_new_headerless<Ts..., no_type>(in_, envelope.envelope.encoding)).first->second;
         }
-    }
 
-    bool header(const Identifier& identifier, header_type& header) {
-        if constexpr (std::is_same_v<header_type, no_type>) {
-            return false;
-        } else {
-            try {
-                return std::visit([&](auto&& inner_channel) -> bool {
-                    if constexpr (std::is_same_v<std::decay_t<decltype(inner_channel)>, std::monostate>) {
-                        throw std::bad_variant_access();
-                    } else {
-                        using H = typename std::decay_t<decltype(inner_channel)>::header_type;
-                        if constexpr (std::is_same_v<H, std::monostate> || std::is_same_v<H, no_type>) {
-                            return false;
-                        } else {
-                            H inner_header;
-                            inner_channel.header(inner_header);
-                            header = inner_header;
-                            return true;
-                        }
-                    }
-                }, channels_.at(identifier));
-            } catch (std::out_of_range&) {
-                return false;
-            }
+        if (index >= by_identifier_.size()) {
+            by_identifier_.resize(index + 1, nullptr);
         }
-    }
+        by_identifier_[index] = channel;
 
-   private:
-    kj::InputStream * in_;
-    std::unordered_map<Identifier, channel_reader> channels_;
+        return channel;
+    }
 
     template<typename U, typename... Us>
     channel_reader channel_reader_new_headerless(kj::InputStream * in, const std::string& encoding)
@@ -206,7 +357,7 @@ class MultiChannelPathReader {
             throw std::system_error(errno, std::system_category());
         }
         in_ = std::make_unique<kj::FdInputStream>(kj::AutoCloseFd(fd));
-        channel_reader_ = std::make_unique<MultiChannelReader<Ts...>>(*in_);
+        channel_reader_ = std::make_unique<MultiChannelReader<Ts...>>(in_.get());
     }
 
     bool read(data_type& data, uint64_t& source_timestamp,
@@ -215,11 +366,33 @@ class MultiChannelPathReader {
         return channel_reader_->read(data, source_timestamp, envelope);
     }
 
+    size_t read_batch(kj::ArrayPtr<FrameSlot<data_type>> slots)
+    {
+        return channel_reader_->read_batch(slots);
+    }
+
+    template <typename F>
+    size_t for_each_frame(F&& f)
+    {
+        return channel_reader_->for_each_frame(std::forward<F>(f));
+    }
+
     const std::optional<std::string> read_json(uint64_t& source_timestamp)
     {
         return channel_reader_->read_json(source_timestamp);
     }
 
+    bool read_json(json::Writer& out, uint64_t& source_timestamp)
+    {
+        return channel_reader_->read_json(out, source_timestamp);
+    }
+
+    bool read_json(json::Writer& out, uint64_t& source_timestamp, Query& query,
+        uint64_t end = std::numeric_limits<uint64_t>::max())
+    {
+        return channel_reader_->read_json(out, source_timestamp, query, end);
+    }
+
     const header_type * header(const Identifier& identifier) {
         return channel_reader_->header(identifier);
     }
@@ -229,4 +402,66 @@ class MultiChannelPathReader {
     std::unique_ptr<MultiChannelReader<Ts...>> channel_reader_;
 };
 
+template <typename... Ts>
+class MultiChannelMappedReader {
+    // Like MultiChannelPathReader, but reads the file through a memory
+    // mapping. See ChannelMappedReader.
+
+   public:
+    using header_type = typename Variant<Ts...>::header_type;
+    using data_type = typename Variant<Ts...>::data_type;
+
+    MultiChannelMappedReader(const std::string& path)
+    {
+        in_ = std::make_unique<MappedInputStream>(path);
+        channel_reader_ = std::make_unique<MultiChannelReader<Ts...>>(in_.get());
+    }
+
+    bool read(data_type& data, uint64_t& source_timestamp,
+        Envelope& envelope)
+    {
+        return channel_reader_->read(data, source_timestamp, envelope);
+    }
+
+    bool read(data_type& data)
+    {
+        return channel_reader_->read(data);
+    }
+
+    size_t read_batch(kj::ArrayPtr<FrameSlot<data_type>> slots)
+    {
+        return channel_reader_->read_batch(slots);
+    }
+
+    template <typename F>
+    size_t for_each_frame(F&& f)
+    {
+        return channel_reader_->for_each_frame(std::forward<F>(f));
+    }
+
+    const std::optional<std::string> read_json(uint64_t& source_timestamp)
+    {
+        return channel_reader_->read_json(source_timestamp);
+    }
+
+    bool read_json(json::Writer& out, uint64_t& source_timestamp)
+    {
+        return channel_reader_->read_json(out, source_timestamp);
+    }
+
+    bool read_json(json::Writer& out, uint64_t& source_timestamp, Query& query,
+        uint64_t end = std::numeric_limits<uint64_t>::max())
+    {
+        return channel_reader_->read_json(out, source_timestamp, query, end);
+    }
+
+    bool header(const Identifier& identifier, header_type& header) {
+        return channel_reader_->header(identifier, header);
+    }
+
+   private:
+    std::unique_ptr<MappedInputStream> in_;
+    std::unique_ptr<MultiChannelReader<Ts...>> channel_reader_;
+};
+
 } // namespace lt::slipstream
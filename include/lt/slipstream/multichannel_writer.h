@@ -5,11 +5,15 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <memory>
+#include <stdexcept>
 #include <system_error>
 #include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "lt/core/stamp.h"
 
+#include "lt/slipstream/buffered_output.h"
 #include "lt/slipstream/envelope.h"
 #include "lt/slipstream/framing.h"
 #include "lt/slipstream/multichannel_variant.h"
@@ -19,6 +23,43 @@ using namespace lt::core;
 
 namespace lt::slipstream {
 
+template <typename T>
+class ChannelHandle {
+    // A channel of a MultiChannelWriter, as returned by its channel().
+    //
+    // Writing through a handle goes straight to the channel's ChannelWriter,
+    // without looking up the channel name or visiting the variant of channel
+    // types. A handle is valid for the life of the writer that issued it,
+    // and is cheap to copy.
+
+   public:
+    using data_type = typename T::data_type;
+
+    ChannelHandle() : writer_(nullptr)
+    {
+    }
+
+    explicit ChannelHandle(ChannelWriter<T> * writer) : writer_(writer)
+    {
+    }
+
+    bool write(const data_type& data, uint64_t source_timestamp=0,
+        bool force_keyframe=false)
+    {
+        return writer_->write(data, source_timestamp, force_keyframe);
+    }
+
+    void set_keyframe_policy(const KeyframePolicy& policy)
+    {
+        writer_->set_keyframe_policy(policy);
+    }
+
+    explicit operator bool() const { return writer_ != nullptr; }
+
+   private:
+    ChannelWriter<T> * writer_;
+};
+
 template <typename... Ts>
 class MultiChannelWriter {
    public:
@@ -28,10 +69,13 @@ class MultiChannelWriter {
     using header_map = typename Variant<Ts...>::header_map;
     using channel_writer = std::variant<std::monostate, ChannelWriter<Ts>...>;
 
+    // Given a ChannelRegistry, every channel is written in the compact
+    // format; see ChannelWriter.
     MultiChannelWriter(kj::OutputStream * out,
         const std::string& application_name,
-        const header_map& channel_headers = {})
-        : out_(out), application_name_(application_name)
+        const header_map& channel_headers = {},
+        ChannelRegistry * registry = nullptr)
+        : out_(out), application_name_(application_name), registry_(registry)
     {
         for (auto&& [channel_name, header] : channel_headers) {
             if (header) {
@@ -49,6 +93,46 @@ class MultiChannelWriter {
         }
     }
 
+    // The handle of a channel of type T, registering the channel if it is
+    // new. Channels with a header must be given one, either here or in the
+    // constructor's `channel_headers`. Throws if the channel is already
+    // registered with a different type.
+    template <typename T>
+    ChannelHandle<T> channel(const std::string& channel_name)
+    {
+        auto it = channels_.find(channel_name);
+
+        if (it == channels_.end()) {
+            if constexpr (!std::is_same_v<typename T::header_type, no_type>) {
+                throw std::runtime_error("MCWriter: no header for " + application_name_ + "/" + channel_name);
+            } else {
+                it = channels_.emplace(channel_name,
+                    channel_writer(ChannelWriter<T>(out_, application_name_, channel_name, registry_))).first;
+                apply_keyframe_policy(it->second, keyframe_policy_);
+            }
+        }
+
+        return handle<T>(channel_name, it->second);
+    }
+
+    template <typename T>
+    ChannelHandle<T> channel(const std::string& channel_name,
+        const typename T::header_type& header,
+        std::enable_if<!std::is_same_v<typename T::header_type, no_type>, T>* = 0)
+    {
+        auto it = channels_.find(channel_name);
+
+        if (it == channels_.end()) {
+            it = channels_.emplace(channel_name,
+                channel_writer(ChannelWriter<T>(out_, application_name_, channel_name, header, registry_))).first;
+            apply_keyframe_policy(it->second, keyframe_policy_);
+        }
+
+        return handle<T>(channel_name, it->second);
+    }
+
+    // Write to a channel by name. Each write looks up the channel, so prefer
+    // a ChannelHandle from channel() on hot paths.
     bool write(const std::string& channel_name, const data_type& data,
         uint64_t source_timestamp=0, bool force_keyframe=false)
     {
@@ -56,50 +140,68 @@ class MultiChannelWriter {
             source_timestamp = Stamp::stamp_clock_rt();
         }
 
-        try {
-            channel_writer * channel = &channels_.at(channel_name);
+        auto it = channels_.find(channel_name);
 
-            return std::visit(
-                [&](auto&& inner_channel, const auto& inner_data) {
-                    using C = std::decay_t<decltype(inner_channel)>;
-                    using D = std::decay_t<decltype(inner_data)>;
-                    if constexpr (std::is_same_v<C, std::monostate> || std::is_same_v<D, std::monostate>) {
-                        return false;
-                    } else if constexpr (!std::is_same_v<typename C::data_type, D>) {
-                        return false;
-                    } else {
-                        return inner_channel.write(inner_data, source_timestamp, force_keyframe);
-                    }
-                },
-                *channel, data);
-        } catch (std::out_of_range& e) {
-            return std::visit(
-                [&](const auto& inner_data) {
+        if (it == channels_.end()) {
+            // A new headerless channel, whose type is chosen by the data
+            if (data.index() == 0) {
+                return false;
+            }
+
+            auto channel = std::visit(
+                [&](const auto& inner_data) -> channel_writer {
                     using D = std::decay_t<decltype(inner_data)>;
                     if constexpr (std::is_same_v<D, std::monostate>) {
-                        return false;
+                        return std::monostate{};
                     } else {
-                        channels_.insert_or_assign(channel_name, channel_writer_new_headerless<D, Ts..., no_type>(out_, application_name_, channel_name));
-                        channel_writer * channel = &channels_.at(channel_name);
-                        auto result = std::visit(
-                            [&](auto&& inner_channel) {
-                                using C = std::decay_t<decltype(inner_channel)>;
-                                if constexpr (std::is_same_v<C, std::monostate>) {
-                                    return false;
-                                } else if constexpr (!std::is_same_v<typename C::data_type, D>) {
-                                    return false;
-                                } else {
-                                    return inner_channel.write(inner_data, source_timestamp, force_keyframe);
-                                }
-                            },
-                            *channel);
-                        return result;
+                        return channel_writer_new_headerless<D, Ts..., no_type>(out_, application_name_, channel_name);
                     }
                 },
                 data);
+
+            it = channels_.emplace(channel_name, std::move(channel)).first;
+            apply_keyframe_policy(it->second, keyframe_policy_);
+        }
+
+        return std::visit(
+            [&](auto&& inner_channel, const auto& inner_data) {
+                using C = std::decay_t<decltype(inner_channel)>;
+                using D = std::decay_t<decltype(inner_data)>;
+                if constexpr (std::is_same_v<C, std::monostate> || std::is_same_v<D, std::monostate>) {
+                    return false;
+                } else if constexpr (!std::is_same_v<typename C::data_type, D>) {
+                    return false;
+                } else {
+                    return inner_channel.write(inner_data, source_timestamp, force_keyframe);
+                }
+            },
+            it->second, data);
+    }
+
+    // The keyframe policy of every channel, including those registered
+    // later
+    void set_keyframe_policy(const KeyframePolicy& policy)
+    {
+        keyframe_policy_ = policy;
+
+        for (auto&& [channel_name, channel] : channels_) {
+            apply_keyframe_policy(channel, policy);
         }
     }
 
+    // The keyframe policy of one channel. Returns false if the channel is
+    // not registered.
+    bool set_keyframe_policy(const std::string& channel_name, const KeyframePolicy& policy)
+    {
+        auto it = channels_.find(channel_name);
+        if (it == channels_.end()) {
+            return false;
+        }
+
+        apply_keyframe_policy(it->second, policy);
+        return true;
+    }
+
     const Identifier identifier(const std::string& channel_name) const {
         return std::visit([&](auto&& inner_channel) -> Identifier {
             using C = std::decay_t<decltype(inner_channel)>;
@@ -114,7 +216,31 @@ class MultiChannelWriter {
    private:
     kj::OutputStream * out_;
     const std::string application_name_;
+    ChannelRegistry * registry_;
     std::unordered_map<std::string, channel_writer> channels_;
+    KeyframePolicy keyframe_policy_;
+
+    static void apply_keyframe_policy(channel_writer& channel, const KeyframePolicy& policy)
+    {
+        std::visit([&](auto&& inner_channel) {
+            using C = std::decay_t<decltype(inner_channel)>;
+            if constexpr (!std::is_same_v<C, std::monostate>) {
+                inner_channel.set_keyframe_policy(policy);
+            }
+        }, channel);
+    }
+
+    template <typename T>
+    ChannelHandle<T> handle(const std::string& channel_name, channel_writer& channel)
+    {
+        auto writer = std::get_if<ChannelWriter<T>>(&channel);
+        if (writer == nullptr) {
+            throw std::runtime_error("MCWriter: " + application_name_ + "/" + channel_name
+                + " is not of type " + std::string(typeid(T).name()));
+        }
+
+        return ChannelHandle<T>(writer);
+    }
 
     template<typename H, typename U, typename... Us>
     channel_writer channel_writer_new_header(kj::OutputStream * out, const std::string& application_name, const std::string& channel_name, const H& header)
@@ -122,7 +248,7 @@ class MultiChannelWriter {
         if constexpr (std::is_same_v<U, no_type>) {
             throw std::runtime_error("MCWriter: could not find header type " + std::string(typeid(H).name()) + " for " + application_name + "/" + channel_name);
         } else if constexpr (!std::is_same_v<typename U::header_type, no_type> && std::is_same_v<typename U::header_type, H>) {
-            return std::variant<std::monostate, ChannelWriter<Ts>...>(ChannelWriter<U>(out, application_name, channel_name, header));
+            return std::variant<std::monostate, ChannelWriter<Ts>...>(ChannelWriter<U>(out, application_name, channel_name, header, registry_));
         } else {
             return channel_writer_new_header<H, Us...>(out, application_name, channel_name, header);
         }
@@ -137,7 +263,7 @@ class MultiChannelWriter {
             if constexpr (!std::is_same_v<typename U::header_type, no_type>) {
                 throw std::runtime_error("MCWriter: could not match data type " + std::string(typeid(D).name()) + " for " + application_name + "/" + channel_name);
             } else {
-                return std::variant<std::monostate, ChannelWriter<Ts>...>(ChannelWriter<U>(out, application_name, channel_name));
+                return std::variant<std::monostate, ChannelWriter<Ts>...>(ChannelWriter<U>(out, application_name, channel_name, registry_));
             }
         } else {
             return channel_writer_new_headerless<D, Us...>(out, application_name, channel_name);
@@ -155,14 +281,99 @@ class MultiChannelPathWriter {
 
     MultiChannelPathWriter(const std::string& path,
         const std::string& application_name,
-        const header_map& channel_headers = {})
+        const header_map& channel_headers = {},
+        const FlushPolicy& policy = {},
+        FrameFormat format = FrameFormat::envelope)
     {
         int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_NONBLOCK, S_IRUSR|S_IWUSR|S_IRGRP);
         if (fd == -1) {
             throw std::system_error(errno, std::system_category());
         }
-        out_ = std::make_unique<kj::FdOutputStream>(kj::AutoCloseFd(fd));
-        channel_writer_ = std::make_unique<MultiChannelWriter<Ts...>>(out_.get(), application_name, channel_headers);
+        out_ = std::make_unique<BufferedFdOutputStream>(kj::AutoCloseFd(fd), policy);
+        if (format == FrameFormat::compact) {
+            registry_ = std::make_unique<ChannelRegistry>();
+        }
+        channel_writer_ = std::make_unique<MultiChannelWriter<Ts...>>(out_.get(), application_name, channel_headers, registry_.get());
+    }
+
+    template <typename T>
+    ChannelHandle<T> channel(const std::string& channel_name)
+    {
+        return channel_writer_->template channel<T>(channel_name);
+    }
+
+    template <typename T>
+    ChannelHandle<T> channel(const std::string& channel_name,
+        const typename T::header_type& header)
+    {
+        return channel_writer_->template channel<T>(channel_name, header);
+    }
+
+    bool write(const std::string& channel_name, const data_type& data,
+        uint64_t source_timestamp=0, bool force_keyframe=false)
+    {
+        return channel_writer_->write(channel_name, data, source_timestamp, force_keyframe);
+    }
+
+    void set_keyframe_policy(const KeyframePolicy& policy)
+    {
+        channel_writer_->set_keyframe_policy(policy);
+    }
+
+    bool set_keyframe_policy(const std::string& channel_name, const KeyframePolicy& policy)
+    {
+        return channel_writer_->set_keyframe_policy(channel_name, policy);
+    }
+
+    void flush()
+    {
+        out_->flush();
+    }
+
+    FlushStats stats() const
+    {
+        return out_->stats();
+    }
+
+   private:
+    std::unique_ptr<BufferedFdOutputStream> out_;
+    std::unique_ptr<ChannelRegistry> registry_;
+    std::unique_ptr<MultiChannelWriter<Ts...>> channel_writer_;
+};
+
+template <typename... Ts>
+class MultiChannelMappedWriter {
+    // A MultiChannelPathWriter that appends through a MappedAppendStream; see
+    // ChannelMappedWriter.
+
+   public:
+    using header_type = typename Variant<Ts...>::header_type;
+    using data_type = typename Variant<Ts...>::data_type;
+    using header_map = typename Variant<Ts...>::header_map;
+
+    MultiChannelMappedWriter(const std::string& path,
+        const std::string& application_name,
+        const header_map& channel_headers = {},
+        FrameFormat format = FrameFormat::envelope)
+        : out_(std::make_unique<MappedAppendStream>(path))
+    {
+        if (format == FrameFormat::compact) {
+            registry_ = std::make_unique<ChannelRegistry>();
+        }
+        channel_writer_ = std::make_unique<MultiChannelWriter<Ts...>>(out_.get(), application_name, channel_headers, registry_.get());
+    }
+
+    template <typename T>
+    ChannelHandle<T> channel(const std::string& channel_name)
+    {
+        return channel_writer_->template channel<T>(channel_name);
+    }
+
+    template <typename T>
+    ChannelHandle<T> channel(const std::string& channel_name,
+        const typename T::header_type& header)
+    {
+        return channel_writer_->template channel<T>(channel_name, header);
     }
 
     bool write(const std::string& channel_name, const data_type& data,
@@ -171,9 +382,77 @@ class MultiChannelPathWriter {
         return channel_writer_->write(channel_name, data, source_timestamp, force_keyframe);
     }
 
+    // Write everything so far to disk
+    void sync()
+    {
+        out_->sync();
+    }
+
+   private:
+    std::unique_ptr<MappedAppendStream> out_;
+    std::unique_ptr<ChannelRegistry> registry_;
+    std::unique_ptr<MultiChannelWriter<Ts...>> channel_writer_;
+};
+
+template <typename... Ts>
+class MultiChannelRotatingWriter {
+    // A MultiChannelPathWriter to a series of files; see
+    // ChannelRotatingWriter. Each file starts with the header of every
+    // channel written so far, and each channel's first frame in it is a
+    // keyframe.
+
+   public:
+    using header_type = typename Variant<Ts...>::header_type;
+    using data_type = typename Variant<Ts...>::data_type;
+    using header_map = typename Variant<Ts...>::header_map;
+
+    MultiChannelRotatingWriter(const std::string& path,
+        const std::string& application_name,
+        const header_map& channel_headers,
+        const RotationPolicy& policy)
+        : out_(std::make_unique<RotatingOutputStream>(path, policy)),
+          channel_writer_(std::make_unique<MultiChannelWriter<Ts...>>(out_.get(), application_name, channel_headers))
+    {
+    }
+
+    bool write(const std::string& channel_name, const data_type& data,
+        uint64_t source_timestamp=0, bool force_keyframe=false)
+    {
+        if (source_timestamp == 0) {
+            source_timestamp = Stamp::stamp_clock_rt();
+        }
+
+        if (out_->roll(source_timestamp)) {
+            keyframed_.clear();
+        }
+
+        if (keyframed_.count(channel_name) == 0) {
+            force_keyframe = true;
+        }
+
+        if (!channel_writer_->write(channel_name, data, source_timestamp, force_keyframe)) {
+            return false;
+        }
+
+        keyframed_.insert(channel_name);
+        return true;
+    }
+
+    // Move on to the next file now
+    void rotate()
+    {
+        out_->rotate();
+        keyframed_.clear();
+    }
+
+    const std::string& current_path() const { return out_->current_path(); }
+
    private:
-    std::unique_ptr<kj::FdOutputStream> out_;
+    std::unique_ptr<RotatingOutputStream> out_;
     std::unique_ptr<MultiChannelWriter<Ts...>> channel_writer_;
+
+    // Channels that have had a keyframe in the current file
+    std::unordered_set<std::string> keyframed_;
 };
 
 } // namespace lt::slipstream
@@ -0,0 +1,353 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <kj/io.h>
+
+#include "lt/slipstream/mapped_input.h"
+#include "lt/slipstream/multichannel_reader.h"
+
+namespace lt::slipstream {
+
+struct FrameRange {
+    // A run of whole frames of a file, with what a reader needs to decode
+    // them independently of the frames before: the first header frame of
+    // each channel seen before the range, and for each delta channel that
+    // starts the range with a delta, its last earlier keyframe and every
+    // delta after it, as a delta may depend on the frame before. The
+    // preamble frames are slices of the same bytes as the range, and are
+    // read first; its `preamble_frames` data frames precede the range and
+    // are not part of its output.
+    kj::ArrayPtr<const kj::byte> frames;
+    std::vector<kj::ArrayPtr<const kj::byte>> preamble;
+    size_t preamble_frames = 0;
+};
+
+// Split the frames in `bytes` into about `count` ranges, using up to
+// `threads` threads. Split points are resynced to the next frame marker.
+// If the ranges do not join up frame to frame, or the stream is compact
+// (its frames name channels by ids registered in earlier frames), the
+// result is a single range over all of `bytes`.
+std::vector<FrameRange> split_frames(kj::ArrayPtr<const kj::byte> bytes,
+    size_t count, size_t threads);
+
+class PreambleInputStream : public kj::BufferedInputStream {
+    // Reads a FrameRange's preamble, then its frames. The range must
+    // outlive the stream.
+
+   public:
+    explicit PreambleInputStream(const FrameRange& range);
+
+    KJ_DISALLOW_COPY(PreambleInputStream);
+    virtual ~PreambleInputStream() noexcept(false);
+
+    // implements BufferedInputStream
+    kj::ArrayPtr<const kj::byte> tryGetReadBuffer() override;
+
+    // implements InputStream
+    size_t tryRead(void* buffer, size_t minBytes, size_t maxBytes) override;
+
+    void skip(size_t bytes) override;
+
+   private:
+    const std::vector<kj::ArrayPtr<const kj::byte>>& preamble_;
+    size_t next_;
+
+    // The rest of the current preamble frame, or of the range's frames
+    // once the preamble is read
+    kj::ArrayPtr<const kj::byte> current_;
+    kj::ArrayPtr<const kj::byte> frames_;
+
+    // Move to the next part once the current one is read. Returns false at
+    // the end of the range.
+    bool next_part();
+};
+
+template <typename... Ts>
+class ParallelReader {
+    // Decodes a multichannel file on several threads, giving its frames in
+    // file order.
+    //
+    // The file is mapped and split into byte ranges at frame boundaries
+    // (see split_frames). Worker threads take the ranges in order and
+    // decode each with its own MultiChannelReader, passing each frame to
+    // `map`; the results are queued per range and handed to `consume` on
+    // the calling thread, range by range. Per range queues are bounded, so
+    // a slow consumer holds back the workers.
+    //
+    // Each range's reader interns its own envelopes, so the envelopes of
+    // frames from different ranges must be compared by value rather than
+    // by pointer. `map` is called concurrently from the worker threads.
+
+   public:
+    using reader_type = MultiChannelReader<Ts...>;
+    using data_type = typename reader_type::data_type;
+    using slot_type = typename reader_type::slot_type;
+
+    // Ranges smaller than this are not worth a thread
+    static constexpr size_t min_range_bytes = 1 << 20;
+
+    // Results queued per range before its worker waits for the consumer
+    static constexpr size_t chunk_frames = 1024;
+    static constexpr size_t queue_chunks = 16;
+
+    // `threads` defaults to the hardware concurrency, and `ranges` to four
+    // per thread, but no smaller than min_range_bytes
+    explicit ParallelReader(const std::string& path, size_t threads = 0,
+        size_t ranges = 0)
+        : in_(path), threads_(threads)
+    {
+        if (threads_ == 0) {
+            threads_ = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        }
+
+        auto bytes = in_.tryGetReadBuffer();
+
+        if (ranges == 0) {
+            ranges = std::clamp<size_t>(bytes.size() / min_range_bytes, 1, 4 * threads_);
+        }
+
+        ranges_ = split_frames(bytes, ranges, threads_);
+    }
+
+    KJ_DISALLOW_COPY(ParallelReader);
+
+    size_t threads() const { return threads_; }
+
+    const std::vector<FrameRange>& ranges() const { return ranges_; }
+
+    // Call map(const slot_type&) for each frame on the worker threads, and
+    // consume(result) for each result on the calling thread, in file
+    // order, until consume returns false if it returns bool. Returns the
+    // number of results consumed. An exception thrown by either is
+    // rethrown here once the workers have stopped.
+    template <typename Map, typename Consume>
+    size_t transform(Map&& map, Consume&& consume)
+    {
+        using R = std::decay_t<std::invoke_result_t<Map&, const slot_type&>>;
+
+        size_t n = 0;
+
+        run<std::vector<R>>([&](std::vector<R>& chunk, const slot_type& slot) {
+            if (chunk.empty()) {
+                chunk.reserve(chunk_frames);
+            }
+            chunk.push_back(map(slot));
+        }, [&](std::vector<R>&& chunk) {
+            for (auto&& result : chunk) {
+                n++;
+
+                if constexpr (std::is_same_v<std::invoke_result_t<Consume&, R&&>, bool>) {
+                    if (!consume(std::move(result))) {
+                        return false;
+                    }
+                } else {
+                    consume(std::move(result));
+                }
+            }
+            return true;
+        });
+
+        return n;
+    }
+
+    // As transform(), but with the results of each run of up to
+    // chunk_frames frames of a range gathered into one Block, so that they
+    // are handed over together: append(Block&, const slot_type&) is called
+    // for each frame, from a default constructed Block, and consume(Block&&)
+    // for each block. Returns the number of blocks consumed.
+    template <typename Block, typename Append, typename Consume>
+    size_t transform_blocks(Append&& append, Consume&& consume)
+    {
+        size_t n = 0;
+
+        run<Block>(append, [&](Block&& block) {
+            n++;
+
+            if constexpr (std::is_same_v<std::invoke_result_t<Consume&, Block&&>, bool>) {
+                return consume(std::move(block));
+            } else {
+                consume(std::move(block));
+                return true;
+            }
+        });
+
+        return n;
+    }
+
+    // Call f(const slot_type&) for each frame, in file order, on the
+    // calling thread. Frames are decoded on the worker threads and copied
+    // into their slots; a slot's envelope remains valid until f returns.
+    template <typename F>
+    size_t for_each_frame(F&& f)
+    {
+        return transform([](const slot_type& slot) { return slot; },
+            [&](slot_type&& slot) { return f(const_cast<const slot_type&>(slot)); });
+    }
+
+   private:
+    MappedInputStream in_;
+    size_t threads_;
+    std::vector<FrameRange> ranges_;
+
+    template <typename Chunk>
+    struct RangeQueue {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Chunk> chunks;
+        bool done = false;
+        std::exception_ptr error;
+
+        // Kept until the range is consumed, as its results may point into
+        // the reader's envelopes
+        std::unique_ptr<PreambleInputStream> in;
+        std::unique_ptr<reader_type> reader;
+    };
+
+    // Decode the ranges on the worker threads, calling add(chunk, slot) to
+    // gather each run of up to chunk_frames frames into a Chunk, and
+    // each(chunk) for each chunk on the calling thread, in file order,
+    // until it returns false
+    template <typename Chunk, typename Add, typename Each>
+    void run(Add&& add, Each&& each)
+    {
+        std::vector<RangeQueue<Chunk>> queues(ranges_.size());
+        std::atomic<size_t> next{0};
+        std::atomic<bool> stop{false};
+
+        auto work = [&]() {
+            for (size_t i; !stop && (i = next++) < ranges_.size();) {
+                decode(ranges_[i], queues[i], stop, add);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < std::min(threads_, ranges_.size()); ++t) {
+            workers.emplace_back(work);
+        }
+
+        auto halt = [&]() {
+            stop = true;
+            for (auto&& q : queues) {
+                std::lock_guard<std::mutex> lock(q.mutex);
+                q.cv.notify_all();
+            }
+            for (auto&& w : workers) {
+                w.join();
+            }
+        };
+
+        try {
+            bool more = true;
+
+            for (size_t i = 0; more && i < queues.size(); ++i) {
+                auto& q = queues[i];
+
+                while (more) {
+                    std::unique_lock<std::mutex> lock(q.mutex);
+                    q.cv.wait(lock, [&] { return !q.chunks.empty() || q.done; });
+
+                    if (q.chunks.empty()) {
+                        if (q.error) {
+                            std::rethrow_exception(q.error);
+                        }
+                        break;
+                    }
+
+                    auto chunk = std::move(q.chunks.front());
+                    q.chunks.pop_front();
+                    q.cv.notify_all();
+                    lock.unlock();
+
+                    more = each(std::move(chunk));
+                }
+
+                // The range is decoded and consumed, and its envelopes are
+                // no longer referenced
+                if (more) {
+                    std::lock_guard<std::mutex> lock(q.mutex);
+                    q.reader.reset();
+                    q.in.reset();
+                }
+            }
+        } catch (...) {
+            halt();
+            throw;
+        }
+
+        halt();
+    }
+
+    template <typename Chunk, typename Add>
+    static void decode(const FrameRange& range, RangeQueue<Chunk>& q,
+        std::atomic<bool>& stop, Add& add)
+    {
+        // Wait for room in the queue; false if the reader is stopping
+        auto push = [&](Chunk&& chunk) {
+            std::unique_lock<std::mutex> lock(q.mutex);
+            q.cv.wait(lock, [&] { return q.chunks.size() < queue_chunks || stop; });
+            if (stop) {
+                return false;
+            }
+            q.chunks.push_back(std::move(chunk));
+            q.cv.notify_all();
+            return true;
+        };
+
+        try {
+            reader_type * reader;
+
+            {
+                std::lock_guard<std::mutex> lock(q.mutex);
+                q.in = std::make_unique<PreambleInputStream>(range);
+                q.reader = std::make_unique<reader_type>(q.in.get());
+                reader = q.reader.get();
+            }
+
+            size_t preamble_frames = range.preamble_frames;
+
+            Chunk chunk{};
+            size_t frames = 0;
+
+            reader->for_each_frame([&](const slot_type& slot) {
+                if (preamble_frames > 0) {
+                    preamble_frames--;
+                    return true;
+                }
+
+                add(chunk, slot);
+
+                if (++frames < chunk_frames) {
+                    return true;
+                }
+
+                bool more = push(std::move(chunk));
+                chunk = Chunk{};
+                frames = 0;
+                return more;
+            });
+
+            if (frames > 0) {
+                push(std::move(chunk));
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.done = true;
+        q.cv.notify_all();
+    }
+};
+
+} // namespace lt::slipstream
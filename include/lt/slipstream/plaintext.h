@@ -1,5 +1,6 @@
 #pragma once
 
+#include "lt/slipstream/json_writer.h"
 #include "lt/slipstream/serialize.h"
 #include "lt/slipstream/types.h"
 
@@ -13,22 +14,9 @@
 
 static std::string json_escape(const std::string& input)
 {
-    std::ostringstream ss;
-
-    for (auto&& c : input) {
-        switch (c) {
-            case '\\': ss << "\\\\"; break;
-            case '"': ss << "\\\""; break;
-            case '/': ss << "\\/"; break;
-            case '\b': ss << "\\b"; break;
-            case '\f': ss << "\\f"; break;
-            case '\n': ss << "\\n"; break;
-            case '\r': ss << "\\r"; break;
-            case '\t': ss << "\\t"; break;
-            default: ss << c; break;
-        }
-    }
-    return ss.str();
+    std::string output;
+    lt::slipstream::json::append_escaped(output, input);
+    return output;
 }
 
 namespace lt::slipstream {
@@ -78,6 +66,13 @@ class SerialString : public Serialize<SerialString> {
         return "{\"text\":\"" + json_escape(s) + "\"}";
     }
 
+    static void to_json(json::Writer& out, const SerialString& ss)
+    {
+        out.raw("{\"text\":");
+        out.string(ss.str_);
+        out.raw('}');
+    }
+
     static bool write_impl(kj::OutputStream& out, const SerialString& ss)
     {
         const std::string& s = ss.str_;
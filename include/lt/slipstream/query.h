@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <capnp/dynamic.h>
+#include <kj/io.h>
+
+#include "lt/slipstream/json_writer.h"
+
+namespace lt::slipstream {
+
+// A query that cannot be applied to a payload's schema, eg. an ordering
+// comparison on a struct field, or a literal that is not a number
+class QueryError : public std::runtime_error {
+   public:
+    using std::runtime_error::runtime_error;
+};
+
+struct Predicate {
+    // A comparison of a payload field with a literal, as text such as
+    // "value > 100", "pos.x <= -1.5" or "name == \"eth0\"". Enum fields
+    // compare by enumerant name, and text literals may be quoted.
+
+    enum class Op { eq, ne, lt, le, gt, ge };
+
+    std::string path;
+    Op op = Op::eq;
+    std::string literal;
+
+    // Throws QueryError if `text` is not a comparison
+    static Predicate parse(const std::string& text);
+};
+
+class Query {
+    // Field paths to project and predicates to match, evaluated on a capnp
+    // message through its schema, without decoding it into its data_type.
+    // Paths name fields by their schema names, with nested structs and
+    // groups separated by dots, eg. "pos.x". Each path is looked up once
+    // per schema; a Query should not be shared between threads.
+    //
+    // A message matches if every predicate holds. A predicate on a field
+    // that the message's schema does not have, or on a union member that is
+    // not set, does not hold. Payloads without a schema, eg. plain text,
+    // match a query with no predicates and are written whole.
+
+   public:
+    Query() = default;
+
+    // Throws QueryError if a predicate cannot be parsed
+    Query(const std::vector<std::string>& fields, const std::vector<std::string>& predicates);
+
+    KJ_DISALLOW_COPY(Query);
+
+    bool empty() const { return fields_.empty() && predicates_.empty(); }
+
+    bool has_predicates() const { return !predicates_.empty(); }
+
+    bool match(::capnp::DynamicStruct::Reader reader);
+
+    // Append a JSON object of the projected fields that are present, keyed
+    // by path, or the whole message if no fields are projected
+    void project(json::Writer& out, ::capnp::DynamicStruct::Reader reader);
+
+   private:
+    using FieldPath = std::vector<::capnp::StructSchema::Field>;
+
+    enum class Kind { signed_integer, unsigned_integer, floating, boolean, text, enumerant };
+
+    struct Comparison {
+        FieldPath path;
+        Predicate::Op op;
+        Kind kind;
+
+        int64_t i = 0;
+        uint64_t u = 0;
+        double d = 0;
+        bool b = false;
+        std::string s;
+        uint16_t e = 0;
+    };
+
+    // The fields and predicates of the query as found in one schema. A
+    // comparison on a field that is not found never holds.
+    struct Resolved {
+        std::vector<std::pair<const std::string *, FieldPath>> fields;
+        std::vector<Comparison> comparisons;
+        bool never = false;
+    };
+
+    std::vector<std::string> fields_;
+    std::vector<Predicate> predicates_;
+
+    std::unordered_map<uint64_t, Resolved> schemas_;
+    uint64_t last_id_ = 0;
+    Resolved * last_ = nullptr;
+
+    Resolved& resolve(::capnp::StructSchema schema);
+};
+
+// Whether T can pass the payload in the stream to a function as a
+// DynamicStruct::Reader, with read_dynamic(in, length, f)
+template <typename T, typename = void>
+struct reads_dynamic : std::false_type {};
+
+template <typename T>
+struct reads_dynamic<T, std::void_t<decltype(std::declval<T&>().read_dynamic(std::declval<kj::InputStream&>(),
+    size_t(), std::declval<void (*)(::capnp::DynamicStruct::Reader)>()))>> : std::true_type {};
+
+} // namespace lt::slipstream
@@ -7,17 +7,107 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <limits>
 #include <memory>
 #include <optional>
 #include <system_error>
 #include <kj/io.h>
 
+#include "lt/slipstream/channel_dictionary.h"
 #include "lt/slipstream/envelope.h"
 #include "lt/slipstream/framing.h"
 #include "lt/slipstream/json.h"
+#include "lt/slipstream/mapped_input.h"
+#include "lt/slipstream/query.h"
+#include "lt/slipstream/serialize.h"
 
 namespace lt::slipstream {
 
+template <typename D>
+struct FrameSlot {
+    // A decoded frame, as filled in by a reader's read_batch() or passed to
+    // its for_each_frame(). The envelope is interned by the reader and
+    // remains valid for the reader's life; envelope->identifier is a handle
+    // to the frame's channel that can be compared or used as a key without
+    // touching its strings.
+    uint64_t source_timestamp = 0;
+    const InternedEnvelope * envelope = nullptr;
+    D data;
+};
+
+// Fill `slots` with the frames read by `read_frame`, stopping at the end
+// of the stream. Returns the number of slots filled.
+template <typename D, typename R>
+size_t read_frames(kj::ArrayPtr<FrameSlot<D>> slots, R&& read_frame)
+{
+    size_t n = 0;
+
+    for (auto&& slot : slots) {
+        if (!read_frame(slot.data, slot.source_timestamp, slot.envelope)) {
+            break;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+// Call f(slot) for each frame read by `read_frame` into `slot`, until the
+// end of the stream or until f returns false. Returns the number of frames
+// read.
+template <typename D, typename R, typename F>
+size_t for_each_read_frame(FrameSlot<D>& slot, R&& read_frame, F&& f)
+{
+    size_t n = 0;
+
+    while (read_frame(slot.data, slot.source_timestamp, slot.envelope)) {
+        n++;
+
+        if constexpr (std::is_same_v<std::invoke_result_t<F, const FrameSlot<D>&>, bool>) {
+            if (!f(const_cast<const FrameSlot<D>&>(slot))) {
+                break;
+            }
+        } else {
+            f(const_cast<const FrameSlot<D>&>(slot));
+        }
+    }
+
+    return n;
+}
+
+// Append a frame record to `out` whose data is written by read(out), which
+// reads it from the stream. If that fails, the record is removed.
+template <typename R>
+bool read_json_frame(json::Writer& out, uint64_t source_timestamp,
+    const InternedEnvelope& envelope, R&& read)
+{
+    size_t mark = out.size();
+    bool result = false;
+
+    try {
+        out.frame(source_timestamp, envelope.envelope.identifier,
+            [&](json::Writer& w) { result = read(w); });
+    } catch (std::exception&) {
+        result = false;
+    }
+
+    if (!result) {
+        out.truncate(mark);
+    }
+
+    return result;
+}
+
+// Where a reader writes the frames that it can write as JSON straight from
+// the stream, and whether it did: `direct` is set if the frame was handled
+// so, and `matched` if a record was written
+struct JsonTarget {
+    json::Writer& out;
+    Query * query = nullptr;
+    bool direct = false;
+    bool matched = false;
+};
+
 template <typename T>
 class ChannelReader {
    public:
@@ -31,24 +121,20 @@ class ChannelReader {
         if constexpr (std::is_same_v<header_type, no_type>) {
             thang_ = std::make_unique<T>();
         } else {
-            Framing framing;
+            uint64_t source_timestamp;
+            const InternedEnvelope * envelope;
+            size_t length;
 
-            auto result = framing.read(*in_);
-            if (!result.first) {
+            if (!next_frame(source_timestamp, envelope, length)) {
                 throw std::runtime_error("Bad frame read");
             }
 
-            Envelope envelope;
-            if (!envelope.read(*in_, framing.envelope_length)) {
-                throw std::runtime_error("Bad envelope read");
-            }
-
-            if (!T::has_header_encoding(envelope.encoding)) {
+            if (!T::has_header_encoding(envelope->envelope.encoding)) {
                 throw std::runtime_error("Wrong encoding");
             }
 
             header_type header;
-            if (!T::read_header(*in_, header, framing.payload_length)) {
+            if (!T::read_header(*in_, header, length)) {
                 throw std::runtime_error("Bad header read");
             }
 
@@ -68,6 +154,8 @@ class ChannelReader {
     {
         in_ = std::move(other.in_);
         thang_ = std::move(other.thang_);
+        dictionary_ = std::move(other.dictionary_);
+        slot_ = std::move(other.slot_);
 
         return *this;
     }
@@ -80,43 +168,15 @@ class ChannelReader {
     bool read(data_type& data, uint64_t& source_timestamp,
         Envelope& envelope)
     {
-        Framing framing;
+        const InternedEnvelope * e;
 
-        auto result = framing.read(*in_);
-        if (!result.first) {
+        if (!read_frame(data, source_timestamp, e)) {
             return false;
         }
 
-        source_timestamp = framing.source_timestamp;
+        envelope = e->envelope;
 
-        if (!envelope.read(*in_, framing.envelope_length)) {
-            return false;
-        }
-
-        if (!T::has_encoding(envelope.encoding)) {
-            return false;
-        }
-
-        if (auto pd = std::get_if<PayloadData>(&envelope.payload_kind)) {
-            if (std::holds_alternative<PayloadKeyframe>(*pd)) {
-                try {
-                    auto result = thang_->read(*in_, data, framing.payload_length);
-                    return result;
-                } catch (std::exception&) {
-                    return false;
-                }
-            } else if constexpr (!std::is_same_v<delta_type, no_type>) {
-                try {
-                    return thang_->read_delta(*in_, data, framing.payload_length);
-                } catch (std::exception&) {
-                    return false;
-                }
-            } else {
-                return false;
-            }
-        } else {
-            return false;
-        }
+        return true;
     }
 
     bool read_header_internal(header_type& header, size_t length)
@@ -155,21 +215,123 @@ class ChannelReader {
     bool read(data_type& data)
     {
         uint64_t source_timestamp;
-        Envelope envelope;
-        return read(data, source_timestamp, envelope);
+        const InternedEnvelope * envelope;
+        return read_frame(data, source_timestamp, envelope);
     }
 
-    const std::optional<std::string> read_json(uint64_t& source_timestamp)
+    using slot_type = FrameSlot<data_type>;
+
+    // Decode up to slots.size() frames into `slots`, reusing the storage of
+    // their data. Returns the number decoded, which is less than requested
+    // only at the end of the stream.
+    size_t read_batch(kj::ArrayPtr<slot_type> slots)
+    {
+        return read_frames(slots, [this](auto&&... args) { return read_frame(args...); });
+    }
+
+    // Call f(const slot_type&) for each remaining frame, until f returns
+    // false if it returns bool. Every frame is decoded into the same slot.
+    // Returns the number of frames read.
+    template <typename F>
+    size_t for_each_frame(F&& f)
+    {
+        return for_each_read_frame(slot_,
+            [this](auto&&... args) { return read_frame(args...); }, std::forward<F>(f));
+    }
+
+    // Whether frames are written as JSON straight from the stream, eg. for
+    // capnp channels, rather than decoded and then encoded
+    static constexpr bool json_direct = reads_json<T>::value;
+
+    // Whether a query is evaluated on each payload through its capnp
+    // schema. A channel may do this without being json_direct, eg. a
+    // HeaderStream, which decodes each payload first.
+    static constexpr bool query_direct = reads_dynamic<T>::value;
+
+    // Whether read_json_internal handles the frames read for `target`;
+    // otherwise they are decoded into the reader's slot
+    static bool handles_json(const JsonTarget& target)
     {
-        Envelope envelope;
-        data_type data;
+        return json_direct ||
+            (query_direct && target.query != nullptr && !target.query->empty());
+    }
+
+    // Write the frame whose payload of `length` bytes is next in the stream
+    // to `target`, if it matches the query. See handles_json().
+    bool read_json_internal(JsonTarget& target, uint64_t source_timestamp,
+        const InternedEnvelope& envelope, size_t length)
+    {
+        if constexpr (json_direct || query_direct) {
+            target.direct = true;
+
+            if constexpr (query_direct) {
+                if (target.query != nullptr && !target.query->empty()) {
+                    size_t mark = target.out.size();
+
+                    try {
+                        return thang_->read_dynamic(*in_, length, [&](::capnp::DynamicStruct::Reader reader) {
+                            if (target.query->match(reader)) {
+                                target.out.frame(source_timestamp, envelope.envelope.identifier,
+                                    [&](json::Writer& w) { target.query->project(w, reader); });
+                                target.matched = true;
+                            }
+                        });
+                    } catch (QueryError&) {
+                        target.out.truncate(mark);
+                        throw;
+                    } catch (std::exception&) {
+                        target.out.truncate(mark);
+                        target.matched = false;
+                        return false;
+                    }
+                }
+            }
+
+            if constexpr (json_direct) {
+                target.matched = read_json_frame(target.out, source_timestamp, envelope,
+                    [&](json::Writer& w) { return thang_->read_json(*in_, w, length); });
+            }
 
-        if (read(data, source_timestamp, envelope)) {
-            auto data_json = thang_->to_json(data);
-            return json::frame(data_json, source_timestamp, envelope);
+            return target.matched;
         } else {
+            return false;
+        }
+    }
+
+    const std::optional<std::string> read_json(uint64_t& source_timestamp)
+    {
+        static thread_local json::Writer writer;
+
+        writer.clear();
+        if (!read_json(writer, source_timestamp)) {
             return {};
         }
+
+        return writer.str();
+    }
+
+    // Append the next frame's JSON record to `out`. Returns false at the
+    // end of the stream.
+    //
+    // When json_direct, the payload is encoded as JSON from the stream;
+    // otherwise the frame is decoded into the reader's slot first.
+    bool read_json(json::Writer& out, uint64_t& source_timestamp)
+    {
+        return next_json(out, source_timestamp, nullptr);
+    }
+
+    // As above, for the next frame that matches `query`, with only the
+    // fields it projects. Throws QueryError if the query does not suit the
+    // channel's schema.
+    //
+    // Frames that do not match are passed over, up to the first frame
+    // after `end`, matched or not: for that frame, returns true with its
+    // timestamp and nothing appended, so that a caller reading to an end
+    // time can stop.
+    bool read_json(json::Writer& out, uint64_t& source_timestamp, Query& query,
+        uint64_t end = std::numeric_limits<uint64_t>::max())
+    {
+        return next_json(out, source_timestamp, &query, end);
     }
 
     bool header(header_type& header) {
@@ -186,6 +348,129 @@ class ChannelReader {
    private:
     kj::InputStream * in_;
     std::unique_ptr<T> thang_;
+    ChannelDictionary dictionary_;
+    slot_type slot_;
+
+    // Read up to the payload of the next frame, passing over the
+    // registration frames of a compact stream and any frames whose channel
+    // is not yet known. `envelope` points into the dictionary.
+    bool next_frame(uint64_t& source_timestamp,
+        const InternedEnvelope *& envelope, size_t& payload_length)
+    {
+        while (true) {
+            Framing framing;
+
+            auto result = framing.read(*in_);
+            if (!result.first) {
+                return false;
+            }
+
+            uint16_t channel_id;
+            if (!dictionary_.read(*in_, framing, envelope, channel_id)) {
+                return false;
+            }
+
+            // Header frames after the first are repeats, eg. at a
+            // RotatingOutputStream's header interval
+            bool repeated_header = thang_ && envelope != nullptr &&
+                !std::holds_alternative<PayloadData>(envelope->envelope.payload_kind);
+
+            if (envelope == nullptr || framing.registration() || repeated_header) {
+                try {
+                    in_->skip(framing.payload_length);
+                } catch (std::exception&) {
+                    return false;
+                }
+                continue;
+            }
+
+            source_timestamp = framing.source_timestamp;
+            payload_length = framing.payload_length;
+
+            return true;
+        }
+    }
+
+    bool next_json(json::Writer& out, uint64_t& source_timestamp, Query * query,
+        uint64_t end = std::numeric_limits<uint64_t>::max())
+    {
+        while (true) {
+            JsonTarget target{out, query};
+            size_t mark = out.size();
+
+            if (!read_frame(slot_.data, slot_.source_timestamp, slot_.envelope, &target)) {
+                return false;
+            }
+
+            source_timestamp = slot_.source_timestamp;
+
+            if (source_timestamp > end) {
+                out.truncate(mark);
+                return true;
+            }
+
+            if (target.direct) {
+                if (target.matched) {
+                    return true;
+                }
+                continue;
+            }
+
+            // Payloads without a schema match only a query with no
+            // predicates
+            if (query != nullptr && query->has_predicates()) {
+                continue;
+            }
+
+            out.frame(source_timestamp, slot_.envelope->envelope.identifier,
+                [&](json::Writer& w) { json::data(w, slot_.data); });
+
+            return true;
+        }
+    }
+
+    // Read the next data frame into `data`, or if `target` is given and
+    // the frame can be written as JSON directly, write it there instead
+    bool read_frame(data_type& data, uint64_t& source_timestamp,
+        const InternedEnvelope *& envelope, JsonTarget * target = nullptr)
+    {
+        size_t length;
+
+        if (!next_frame(source_timestamp, envelope, length)) {
+            return false;
+        }
+
+        if (!T::has_encoding(envelope->envelope.encoding)) {
+            return false;
+        }
+
+        if (auto pd = std::get_if<PayloadData>(&envelope->envelope.payload_kind)) {
+            if (std::holds_alternative<PayloadKeyframe>(*pd)) {
+                if constexpr (json_direct || query_direct) {
+                    if (target != nullptr && handles_json(*target)) {
+                        return read_json_internal(*target, source_timestamp, *envelope, length);
+                    }
+                }
+
+                try {
+                    auto result = thang_->read(*in_, data, length);
+                    return result;
+                } catch (std::exception&) {
+                    return false;
+                }
+            } else if constexpr (!std::is_same_v<delta_type, no_type>) {
+                try {
+                    return thang_->read_delta(*in_, data, length);
+                } catch (std::exception&) {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
 };
 
 template <typename T>
@@ -210,11 +495,33 @@ class ChannelPathReader {
         return channel_reader_->read(data, source_timestamp, envelope);
     }
 
+    size_t read_batch(kj::ArrayPtr<FrameSlot<data_type>> slots)
+    {
+        return channel_reader_->read_batch(slots);
+    }
+
+    template <typename F>
+    size_t for_each_frame(F&& f)
+    {
+        return channel_reader_->for_each_frame(std::forward<F>(f));
+    }
+
     const std::optional<std::string> read_json(uint64_t& source_timestamp)
     {
         return channel_reader_->read_json(source_timestamp);
     }
 
+    bool read_json(json::Writer& out, uint64_t& source_timestamp)
+    {
+        return channel_reader_->read_json(out, source_timestamp);
+    }
+
+    bool read_json(json::Writer& out, uint64_t& source_timestamp, Query& query,
+        uint64_t end = std::numeric_limits<uint64_t>::max())
+    {
+        return channel_reader_->read_json(out, source_timestamp, query, end);
+    }
+
     const header_type * header() {
         return channel_reader_->header();
     }
@@ -224,5 +531,68 @@ class ChannelPathReader {
     std::unique_ptr<ChannelReader<T>> channel_reader_;
 };
 
+template <typename T>
+class ChannelMappedReader {
+    // Like ChannelPathReader, but reads the file through a memory mapping:
+    // framing headers are decoded in place and capnp messages are read from
+    // the mapping, so a read needs no system calls.
+
+   public:
+    using header_type = typename T::header_type;
+    using data_type = typename T::data_type;
+
+    ChannelMappedReader(const std::string& path)
+    {
+        in_ = std::make_unique<MappedInputStream>(path);
+        channel_reader_ = std::make_unique<ChannelReader<T>>(in_.get());
+    }
+
+    bool read(data_type& data, uint64_t& source_timestamp,
+        Envelope& envelope)
+    {
+        return channel_reader_->read(data, source_timestamp, envelope);
+    }
+
+    bool read(data_type& data)
+    {
+        return channel_reader_->read(data);
+    }
+
+    size_t read_batch(kj::ArrayPtr<FrameSlot<data_type>> slots)
+    {
+        return channel_reader_->read_batch(slots);
+    }
+
+    template <typename F>
+    size_t for_each_frame(F&& f)
+    {
+        return channel_reader_->for_each_frame(std::forward<F>(f));
+    }
+
+    const std::optional<std::string> read_json(uint64_t& source_timestamp)
+    {
+        return channel_reader_->read_json(source_timestamp);
+    }
+
+    bool read_json(json::Writer& out, uint64_t& source_timestamp)
+    {
+        return channel_reader_->read_json(out, source_timestamp);
+    }
+
+    bool read_json(json::Writer& out, uint64_t& source_timestamp, Query& query,
+        uint64_t end = std::numeric_limits<uint64_t>::max())
+    {
+        return channel_reader_->read_json(out, source_timestamp, query, end);
+    }
+
+    bool header(header_type& header) {
+        return channel_reader_->header(header);
+    }
+
+   private:
+    std::unique_ptr<MappedInputStream> in_;
+    std::unique_ptr<ChannelReader<T>> channel_reader_;
+};
+
 
 } // namespace lt::slipstream
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+#include <kj/io.h>
+
+namespace lt::slipstream {
+
+class SpscRing {
+    // A lock-free single-producer/single-consumer ring of variable-length
+    // records, eg. encoded frames.
+    //
+    // Records are stored contiguously, each preceded by a 4 byte length and
+    // padded to 8 bytes. A record that would straddle the end of the buffer
+    // is preceded by a wrap marker and stored at the start instead, so the
+    // consumer can always hand out a record as a single flat array.
+    //
+    // push() may only be called from one thread, and front()/pop() from one
+    // other thread.
+
+   public:
+    explicit SpscRing(size_t capacity);
+
+    KJ_DISALLOW_COPY(SpscRing);
+    ~SpscRing();
+
+    // Producer: copy a record into the ring. Returns false if there is not
+    // enough free space, in which case the ring is unchanged.
+    bool push(const void * data, size_t length);
+
+    // Consumer: fill records with up to max of the oldest records, without
+    // releasing them. Returns the number of records found.
+    size_t peek(kj::ArrayPtr<const kj::byte> * records, size_t max);
+
+    // Consumer: release the n oldest records.
+    void pop(size_t n);
+
+    // Consumer: the oldest record, or an empty array if the ring is empty.
+    kj::ArrayPtr<const kj::byte> front();
+
+    // Consumer: release the record returned by front().
+    void pop() { pop(1); }
+
+    bool empty() const;
+
+    // Bytes currently in use, including record overhead. Approximate when
+    // called concurrently with push() or pop().
+    size_t used() const;
+
+    size_t capacity() const { return capacity_; }
+
+    // The largest record that can ever be pushed.
+    size_t max_record() const { return capacity_ / 2 - record_header_; }
+
+   private:
+    static constexpr size_t cacheline_ = 64;
+    static constexpr size_t record_header_ = sizeof(uint64_t);
+    static constexpr uint32_t wrap_marker_ = 0xffffffff;
+
+    size_t capacity_;
+    size_t mask_;
+    std::unique_ptr<uint8_t[]> buffer_;
+
+    // Written by the producer
+    alignas(cacheline_) std::atomic<uint64_t> head_;
+    uint64_t cached_tail_;
+
+    // Written by the consumer
+    alignas(cacheline_) std::atomic<uint64_t> tail_;
+    uint64_t cached_head_;
+
+    static size_t record_size(size_t length);
+};
+
+} // namespace lt::slipstream
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <kj/io.h>
+
+namespace lt::slipstream {
+
+struct RotationPolicy {
+    // Start a new file once the current one has reached this many bytes.
+    // Zero means no size limit.
+    uint64_t max_bytes = 0;
+
+    // Start a new file when the timestamps of the frames written cross a
+    // multiple of this, eg. every hour on the hour. Zero means no time
+    // limit.
+    uint64_t interval_ns = 0;
+
+    // Write every header frame again once this long has passed, by frame
+    // timestamps, since they were last written. Zero means headers are only
+    // repeated at the start of each file.
+    uint64_t header_interval_ns = 0;
+};
+
+class RotatingOutputStream : public kj::OutputStream {
+    // An OutputStream to a series of files, <path>.000000, <path>.000001,
+    // ..., moving on to the next as the RotationPolicy requires. Numbering
+    // starts after the last file that already exists.
+    //
+    // Each write must hold whole frames, so that no frame is split across
+    // files. Time limits are measured by the timestamp of the first frame of
+    // each write that has one, which writers take from the wall clock unless
+    // given one. A writer of delta frames should call roll() before encoding
+    // each frame, and write a keyframe after it returns true.
+    //
+    // Header frames (version 2 frames with a timestamp of 0) that pass
+    // through are remembered, and each new file starts with a copy of every
+    // one seen, so that any file can be read on its own. Compact streams are
+    // not supported, as their registrations are not replayed.
+
+   public:
+    RotatingOutputStream(const std::string& path, const RotationPolicy& policy);
+
+    KJ_DISALLOW_COPY(RotatingOutputStream);
+    virtual ~RotatingOutputStream() noexcept(false);
+
+    // implements OutputStream
+    void write(const void* buffer, size_t size) override;
+
+    void write(kj::ArrayPtr<const kj::ArrayPtr<const kj::byte>> pieces) override;
+
+    // Move on to the next file now
+    void rotate();
+
+    // Move on to the next file if the policy requires it before a frame
+    // with `timestamp` is written. Returns true if it did.
+    bool roll(uint64_t timestamp);
+
+    // The name of file `sequence` of `path`
+    static std::string file_path(const std::string& path, uint64_t sequence);
+
+    const std::string& current_path() const { return current_path_; }
+
+    // The number of files written, including the current one
+    uint64_t files() const { return files_; }
+
+    const RotationPolicy& policy() const { return policy_; }
+
+   private:
+    std::string path_;
+    RotationPolicy policy_;
+    uint64_t sequence_;
+    uint64_t files_;
+    std::string current_path_;
+    std::unique_ptr<kj::FdOutputStream> out_;
+
+    // Bytes written to the current file, of which the first headers_size_
+    // are replayed headers
+    uint64_t size_;
+    uint64_t headers_size_;
+
+    // The interval of the current file, by policy_.interval_ns, once a frame
+    // with a timestamp has been written to it
+    bool has_period_;
+    uint64_t period_;
+
+    // The timestamp at which headers were last written, or 0
+    uint64_t headers_written_;
+
+    std::vector<std::string> headers_;
+    std::unordered_set<std::string> seen_headers_;
+
+    void open_next();
+
+    void write_headers();
+
+    void remember_headers(kj::ArrayPtr<const kj::byte> frames);
+};
+
+} // namespace lt::slipstream
@@ -1,12 +1,17 @@
 #pragma once
 
+#include "lt/slipstream/channel_dictionary.h"
+#include "lt/slipstream/merge.h"
 #include "lt/slipstream/reader.h"
 
 #include <algorithm>
+#include <stdexcept>
 #include <vector>
 
 namespace lt::slipstream {
 
+class SeekableStream;
+
 class PeekStream : public kj::InputStream {
    public:
     explicit PeekStream(kj::InputStream& inner);
@@ -45,16 +50,39 @@ class Scanner : public kj::InputStream {
 
     virtual bool next() = 0;
 
+    // Move from the current frame to the one after it, using the lengths in
+    // the frame header rather than searching for the next marker. Falls back
+    // to next() if the current position is not a valid frame, or if no valid
+    // frame follows it. Returns false at the end of the stream.
+    virtual bool skip_frame() = 0;
+
     virtual bool peek(uint64_t& source_timestamp) = 0;
 
     virtual bool peek(uint64_t& source_timestamp, Envelope& envelope) = 0;
 
+    // As above, giving the envelope interned by the scanner rather than a
+    // copy. It remains valid for the life of the scanner, and peeking does
+    // not allocate once the scanner has seen each channel.
+    virtual bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope) = 0;
+
     virtual size_t copy_frame(kj::OutputStream& out) = 0;
 };
 
 class ScannerWrapper : public Scanner {
     // Implements Scanner in terms of an InputStream.
     //
+    // The inner stream is read in large chunks, and frame markers are found
+    // with find_frame_marker(). Frame headers and envelopes are peeked at
+    // directly in the chunk buffer.
+    //
+    // reset() discards any buffered data, so call it after repositioning
+    // the inner stream.
+    //
+    // In a compact stream, registration frames are scanned like any other
+    // frame, but peek(source_timestamp, envelope) passes over them, once
+    // their channel ids are learned, and over frames whose channel id has
+    // not been registered yet.
+    //
     // Note that the underlying stream's position is unpredictable once
     // the wrapper is destroyed.
 
@@ -67,9 +95,11 @@ class ScannerWrapper : public Scanner {
     // implements Scanner
     void reset() override;
     bool next() override;
+    bool skip_frame() override;
 
     bool peek(uint64_t& source_timestamp) override;
     bool peek(uint64_t& source_timestamp, Envelope& envelope) override;
+    bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope) override;
 
     size_t copy_frame(kj::OutputStream& out) override;
 
@@ -78,22 +108,45 @@ class ScannerWrapper : public Scanner {
 
     void skip(size_t bytes) override;
 
+    // The number of bytes read from the inner stream beyond the start of
+    // the peeked frame, or beyond the current position if nothing has been
+    // peeked.
+    size_t lookahead() const;
+
    private:
-    PeekStream inner_;
+    static constexpr size_t chunk_size_ = 64 * 1024;
 
-    static constexpr uint32_t marker_checksum_ =
-        (frame_marker[2] << 16) | (frame_marker[1] << 8) | frame_marker[0];
-    uint32_t checksum_;
+    kj::InputStream& inner_;
 
-    int buffered_;
-    bool at_eof_;
-    bool seen_;
+    std::vector<uint8_t> buffer_;
+    size_t begin_;
+    size_t end_;
 
+    // After peek(), frame_ is the offset in buffer_ of the peeked frame
+    bool peeked_;
+    size_t frame_;
     uint64_t source_timestamp_;
     uint64_t envelope_length_;
+    uint64_t payload_length_;
+    uint8_t version_;
+    bool sync_;
 
-    uint8_t advance();
-    void soft_reset();
+    ChannelDictionary dictionary_;
+
+    size_t fill(size_t bytes);
+
+    // The length of the frame at the current position, or 0 if there is no
+    // valid frame there. On success the frame is peeked.
+    size_t frame_length();
+
+    // Whether a valid frame header starts at buffer_[offset]
+    bool valid_frame_at(size_t offset) const;
+
+    // skip_frame() for a frame that extends past the buffer, starting at
+    // `frame_start` in a seekable inner stream
+    bool skip_frame_seeking(SeekableStream& seekable, int64_t frame_start, size_t length);
+
+    size_t scan_frame(kj::OutputStream& out);
 };
 
 class PathScanner : public Scanner {
@@ -109,10 +162,12 @@ class PathScanner : public Scanner {
     // implements Scanner
     void reset() override;
     bool next() override;
+    bool skip_frame() override;
 
     bool peek(uint64_t& source_timestamp) override;
 
     bool peek(uint64_t& source_timestamp, Envelope& envelope) override;
+    bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope) override;
 
     size_t copy_frame(kj::OutputStream& out) override;
 
@@ -129,11 +184,8 @@ class PathScanner : public Scanner {
 template <typename T>
 class ScannerGroup : public Scanner {
    public:
-    ScannerGroup(std::vector<T>& scanners) : scanners_(scanners), sorted_(false)
+    ScannerGroup(std::vector<T>& scanners) : scanners_(scanners), merge_(scanners)
     {
-        for (size_t ix=0; ix < scanners.size(); ++ix) {
-            ixs_.push_back(ix);
-        }
     }
 
     KJ_DISALLOW_COPY(ScannerGroup);
@@ -144,77 +196,76 @@ class ScannerGroup : public Scanner {
         for (auto&& s : scanners_) {
             s.reset();
         }
+        merge_.rebuild();
     }
 
     bool next()
     {
-        return head(false).next();
+        T* h = merge_.advance();
+        return h != nullptr && h->next();
+    }
+
+    bool skip_frame() override
+    {
+        T* h = merge_.advance();
+        return h != nullptr && h->skip_frame();
     }
 
     bool peek(uint64_t& source_timestamp) override
     {
-        return head().peek(source_timestamp);
+        T* h = merge_.head();
+        return h != nullptr && h->peek(source_timestamp);
     }
 
     bool peek(uint64_t& source_timestamp, Envelope& envelope) override
     {
-        while (!head().peek(source_timestamp, envelope)) {
-            ixs_.erase(ixs_.begin());
-            if (ixs_.empty()) {
-                return false;
+        while (T* h = merge_.head()) {
+            if (h->peek(source_timestamp, envelope)) {
+                return true;
+            }
+            merge_.drop();
+        }
+
+        return false;
+    }
+
+    bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope) override
+    {
+        while (T* h = merge_.head()) {
+            if (h->peek(source_timestamp, envelope)) {
+                return true;
             }
+            merge_.drop();
         }
 
-        return true;
+        return false;
     }
 
     size_t copy_frame(kj::OutputStream& out) override
     {
-        return head(false).copy_frame(out);
+        T* h = merge_.advance();
+        return h != nullptr ? h->copy_frame(out) : 0;
     }
 
     // implements InputStream
     size_t tryRead(void* buffer, size_t minBytes, size_t maxBytes)
     {
-        return head(false).tryRead(buffer, minBytes, maxBytes);
+        T* h = merge_.advance();
+        return h != nullptr ? h->tryRead(buffer, minBytes, maxBytes) : 0;
     }
 
     void skip(size_t bytes)
     {
-        head(false).skip(bytes);
+        T* h = merge_.advance();
+        if (h == nullptr) {
+            throw std::runtime_error("skip past end of stream");
+        }
+        h->skip(bytes);
     }
 
    private:
     std::vector<T>& scanners_;
-    std::vector<int> ixs_;
-    bool sorted_;
-
-    void sort() {
-        if (sorted_ || ixs_.empty()) {
-            return;
-        }
-
-        std::sort(ixs_.begin(), ixs_.end(),
-            [&](int i1, int i2) {
-                uint64_t t1, t2;
-
-                if (!scanners_[i1].peek(t1)) {
-                    return false;
-                }
-                if (!scanners_[i2].peek(t2)) {
-                    return true;
-                }
-                return t1 < t2;
-            });
-
-        sorted_ = true;
-    }
-
-    T& head(bool stay_sorted=true) {
-        sort();
-        sorted_ = stay_sorted;
-        return scanners_[ixs_[0]];
-    }
+    FrameMerge<T> merge_;
 };
 
 class PathScannerGroup : public Scanner {
@@ -230,10 +281,12 @@ class PathScannerGroup : public Scanner {
     // implements Scanner
     void reset() override;
     bool next() override;
+    bool skip_frame() override;
 
     bool peek(uint64_t& source_timestamp) override;
 
     bool peek(uint64_t& source_timestamp, Envelope& envelope) override;
+    bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope) override;
 
     size_t copy_frame(kj::OutputStream& out) override;
 
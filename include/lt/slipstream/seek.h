@@ -1,5 +1,11 @@
 #pragma once
 
+#include <limits>
+#include <optional>
+
+#include "lt/slipstream/follow.h"
+#include "lt/slipstream/index.h"
+#include "lt/slipstream/mapped_output.h"
 #include "lt/slipstream/scanner.h"
 
 namespace lt::slipstream {
@@ -14,22 +20,56 @@ class SeekableStream {
 };
 
 class FdSeekableStream : public kj::FdInputStream, public SeekableStream {
+    // Given the path of the file, the file ends at its committed length
+    // while a MappedAppendStream writes it (see CommittedLength): reads stop
+    // there, and SEEK_END is relative to it. Without a sidecar, reads stop
+    // at the size of the file when the sidecar was last looked for. On
+    // reaching either, the sidecar is looked for again, as the writer may
+    // have finished, or another started.
+    //
+    // Once following a file (see follow()), a read at the end of the file
+    // waits for the file to grow instead of returning short, so a frame
+    // that is still being written at the end is read whole once it is
+    // complete.
+
    public:
-    FdSeekableStream(int fd);
+    FdSeekableStream(int fd, const std::string& path = "");
 
     virtual ~FdSeekableStream() noexcept(false);
 
+    // Wait on `watch` at the end of the file. A read returns short only if
+    // the watch times out. Pass nullptr to stop following.
+    void follow(std::unique_ptr<FileWatch> watch);
+
+    bool following() const { return watch_ != nullptr; }
+
     // implements SeekableStream
     int64_t seek(int64_t offset, int whence) override;
 
     int64_t tell() override;
 
     // implements InputStream
-    using kj::FdInputStream::tryRead;
-    using kj::FdInputStream::skip;
+    size_t tryRead(void* buffer, size_t minBytes, size_t maxBytes) override;
+
+    // Seeks forward rather than reading, where the descriptor allows it
+    void skip(size_t bytes) override;
 
    private:
     int fd_;
+    std::string path_;
+    std::shared_ptr<const CommittedLength> committed_;
+    int64_t size_;
+    std::unique_ptr<FileWatch> watch_;
+
+    // The end of the file, or -1 if it is not a regular file
+    int64_t end();
+
+    // Where reads of a file opened by path stop, looking for the sidecar
+    // again if `position` has reached it
+    int64_t limit(int64_t position);
+
+    // Read what is there, up to the committed length
+    size_t read_available(void* buffer, size_t minBytes, size_t maxBytes);
 };
 
 class Seeker : public Scanner {
@@ -41,9 +81,14 @@ class Seeker : public Scanner {
 
 class FdSeeker : public SeekableStream, public Seeker {
     // Implements Seeker in terms of FdSeekableStream
+    //
+    // Given a TimeIndex of the file, seek_time() starts from the nearest
+    // indexed frame rather than searching the file, and find_keyframe()
+    // from the nearest indexed keyframe, for as long as the index is fresh.
 
    public:
-    FdSeeker(int fd);
+    FdSeeker(int fd, std::optional<TimeIndex> index = std::nullopt,
+        const std::string& path = "");
 
     virtual ~FdSeeker() noexcept(false);
 
@@ -55,13 +100,29 @@ class FdSeeker : public SeekableStream, public Seeker {
     // implements Seeker
     bool seek_time(uint64_t timestamp) override;
 
+    // The offset of the last keyframe of `identifier` at or before the
+    // frame at `offset`. The search starts from the nearest keyframe in the
+    // index while it is fresh, and otherwise steps back from `offset` by a
+    // growing distance until a keyframe is found. Returns false if there is
+    // none. Leaves the stream at an unspecified frame.
+    bool find_keyframe(const Identifier& identifier, uint64_t offset,
+        uint64_t& keyframe_offset);
+
+    // Wait on `watch` at the end of the file; see FdSeekableStream. Call
+    // this once positioned, as seek_time() and find_keyframe() would wait
+    // at the end of the file too.
+    void follow(std::unique_ptr<FileWatch> watch);
+
     // implements Scanner
     void reset() override;
     bool next() override;
 
+    bool skip_frame() override;
+
     bool peek(uint64_t& source_timestamp) override;
 
     bool peek(uint64_t& source_timestamp, Envelope& envelope) override;
+    bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope) override;
 
     size_t copy_frame(kj::OutputStream& out) override;
 
@@ -74,11 +135,14 @@ class FdSeeker : public SeekableStream, public Seeker {
     int fd_;
     FdSeekableStream fdSeekableStream_;
     ScannerWrapper scanner_;
+    std::optional<TimeIndex> index_;
 };
 
 class PathSeeker : public Seeker {
    public:
 
+    // Uses the sidecar index of `path` if there is a fresh one, and its
+    // committed length if it is being written by a MappedAppendStream
     PathSeeker(const std::string& path);
 
     PathSeeker(PathSeeker&& ps);
@@ -93,9 +157,12 @@ class PathSeeker : public Seeker {
     void reset() override;
     bool next() override;
 
+    bool skip_frame() override;
+
     bool peek(uint64_t& source_timestamp) override;
 
     bool peek(uint64_t& source_timestamp, Envelope& envelope) override;
+    bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope) override;
 
     size_t copy_frame(kj::OutputStream& out) override;
 
@@ -111,11 +178,8 @@ class PathSeeker : public Seeker {
 template <typename T>
 class SeekerGroup : public Seeker {
    public:
-    SeekerGroup(std::vector<T>& seekers) : seekers_(seekers), sorted_(false)
+    SeekerGroup(std::vector<T>& seekers) : seekers_(seekers), merge_(seekers)
     {
-        for (size_t ix=0; ix < seekers.size(); ++ix) {
-            ixs_.push_back(ix);
-        }
     }
 
     KJ_DISALLOW_COPY(SeekerGroup);
@@ -127,6 +191,7 @@ class SeekerGroup : public Seeker {
         for (auto&& s : seekers_) {
             s.seek_time(timestamp);
         }
+        merge_.rebuild();
 
         return true;
     }
@@ -137,77 +202,76 @@ class SeekerGroup : public Seeker {
         for (auto&& s : seekers_) {
             s.reset();
         }
+        merge_.rebuild();
     }
 
     bool next()
     {
-        return head(false).next();
+        T* h = merge_.advance();
+        return h != nullptr && h->next();
+    }
+
+    bool skip_frame() override
+    {
+        T* h = merge_.advance();
+        return h != nullptr && h->skip_frame();
     }
 
     bool peek(uint64_t& source_timestamp) override
     {
-        return head().peek(source_timestamp);
+        T* h = merge_.head();
+        return h != nullptr && h->peek(source_timestamp);
     }
 
     bool peek(uint64_t& source_timestamp, Envelope& envelope) override
     {
-        while (!head().peek(source_timestamp, envelope)) {
-            ixs_.erase(ixs_.begin());
-            if (ixs_.empty()) {
-                return false;
+        while (T* h = merge_.head()) {
+            if (h->peek(source_timestamp, envelope)) {
+                return true;
             }
+            merge_.drop();
         }
 
-        return true;
+        return false;
+    }
+
+    bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope) override
+    {
+        while (T* h = merge_.head()) {
+            if (h->peek(source_timestamp, envelope)) {
+                return true;
+            }
+            merge_.drop();
+        }
+
+        return false;
     }
 
     size_t copy_frame(kj::OutputStream& out) override
     {
-        return head(false).copy_frame(out);
+        T* h = merge_.advance();
+        return h != nullptr ? h->copy_frame(out) : 0;
     }
 
     // implements InputStream
     size_t tryRead(void* buffer, size_t minBytes, size_t maxBytes)
     {
-        return head(false).tryRead(buffer, minBytes, maxBytes);
+        T* h = merge_.advance();
+        return h != nullptr ? h->tryRead(buffer, minBytes, maxBytes) : 0;
     }
 
     void skip(size_t bytes)
     {
-        head(false).skip(bytes);
+        T* h = merge_.advance();
+        if (h == nullptr) {
+            throw std::runtime_error("skip past end of stream");
+        }
+        h->skip(bytes);
     }
 
    private:
     std::vector<T>& seekers_;
-    std::vector<int> ixs_;
-    bool sorted_;
-
-    void sort() {
-        if (sorted_ || ixs_.empty()) {
-            return;
-        }
-
-        std::sort(ixs_.begin(), ixs_.end(),
-            [&](int i1, int i2) {
-                uint64_t t1, t2;
-
-                if (!seekers_[i1].peek(t1)) {
-                    return false;
-                }
-                if (!seekers_[i2].peek(t2)) {
-                    return true;
-                }
-                return t1 < t2;
-            });
-
-        sorted_ = true;
-    }
-
-    T& head(bool stay_sorted=true) {
-        sort();
-        sorted_ = stay_sorted;
-        return seekers_[ixs_[0]];
-    }
+    FrameMerge<T> merge_;
 };
 
 class PathSeekerGroup : public Seeker {
@@ -228,9 +292,12 @@ class PathSeekerGroup : public Seeker {
 
     bool next() override;
 
+    bool skip_frame() override;
+
     bool peek(uint64_t& source_timestamp) override;
 
     bool peek(uint64_t& source_timestamp, Envelope& envelope) override;
+    bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope) override;
 
     size_t copy_frame(kj::OutputStream& out) override;
 
@@ -249,14 +316,24 @@ class ChannelPathSeeker {
    public:
     using header_type = typename T::header_type;
     using data_type = typename T::data_type;
+    using delta_type = typename T::delta_type;
 
     ChannelPathSeeker(const std::string& path)
+        : path_(path)
     {
         int fd = ::open(path.c_str(), O_RDONLY);
         if (fd == -1) {
             throw std::system_error(errno, std::system_category());
         }
-        seeker_ = std::make_unique<FdSeeker>(fd);
+        seeker_ = std::make_unique<FdSeeker>(fd, TimeIndex::load(path), path);
+
+        // The channel is that of the first frame
+        uint64_t timestamp;
+        Envelope envelope;
+        if (seeker_->peek(timestamp, envelope)) {
+            identifier_ = envelope.identifier;
+        }
+
         channel_reader_ = std::make_unique<ChannelReader<T>>(seeker_.get());
     }
 
@@ -271,9 +348,29 @@ class ChannelPathSeeker {
         return seeker_->tell();
     }
 
+    // Move to the last frame no later than `timestamp`. A channel with
+    // deltas is first decoded forward from its last keyframe before that
+    // frame, so that the next frame read is correct whether it is a keyframe
+    // or a delta. Returns false if there is no such keyframe.
     bool seek_time(uint64_t timestamp)
     {
-        return seeker_->seek_time(timestamp);
+        if (!seeker_->seek_time(timestamp)) {
+            return false;
+        }
+
+        if constexpr (!std::is_same_v<delta_type, no_type>) {
+            return roll_from_keyframe();
+        }
+
+        return true;
+    }
+
+    // Follow the file as it is written: from here on, a read at the end of
+    // the file waits for the next frame, woken by inotify, rather than
+    // failing. Call this once positioned with seek() or seek_time().
+    void follow(const FollowPolicy& policy = {})
+    {
+        seeker_->follow(std::make_unique<FileWatch>(path_, policy));
     }
 
     bool read(data_type& data, uint64_t& source_timestamp,
@@ -282,11 +379,27 @@ class ChannelPathSeeker {
         return channel_reader_->read(data, source_timestamp, envelope);
     }
 
+    bool read(data_type& data)
+    {
+        return channel_reader_->read(data);
+    }
+
     const std::optional<std::string> read_json(uint64_t& source_timestamp)
     {
         return channel_reader_->read_json(source_timestamp);
     }
 
+    bool read_json(json::Writer& out, uint64_t& source_timestamp)
+    {
+        return channel_reader_->read_json(out, source_timestamp);
+    }
+
+    bool read_json(json::Writer& out, uint64_t& source_timestamp, Query& query,
+        uint64_t end = std::numeric_limits<uint64_t>::max())
+    {
+        return channel_reader_->read_json(out, source_timestamp, query, end);
+    }
+
     const header_type * header() {
         return channel_reader_->header();
     }
@@ -302,6 +415,11 @@ class ChannelPathSeeker {
         return seeker_->next();
     }
 
+    bool skip_frame()
+    {
+        return seeker_->skip_frame();
+    }
+
     bool peek(uint64_t& source_timestamp)
     {
         return seeker_->peek(source_timestamp);
@@ -312,14 +430,57 @@ class ChannelPathSeeker {
         return seeker_->peek(source_timestamp, envelope);
     }
 
+    bool peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope)
+    {
+        return seeker_->peek(source_timestamp, envelope);
+    }
+
     size_t copy_frame(kj::OutputStream& out)
     {
         return seeker_->copy_frame(out);
     }
 
    private:
+    std::string path_;
     std::unique_ptr<FdSeeker> seeker_;
     std::unique_ptr<ChannelReader<T>> channel_reader_;
+    Identifier identifier_;
+
+    // Decode the channel's frames from its last keyframe up to the current
+    // frame, passing over those of other channels
+    bool roll_from_keyframe()
+    {
+        int64_t target = seeker_->tell();
+        uint64_t keyframe;
+
+        if (target < 0 || !seeker_->find_keyframe(identifier_, target, keyframe)) {
+            return false;
+        }
+
+        seeker_->seek(keyframe, SEEK_SET);
+
+        data_type data;
+
+        while (seeker_->tell() < target) {
+            uint64_t timestamp;
+            const InternedEnvelope * envelope;
+
+            if (!seeker_->peek(timestamp, envelope)) {
+                return false;
+            }
+
+            if (envelope->envelope.identifier == identifier_ &&
+                    std::holds_alternative<PayloadData>(envelope->envelope.payload_kind)) {
+                if (!channel_reader_->read(data)) {
+                    return false;
+                }
+            } else if (!seeker_->skip_frame()) {
+                return false;
+            }
+        }
+
+        return true;
+    }
 };
 
 } // namespace lt::slipstream
@@ -1,11 +1,24 @@
 #pragma once
 
+#include <string_view>
+#include <type_traits>
+
 #include <kj/io.h>
 
+#include "lt/slipstream/json_writer.h"
 #include "lt/slipstream/types.h"
 
 namespace lt::slipstream {
 
+// Whether T can append the JSON of a payload as it reads it, with
+// read_json(in, out, length), rather than decoding it into a data_type first
+template <typename T, typename = void>
+struct reads_json : std::false_type {};
+
+template <typename T>
+struct reads_json<T, std::void_t<decltype(std::declval<T&>().read_json(std::declval<kj::InputStream&>(),
+    std::declval<json::Writer&>(), size_t()))>> : std::true_type {};
+
 template <typename T>
 class Serialize {
    public:
@@ -47,7 +60,7 @@ class Headerless {
         return false;
     }
 
-    static const std::string encoding(const data_type& value)
+    static std::string_view encoding(const data_type& value)
     {
         return T::encoding;
     }
@@ -77,6 +90,19 @@ class Headerless {
         return T::to_json(value);
     }
 
+    template <typename U = T, typename = std::enable_if_t<reads_json<U>::value>>
+    static bool read_json(kj::InputStream& in, json::Writer& out, size_t length)
+    {
+        return U::read_json(in, out, length);
+    }
+
+    template <typename F, typename U = T>
+    static auto read_dynamic(kj::InputStream& in, size_t length, F&& f)
+        -> decltype(U::read_dynamic(in, length, std::forward<F>(f)))
+    {
+        return U::read_dynamic(in, length, std::forward<F>(f));
+    }
+
    private:
     T thang_;
 };
@@ -107,12 +133,12 @@ class HeaderStream {
         return false;
     }
 
-    static const std::string header_encoding(const header_type& value)
+    static std::string_view header_encoding(const header_type& value)
     {
         return header_type::encoding;
     }
 
-    static const std::string encoding(const data_type& value)
+    static std::string_view encoding(const data_type& value)
     {
         return data_type::encoding;
     }
@@ -154,12 +180,28 @@ class HeaderStream {
         return false;
     }
 
+    // Call f(reader) with the next payload, decoded, as a
+    // DynamicStruct::Reader, eg. to evaluate a Query against it. The
+    // payload is decoded first, as the data on the wire is not what T
+    // gives, into a value kept between calls.
+    template <typename F, typename U = data_type>
+    auto read_dynamic(kj::InputStream& in, size_t length, F&& f)
+        -> decltype(U::with_dynamic(std::declval<const U&>(), std::forward<F>(f)))
+    {
+        if (!read(in, decoded_, length)) {
+            return false;
+        }
+
+        return U::with_dynamic(decoded_, std::forward<F>(f));
+    }
+
     const header_type& header() {
         return thang_.header();
     }
 
    private:
     T thang_;
+    data_type decoded_;
 };
 
 template <typename T>
@@ -188,17 +230,17 @@ class HeaderDeltaStream {
         return encoding == delta_type::encoding;
     }
 
-    static const std::string header_encoding(const header_type& value)
+    static std::string_view header_encoding(const header_type& value)
     {
         return header_type::encoding;
     }
 
-    static const std::string encoding(const data_type& value)
+    static std::string_view encoding(const data_type& value)
     {
         return data_type::encoding;
     }
 
-    static const std::string delta_encoding(const data_type& value)
+    static std::string_view delta_encoding(const data_type& value)
     {
         return delta_type::encoding;
     }
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/multichannel_writer.h"
+#include "lt/slipstream/ring.h"
+
+namespace lt::slipstream {
+
+struct SharedWriterStats {
+    uint64_t frames;          // frames accepted into the rings
+    uint64_t drops;           // frames dropped because a ring was full
+    uint64_t late;            // frames that arrived after the reorder window
+    uint64_t bytes;           // bytes written to the output stream
+    uint64_t write_errors;    // batches the output stream failed to write
+    uint64_t producers;       // threads that have written
+};
+
+class OrderedFrameSink {
+    // Collects complete frames from many threads and writes them to one
+    // output stream in nondecreasing source_timestamp order.
+    //
+    // Each writing thread stages its frames in its own SpscRing, registered
+    // on the thread's first push; after that, pushing takes no lock. A
+    // flusher thread merges the rings by the timestamp at the head of each,
+    // assuming that each thread's own frames are in time order.
+    //
+    // The flusher can only be sure of the order while every ring has a
+    // frame waiting. Otherwise it holds frames back for up to the reorder
+    // window: a frame is written once a frame at least `reorder_window`
+    // later has been seen, or once no new frame has arrived for that long.
+    // A frame that arrives later than that, earlier than one already
+    // written, is written with its timestamp raised to that of the last
+    // frame and counted as late, so that the output stays monotonic.
+
+   public:
+    static constexpr size_t default_ring_capacity = 4 << 20;
+    static constexpr std::chrono::nanoseconds default_reorder_window =
+        std::chrono::milliseconds(10);
+    static constexpr size_t default_max_producers = 64;
+
+    OrderedFrameSink(kj::OutputStream * out,
+        std::chrono::nanoseconds reorder_window = default_reorder_window,
+        size_t ring_capacity = default_ring_capacity,
+        size_t max_producers = default_max_producers);
+
+    KJ_DISALLOW_COPY(OrderedFrameSink);
+
+    // Writes out everything already pushed, then stops the flusher.
+    ~OrderedFrameSink() noexcept(false);
+
+    // The index of the calling thread's ring, from 0, registering it on
+    // first use. Throws if more than `max_producers` threads push.
+    size_t producer();
+
+    // Enqueue a frame from the calling thread without blocking. Returns
+    // false if the frame was dropped.
+    bool push(const FrameBuffer& frame);
+
+    // Enqueue a frame, waiting for space if necessary. Used for header
+    // frames, which must not be dropped.
+    void push_wait(const FrameBuffer& frame);
+
+    // Wait until every frame pushed so far has been written, without
+    // waiting for the reorder window.
+    void flush();
+
+    SharedWriterStats stats() const;
+
+   private:
+    static constexpr size_t max_batch_ = 64;
+    static constexpr std::chrono::microseconds idle_sleep_{50};
+
+    kj::OutputStream * out_;
+    std::chrono::nanoseconds reorder_window_;
+    size_t ring_capacity_;
+    const uint64_t id_;
+
+    struct Producer {
+        explicit Producer(size_t ring_capacity) : ring(ring_capacity), latest(0)
+        {
+        }
+
+        SpscRing ring;
+
+        // The latest timestamp pushed, which may be beyond what the flusher
+        // has peeked
+        std::atomic<uint64_t> latest;
+    };
+
+    // Slots are filled under mutex_ and published through nproducers_
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Producer>> producers_;
+    std::atomic<size_t> nproducers_;
+
+    std::atomic<bool> running_;
+    std::atomic<uint64_t> flush_requested_;
+    std::atomic<uint64_t> flushed_;
+
+    std::atomic<uint64_t> frames_;
+    std::atomic<uint64_t> drops_;
+    std::atomic<uint64_t> late_;
+    std::atomic<uint64_t> bytes_;
+    std::atomic<uint64_t> write_errors_;
+
+    std::thread thread_;
+
+    void run();
+};
+
+template <typename... Ts>
+class SharedMultiChannelWriter {
+    // A MultiChannelWriter that may be shared between threads, writing to
+    // one output stream through an OrderedFrameSink.
+    //
+    // Each thread encodes frames with its own MultiChannelWriter into its
+    // own ring, so write() takes no lock after a thread's first call. As
+    // delta frames are encoded relative to the thread's previous frame of
+    // the channel, a channel with deltas should only be written from one
+    // thread. Header frames are written once by each thread. A dropped
+    // frame forces the next frame of its channel from that thread to be a
+    // keyframe.
+
+   public:
+    using data_type = typename Variant<Ts...>::data_type;
+    using header_map = typename Variant<Ts...>::header_map;
+
+    SharedMultiChannelWriter(kj::OutputStream * out,
+        const std::string& application_name,
+        const header_map& channel_headers = {},
+        std::chrono::nanoseconds reorder_window = OrderedFrameSink::default_reorder_window,
+        size_t ring_capacity = OrderedFrameSink::default_ring_capacity,
+        size_t max_threads = OrderedFrameSink::default_max_producers)
+        : sink_(out, reorder_window, ring_capacity, max_threads),
+          application_name_(application_name),
+          channel_headers_(channel_headers),
+          states_(max_threads)
+    {
+    }
+
+    KJ_DISALLOW_COPY(SharedMultiChannelWriter);
+
+    bool write(const std::string& channel_name, const data_type& data,
+        uint64_t source_timestamp=0, bool force_keyframe=false)
+    {
+        auto& state = local();
+
+        state.frame.clear();
+
+        if (!state.pending_keyframes.empty()) {
+            auto it = state.pending_keyframes.find(channel_name);
+            if (it != state.pending_keyframes.end()) {
+                force_keyframe = true;
+                state.pending_keyframes.erase(it);
+            }
+        }
+
+        if (!state.writer.write(channel_name, data, source_timestamp, force_keyframe)) {
+            return false;
+        }
+
+        bool result = sink_.push(state.frame);
+        if (!result) {
+            state.pending_keyframes.insert(channel_name);
+        }
+
+        return result;
+    }
+
+    void flush()
+    {
+        sink_.flush();
+    }
+
+    SharedWriterStats stats() const
+    {
+        return sink_.stats();
+    }
+
+   private:
+    struct ThreadState {
+        ThreadState(const std::string& application_name, const header_map& channel_headers)
+            : writer(&frame, application_name, channel_headers)
+        {
+        }
+
+        FrameBuffer frame;
+        MultiChannelWriter<Ts...> writer;
+        std::unordered_set<std::string> pending_keyframes;
+    };
+
+    OrderedFrameSink sink_;
+    const std::string application_name_;
+    const header_map channel_headers_;
+
+    // By producer index; each slot is only touched by its own thread
+    std::vector<std::unique_ptr<ThreadState>> states_;
+
+    ThreadState& local()
+    {
+        auto& state = states_[sink_.producer()];
+
+        if (!state) {
+            state = std::make_unique<ThreadState>(application_name_, channel_headers_);
+            if (!state->frame.empty()) {
+                sink_.push_wait(state->frame);
+            }
+        }
+
+        return *state;
+    }
+};
+
+template <typename... Ts>
+class SharedMultiChannelPathWriter {
+    // A SharedMultiChannelWriter to a file
+
+   public:
+    using data_type = typename Variant<Ts...>::data_type;
+    using header_map = typename Variant<Ts...>::header_map;
+
+    SharedMultiChannelPathWriter(const std::string& path,
+        const std::string& application_name,
+        const header_map& channel_headers = {},
+        std::chrono::nanoseconds reorder_window = OrderedFrameSink::default_reorder_window)
+    {
+        int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP);
+        if (fd == -1) {
+            throw std::system_error(errno, std::system_category());
+        }
+        out_ = std::make_unique<kj::FdOutputStream>(kj::AutoCloseFd(fd));
+        channel_writer_ = std::make_unique<SharedMultiChannelWriter<Ts...>>(
+            out_.get(), application_name, channel_headers, reorder_window);
+    }
+
+    bool write(const std::string& channel_name, const data_type& data,
+        uint64_t source_timestamp=0, bool force_keyframe=false)
+    {
+        return channel_writer_->write(channel_name, data, source_timestamp, force_keyframe);
+    }
+
+    void flush()
+    {
+        channel_writer_->flush();
+    }
+
+    SharedWriterStats stats() const
+    {
+        return channel_writer_->stats();
+    }
+
+   private:
+    std::unique_ptr<kj::FdOutputStream> out_;
+    std::unique_ptr<SharedMultiChannelWriter<Ts...>> channel_writer_;
+};
+
+} // namespace lt::slipstream
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+
+#include <kj/io.h>
+
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/multichannel_writer.h"
+
+namespace lt::slipstream {
+
+// Ring files are named <name>.<pid>.<n>.ssring, where n numbers the rings
+// of a process, by default in /dev/shm
+static constexpr const char * shm_ring_directory = "/dev/shm";
+static constexpr const char * shm_ring_suffix = ".ssring";
+
+struct ShmRingHeader {
+    // The first page of a ring file, shared between the producer process
+    // and the collector.
+    //
+    // The ring buffer follows at ring_offset. Its records are laid out as in
+    // SpscRing: a 4 byte length (or wrap marker) padded to 8 bytes, then the
+    // record, padded to 8 bytes.
+
+    static constexpr uint64_t magic_value = 0x676e697273737373; // "ssssring"
+    static constexpr uint32_t current_version = 1;
+    static constexpr size_t ring_offset = 4096;
+    static constexpr size_t name_length = 64;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t pid;
+    uint64_t capacity;
+    char name[name_length];
+
+    // Written by the producer. frames and drops have a single writer, so
+    // they are stored rather than incremented atomically.
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> drops;
+    std::atomic<uint32_t> closed;
+
+    // Written by the collector
+    alignas(64) std::atomic<uint64_t> tail;
+};
+
+static_assert(sizeof(ShmRingHeader) <= ShmRingHeader::ring_offset);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+class ShmRingWriter {
+    // The producer side of a ring file: a single-producer/single-consumer
+    // ring of frames in shared memory, drained by a RingCollector in another
+    // process.
+    //
+    // push() costs a copy into the mapping and a release store of the head;
+    // it never blocks or makes a system call. The file is created under a
+    // temporary name and renamed into place once its header is written, so
+    // a collector never sees a partial ring. The destructor marks the ring
+    // closed, leaving the collector to drain and remove it.
+
+   public:
+    static constexpr size_t default_capacity = 4 << 20;
+
+    explicit ShmRingWriter(const std::string& name,
+        size_t capacity = default_capacity,
+        const std::string& directory = shm_ring_directory);
+
+    KJ_DISALLOW_COPY(ShmRingWriter);
+    ~ShmRingWriter();
+
+    // Copy a record, eg. a frame, into the ring. Returns false, and counts a
+    // drop, if there is not enough free space.
+    bool push(const void * data, size_t length);
+
+    const std::string& path() const { return path_; }
+
+    size_t capacity() const { return capacity_; }
+
+    // The largest record that can ever be pushed.
+    size_t max_record() const { return capacity_ / 2 - record_header_; }
+
+    uint64_t frames() const { return frames_; }
+
+    uint64_t drops() const { return drops_; }
+
+   private:
+    static constexpr size_t record_header_ = sizeof(uint64_t);
+    static constexpr uint32_t wrap_marker_ = 0xffffffff;
+
+    std::string path_;
+    size_t capacity_;
+    size_t mask_;
+    size_t mapped_size_;
+    ShmRingHeader * header_;
+    uint8_t * buffer_;
+
+    uint64_t cached_tail_;
+    uint64_t frames_;
+    uint64_t drops_;
+};
+
+class ShmRingReader {
+    // The collector side of a ring file. peek() and pop() may only be called
+    // from one thread.
+    //
+    // The head, tail and record lengths are in memory that any process of
+    // the ring's group can write, so they are checked before a record is
+    // handed out. A ring found inconsistent is marked bad, and yields no more
+    // records.
+
+   public:
+    // Map an existing ring file. Throws if it is not a ring.
+    explicit ShmRingReader(const std::string& path);
+
+    KJ_DISALLOW_COPY(ShmRingReader);
+    ~ShmRingReader();
+
+    // Fill records with up to max of the oldest records, without releasing
+    // them. Returns the number of records found.
+    size_t peek(kj::ArrayPtr<const kj::byte> * records, size_t max);
+
+    // Release the n oldest records.
+    void pop(size_t n);
+
+    bool empty() const;
+
+    // Bytes waiting in the ring, including record overhead
+    size_t used() const;
+
+    // The producer has closed the ring, or its process has gone
+    bool abandoned() const;
+
+    // The ring has been found corrupt
+    bool bad() const { return bad_; }
+
+    const std::string& path() const { return path_; }
+
+    const std::string& name() const { return name_; }
+
+    uint32_t pid() const { return header_->pid; }
+
+    uint64_t frames() const { return header_->frames.load(std::memory_order_relaxed); }
+
+    uint64_t drops() const { return header_->drops.load(std::memory_order_relaxed); }
+
+   private:
+    static constexpr size_t record_header_ = sizeof(uint64_t);
+    static constexpr uint32_t wrap_marker_ = 0xffffffff;
+
+    std::string path_;
+    std::string name_;
+    size_t capacity_;
+    size_t mask_;
+    size_t mapped_size_;
+    ShmRingHeader * header_;
+    const uint8_t * buffer_;
+    bool bad_;
+
+    // Find the record at tail, and advance tail past it. Returns false, and
+    // marks the ring bad, if it does not lie between tail and head.
+    bool next_record(uint64_t& tail, uint64_t head, kj::ArrayPtr<const kj::byte>& record);
+};
+
+template <typename... Ts>
+class ShmMultiChannelWriter {
+    // A MultiChannelWriter whose frames go to a ring file, to be written out
+    // by a collector process (see slipstream-collector).
+    //
+    // Frames are encoded into a reusable buffer on the calling thread and
+    // pushed into the ring, so write() makes no system calls. Header frames
+    // are pushed by the constructor. A dropped frame forces the next frame
+    // of its channel to be a keyframe. Frames must be in the envelope
+    // format, as the collector merges many producers into one stream.
+
+   public:
+    using data_type = typename Variant<Ts...>::data_type;
+    using header_map = typename Variant<Ts...>::header_map;
+
+    ShmMultiChannelWriter(const std::string& application_name,
+        const header_map& channel_headers = {},
+        size_t ring_capacity = ShmRingWriter::default_capacity,
+        const std::string& directory = shm_ring_directory)
+        : ring_(application_name, ring_capacity, directory),
+          channel_writer_(&frame_, application_name, channel_headers)
+    {
+        // The ring is empty, so the headers only fail to fit if it is too
+        // small to be useful
+        if (!frame_.empty() && !ring_.push(frame_.data(), frame_.size())) {
+            throw std::runtime_error("ShmMultiChannelWriter: headers larger than ring");
+        }
+    }
+
+    KJ_DISALLOW_COPY(ShmMultiChannelWriter);
+
+    bool write(const std::string& channel_name, const data_type& data,
+        uint64_t source_timestamp=0, bool force_keyframe=false)
+    {
+        frame_.clear();
+
+        if (!pending_keyframes_.empty()) {
+            auto it = pending_keyframes_.find(channel_name);
+            if (it != pending_keyframes_.end()) {
+                force_keyframe = true;
+                pending_keyframes_.erase(it);
+            }
+        }
+
+        if (!channel_writer_.write(channel_name, data, source_timestamp,
+                force_keyframe)) {
+            return false;
+        }
+
+        bool result = ring_.push(frame_.data(), frame_.size());
+        if (!result) {
+            pending_keyframes_.insert(channel_name);
+        }
+
+        return result;
+    }
+
+    const ShmRingWriter& ring() const { return ring_; }
+
+   private:
+    ShmRingWriter ring_;
+    FrameBuffer frame_;
+    MultiChannelWriter<Ts...> channel_writer_;
+    std::unordered_set<std::string> pending_keyframes_;
+};
+
+} // namespace lt::slipstream
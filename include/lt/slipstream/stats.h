@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lt::slipstream {
+
+class LatencyHistogram {
+    // A fixed-size histogram of durations in nanoseconds.
+    //
+    // Buckets are log-linear: each power of two is split into 16 equal
+    // sub-buckets, so percentiles are accurate to within about 6% over the
+    // whole range from nanoseconds to hours.
+    //
+    // Recording never allocates, and the histogram may be read from another
+    // thread while it is being recorded into.
+
+   public:
+    LatencyHistogram();
+
+    void record(uint64_t ns);
+
+    void reset();
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    // The upper bound of the bucket containing the p'th percentile, for p
+    // in [0, 100]. Returns 0 if nothing has been recorded.
+    uint64_t percentile(double p) const;
+
+   private:
+    static constexpr int sub_bits_ = 4;
+    static constexpr size_t sub_buckets_ = 1 << sub_bits_;
+    static constexpr size_t buckets_ = (64 - sub_bits_ + 1) * sub_buckets_;
+
+    std::array<std::atomic<uint64_t>, buckets_> counts_;
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> max_;
+
+    static size_t bucket(uint64_t ns);
+    static uint64_t bucket_upper(size_t bucket);
+};
+
+} // namespace lt::slipstream
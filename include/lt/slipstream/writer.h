@@ -10,8 +10,14 @@
 
 #include "lt/core/stamp.h"
 
+#include "lt/slipstream/buffered_output.h"
+#include "lt/slipstream/channel_dictionary.h"
 #include "lt/slipstream/envelope.h"
+#include "lt/slipstream/frame_buffer.h"
 #include "lt/slipstream/framing.h"
+#include "lt/slipstream/keyframe_policy.h"
+#include "lt/slipstream/mapped_output.h"
+#include "lt/slipstream/rotating_output.h"
 
 using namespace lt::core;
 
@@ -19,6 +25,15 @@ namespace lt::slipstream {
 
 template <typename T>
 class ChannelWriter {
+    // Each frame (framing, envelope and payload) is assembled in a reusable
+    // buffer and handed to the output stream in a single write, so that an
+    // unbuffered stream such as kj::FdOutputStream issues one write(2) per
+    // frame.
+    //
+    // Given a ChannelRegistry, shared by every writer of the stream, frames
+    // are written in the compact format, carrying a channel id in place of
+    // the envelope.
+
    public:
     using header_type = typename T::header_type;
     using data_type = typename T::data_type;
@@ -28,13 +43,13 @@ class ChannelWriter {
     ChannelWriter(kj::OutputStream * out,
         const std::string& application_name,
         const std::string& channel_name,
+        ChannelRegistry * registry = nullptr,
         std::enable_if<std::is_same_v<header_type, no_type>, T>* = 0)
         : out_(out),
-          envelope_(Envelope{Identifier{"", application_name, channel_name},
-                    "", PayloadKeyframe{} }),
+          registry_(registry),
+          envelopes_(Identifier{hostname(), application_name, channel_name}, registry),
           thang_()
     {
-        set_hostname();
     }
 
     /* Mandatory header */
@@ -42,38 +57,38 @@ class ChannelWriter {
         const std::string& application_name,
         const std::string& channel_name,
         const header_type& header,
+        ChannelRegistry * registry = nullptr,
         std::enable_if<!std::is_same_v<header_type, no_type>, T>* = 0)
         : out_(out),
-          envelope_(Envelope{
-            Identifier{"", application_name, channel_name},
-            "", PayloadKeyframe{} }),
+          registry_(registry),
+          envelopes_(Identifier{hostname(), application_name, channel_name}, registry),
           thang_(header)
     {
-        set_hostname();
-
         // Write header
-        uint32_t envelope_size = envelope_.size();
-        uint32_t header_size = thang_.size_header();
+        uint16_t channel_id;
+        auto envelope = envelopes_.get(PayloadHeader{}, T::header_encoding(header), channel_id);
 
-        auto framing = Framing {envelope_size, header_size, 0, 0, false};
-        framing.write(*out_);
+        begin_frame(envelope);
 
-        envelope_.encoding = T::header_encoding(header);
-        envelope_.payload_kind = PayloadHeader{};
-        envelope_.write(*out_);
-
-        if (!thang_.write_header(*out_)) {
+        if (!thang_.write_header(frame_)) {
             throw std::system_error(errno, std::system_category());
         }
 
-        envelope_.encoding = T::data_type::encoding;
+        end_frame(envelope, 0);
+
+        if (!emit(channel_id, 0)) {
+            throw std::system_error(errno, std::system_category());
+        }
     }
 
     ChannelWriter& operator=(ChannelWriter&& other)
     {
         out_ = std::move(other.out_);
-        envelope_ = std::move(other.envelope_);
+        registry_ = other.registry_;
+        envelopes_ = std::move(other.envelopes_);
         thang_ = std::move(other.thang_);
+        frame_ = std::move(other.frame_);
+        keyframes_ = other.keyframes_;
 
         return *this;
     }
@@ -91,60 +106,121 @@ class ChannelWriter {
             source_timestamp = Stamp::stamp_clock_rt();
         }
 
-        uint32_t payload_size = 0;
+        kj::ArrayPtr<const kj::byte> envelope;
+        uint16_t channel_id;
+        bool keyframe = true;
+        bool result = false;
 
-        if constexpr (std::is_same_v<delta_type, no_type>) {
-            payload_size = thang_.size(data);
-            envelope_.payload_kind = PayloadKeyframe{};
-            envelope_.encoding = T::encoding(data);
-            do_keyframe_ = true;
-        } else {
-            do_keyframe_ = !do_keyframe_; // Alternate since previous frame
-            if (force_keyframe) {
-                do_keyframe_ = true;
-            }
-            if (do_keyframe_) {
-                payload_size = thang_.size(data);
-                envelope_.payload_kind = PayloadKeyframe{};
-                envelope_.encoding = T::encoding(data);
-            } else {
-                //throw std::runtime_error("Writing delta!");
-                payload_size = thang_.size_delta(data);
-                envelope_.payload_kind = PayloadDelta{};
-                envelope_.encoding = T::delta_encoding(data);
+        if constexpr (!std::is_same_v<delta_type, no_type>) {
+            keyframe = force_keyframe || keyframes_.due(source_timestamp);
+
+            if (!keyframe) {
+                envelope = envelopes_.get(PayloadDelta{}, T::delta_encoding(data), channel_id);
+                begin_frame(envelope);
+                result = thang_.write_delta(frame_, data);
+
+                // A delta that has grown too large is encoded again as a
+                // keyframe
+                if (result && keyframes_.oversized(payload_size(envelope))) {
+                    keyframe = true;
+                }
             }
         }
 
-        uint32_t envelope_size = envelope_.size();
-        auto framing = Framing {envelope_size, payload_size, source_timestamp, 0, false};
-        framing.write(*out_);
+        if (keyframe) {
+            envelope = envelopes_.get(PayloadKeyframe{}, T::encoding(data), channel_id);
+            begin_frame(envelope);
+            result = thang_.write(frame_, data);
+        }
 
-        envelope_.write(*out_);
+        if (!result) {
+            return false;
+        }
 
-        if (do_keyframe_) {
-            return thang_.write(*out_, data);
-        } else if constexpr (!std::is_same_v<delta_type, no_type>) {
-            return thang_.write_delta(*out_, data);
+        if (keyframe) {
+            keyframes_.keyframe(source_timestamp, payload_size(envelope));
         } else {
-            return false;
+            keyframes_.delta();
         }
+
+        end_frame(envelope, source_timestamp);
+
+        return emit(channel_id, source_timestamp);
     }
 
     const Identifier identifier(const std::string& channel_name) const {
-        return envelope_.identifier;
+        return envelopes_.identifier();
     }
 
+    // How often a channel with deltas writes keyframes
+    void set_keyframe_policy(const KeyframePolicy& policy)
+    {
+        keyframes_.set_policy(policy);
+    }
+
+    const KeyframePolicy& keyframe_policy() const { return keyframes_.policy(); }
+
    private:
     kj::OutputStream * out_;
-    Envelope envelope_;
+    ChannelRegistry * registry_;
+    EnvelopeCache envelopes_;
     T thang_;
-    bool do_keyframe_;
+    FrameBuffer frame_;
+    KeyframeSchedule keyframes_;
+
+    // The payload is encoded straight into frame_ after the envelope, and
+    // the framing header, which records its length, is filled in afterwards.
+    // Each payload is therefore encoded exactly once.
+    void begin_frame(kj::ArrayPtr<const kj::byte> envelope)
+    {
+        static constexpr uint8_t placeholder[frame_header_length] = {};
+
+        frame_.clear();
+        frame_.write(placeholder, frame_header_length);
+        frame_.write(envelope.begin(), envelope.size());
+    }
 
-    void set_hostname()
+    void end_frame(kj::ArrayPtr<const kj::byte> envelope, uint64_t source_timestamp)
+    {
+        uint32_t envelope_size = envelope.size();
+        uint32_t payload_length = payload_size(envelope);
+
+        auto framing = Framing {envelope_size, payload_length, source_timestamp, 0, false,
+            registry_ != nullptr ? compact_frame_version : frame_version};
+        framing.encode(frame_.data());
+    }
+
+    size_t payload_size(kj::ArrayPtr<const kj::byte> envelope) const
+    {
+        return frame_.size() - frame_header_length - envelope.size();
+    }
+
+    // In a compact stream, the channel's registration frame goes first when
+    // it is due.
+    bool emit(uint16_t channel_id, uint64_t source_timestamp)
+    {
+        try {
+            if (registry_ != nullptr) {
+                registry_->register_if_due(*out_, channel_id, source_timestamp);
+            }
+
+            out_->write(frame_.data(), frame_.size());
+        } catch (const std::exception&) {
+            return false;
+        }
+
+        if (registry_ != nullptr) {
+            registry_->written(frame_.size());
+        }
+
+        return true;
+    }
+
+    static std::string hostname()
     {
         static char buf[HOST_NAME_MAX];
         gethostname(buf, HOST_NAME_MAX);
-        envelope_.identifier.host_name = std::string(buf);
+        return std::string(buf);
     }
 };
 
@@ -157,28 +233,38 @@ class ChannelPathWriter {
     ChannelPathWriter(const std::string& path,
         const std::string& application_name,
         const std::string& channel_name,
+        const FlushPolicy& policy = {},
+        FrameFormat format = FrameFormat::envelope,
         std::enable_if<std::is_same_v<header_type, no_type>, T>* = 0)
     {
         int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_NONBLOCK, S_IRUSR|S_IWUSR|S_IRGRP);
         if (fd == -1) {
             throw std::system_error(errno, std::system_category());
         }
-        out_ = std::make_unique<kj::FdOutputStream>(kj::AutoCloseFd(fd));
-        channel_writer_ = std::make_unique<ChannelWriter<T>>(out_.get(), application_name, channel_name);
+        out_ = std::make_unique<BufferedFdOutputStream>(kj::AutoCloseFd(fd), policy);
+        if (format == FrameFormat::compact) {
+            registry_ = std::make_unique<ChannelRegistry>();
+        }
+        channel_writer_ = std::make_unique<ChannelWriter<T>>(out_.get(), application_name, channel_name, registry_.get());
     }
 
     ChannelPathWriter(const std::string& path,
         const std::string& application_name,
         const std::string& channel_name,
         const header_type& header,
+        const FlushPolicy& policy = {},
+        FrameFormat format = FrameFormat::envelope,
         std::enable_if<!std::is_same_v<header_type, no_type>, T>* = 0)
     {
         int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_NONBLOCK, S_IRUSR|S_IWUSR|S_IRGRP);
         if (fd == -1) {
             throw std::system_error(errno, std::system_category());
         }
-        out_ = std::make_unique<kj::FdOutputStream>(kj::AutoCloseFd(fd));
-        channel_writer_ = std::make_unique<ChannelWriter<T>>(out_.get(), application_name, channel_name, header);
+        out_ = std::make_unique<BufferedFdOutputStream>(kj::AutoCloseFd(fd), policy);
+        if (format == FrameFormat::compact) {
+            registry_ = std::make_unique<ChannelRegistry>();
+        }
+        channel_writer_ = std::make_unique<ChannelWriter<T>>(out_.get(), application_name, channel_name, header, registry_.get());
     }
 
     bool write(const data_type& data, uint64_t source_timestamp=0, bool force_keyframe=false)
@@ -186,9 +272,146 @@ class ChannelPathWriter {
         return channel_writer_->write(data, source_timestamp, force_keyframe);
     }
 
+    void set_keyframe_policy(const KeyframePolicy& policy)
+    {
+        channel_writer_->set_keyframe_policy(policy);
+    }
+
+    void flush()
+    {
+        out_->flush();
+    }
+
+    FlushStats stats() const
+    {
+        return out_->stats();
+    }
+
+   private:
+    std::unique_ptr<BufferedFdOutputStream> out_;
+    std::unique_ptr<ChannelRegistry> registry_;
+    std::unique_ptr<ChannelWriter<T>> channel_writer_;
+};
+
+template <typename T>
+class ChannelMappedWriter {
+    // A ChannelPathWriter that appends through a MappedAppendStream, so that
+    // each frame survives the process crashing once write() has returned.
+    // An existing file is appended to.
+
+   public:
+    using header_type = typename T::header_type;
+    using data_type = typename T::data_type;
+
+    ChannelMappedWriter(const std::string& path,
+        const std::string& application_name,
+        const std::string& channel_name,
+        FrameFormat format = FrameFormat::envelope,
+        std::enable_if<std::is_same_v<header_type, no_type>, T>* = 0)
+        : out_(std::make_unique<MappedAppendStream>(path))
+    {
+        if (format == FrameFormat::compact) {
+            registry_ = std::make_unique<ChannelRegistry>();
+        }
+        channel_writer_ = std::make_unique<ChannelWriter<T>>(out_.get(), application_name, channel_name, registry_.get());
+    }
+
+    ChannelMappedWriter(const std::string& path,
+        const std::string& application_name,
+        const std::string& channel_name,
+        const header_type& header,
+        FrameFormat format = FrameFormat::envelope,
+        std::enable_if<!std::is_same_v<header_type, no_type>, T>* = 0)
+        : out_(std::make_unique<MappedAppendStream>(path))
+    {
+        if (format == FrameFormat::compact) {
+            registry_ = std::make_unique<ChannelRegistry>();
+        }
+        channel_writer_ = std::make_unique<ChannelWriter<T>>(out_.get(), application_name, channel_name, header, registry_.get());
+    }
+
+    bool write(const data_type& data, uint64_t source_timestamp=0, bool force_keyframe=false)
+    {
+        return channel_writer_->write(data, source_timestamp, force_keyframe);
+    }
+
+    // Write everything so far to disk
+    void sync()
+    {
+        out_->sync();
+    }
+
+   private:
+    std::unique_ptr<MappedAppendStream> out_;
+    std::unique_ptr<ChannelRegistry> registry_;
+    std::unique_ptr<ChannelWriter<T>> channel_writer_;
+};
+
+template <typename T>
+class ChannelRotatingWriter {
+    // A ChannelPathWriter to a series of files, <path>.000000,
+    // <path>.000001, ..., rolling over by size or time according to a
+    // RotationPolicy. Each file starts with the channel's header, and its
+    // first frame is a keyframe, so that it can be read on its own.
+
+   public:
+    using header_type = typename T::header_type;
+    using data_type = typename T::data_type;
+
+    ChannelRotatingWriter(const std::string& path,
+        const std::string& application_name,
+        const std::string& channel_name,
+        const RotationPolicy& policy,
+        std::enable_if<std::is_same_v<header_type, no_type>, T>* = 0)
+        : out_(std::make_unique<RotatingOutputStream>(path, policy)),
+          channel_writer_(std::make_unique<ChannelWriter<T>>(out_.get(), application_name, channel_name)),
+          force_keyframe_(false)
+    {
+    }
+
+    ChannelRotatingWriter(const std::string& path,
+        const std::string& application_name,
+        const std::string& channel_name,
+        const header_type& header,
+        const RotationPolicy& policy,
+        std::enable_if<!std::is_same_v<header_type, no_type>, T>* = 0)
+        : out_(std::make_unique<RotatingOutputStream>(path, policy)),
+          channel_writer_(std::make_unique<ChannelWriter<T>>(out_.get(), application_name, channel_name, header)),
+          force_keyframe_(false)
+    {
+    }
+
+    bool write(const data_type& data, uint64_t source_timestamp=0, bool force_keyframe=false)
+    {
+        if (source_timestamp == 0) {
+            source_timestamp = Stamp::stamp_clock_rt();
+        }
+
+        if (out_->roll(source_timestamp)) {
+            force_keyframe_ = true;
+        }
+
+        if (!channel_writer_->write(data, source_timestamp, force_keyframe || force_keyframe_)) {
+            return false;
+        }
+
+        force_keyframe_ = false;
+        return true;
+    }
+
+    // Move on to the next file now
+    void rotate()
+    {
+        out_->rotate();
+        force_keyframe_ = true;
+    }
+
+    const std::string& current_path() const { return out_->current_path(); }
+
    private:
-    std::unique_ptr<kj::FdOutputStream> out_;
+    std::unique_ptr<RotatingOutputStream> out_;
     std::unique_ptr<ChannelWriter<T>> channel_writer_;
+    bool force_keyframe_;
 };
 
 } // namespace lt::slipstream
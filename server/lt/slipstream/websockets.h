@@ -4,6 +4,8 @@
 #include "seasocks/WebSocket.h"
 #include "seasocks/util/Json.h"
 
+#include <mutex>
+#include <optional>
 #include <set>
 #include <thread>
 
@@ -92,27 +94,43 @@ class PathServer {
             server.serve(http_static_path_.c_str(), http_port_);
         });
 
+        // Frames are read as they are written, waiting on inotify at the
+        // end of the file. The server thread sends the latest frame; those
+        // read while a send is still pending are dropped.
+        channel_reader_.follow();
+
+        std::mutex latest_mutex;
+        std::optional<std::string> latest;
         uint64_t source_timestamp;
-        static constexpr int fps = 30; // frames per second
-        static constexpr int frame_delay_ms = 1000 / fps;
 
         while(true) {
-            server.execute([&]{
-                std::optional<std::string> o[2];
-                int i=0;
-
-                while (o[i] = channel_reader_.read_json(source_timestamp)) {
-                    i = 1-i;
-                }
-
-                i = 1-i;
-
-                if (o[i]) {
-                    handler->send(*o[i]);
-                }
-            });
-
-            std::this_thread::sleep_for(std::chrono::milliseconds(frame_delay_ms));
+            auto o = channel_reader_.read_json(source_timestamp);
+            if (!o) {
+                // Step over a frame that could not be read
+                channel_reader_.next();
+                continue;
+            }
+
+            bool pending;
+            {
+                std::lock_guard<std::mutex> lock(latest_mutex);
+                pending = latest.has_value();
+                latest = *o;
+            }
+
+            if (!pending) {
+                server.execute([&]{
+                    std::optional<std::string> s;
+                    {
+                        std::lock_guard<std::mutex> lock(latest_mutex);
+                        s.swap(latest);
+                    }
+
+                    if (s) {
+                        handler->send(*s);
+                    }
+                });
+            }
         };
     }
 
@@ -0,0 +1,97 @@
+#include "lt/slipstream/async_writer.h"
+
+namespace lt::slipstream {
+
+AsyncFrameSink::AsyncFrameSink(kj::OutputStream * out, size_t ring_capacity)
+    : out_(out), ring_(ring_capacity),
+      running_(true), frames_(0), drops_(0), bytes_(0), write_errors_(0)
+{
+    thread_ = std::thread([this] { run(); });
+}
+
+AsyncFrameSink::~AsyncFrameSink() noexcept(false)
+{
+    running_.store(false, std::memory_order_release);
+    thread_.join();
+}
+
+bool AsyncFrameSink::push(const FrameBuffer& frame)
+{
+    if (!ring_.push(frame.data(), frame.size())) {
+        drops_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    frames_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void AsyncFrameSink::push_wait(const FrameBuffer& frame)
+{
+    if (frame.size() > ring_.max_record()) {
+        throw std::runtime_error("AsyncFrameSink: frame larger than ring");
+    }
+
+    while (!ring_.push(frame.data(), frame.size())) {
+        std::this_thread::sleep_for(idle_sleep_);
+    }
+
+    frames_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AsyncFrameSink::flush()
+{
+    while (!ring_.empty()) {
+        std::this_thread::sleep_for(idle_sleep_);
+    }
+}
+
+AsyncWriterStats AsyncFrameSink::stats() const
+{
+    return AsyncWriterStats {
+        frames_.load(std::memory_order_relaxed),
+        drops_.load(std::memory_order_relaxed),
+        bytes_.load(std::memory_order_relaxed),
+        write_errors_.load(std::memory_order_relaxed),
+        enqueue_.percentile(50),
+        enqueue_.percentile(99),
+        enqueue_.max()
+    };
+}
+
+void AsyncFrameSink::run()
+{
+    kj::ArrayPtr<const kj::byte> records[max_batch_];
+
+    while (true) {
+        // Check for shutdown before looking for work, so that frames pushed
+        // just before the destructor ran are still written.
+        bool running = running_.load(std::memory_order_acquire);
+
+        size_t n = ring_.peek(records, max_batch_);
+
+        if (n == 0) {
+            if (!running) {
+                break;
+            }
+            std::this_thread::sleep_for(idle_sleep_);
+            continue;
+        }
+
+        size_t total = 0;
+        for (size_t i = 0; i < n; ++i) {
+            total += records[i].size();
+        }
+
+        try {
+            out_->write(kj::arrayPtr(records, n));
+            bytes_.fetch_add(total, std::memory_order_relaxed);
+        } catch (const std::exception&) {
+            write_errors_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        ring_.pop(n);
+    }
+}
+
+} // namespace lt::slipstream
@@ -0,0 +1,234 @@
+#include "lt/slipstream/buffered_output.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <system_error>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace lt::slipstream {
+
+static uint64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+BufferedFdOutputStream::BufferedFdOutputStream(kj::AutoCloseFd fd,
+    const FlushPolicy& policy)
+    : fd_(std::move(fd)), policy_(policy),
+      buffer_(policy.max_bytes), buffered_(0), oldest_ns_(0),
+      last_sync_ns_(monotonic_ns()),
+      flushes_(0), bytes_(0), syncs_(0)
+{
+}
+
+BufferedFdOutputStream::~BufferedFdOutputStream() noexcept(false)
+{
+    // Errors cannot be reported from here; call flush() beforehand to
+    // observe them.
+    try {
+        flush();
+    } catch (const std::exception&) {
+    }
+}
+
+void BufferedFdOutputStream::write_fd(const void* buffer, size_t size)
+{
+    struct iovec iov = { const_cast<void*>(buffer), size };
+    writev_fd(&iov, 1);
+}
+
+void BufferedFdOutputStream::writev_fd(struct iovec * iov, size_t count)
+{
+    while (count > 0) {
+        ssize_t n = ::writev(fd_.get(), iov, std::min<size_t>(count, IOV_MAX));
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pollfd pfd = { fd_.get(), POLLOUT, 0 };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            throw std::system_error(errno, std::system_category());
+        }
+
+        // Step over what was written, which may end within a piece
+        while (count > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+
+        if (count > 0) {
+            iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+void BufferedFdOutputStream::maybe_sync(uint64_t now_ns)
+{
+    if (policy_.sync_interval_ns == 0 ||
+        now_ns - last_sync_ns_ < policy_.sync_interval_ns) {
+        return;
+    }
+
+    if (fdatasync(fd_.get()) == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    last_sync_ns_ = now_ns;
+    ++syncs_;
+}
+
+void BufferedFdOutputStream::write(const void* buffer, size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+
+    if (buffered_ + size > policy_.max_bytes) {
+        flush();
+
+        if (size >= policy_.max_bytes) {
+            // Too big to buffer: write through
+            uint64_t start = monotonic_ns();
+            write_fd(buffer, size);
+            ++flushes_;
+            bytes_ += size;
+            maybe_sync(start);
+            flush_latency_.record(monotonic_ns() - start);
+            return;
+        }
+    }
+
+    if (buffered_ == 0 && policy_.max_delay_ns != 0) {
+        oldest_ns_ = monotonic_ns();
+    }
+
+    memcpy(&buffer_[buffered_], buffer, size);
+    buffered_ += size;
+
+    if (buffered_ == policy_.max_bytes) {
+        flush();
+    } else {
+        flush_if_due();
+    }
+}
+
+void BufferedFdOutputStream::write(
+    kj::ArrayPtr<const kj::ArrayPtr<const kj::byte>> pieces)
+{
+    size_t size = 0;
+    for (auto&& piece : pieces) {
+        size += piece.size();
+    }
+
+    if (buffered_ + size <= policy_.max_bytes) {
+        for (auto&& piece : pieces) {
+            write(piece.begin(), piece.size());
+        }
+        return;
+    }
+
+    // Too much to buffer: write the buffered bytes and the pieces with one
+    // system call
+    iov_.clear();
+
+    if (buffered_ > 0) {
+        iov_.push_back({ buffer_.data(), buffered_ });
+    }
+
+    for (auto&& piece : pieces) {
+        if (piece.size() > 0) {
+            iov_.push_back({ const_cast<kj::byte*>(piece.begin()), piece.size() });
+        }
+    }
+
+    uint64_t start = monotonic_ns();
+
+    // Reset before writing, as in flush()
+    size += buffered_;
+    buffered_ = 0;
+
+    writev_fd(iov_.data(), iov_.size());
+
+    ++flushes_;
+    bytes_ += size;
+
+    maybe_sync(start);
+
+    flush_latency_.record(monotonic_ns() - start);
+}
+
+void BufferedFdOutputStream::flush()
+{
+    if (buffered_ == 0) {
+        return;
+    }
+
+    uint64_t start = monotonic_ns();
+
+    // Reset before writing, so that a failed write is not retried by the
+    // destructor.
+    size_t size = buffered_;
+    buffered_ = 0;
+
+    write_fd(buffer_.data(), size);
+
+    ++flushes_;
+    bytes_ += size;
+
+    maybe_sync(start);
+
+    flush_latency_.record(monotonic_ns() - start);
+}
+
+bool BufferedFdOutputStream::flush_if_due()
+{
+    if (buffered_ == 0 || policy_.max_delay_ns == 0) {
+        return false;
+    }
+
+    if (monotonic_ns() - oldest_ns_ < policy_.max_delay_ns) {
+        return false;
+    }
+
+    flush();
+    return true;
+}
+
+void BufferedFdOutputStream::sync()
+{
+    flush();
+
+    if (fdatasync(fd_.get()) == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    last_sync_ns_ = monotonic_ns();
+    ++syncs_;
+}
+
+FlushStats BufferedFdOutputStream::stats() const
+{
+    return FlushStats {
+        flushes_,
+        bytes_,
+        syncs_,
+        flush_latency_.percentile(50),
+        flush_latency_.percentile(99),
+        flush_latency_.max()
+    };
+}
+
+} // namespace lt::slipstream
@@ -0,0 +1,65 @@
+#include "lt/slipstream/capnp.h"
+
+#include <string.h>
+
+#include <vector>
+
+namespace lt::slipstream {
+
+static thread_local ::capnp::word scratch_words[ScratchSegment::words];
+static thread_local bool scratch_in_use = false;
+
+ScratchSegment::ScratchSegment()
+{
+    if (!scratch_in_use) {
+        scratch_in_use = true;
+        segment_ = kj::arrayPtr(scratch_words, words);
+    }
+}
+
+ScratchSegment::~ScratchSegment()
+{
+    if (!empty()) {
+        scratch_in_use = false;
+    }
+}
+
+kj::ArrayPtr<const ::capnp::word> buffered_words(kj::InputStream& in, size_t length)
+{
+    static thread_local std::vector<::capnp::word> aligned;
+
+    if (length == 0 || length % sizeof(::capnp::word) != 0) {
+        return nullptr;
+    }
+
+    auto buffered = dynamic_cast<kj::BufferedInputStream*>(&in);
+    if (buffered == nullptr) {
+        return nullptr;
+    }
+
+    auto bytes = buffered->tryGetReadBuffer();
+    if (bytes.size() < length) {
+        return nullptr;
+    }
+
+    size_t n = length / sizeof(::capnp::word);
+
+    if (reinterpret_cast<uintptr_t>(bytes.begin()) % alignof(::capnp::word) == 0) {
+        return kj::arrayPtr(reinterpret_cast<const ::capnp::word*>(bytes.begin()), n);
+    }
+
+    if (aligned.size() < n) {
+        aligned.resize(n);
+    }
+    memcpy(aligned.data(), bytes.begin(), length);
+
+    return kj::arrayPtr(const_cast<const ::capnp::word*>(aligned.data()), n);
+}
+
+::capnp::JsonCodec& json_codec()
+{
+    static thread_local ::capnp::JsonCodec codec;
+    return codec;
+}
+
+} // namespace lt::slipstream
@@ -0,0 +1,156 @@
+#include "lt/slipstream/channel_dictionary.h"
+
+#include <endian.h>
+#include <string.h>
+
+#include <limits>
+#include <stdexcept>
+
+namespace lt::slipstream {
+
+ChannelRegistry::ChannelRegistry(uint64_t sync_interval)
+    : sync_interval_(sync_interval), since_sync_(0), epoch_(0)
+{
+}
+
+uint16_t ChannelRegistry::id(const Envelope& envelope)
+{
+    for (size_t i = 0; i < channels_.size(); ++i) {
+        if (channels_[i].envelope == envelope) {
+            return i + 1;
+        }
+    }
+
+    if (channels_.size() >= std::numeric_limits<uint16_t>::max()) {
+        throw std::runtime_error("ChannelRegistry: out of channel ids");
+    }
+
+    uint16_t id = channels_.size() + 1;
+
+    channels_.push_back(Channel{envelope, envelope.registration(id), 0, false});
+
+    return id;
+}
+
+size_t ChannelRegistry::register_if_due(kj::OutputStream& out, uint16_t id,
+    uint64_t source_timestamp)
+{
+    Channel& channel = channels_.at(id - 1);
+
+    if (channel.registered && channel.registered_epoch == epoch_) {
+        return 0;
+    }
+
+    auto framing = Framing {static_cast<uint32_t>(channel.registration.size()), 0,
+        source_timestamp, 0, true, compact_frame_version};
+
+    uint8_t header[frame_header_length];
+    framing.encode(header);
+
+    kj::ArrayPtr<const kj::byte> pieces[] = {
+        kj::arrayPtr(header, frame_header_length),
+        kj::arrayPtr(channel.registration.data(), channel.registration.size()),
+    };
+
+    out.write(kj::arrayPtr(pieces, 2));
+
+    channel.registered = true;
+    channel.registered_epoch = epoch_;
+
+    size_t n = frame_header_length + channel.registration.size();
+    written(n);
+
+    return n;
+}
+
+void ChannelRegistry::written(size_t bytes)
+{
+    since_sync_ += bytes;
+
+    if (since_sync_ >= sync_interval_) {
+        since_sync_ = 0;
+        epoch_++;
+    }
+}
+
+bool ChannelRegistry::copy_frame(kj::OutputStream& out, kj::ArrayPtr<kj::byte> frame,
+    const Envelope& envelope)
+{
+    Framing framing;
+
+    if (frame.size() >= frame_header_length + channel_id_length &&
+        framing.decode(frame.begin()) && framing.compact()) {
+        if (framing.sync) {
+            return false;
+        }
+
+        uint16_t id = this->id(envelope);
+        register_if_due(out, id, framing.source_timestamp);
+
+        uint16_t id_be = htobe16(id);
+        memcpy(frame.begin() + frame_header_length, &id_be, channel_id_length);
+    }
+
+    out.write(frame.begin(), frame.size());
+    written(frame.size());
+
+    return true;
+}
+
+bool ChannelDictionary::read(kj::InputStream& in, const Framing& framing,
+    const InternedEnvelope *& envelope, uint16_t& channel_id)
+{
+    channel_id = 0;
+    envelope = nullptr;
+
+    if (!framing.compact()) {
+        uint16_t id;
+        envelope = decoder_.read(in, framing.envelope_length, id);
+        return envelope != nullptr;
+    }
+
+    if (framing.sync) {
+        uint16_t id = 0;
+        auto registered = decoder_.read(in, framing.envelope_length, id);
+        if (registered == nullptr) {
+            return false;
+        }
+        if (id != 0) {
+            if (id >= envelopes_.size()) {
+                envelopes_.resize(id + 1, nullptr);
+            }
+            envelopes_[id] = registered;
+            envelope = registered;
+            channel_id = id;
+        }
+        return true;
+    }
+
+    try {
+        if (framing.envelope_length != channel_id_length) {
+            in.skip(framing.envelope_length);
+            return true;
+        }
+
+        uint16_t id_be;
+        in.read(&id_be, channel_id_length);
+        channel_id = be16toh(id_be);
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    envelope = get(channel_id);
+
+    return true;
+}
+
+const InternedEnvelope * ChannelDictionary::get(uint16_t channel_id) const
+{
+    if (channel_id >= envelopes_.size()) {
+        return nullptr;
+    }
+
+    return envelopes_[channel_id];
+}
+
+} // namespace lt::slipstream
@@ -0,0 +1,186 @@
+#include "lt/slipstream/collector.h"
+
+#include <dirent.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "lt/core/stamp.h"
+
+#include "lt/slipstream/framing.h"
+
+namespace lt::slipstream {
+
+// The timestamp of the first frame in a record, or 0 if it has none
+static uint64_t record_timestamp(kj::ArrayPtr<const kj::byte> record)
+{
+    Framing framing;
+
+    if (record.size() < frame_header_length || !framing.decode(record.begin())) {
+        return 0;
+    }
+
+    return framing.source_timestamp;
+}
+
+static bool has_suffix(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() &&
+        s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+RingCollector::RingCollector(kj::OutputStream * out, const std::string& directory,
+    std::chrono::nanoseconds scan_interval)
+    : out_(out), directory_(directory), scan_interval_(scan_interval),
+      write_errors_(0)
+{
+    scan();
+}
+
+void RingCollector::scan()
+{
+    last_scan_ = std::chrono::steady_clock::now();
+
+    remove_abandoned();
+
+    DIR * dir = opendir(directory_.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+
+    std::unordered_set<std::string> known;
+    for (auto&& p : rings_) {
+        known.insert(p->ring->path());
+    }
+
+    while (struct dirent * entry = readdir(dir)) {
+        std::string name = entry->d_name;
+
+        if (!has_suffix(name, shm_ring_suffix)) {
+            continue;
+        }
+
+        std::string path = directory_ + "/" + name;
+        if (known.count(path)) {
+            continue;
+        }
+
+        auto p = std::make_unique<Producer>();
+
+        try {
+            p->ring = std::make_unique<ShmRingReader>(path);
+        } catch (const std::exception&) {
+            // Not a ring, or removed since it was listed
+            continue;
+        }
+
+        p->written = 0;
+        p->lag_ns = 0;
+        p->n = 0;
+        p->next = 0;
+
+        rings_.push_back(std::move(p));
+    }
+
+    closedir(dir);
+}
+
+void RingCollector::remove_abandoned()
+{
+    // Once abandoned a ring receives no more frames, so if it is then found
+    // empty it has been completely drained. A corrupt ring is removed too,
+    // lest the next scan find it again.
+    auto it = std::remove_if(rings_.begin(), rings_.end(), [](auto&& p) {
+        if (p->ring->bad() || (p->ring->abandoned() && p->ring->empty())) {
+            unlink(p->ring->path().c_str());
+            return true;
+        }
+        return false;
+    });
+
+    rings_.erase(it, rings_.end());
+}
+
+size_t RingCollector::poll()
+{
+    if (std::chrono::steady_clock::now() - last_scan_ >= scan_interval_) {
+        scan();
+    }
+
+    uint64_t now = lt::core::Stamp::stamp_clock_rt();
+
+    for (auto&& p : rings_) {
+        p->n = p->ring->peek(p->records, max_batch_);
+        p->next = 0;
+
+        for (size_t i = 0; i < p->n; ++i) {
+            p->timestamps[i] = record_timestamp(p->records[i]);
+        }
+
+        uint64_t oldest = p->n ? p->timestamps[0] : 0;
+        p->lag_ns = (oldest != 0 && now > oldest) ? now - oldest : 0;
+    }
+
+    pieces_.clear();
+
+    while (true) {
+        // The earliest waiting frame. There are few producers, so a linear
+        // search is as quick as a heap.
+        Producer * head = nullptr;
+        for (auto&& p : rings_) {
+            if (p->next < p->n &&
+                (head == nullptr || p->timestamps[p->next] < head->timestamps[head->next])) {
+                head = p.get();
+            }
+        }
+
+        if (head == nullptr) {
+            break;
+        }
+
+        pieces_.push_back(head->records[head->next++]);
+    }
+
+    if (pieces_.empty()) {
+        return 0;
+    }
+
+    try {
+        out_->write(kj::arrayPtr(pieces_.data(), pieces_.size()));
+    } catch (const std::exception&) {
+        write_errors_++;
+    }
+
+    for (auto&& p : rings_) {
+        if (p->next != 0) {
+            p->ring->pop(p->next);
+            p->written += p->next;
+        }
+    }
+
+    return pieces_.size();
+}
+
+std::vector<CollectorProducerStats> RingCollector::stats() const
+{
+    std::vector<CollectorProducerStats> result;
+
+    for (auto&& p : rings_) {
+        result.push_back(CollectorProducerStats {
+            p->ring->path(),
+            p->ring->name(),
+            p->ring->pid(),
+            p->ring->frames(),
+            p->ring->drops(),
+            p->written,
+            p->ring->used(),
+            p->lag_ns
+        });
+    }
+
+    return result;
+}
+
+} // namespace lt::slipstream
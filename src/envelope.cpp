@@ -1,12 +1,27 @@
 #include "lt/slipstream/envelope.h"
 
+#include <endian.h>
+
 #include <capnp/message.h>
 #include <capnp/serialize.h>
 
+#include "lt/slipstream/capnp.h"
+#include "lt/slipstream/channel_dictionary.h"
 #include "lt/slipstream/capnp/slipstream.capnp.h"
 
 namespace lt::slipstream {
 
+size_t identifier_hash(std::string_view host_name, std::string_view application_name,
+    std::string_view channel_name)
+{
+    using std::hash;
+    using std::string_view;
+
+    return ((hash<string_view>()(host_name)
+            ^ (hash<string_view>()(application_name) << 1)) >> 1)
+            ^ (hash<string_view>()(channel_name) << 1);
+}
+
 static capnp::Envelope::PayloadKind fromPayloadKind(PayloadKind payloadKind)
 {
     capnp::Envelope::PayloadKind value = capnp::Envelope::PayloadKind::HEADER;
@@ -22,7 +37,8 @@ static capnp::Envelope::PayloadKind fromPayloadKind(PayloadKind payloadKind)
     return value;
 }
 
-static void envelope_message(::capnp::MallocMessageBuilder& message, const Envelope& envelope)
+static void envelope_message(::capnp::MallocMessageBuilder& message, const Envelope& envelope,
+    uint16_t channel_id = 0)
 {
     capnp::Envelope::Builder capnp_envelope = message.initRoot<capnp::Envelope>();
 
@@ -31,6 +47,20 @@ static void envelope_message(::capnp::MallocMessageBuilder& message, const Envel
     capnp_envelope.setApplicationName(envelope.identifier.application_name);
     capnp_envelope.setChannelName(envelope.identifier.channel_name);
     capnp_envelope.setPayloadKind(fromPayloadKind(envelope.payload_kind));
+
+    if (channel_id != 0) {
+        capnp_envelope.setChannelId(channel_id);
+    }
+}
+
+static std::vector<kj::byte> envelope_bytes(const Envelope& envelope, uint16_t channel_id)
+{
+    ::capnp::MallocMessageBuilder message;
+    envelope_message(message, envelope, channel_id);
+    auto words = ::capnp::messageToFlatArray(message);
+    auto bytes = words.asBytes();
+
+    return std::vector<kj::byte>(bytes.begin(), bytes.end());
 }
 
 size_t Envelope::size() const
@@ -49,6 +79,57 @@ void Envelope::write(kj::OutputStream& out) const
     ::capnp::writeMessage(out, message);
 }
 
+static size_t payload_kind_index(const PayloadKind& payload_kind)
+{
+    if (auto data = std::get_if<PayloadData>(&payload_kind)) {
+        return 1 + data->index();
+    }
+
+    return 0;
+}
+
+EnvelopeCache::EnvelopeCache(const Identifier& identifier, ChannelRegistry * registry)
+    : identifier_(identifier), registry_(registry)
+{
+}
+
+kj::ArrayPtr<const kj::byte> EnvelopeCache::get(const PayloadKind& payload_kind,
+    std::string_view encoding)
+{
+    uint16_t channel_id;
+    return get(payload_kind, encoding, channel_id);
+}
+
+kj::ArrayPtr<const kj::byte> EnvelopeCache::get(const PayloadKind& payload_kind,
+    std::string_view encoding, uint16_t& channel_id)
+{
+    size_t kind = payload_kind_index(payload_kind);
+
+    for (auto&& entry : entries_) {
+        if (entry.kind == kind && entry.encoding == encoding) {
+            channel_id = entry.channel_id;
+            return kj::ArrayPtr<const kj::byte>(entry.bytes.data(), entry.bytes.size());
+        }
+    }
+
+    auto envelope = Envelope{identifier_, std::string(encoding), payload_kind};
+
+    if (registry_ != nullptr) {
+        channel_id = registry_->id(envelope);
+        uint16_t id_be = htobe16(channel_id);
+        auto id_bytes = reinterpret_cast<const kj::byte*>(&id_be);
+
+        entries_.push_back(Entry{kind, std::string(encoding),
+            std::vector<kj::byte>(id_bytes, id_bytes + sizeof(id_be)), channel_id});
+    } else {
+        channel_id = 0;
+        entries_.push_back(Entry{kind, std::string(encoding), envelope_bytes(envelope, 0), 0});
+    }
+
+    auto& added = entries_.back().bytes;
+    return kj::ArrayPtr<const kj::byte>(added.data(), added.size());
+}
+
 static PayloadKind toPayloadKind(capnp::Envelope::PayloadKind payloadKind)
 {
     PayloadKind value = PayloadKeyframe{};
@@ -68,18 +149,36 @@ static PayloadKind toPayloadKind(capnp::Envelope::PayloadKind payloadKind)
     return value;
 }
 
+static void from_capnp(Envelope& envelope, uint16_t& channel_id,
+    capnp::Envelope::Reader capnp_envelope)
+{
+    envelope.identifier.host_name = capnp_envelope.getHostName();
+    envelope.identifier.application_name = capnp_envelope.getApplicationName();
+    envelope.identifier.channel_name = capnp_envelope.getChannelName();
+    envelope.encoding = capnp_envelope.getEncoding();
+    envelope.payload_kind = toPayloadKind(capnp_envelope.getPayloadKind());
+    channel_id = capnp_envelope.getChannelId();
+}
+
 bool Envelope::read(kj::InputStream& in, size_t length)
 {
-    try {
-        ::capnp::InputStreamMessageReader message(in);
+    uint16_t channel_id;
+    return read(in, length, channel_id);
+}
 
-        capnp::Envelope::Reader capnp_envelope = message.getRoot<capnp::Envelope>();
+bool Envelope::read(kj::InputStream& in, size_t length, uint16_t& channel_id)
+{
+    try {
+        auto words = buffered_words(in, length);
 
-        identifier.host_name = capnp_envelope.getHostName();
-        identifier.application_name = capnp_envelope.getApplicationName();
-        identifier.channel_name = capnp_envelope.getChannelName();
-        encoding = capnp_envelope.getEncoding();
-        payload_kind = toPayloadKind(capnp_envelope.getPayloadKind());
+        if (words.size() != 0) {
+            ::capnp::FlatArrayMessageReader message(words);
+            from_capnp(*this, channel_id, message.getRoot<capnp::Envelope>());
+            in.skip(length);
+        } else {
+            ::capnp::InputStreamMessageReader message(in);
+            from_capnp(*this, channel_id, message.getRoot<capnp::Envelope>());
+        }
     } catch (std::exception&) {
         return false;
     }
@@ -87,4 +186,94 @@ bool Envelope::read(kj::InputStream& in, size_t length)
     return true;
 }
 
+const InternedIdentifier& IdentifierTable::intern(std::string_view host_name,
+    std::string_view application_name, std::string_view channel_name)
+{
+    size_t hash = identifier_hash(host_name, application_name, channel_name);
+
+    auto range = by_hash_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        auto& entry = entries_[it->second];
+        if (entry.identifier.host_name == host_name &&
+            entry.identifier.application_name == application_name &&
+            entry.identifier.channel_name == channel_name) {
+            return entry;
+        }
+    }
+
+    uint32_t index = entries_.size();
+    entries_.push_back(InternedIdentifier{Identifier{std::string(host_name),
+        std::string(application_name), std::string(channel_name)}, hash, index});
+    by_hash_.emplace(hash, index);
+
+    return entries_.back();
+}
+
+const InternedIdentifier& IdentifierTable::intern(const Identifier& identifier)
+{
+    return intern(identifier.host_name, identifier.application_name, identifier.channel_name);
+}
+
+static std::string_view view(kj::StringPtr text)
+{
+    return std::string_view(text.begin(), text.size());
+}
+
+const InternedEnvelope * EnvelopeDecoder::read(kj::InputStream& in, size_t length,
+    uint16_t& channel_id)
+{
+    try {
+        auto words = buffered_words(in, length);
+        bool buffered = words.size() != 0;
+
+        if (!buffered) {
+            size_t nwords = (length + sizeof(::capnp::word) - 1) / sizeof(::capnp::word);
+            if (scratch_.size() < nwords) {
+                scratch_.resize(nwords);
+            }
+            in.read(scratch_.data(), length);
+            words = kj::arrayPtr(scratch_.data(), nwords);
+        }
+
+        ::capnp::FlatArrayMessageReader message(words);
+        auto capnp_envelope = message.getRoot<capnp::Envelope>();
+
+        auto& identifier = identifiers_.intern(view(capnp_envelope.getHostName()),
+            view(capnp_envelope.getApplicationName()), view(capnp_envelope.getChannelName()));
+        auto encoding = view(capnp_envelope.getEncoding());
+        auto payload_kind = toPayloadKind(capnp_envelope.getPayloadKind());
+        channel_id = capnp_envelope.getChannelId();
+
+        if (buffered) {
+            in.skip(length);
+        }
+
+        if (identifier.index >= by_identifier_.size()) {
+            by_identifier_.resize(identifier.index + 1);
+        }
+
+        auto& candidates = by_identifier_[identifier.index];
+        for (auto ix : candidates) {
+            auto& interned = envelopes_[ix];
+            if (interned.envelope.encoding == encoding &&
+                interned.envelope.payload_kind == payload_kind) {
+                return &interned;
+            }
+        }
+
+        candidates.push_back(envelopes_.size());
+        envelopes_.push_back(InternedEnvelope{
+            Envelope{identifier.identifier, std::string(encoding), payload_kind}, &identifier});
+
+        return &envelopes_.back();
+    } catch (std::exception&) {
+        return nullptr;
+    }
+}
+
+std::vector<kj::byte> Envelope::registration(uint16_t channel_id) const
+{
+    return envelope_bytes(*this, channel_id);
+}
+
 } // namespace lt::slipstream
@@ -20,23 +20,43 @@ bool FilterScanner::next()
     return scanner_.next();
 }
 
+bool FilterScanner::skip_frame()
+{
+    return scanner_.skip_frame();
+}
+
 bool FilterScanner::peek(uint64_t& source_timestamp)
 {
     return scanner_.peek(source_timestamp);
 }
 
 bool FilterScanner::peek(uint64_t& source_timestamp, Envelope& envelope)
+{
+    const InternedEnvelope * e;
+
+    if (!peek(source_timestamp, e)) {
+        return false;
+    }
+
+    envelope = e->envelope;
+
+    return true;
+}
+
+bool FilterScanner::peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope)
 {
     while(true) {
         if (!scanner_.peek(source_timestamp, envelope)) {
             return false;
         }
 
-        if (filter_.match(envelope)) {
+        if (filter_.match(*envelope->identifier)) {
             return true;
         }
 
-        scanner_.skip(1);
+        if (!scanner_.skip_frame()) {
+            return false;
+        }
     }
 }
 
@@ -75,23 +95,43 @@ bool FilterSeeker::next()
     return seeker_.next();
 }
 
+bool FilterSeeker::skip_frame()
+{
+    return seeker_.skip_frame();
+}
+
 bool FilterSeeker::peek(uint64_t& source_timestamp)
 {
     return seeker_.peek(source_timestamp);
 }
 
 bool FilterSeeker::peek(uint64_t& source_timestamp, Envelope& envelope)
+{
+    const InternedEnvelope * e;
+
+    if (!peek(source_timestamp, e)) {
+        return false;
+    }
+
+    envelope = e->envelope;
+
+    return true;
+}
+
+bool FilterSeeker::peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope)
 {
     while(true) {
         if (!seeker_.peek(source_timestamp, envelope)) {
             return false;
         }
 
-        if (filter_.match(envelope)) {
+        if (filter_.match(*envelope->identifier)) {
             return true;
         }
 
-        seeker_.skip(1);
+        if (!seeker_.skip_frame()) {
+            return false;
+        }
     }
 }
 
@@ -0,0 +1,106 @@
+#include "lt/slipstream/follow.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <system_error>
+
+namespace lt::slipstream {
+
+FileWatch::FileWatch(const std::string& path, const FollowPolicy& policy)
+    : fd_(-1), policy_(policy), spin_ns_(0)
+{
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    if (inotify_add_watch(fd_, path.c_str(), IN_MODIFY) == -1) {
+        int error = errno;
+        close(fd_);
+        throw std::system_error(error, std::system_category());
+    }
+}
+
+FileWatch::~FileWatch()
+{
+    close(fd_);
+}
+
+void FileWatch::drain()
+{
+    alignas(struct inotify_event) char buffer[4096];
+
+    while (read(fd_, buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+bool FileWatch::wait(const std::function<bool()>& ready)
+{
+    using clock = std::chrono::steady_clock;
+
+    auto start = clock::now();
+
+    if (ready()) {
+        return true;
+    }
+
+    if (spin_ns_ > 0) {
+        auto until = start + std::chrono::nanoseconds(spin_ns_);
+
+        while (clock::now() < until) {
+            if (ready()) {
+                return true;
+            }
+        }
+
+        // Nothing came while spinning
+        spin_ns_ /= 2;
+    }
+
+    while (true) {
+        auto waited = clock::now() - start;
+        int timeout = policy_.recheck_ms;
+
+        if (policy_.timeout_ms >= 0) {
+            int left = policy_.timeout_ms -
+                std::chrono::duration_cast<std::chrono::milliseconds>(waited).count();
+
+            if (left <= 0) {
+                return ready();
+            }
+
+            timeout = timeout < 0 ? left : std::min(timeout, left);
+        }
+
+        struct pollfd pfd = {fd_, POLLIN, 0};
+
+        int n = poll(&pfd, 1, timeout);
+        if (n == -1 && errno != EINTR) {
+            throw std::system_error(errno, std::system_category());
+        }
+
+        if (n > 0) {
+            drain();
+        }
+
+        if (ready()) {
+            // Had the data come within the spin limit, spinning for about
+            // as long would have found it without blocking
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                clock::now() - start).count();
+
+            if (ns < policy_.max_spin_ns) {
+                spin_ns_ = std::min(policy_.max_spin_ns, std::max(2 * spin_ns_, ns));
+            }
+
+            return true;
+        }
+    }
+}
+
+} // namespace lt::slipstream
@@ -0,0 +1,24 @@
+#include "lt/slipstream/frame_buffer.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace lt::slipstream {
+
+FrameBuffer::~FrameBuffer() noexcept(false) {}
+
+FrameBuffer::FrameBuffer() : size_(0)
+{
+}
+
+void FrameBuffer::write(const void* buffer, size_t size)
+{
+    if (size_ + size > buffer_.size()) {
+        buffer_.resize(std::max(size_ + size, 2 * buffer_.size()));
+    }
+
+    memcpy(&buffer_[size_], buffer, size);
+    size_ += size;
+}
+
+} // namespace lt::slipstream
@@ -2,85 +2,114 @@
 
 #include <endian.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SLIPSTREAM_X86 1
+#endif
+
 namespace lt::slipstream {
 
-void Framing::encode(uint8_t * buf) const
+static size_t find_frame_marker_scalar(const uint8_t * data, size_t size, size_t i)
 {
-    buf[0] = frame_marker[0];
-    buf[1] = frame_marker[1];
-    buf[2] = frame_marker[2];
-    buf[3] = frame_version;
+    for (; i + 2 < size; ++i) {
+        if (data[i] == frame_marker[0] &&
+            data[i+1] == frame_marker[1] &&
+            data[i+2] == frame_marker[2]) {
+            return i;
+        }
+    }
 
-    uint16_t * buf_checksum = reinterpret_cast<uint16_t*>(&buf[4]);
-    *buf_checksum = htobe16(checksum);
+    return size;
+}
 
-    buf[6] = sync ? 0x01 : 0x00;
-    buf[7] = frame_header_length;
+#ifdef SLIPSTREAM_X86
 
-    uint32_t envelope_length_be = htobe32(envelope_length);
-    uint8_t * e = reinterpret_cast<uint8_t*>(&envelope_length_be);
+// Compare each of 16 (or 32) consecutive positions against all three marker
+// bytes at once, by loading the block at offsets 0, 1 and 2.
 
-    uint32_t payload_length_be = htobe32(payload_length);
-    uint8_t * p = reinterpret_cast<uint8_t*>(&payload_length_be);
+__attribute__((target("sse2")))
+static size_t find_frame_marker_sse2(const uint8_t * data, size_t size)
+{
+    const __m128i m0 = _mm_set1_epi8(static_cast<char>(frame_marker[0]));
+    const __m128i m1 = _mm_set1_epi8(static_cast<char>(frame_marker[1]));
+    const __m128i m2 = _mm_set1_epi8(static_cast<char>(frame_marker[2]));
 
-    buf[8] = (e[2] << 4) | (e[3] >> 4);
-    buf[9] = (e[3] << 4) | (p[1] & 0x0f);
+    size_t i = 0;
 
-    buf[10] = p[2];
-    buf[11] = p[3];
+    for (; i + 16 + 2 <= size; i += 16) {
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1));
+        __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2));
 
-    uint64_t * buf_source_timestamp = reinterpret_cast<uint64_t*>(&buf[12]);
-    *buf_source_timestamp = htobe64(source_timestamp);
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(b0, m0),
+            _mm_and_si128(_mm_cmpeq_epi8(b1, m1), _mm_cmpeq_epi8(b2, m2)));
+
+        int mask = _mm_movemask_epi8(eq);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return find_frame_marker_scalar(data, size, i);
 }
 
-std::pair<bool, ssize_t> Framing::write(kj::OutputStream& out) const
+__attribute__((target("avx2")))
+static size_t find_frame_marker_avx2(const uint8_t * data, size_t size)
 {
-    ssize_t total = 0;
+    const __m256i m0 = _mm256_set1_epi8(static_cast<char>(frame_marker[0]));
+    const __m256i m1 = _mm256_set1_epi8(static_cast<char>(frame_marker[1]));
+    const __m256i m2 = _mm256_set1_epi8(static_cast<char>(frame_marker[2]));
 
-    try {
-        out.write (frame_marker, sizeof(frame_marker));
-        total += sizeof(frame_marker);
-    } catch(const std::exception&) {
-        return { false, total };
-    }
+    size_t i = 0;
 
-    uint8_t buf[4];
+    for (; i + 32 + 2 <= size; i += 32) {
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 1));
+        __m256i b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 2));
 
-    // Version
-    buf[0] = frame_version;
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(b0, m0),
+            _mm256_and_si256(_mm256_cmpeq_epi8(b1, m1), _mm256_cmpeq_epi8(b2, m2)));
 
-    try {
-        out.write (buf, 1);
-        total += 1;
-    } catch(const std::exception&) {
-        return { false, total };
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
     }
 
-    // Checksum
-    uint16_t checksum_be = htobe16(checksum);
+    size_t r = find_frame_marker_sse2(data + i, size - i);
+    return i + r;
+}
 
-    try {
-        out.write(&checksum_be, sizeof(uint16_t));
-        total += sizeof(uint16_t);
-    } catch(const std::exception&) {
-        return { false, total };
-    }
+#endif
 
-    // Flags, header_len
-    if (sync) {
-        buf[0] = 0x01;
-    } else {
-        buf[0] = 0x00;
+size_t find_frame_marker(const uint8_t * data, size_t size)
+{
+#ifdef SLIPSTREAM_X86
+    static const bool have_avx2 = __builtin_cpu_supports("avx2");
+    static const bool have_sse2 = __builtin_cpu_supports("sse2");
+
+    if (have_avx2) {
+        return find_frame_marker_avx2(data, size);
+    } else if (have_sse2) {
+        return find_frame_marker_sse2(data, size);
     }
+#endif
 
-    buf[1] = frame_header_length;
+    return find_frame_marker_scalar(data, size, 0);
+}
 
-    try {
-        out.write (buf, 2);
-        total += 2;
-    } catch(const std::exception&) {
-        return { false, total };
-    }
+void Framing::encode(uint8_t * buf) const
+{
+    buf[0] = frame_marker[0];
+    buf[1] = frame_marker[1];
+    buf[2] = frame_marker[2];
+    buf[3] = version;
+
+    uint16_t * buf_checksum = reinterpret_cast<uint16_t*>(&buf[4]);
+    *buf_checksum = htobe16(checksum);
+
+    buf[6] = sync ? 0x01 : 0x00;
+    buf[7] = frame_header_length;
 
     uint32_t envelope_length_be = htobe32(envelope_length);
     uint8_t * e = reinterpret_cast<uint8_t*>(&envelope_length_be);
@@ -88,29 +117,29 @@ std::pair<bool, ssize_t> Framing::write(kj::OutputStream& out) const
     uint32_t payload_length_be = htobe32(payload_length);
     uint8_t * p = reinterpret_cast<uint8_t*>(&payload_length_be);
 
-    buf[0] = (e[2] << 4) | (e[3] >> 4);
-    buf[1] = (e[3] << 4) | (p[1] & 0x0f);
+    buf[8] = (e[2] << 4) | (e[3] >> 4);
+    buf[9] = (e[3] << 4) | (p[1] & 0x0f);
+
+    buf[10] = p[2];
+    buf[11] = p[3];
 
-    buf[2] = p[2];
-    buf[3] = p[3];
+    uint64_t * buf_source_timestamp = reinterpret_cast<uint64_t*>(&buf[12]);
+    *buf_source_timestamp = htobe64(source_timestamp);
+}
 
-    try {
-        out.write (buf, 4);
-        total += 4;
-    } catch(const std::exception&) {
-        return { false, total };
-    }
+std::pair<bool, ssize_t> Framing::write(kj::OutputStream& out) const
+{
+    uint8_t buf[frame_header_length];
 
-    uint64_t source_timestamp_be = htobe64(source_timestamp);
+    encode(buf);
 
     try {
-        out.write(&source_timestamp_be, sizeof(uint64_t));
-        total += sizeof(uint64_t);
+        out.write(buf, frame_header_length);
     } catch(const std::exception&) {
-        return { false, total };
+        return { false, 0 };
     }
 
-    return {true, total};
+    return { true, frame_header_length };
 }
 
 bool Framing::decode(const uint8_t * buf)
@@ -118,11 +147,13 @@ bool Framing::decode(const uint8_t * buf)
     if (buf[0] != frame_marker[0] ||
         buf[1] != frame_marker[1] ||
         buf[2] != frame_marker[2] ||
-        buf[3] != frame_version ||
+        (buf[3] != frame_version && buf[3] != compact_frame_version) ||
         buf[7] != frame_header_length) {
         return false;
     }
 
+    version = buf[3];
+
     const uint16_t * buf_checksum =
         reinterpret_cast<const uint16_t*>(&buf[4]);
     checksum = be16toh(*buf_checksum);
@@ -161,6 +192,17 @@ bool Framing::decode(const uint8_t * buf)
 
 std::pair<bool, ssize_t> Framing::read(kj::InputStream& in)
 {
+    // Decode in place if the whole header is already buffered, eg. from a
+    // MappedInputStream. Anything unusual takes the slower path below, which
+    // consumes exactly as much of a bad header as it always has.
+    if (auto buffered = dynamic_cast<kj::BufferedInputStream*>(&in)) {
+        auto bytes = buffered->tryGetReadBuffer();
+        if (bytes.size() >= frame_header_length && decode(bytes.begin())) {
+            in.skip(frame_header_length);
+            return { true, frame_header_length };
+        }
+    }
+
     ssize_t total = 0;
     uint8_t buf[4];
 
@@ -174,10 +216,12 @@ std::pair<bool, ssize_t> Framing::read(kj::InputStream& in)
     if (buf[0] != frame_marker[0] ||
         buf[1] != frame_marker[1] ||
         buf[2] != frame_marker[2] ||
-        buf[3] != frame_version) {
+        (buf[3] != frame_version && buf[3] != compact_frame_version)) {
         return { false, total };
     }
 
+    version = buf[3];
+
     uint16_t checksum_be = 0;
 
     try {
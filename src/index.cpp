@@ -0,0 +1,462 @@
+#include "lt/slipstream/index.h"
+
+#include <endian.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <system_error>
+#include <unordered_map>
+
+#include "lt/slipstream/seek.h"
+
+namespace lt::slipstream {
+
+static constexpr char index_magic[4] = {'S', 'S', 'I', 'X'};
+static constexpr uint32_t index_version = 2;
+
+namespace {
+
+class IndexWriter {
+   public:
+    void u16(uint16_t v)
+    {
+        v = htobe16(v);
+        data_.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    void u32(uint32_t v)
+    {
+        v = htobe32(v);
+        data_.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    void u64(uint64_t v)
+    {
+        v = htobe64(v);
+        data_.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    void str(const std::string& s)
+    {
+        u16(s.size());
+        data_.append(s);
+    }
+
+    void bytes(const char * b, size_t n)
+    {
+        data_.append(b, n);
+    }
+
+    const std::string& data() const { return data_; }
+
+   private:
+    std::string data_;
+};
+
+class IndexReader {
+    // Reads fields from a sidecar, failing rather than reading past its end
+
+   public:
+    IndexReader(const std::string& data) : data_(data), offset_(0)
+    {
+    }
+
+    bool u16(uint16_t& v)
+    {
+        return get(&v, sizeof(v)) && ((v = be16toh(v)), true);
+    }
+
+    bool u32(uint32_t& v)
+    {
+        return get(&v, sizeof(v)) && ((v = be32toh(v)), true);
+    }
+
+    bool u64(uint64_t& v)
+    {
+        return get(&v, sizeof(v)) && ((v = be64toh(v)), true);
+    }
+
+    bool i64(int64_t& v)
+    {
+        uint64_t u;
+        if (!u64(u)) {
+            return false;
+        }
+        v = static_cast<int64_t>(u);
+        return true;
+    }
+
+    bool str(std::string& s)
+    {
+        uint16_t n;
+        if (!u16(n) || data_.size() - offset_ < n) {
+            return false;
+        }
+        s.assign(data_, offset_, n);
+        offset_ += n;
+        return true;
+    }
+
+    bool get(void * v, size_t n)
+    {
+        if (data_.size() - offset_ < n) {
+            return false;
+        }
+        memcpy(v, data_.data() + offset_, n);
+        offset_ += n;
+        return true;
+    }
+
+    bool done() const { return offset_ == data_.size(); }
+
+   private:
+    const std::string& data_;
+    size_t offset_;
+};
+
+} // namespace
+
+std::string TimeIndex::sidecar_path(const std::string& path)
+{
+    return path + ".ssidx";
+}
+
+TimeIndex TimeIndex::build(int fd, uint64_t interval)
+{
+    TimeIndex index;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    index.file_size_ = st.st_size;
+    index.mtime_sec_ = st.st_mtim.tv_sec;
+    index.mtime_nsec_ = st.st_mtim.tv_nsec;
+    index.interval_ = interval;
+
+    FdSeeker seeker(fd);
+    seeker.seek(0, SEEK_SET);
+
+    if (!seeker.next()) {
+        return index;
+    }
+
+    // Keyframes of every channel, of which only those of channels that
+    // turn out to write deltas are kept
+    std::vector<KeyframeEntries> keyframes;
+    std::vector<bool> deltas;
+    std::unordered_map<Identifier, size_t> keyframes_of;
+
+    do {
+        uint64_t timestamp;
+        Envelope envelope;
+
+        if (!seeker.peek(timestamp, envelope)) {
+            continue;
+        }
+
+        uint64_t offset = seeker.tell();
+
+        // Only index frames in time order, so that entries can be searched
+        if (index.entries_.empty() ||
+            (offset - index.entries_.back().offset >= interval &&
+             timestamp >= index.entries_.back().timestamp)) {
+            index.entries_.push_back({timestamp, offset});
+        }
+
+        if (index.channel(envelope.identifier) == nullptr) {
+            index.channels_.push_back({envelope.identifier, timestamp, offset});
+        }
+
+        if (auto pd = std::get_if<PayloadData>(&envelope.payload_kind)) {
+            auto it = keyframes_of.find(envelope.identifier);
+            if (it == keyframes_of.end()) {
+                it = keyframes_of.emplace(envelope.identifier, keyframes.size()).first;
+                keyframes.push_back({envelope.identifier, {}});
+                deltas.push_back(false);
+            }
+
+            auto& entries = keyframes[it->second].entries;
+
+            if (!std::holds_alternative<PayloadKeyframe>(*pd)) {
+                deltas[it->second] = true;
+            } else if (entries.empty() || offset - entries.back().offset >= interval) {
+                entries.push_back({timestamp, offset});
+            }
+        }
+
+        index.last_ = {timestamp, offset};
+    } while (seeker.skip_frame());
+
+    for (size_t i = 0; i < keyframes.size(); ++i) {
+        if (deltas[i]) {
+            index.keyframes_.push_back(std::move(keyframes[i]));
+        }
+    }
+
+    return index;
+}
+
+TimeIndex TimeIndex::build(const std::string& path, uint64_t interval)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+    kj::AutoCloseFd closer(fd);
+
+    return build(fd, interval);
+}
+
+std::optional<TimeIndex> TimeIndex::load(const std::string& path)
+{
+    int fd = ::open(sidecar_path(path).c_str(), O_RDONLY);
+    if (fd == -1) {
+        return std::nullopt;
+    }
+    kj::AutoCloseFd closer(fd);
+
+    std::string data;
+    char buf[65536];
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) > 0) {
+        data.append(buf, n);
+    }
+    if (n == -1) {
+        return std::nullopt;
+    }
+
+    TimeIndex index;
+    if (!index.parse(data)) {
+        return std::nullopt;
+    }
+
+    int file_fd = ::open(path.c_str(), O_RDONLY);
+    if (file_fd == -1) {
+        return std::nullopt;
+    }
+    kj::AutoCloseFd file_closer(file_fd);
+
+    if (!index.fresh(file_fd)) {
+        return std::nullopt;
+    }
+
+    return index;
+}
+
+void TimeIndex::write(const std::string& path) const
+{
+    IndexWriter w;
+
+    w.bytes(index_magic, sizeof(index_magic));
+    w.u32(index_version);
+    w.u64(file_size_);
+    w.u64(mtime_sec_);
+    w.u64(mtime_nsec_);
+    w.u64(interval_);
+    w.u64(last_.timestamp);
+    w.u64(last_.offset);
+
+    w.u32(entries_.size());
+    for (auto&& e : entries_) {
+        w.u64(e.timestamp);
+        w.u64(e.offset);
+    }
+
+    w.u32(channels_.size());
+    for (auto&& c : channels_) {
+        w.str(c.identifier.host_name);
+        w.str(c.identifier.application_name);
+        w.str(c.identifier.channel_name);
+        w.u64(c.timestamp);
+        w.u64(c.offset);
+    }
+
+    w.u32(keyframes_.size());
+    for (auto&& k : keyframes_) {
+        w.str(k.identifier.host_name);
+        w.str(k.identifier.application_name);
+        w.str(k.identifier.channel_name);
+        w.u32(k.entries.size());
+        for (auto&& e : k.entries) {
+            w.u64(e.timestamp);
+            w.u64(e.offset);
+        }
+    }
+
+    // Write a temporary file and rename it over the sidecar, so that readers
+    // never see a partial index
+    std::string sidecar = sidecar_path(path);
+    std::string tmp = sidecar + ".tmp";
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    {
+        auto out = kj::FdOutputStream(kj::AutoCloseFd(fd));
+        out.write(w.data().data(), w.data().size());
+    }
+
+    if (::rename(tmp.c_str(), sidecar.c_str()) == -1) {
+        int err = errno;
+        ::unlink(tmp.c_str());
+        throw std::system_error(err, std::system_category());
+    }
+}
+
+bool TimeIndex::parse(const std::string& data)
+{
+    IndexReader r(data);
+
+    char magic[sizeof(index_magic)];
+    uint32_t version;
+
+    if (!r.get(magic, sizeof(magic)) ||
+        memcmp(magic, index_magic, sizeof(magic)) != 0 ||
+        !r.u32(version) || version != index_version) {
+        return false;
+    }
+
+    if (!r.u64(file_size_) || !r.i64(mtime_sec_) || !r.i64(mtime_nsec_) ||
+        !r.u64(interval_) || !r.u64(last_.timestamp) || !r.u64(last_.offset)) {
+        return false;
+    }
+
+    uint32_t nentries;
+    if (!r.u32(nentries)) {
+        return false;
+    }
+
+    entries_.clear();
+    for (uint32_t i = 0; i < nentries; ++i) {
+        Entry e;
+        if (!r.u64(e.timestamp) || !r.u64(e.offset)) {
+            return false;
+        }
+        entries_.push_back(e);
+    }
+
+    uint32_t nchannels;
+    if (!r.u32(nchannels)) {
+        return false;
+    }
+
+    channels_.clear();
+    for (uint32_t i = 0; i < nchannels; ++i) {
+        ChannelEntry c;
+        if (!r.str(c.identifier.host_name) ||
+            !r.str(c.identifier.application_name) ||
+            !r.str(c.identifier.channel_name) ||
+            !r.u64(c.timestamp) || !r.u64(c.offset)) {
+            return false;
+        }
+        channels_.push_back(std::move(c));
+    }
+
+    uint32_t nkeyframes;
+    if (!r.u32(nkeyframes)) {
+        return false;
+    }
+
+    keyframes_.clear();
+    for (uint32_t i = 0; i < nkeyframes; ++i) {
+        KeyframeEntries k;
+        uint32_t n;
+        if (!r.str(k.identifier.host_name) ||
+            !r.str(k.identifier.application_name) ||
+            !r.str(k.identifier.channel_name) ||
+            !r.u32(n)) {
+            return false;
+        }
+        for (uint32_t j = 0; j < n; ++j) {
+            Entry e;
+            if (!r.u64(e.timestamp) || !r.u64(e.offset)) {
+                return false;
+            }
+            k.entries.push_back(e);
+        }
+        keyframes_.push_back(std::move(k));
+    }
+
+    return r.done();
+}
+
+bool TimeIndex::fresh(int fd) const
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return false;
+    }
+
+    return static_cast<uint64_t>(st.st_size) == file_size_ &&
+        st.st_mtim.tv_sec == mtime_sec_ &&
+        st.st_mtim.tv_nsec == mtime_nsec_;
+}
+
+bool TimeIndex::find(uint64_t timestamp, uint64_t& offset) const
+{
+    if (entries_.empty() || timestamp < entries_.front().timestamp ||
+        timestamp > last_.timestamp) {
+        return false;
+    }
+
+    // The last entry no later than the target
+    auto it = std::upper_bound(entries_.begin(), entries_.end(), timestamp,
+        [](uint64_t t, const Entry& e) { return t < e.timestamp; });
+
+    offset = std::prev(it)->offset;
+
+    return true;
+}
+
+const TimeIndex::ChannelEntry * TimeIndex::channel(const Identifier& identifier) const
+{
+    for (auto&& c : channels_) {
+        if (c.identifier == identifier) {
+            return &c;
+        }
+    }
+
+    return nullptr;
+}
+
+bool TimeIndex::find_keyframe(const Identifier& identifier, uint64_t offset,
+    uint64_t& keyframe_offset) const
+{
+    auto k = keyframes(identifier);
+    if (k == nullptr) {
+        return false;
+    }
+
+    // The last entry no later in the file than `offset`
+    auto it = std::upper_bound(k->entries.begin(), k->entries.end(), offset,
+        [](uint64_t o, const Entry& e) { return o < e.offset; });
+
+    if (it == k->entries.begin()) {
+        return false;
+    }
+
+    keyframe_offset = std::prev(it)->offset;
+
+    return true;
+}
+
+const TimeIndex::KeyframeEntries * TimeIndex::keyframes(const Identifier& identifier) const
+{
+    for (auto&& k : keyframes_) {
+        if (k.identifier == identifier) {
+            return &k;
+        }
+    }
+
+    return nullptr;
+}
+
+} // namespace lt::slipstream
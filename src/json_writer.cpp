@@ -0,0 +1,203 @@
+#include "lt/slipstream/json_writer.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <charconv>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SLIPSTREAM_X86 1
+#endif
+
+namespace lt::slipstream::json {
+
+// Whether c must be escaped
+static inline bool needs_escape(uint8_t c)
+{
+    return c < 0x20 || c == '"' || c == '\\' || c == '/';
+}
+
+static size_t find_escape_scalar(const uint8_t * data, size_t size, size_t i)
+{
+    for (; i < size; ++i) {
+        if (needs_escape(data[i])) {
+            return i;
+        }
+    }
+
+    return size;
+}
+
+#ifdef SLIPSTREAM_X86
+
+// Compare 16 (or 32) characters at once against each character that must
+// be escaped; control characters are those unchanged by an unsigned
+// minimum with 0x1f.
+
+__attribute__((target("sse2")))
+static size_t find_escape_sse2(const uint8_t * data, size_t size)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i control = _mm_set1_epi8(0x1f);
+
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(b, quote), _mm_cmpeq_epi8(b, backslash)),
+            _mm_or_si128(_mm_cmpeq_epi8(b, slash),
+                _mm_cmpeq_epi8(_mm_min_epu8(b, control), b)));
+
+        int mask = _mm_movemask_epi8(eq);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return find_escape_scalar(data, size, i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_escape_avx2(const uint8_t * data, size_t size)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i control = _mm256_set1_epi8(0x1f);
+
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+
+        __m256i eq = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(b, quote), _mm256_cmpeq_epi8(b, backslash)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(b, slash),
+                _mm256_cmpeq_epi8(_mm256_min_epu8(b, control), b)));
+
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return i + find_escape_sse2(data + i, size - i);
+}
+
+#endif
+
+// The offset of the first character in `data` that must be escaped, or
+// `size` if there is none
+static size_t find_escape(const uint8_t * data, size_t size)
+{
+#ifdef SLIPSTREAM_X86
+    static const bool have_avx2 = __builtin_cpu_supports("avx2");
+    static const bool have_sse2 = __builtin_cpu_supports("sse2");
+
+    if (have_avx2) {
+        return find_escape_avx2(data, size);
+    } else if (have_sse2) {
+        return find_escape_sse2(data, size);
+    }
+#endif
+
+    return find_escape_scalar(data, size, 0);
+}
+
+void append_escaped(std::string& out, std::string_view s)
+{
+    static constexpr char hex[] = "0123456789abcdef";
+
+    auto data = reinterpret_cast<const uint8_t*>(s.data());
+    size_t size = s.size();
+
+    while (size > 0) {
+        size_t i = find_escape(data, size);
+        out.append(reinterpret_cast<const char*>(data), i);
+
+        if (i == size) {
+            break;
+        }
+
+        uint8_t c = data[i];
+
+        switch (c) {
+            case '\\': out += "\\\\"; break;
+            case '"': out += "\\\""; break;
+            case '/': out += "\\/"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default: {
+                char u[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                out.append(u, sizeof(u));
+                break;
+            }
+        }
+
+        data += i + 1;
+        size -= i + 1;
+    }
+}
+
+void Writer::number(uint64_t value)
+{
+    char buf[20];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    out_.append(buf, result.ptr - buf);
+}
+
+void Writer::timestamp(uint64_t timestamp)
+{
+    static constexpr uint64_t one_billion = 1000000000L;
+
+    int64_t second = timestamp / one_billion;
+    uint64_t nanos = timestamp % one_billion;
+
+    if (second != second_) {
+        time_t epoch_seconds = second;
+        tm tm;
+        gmtime_r(&epoch_seconds, &tm);
+
+        prefix_length_ = strftime(prefix_, sizeof(prefix_), "%FT%T", &tm);
+        second_ = second;
+    }
+
+    char fraction[10];
+    fraction[0] = '.';
+    for (int i = 9; i > 0; --i) {
+        fraction[i] = '0' + nanos % 10;
+        nanos /= 10;
+    }
+
+    out_.push_back('"');
+    out_.append(prefix_, prefix_length_);
+    out_.append(fraction, sizeof(fraction));
+    out_.push_back('"');
+}
+
+void Writer::frame_begin(uint64_t source_timestamp, const Identifier& identifier)
+{
+    out_ += "{\"timestamp\":";
+    timestamp(source_timestamp);
+    out_ += ",\"epochMillis\":";
+    number(source_timestamp / 1000000);
+    out_ += ",\"nanos\":";
+    number(source_timestamp % 1000000);
+    out_ += ",\"host\":";
+    string(identifier.host_name);
+    out_ += ",\"app\":";
+    string(identifier.application_name);
+    out_ += ",\"channel\":";
+    string(identifier.channel_name);
+    out_ += ",\"data\":";
+}
+
+} // namespace lt::slipstream::json
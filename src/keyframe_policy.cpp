@@ -0,0 +1,47 @@
+#include "lt/slipstream/keyframe_policy.h"
+
+namespace lt::slipstream {
+
+KeyframeSchedule::KeyframeSchedule(const KeyframePolicy& policy)
+    : policy_(policy), has_keyframe_(false), frames_(0),
+      keyframe_timestamp_(0), keyframe_size_(0)
+{
+}
+
+bool KeyframeSchedule::due(uint64_t timestamp) const
+{
+    if (!has_keyframe_) {
+        return true;
+    }
+
+    if (policy_.every_frames != 0 && frames_ >= policy_.every_frames) {
+        return true;
+    }
+
+    if (policy_.every_ns != 0 && timestamp >= keyframe_timestamp_ + policy_.every_ns) {
+        return true;
+    }
+
+    return false;
+}
+
+bool KeyframeSchedule::oversized(size_t size) const
+{
+    return policy_.max_delta_ratio != 0 &&
+        size > policy_.max_delta_ratio * keyframe_size_;
+}
+
+void KeyframeSchedule::keyframe(uint64_t timestamp, size_t size)
+{
+    has_keyframe_ = true;
+    frames_ = 1;
+    keyframe_timestamp_ = timestamp;
+    keyframe_size_ = size;
+}
+
+void KeyframeSchedule::delta()
+{
+    frames_++;
+}
+
+} // namespace lt::slipstream
@@ -0,0 +1,99 @@
+#include "lt/slipstream/mapped_input.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <system_error>
+
+#include "lt/slipstream/mapped_output.h"
+
+namespace lt::slipstream {
+
+MappedInputStream::MappedInputStream(const std::string& path)
+    : data_(nullptr), mapped_(0), size_(0), position_(0)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    // The mapping remains valid once the descriptor is closed
+    kj::AutoCloseFd closer(fd);
+    map(fd);
+
+    // Looked for once the size is taken, as a writer creates its sidecar
+    // before preallocating: without one, the mapping holds whole frames
+    if (auto committed = CommittedLength::open(path)) {
+        size_ = std::min<size_t>(size_, committed->get());
+    }
+}
+
+MappedInputStream::MappedInputStream(int fd)
+    : data_(nullptr), mapped_(0), size_(0), position_(0)
+{
+    map(fd);
+}
+
+MappedInputStream::~MappedInputStream() noexcept(false)
+{
+    if (data_ != nullptr) {
+        munmap(const_cast<uint8_t*>(data_), mapped_);
+    }
+}
+
+void MappedInputStream::map(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    size_ = st.st_size;
+
+    if (size_ == 0) {
+        return;
+    }
+
+    void * addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    madvise(addr, size_, MADV_SEQUENTIAL);
+
+    data_ = static_cast<const uint8_t*>(addr);
+    mapped_ = size_;
+}
+
+kj::ArrayPtr<const kj::byte> MappedInputStream::tryGetReadBuffer()
+{
+    return kj::arrayPtr(data_ + position_, size_ - position_);
+}
+
+size_t MappedInputStream::tryRead(void* buffer, size_t minBytes, size_t maxBytes)
+{
+    size_t n = std::min(maxBytes, size_ - position_);
+
+    if (n > 0) {
+        memcpy(buffer, data_ + position_, n);
+        position_ += n;
+    }
+
+    return n;
+}
+
+void MappedInputStream::skip(size_t bytes)
+{
+    if (bytes > size_ - position_) {
+        position_ = size_;
+        throw std::runtime_error("MappedInputStream: premature EOF");
+    }
+
+    position_ += bytes;
+}
+
+} // namespace lt::slipstream
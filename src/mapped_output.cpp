@@ -0,0 +1,237 @@
+#include "lt/slipstream/mapped_output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+
+namespace lt::slipstream {
+
+struct CommitRecord {
+    static constexpr uint64_t magic_value = 0x74696d6d6f637373; // "sscommit"
+    static constexpr size_t size = 4096;
+
+    uint64_t magic;
+    std::atomic<uint64_t> committed;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+std::string CommittedLength::sidecar_path(const std::string& path)
+{
+    return path + ".sscommit";
+}
+
+std::shared_ptr<const CommittedLength> CommittedLength::open(const std::string& path)
+{
+    int fd = ::open(sidecar_path(path).c_str(), O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+
+    kj::AutoCloseFd closer(fd);
+
+    try {
+        auto committed = std::make_shared<CommittedLength>(fd);
+        committed->path_ = sidecar_path(path);
+        return committed;
+    } catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+CommittedLength::CommittedLength(int fd)
+    : record_(nullptr)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    dev_ = st.st_dev;
+    ino_ = st.st_ino;
+
+    if (static_cast<size_t>(st.st_size) < CommitRecord::size) {
+        throw std::runtime_error("CommittedLength: not a commit sidecar");
+    }
+
+    void * addr = mmap(nullptr, CommitRecord::size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    record_ = static_cast<const CommitRecord*>(addr);
+
+    if (record_->magic != CommitRecord::magic_value) {
+        munmap(addr, CommitRecord::size);
+        throw std::runtime_error("CommittedLength: not a commit sidecar");
+    }
+}
+
+CommittedLength::~CommittedLength()
+{
+    munmap(const_cast<CommitRecord*>(record_), CommitRecord::size);
+}
+
+uint64_t CommittedLength::get() const
+{
+    return record_->committed.load(std::memory_order_acquire);
+}
+
+bool CommittedLength::current() const
+{
+    if (path_.empty()) {
+        return true;
+    }
+
+    struct stat st;
+    return stat(path_.c_str(), &st) == 0 && st.st_dev == dev_ && st.st_ino == ino_;
+}
+
+MappedAppendStream::MappedAppendStream(const std::string& path, size_t chunk_size)
+    : path_(path), chunk_size_(std::max<size_t>(chunk_size, 4096)),
+      data_(nullptr), mapped_(0), committed_(0), record_(nullptr)
+{
+    int fd = ::open(path.c_str(), O_RDWR|O_CREAT, S_IRUSR|S_IWUSR|S_IRGRP);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+    fd_ = kj::AutoCloseFd(fd);
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    committed_ = st.st_size;
+
+    // A sidecar left by a writer that crashed holds the length to recover
+    if (auto previous = CommittedLength::open(path)) {
+        committed_ = std::min<uint64_t>(committed_, previous->get());
+    }
+
+    if (ftruncate(fd, committed_) == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    // A new sidecar rather than the old one rewritten, so that readers
+    // still mapping the old one see that it has been replaced. The file is
+    // already cut back, so readers without a sidecar read whole frames.
+    unlink(CommittedLength::sidecar_path(path).c_str());
+
+    int sidecar = ::open(CommittedLength::sidecar_path(path).c_str(),
+        O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP);
+    if (sidecar == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    kj::AutoCloseFd sidecar_closer(sidecar);
+
+    if (ftruncate(sidecar, CommitRecord::size) == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    void * addr = mmap(nullptr, CommitRecord::size, PROT_READ|PROT_WRITE, MAP_SHARED, sidecar, 0);
+    if (addr == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    record_ = new (addr) CommitRecord{};
+    record_->committed.store(committed_, std::memory_order_relaxed);
+    record_->magic = CommitRecord::magic_value;
+
+    reserve(0);
+}
+
+MappedAppendStream::~MappedAppendStream() noexcept(false)
+{
+    if (data_ != nullptr) {
+        munmap(data_, mapped_);
+    }
+
+    // Readers fall back to the size of the file once the sidecar has gone
+    int result = ftruncate(fd_.get(), committed_);
+    if (result == 0) {
+        unlink(CommittedLength::sidecar_path(path_).c_str());
+    }
+
+    munmap(record_, CommitRecord::size);
+}
+
+void MappedAppendStream::reserve(size_t bytes)
+{
+    if (committed_ + bytes <= mapped_ && data_ != nullptr) {
+        return;
+    }
+
+    size_t size = (committed_ + bytes + chunk_size_) / chunk_size_ * chunk_size_;
+
+    if (fallocate(fd_.get(), 0, mapped_, size - mapped_) == -1) {
+        // Not every filesystem can preallocate
+        if (errno != EOPNOTSUPP || ftruncate(fd_.get(), size) == -1) {
+            throw std::system_error(errno, std::system_category());
+        }
+    }
+
+    void * addr;
+    if (data_ == nullptr) {
+        addr = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd_.get(), 0);
+    } else {
+        addr = mremap(data_, mapped_, size, MREMAP_MAYMOVE);
+    }
+
+    if (addr == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    data_ = static_cast<uint8_t*>(addr);
+    mapped_ = size;
+}
+
+void MappedAppendStream::write(const void* buffer, size_t size)
+{
+    reserve(size);
+
+    memcpy(data_ + committed_, buffer, size);
+    committed_ += size;
+
+    record_->committed.store(committed_, std::memory_order_release);
+}
+
+void MappedAppendStream::write(kj::ArrayPtr<const kj::ArrayPtr<const kj::byte>> pieces)
+{
+    size_t total = 0;
+    for (auto&& piece : pieces) {
+        total += piece.size();
+    }
+
+    reserve(total);
+
+    size_t offset = committed_;
+    for (auto&& piece : pieces) {
+        memcpy(data_ + offset, piece.begin(), piece.size());
+        offset += piece.size();
+    }
+
+    committed_ = offset;
+
+    record_->committed.store(committed_, std::memory_order_release);
+}
+
+void MappedAppendStream::sync()
+{
+    if (msync(data_, committed_, MS_SYNC) == -1 ||
+        msync(record_, CommitRecord::size, MS_SYNC) == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+}
+
+} // namespace lt::slipstream
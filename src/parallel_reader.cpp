@@ -0,0 +1,344 @@
+#include "lt/slipstream/parallel_reader.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "lt/slipstream/channel_dictionary.h"
+#include "lt/slipstream/framing.h"
+
+namespace lt::slipstream {
+
+namespace {
+
+// What a range's frames need from earlier ranges, and what they offer to
+// later ones
+struct RangeScan {
+    size_t end = 0;             // offset of the first frame after the range
+    bool compact = false;
+
+    // Header frames, the first of each channel in the range
+    std::vector<std::pair<Identifier, kj::ArrayPtr<const kj::byte>>> headers;
+
+    // Each delta channel's data frames from its last keyframe in the
+    // range, or all of them if it has none; `keyed` if the first is a
+    // keyframe
+    struct Chain {
+        bool keyed = false;
+        std::vector<kj::ArrayPtr<const kj::byte>> frames;
+    };
+    std::unordered_map<Identifier, Chain> chains;
+
+    // Channels with a delta before their first keyframe in the range
+    std::unordered_set<Identifier> needs_state;
+};
+
+// Walks the whole frames of `bytes` from `offset`, giving each frame's
+// framing and envelope
+class FrameWalker {
+   public:
+    FrameWalker(kj::ArrayPtr<const kj::byte> bytes, size_t offset)
+        : bytes_(bytes), offset_(offset), envelope_(nullptr)
+    {
+    }
+
+    // Decode the frame at the current offset. Returns false at the end of
+    // the bytes, or at anything that is not a valid frame.
+    bool decode()
+    {
+        if (offset_ + frame_header_length > bytes_.size() ||
+                !framing_.decode(bytes_.begin() + offset_)) {
+            return false;
+        }
+
+        if (offset_ + length() > bytes_.size()) {
+            return false;
+        }
+
+        auto in = kj::ArrayInputStream(bytes_.slice(offset_ + frame_header_length,
+            offset_ + frame_header_length + framing_.envelope_length));
+
+        uint16_t channel_id;
+        return dictionary_.read(in, framing_, envelope_, channel_id);
+    }
+
+    void advance() { offset_ += length(); }
+
+    size_t offset() const { return offset_; }
+
+    size_t length() const
+    {
+        return frame_header_length + framing_.envelope_length + framing_.payload_length;
+    }
+
+    kj::ArrayPtr<const kj::byte> frame() const
+    {
+        return bytes_.slice(offset_, offset_ + length());
+    }
+
+    const Framing& framing() const { return framing_; }
+
+    // The frame's envelope; nullptr for a compact frame whose channel id
+    // has not been registered
+    const InternedEnvelope * envelope() const { return envelope_; }
+
+   private:
+    kj::ArrayPtr<const kj::byte> bytes_;
+    size_t offset_;
+    Framing framing_;
+    ChannelDictionary dictionary_;
+    const InternedEnvelope * envelope_;
+};
+
+// Whether a valid frame starts at `offset` and is followed by another, or
+// by the end of the bytes
+bool frame_at(kj::ArrayPtr<const kj::byte> bytes, size_t offset)
+{
+    Framing framing;
+
+    if (offset + frame_header_length > bytes.size() ||
+            !framing.decode(bytes.begin() + offset)) {
+        return false;
+    }
+
+    size_t next = offset + frame_header_length + framing.envelope_length + framing.payload_length;
+    if (next == bytes.size()) {
+        return true;
+    }
+
+    return next + frame_header_length <= bytes.size() &&
+        framing.decode(bytes.begin() + next);
+}
+
+// The offset of the first frame at or after `offset`, or the size of the
+// bytes if there is none
+size_t resync(kj::ArrayPtr<const kj::byte> bytes, size_t offset)
+{
+    while (offset < bytes.size()) {
+        offset += find_frame_marker(bytes.begin() + offset, bytes.size() - offset);
+
+        if (offset >= bytes.size() || frame_at(bytes, offset)) {
+            break;
+        }
+
+        offset++;
+    }
+
+    return std::min(offset, bytes.size());
+}
+
+// Call f(i) for each i in [0, n) on up to `threads` threads
+template <typename F>
+void parallel_for(size_t n, size_t threads, F f)
+{
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+
+    auto work = [&]() {
+        for (size_t i; (i = next++) < n;) {
+            f(i);
+        }
+    };
+
+    for (size_t t = 1; t < std::min(threads, n); ++t) {
+        workers.emplace_back(work);
+    }
+
+    work();
+
+    for (auto&& w : workers) {
+        w.join();
+    }
+}
+
+RangeScan scan_range(kj::ArrayPtr<const kj::byte> bytes, size_t begin, size_t end)
+{
+    RangeScan scan;
+    std::unordered_set<Identifier> seen;
+
+    FrameWalker walker(bytes, begin);
+
+    for (; walker.offset() < end && walker.decode(); walker.advance()) {
+        if (walker.framing().compact()) {
+            scan.compact = true;
+            break;
+        }
+
+        auto envelope = walker.envelope();
+        auto& identifier = envelope->envelope.identifier;
+
+        if (auto pd = std::get_if<PayloadData>(&envelope->envelope.payload_kind)) {
+            auto& chain = scan.chains[identifier];
+
+            if (std::holds_alternative<PayloadKeyframe>(*pd)) {
+                chain.keyed = true;
+                chain.frames.clear();
+            } else if (seen.count(identifier) == 0) {
+                scan.needs_state.insert(identifier);
+            }
+
+            chain.frames.push_back(walker.frame());
+            seen.insert(identifier);
+        } else if (std::none_of(scan.headers.begin(), scan.headers.end(),
+                [&](auto&& h) { return h.first == identifier; })) {
+            scan.headers.emplace_back(identifier, walker.frame());
+        }
+    }
+
+    scan.end = walker.offset();
+
+    return scan;
+}
+
+} // namespace
+
+std::vector<FrameRange> split_frames(kj::ArrayPtr<const kj::byte> bytes,
+    size_t count, size_t threads)
+{
+    count = std::max<size_t>(count, 1);
+
+    std::vector<size_t> begins;
+    for (size_t i = 0; i < count; ++i) {
+        size_t begin = i == 0 ? 0 : resync(bytes, bytes.size() / count * i);
+        if (begin < bytes.size() && (begins.empty() || begin > begins.back())) {
+            begins.push_back(begin);
+        }
+    }
+
+    std::vector<FrameRange> ranges;
+
+    if (begins.size() <= 1) {
+        ranges.push_back({bytes, {}, 0});
+        return ranges;
+    }
+
+    std::vector<RangeScan> scans(begins.size());
+
+    parallel_for(begins.size(), threads, [&](size_t i) {
+        size_t end = i + 1 < begins.size() ? begins[i + 1] : bytes.size();
+        scans[i] = scan_range(bytes, begins[i], end);
+    });
+
+    // Each range must end exactly where the next begins; otherwise a split
+    // was not at a frame after all, or the file is damaged, and the file is
+    // read as one range, as a ChannelReader would read it
+    for (size_t i = 0; i < begins.size(); ++i) {
+        size_t end = i + 1 < begins.size() ? begins[i + 1] : bytes.size();
+
+        if (scans[i].compact || scans[i].end != end) {
+            ranges.push_back({bytes, {}, 0});
+            return ranges;
+        }
+    }
+
+    ranges.resize(begins.size());
+
+    parallel_for(begins.size(), threads, [&](size_t i) {
+        auto& range = ranges[i];
+        size_t end = i + 1 < begins.size() ? begins[i + 1] : bytes.size();
+
+        range.frames = bytes.slice(begins[i], end);
+        range.preamble_frames = 0;
+
+        // The first header of each channel seen so far
+        std::unordered_set<Identifier> headed;
+        for (size_t j = 0; j < i; ++j) {
+            for (auto&& [identifier, frame] : scans[j].headers) {
+                if (headed.insert(identifier).second) {
+                    range.preamble.push_back(frame);
+                }
+            }
+        }
+
+        // Each delta channel's last keyframe before the range and every
+        // delta after it, as a codec may carry state from one delta to the
+        // next
+        for (auto&& identifier : scans[i].needs_state) {
+            size_t first = i;
+            while (first > 0) {
+                auto it = scans[--first].chains.find(identifier);
+                if (it != scans[first].chains.end() && it->second.keyed) {
+                    break;
+                }
+            }
+
+            for (size_t j = first; j < i; ++j) {
+                auto it = scans[j].chains.find(identifier);
+                if (it != scans[j].chains.end()) {
+                    range.preamble.insert(range.preamble.end(),
+                        it->second.frames.begin(), it->second.frames.end());
+                    range.preamble_frames += it->second.frames.size();
+                }
+            }
+        }
+    });
+
+    return ranges;
+}
+
+PreambleInputStream::PreambleInputStream(const FrameRange& range)
+    : preamble_(range.preamble), next_(0), frames_(range.frames)
+{
+    next_part();
+}
+
+PreambleInputStream::~PreambleInputStream() noexcept(false) {}
+
+bool PreambleInputStream::next_part()
+{
+    while (current_.size() == 0) {
+        if (next_ < preamble_.size()) {
+            current_ = preamble_[next_++];
+        } else if (frames_.size() != 0) {
+            current_ = frames_;
+            frames_ = nullptr;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+kj::ArrayPtr<const kj::byte> PreambleInputStream::tryGetReadBuffer()
+{
+    return current_;
+}
+
+size_t PreambleInputStream::tryRead(void* buffer, size_t minBytes, size_t maxBytes)
+{
+    auto out = static_cast<kj::byte*>(buffer);
+    size_t n = 0;
+
+    while (n < maxBytes && next_part()) {
+        size_t c = std::min(maxBytes - n, current_.size());
+        memcpy(out + n, current_.begin(), c);
+        current_ = current_.slice(c, current_.size());
+        n += c;
+    }
+
+    next_part();
+
+    return n;
+}
+
+void PreambleInputStream::skip(size_t bytes)
+{
+    while (bytes > 0) {
+        if (!next_part()) {
+            throw std::runtime_error("skip past end of stream");
+        }
+
+        size_t c = std::min(bytes, current_.size());
+        current_ = current_.slice(c, current_.size());
+        bytes -= c;
+    }
+
+    next_part();
+}
+
+} // namespace lt::slipstream
@@ -0,0 +1,360 @@
+#include "lt/slipstream/query.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lt/slipstream/capnp.h"
+
+namespace lt::slipstream {
+
+static std::string trim(const std::string& s)
+{
+    size_t begin = s.find_first_not_of(" \t");
+    if (begin == std::string::npos) {
+        return {};
+    }
+
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(begin, end - begin + 1);
+}
+
+Predicate Predicate::parse(const std::string& text)
+{
+    static const std::pair<const char *, Op> ops[] = {
+        {"==", Op::eq}, {"!=", Op::ne}, {"<=", Op::le}, {">=", Op::ge},
+        {"<", Op::lt}, {">", Op::gt}, {"=", Op::eq},
+    };
+
+    size_t at = text.find_first_of("=!<>");
+    if (at == std::string::npos) {
+        throw QueryError("No comparison in predicate: " + text);
+    }
+
+    Predicate predicate;
+
+    for (auto&& [token, op] : ops) {
+        if (text.compare(at, strlen(token), token) == 0) {
+            predicate.path = trim(text.substr(0, at));
+            predicate.op = op;
+            predicate.literal = trim(text.substr(at + strlen(token)));
+            break;
+        }
+    }
+
+    if (predicate.path.empty() || predicate.literal.empty()) {
+        throw QueryError("Bad predicate: " + text);
+    }
+
+    auto& literal = predicate.literal;
+    if (literal.size() >= 2 && literal.front() == '"' && literal.back() == '"') {
+        literal = literal.substr(1, literal.size() - 2);
+    }
+
+    return predicate;
+}
+
+Query::Query(const std::vector<std::string>& fields, const std::vector<std::string>& predicates)
+    : fields_(fields)
+{
+    for (auto&& p : predicates) {
+        predicates_.push_back(Predicate::parse(p));
+    }
+}
+
+// The fields along a dotted path, or an empty path if it is not in the
+// schema
+static std::vector<::capnp::StructSchema::Field> find_path(::capnp::StructSchema schema,
+    const std::string& path)
+{
+    std::vector<::capnp::StructSchema::Field> fields;
+
+    size_t begin = 0;
+
+    while (true) {
+        size_t dot = path.find('.', begin);
+        std::string name = path.substr(begin, dot == std::string::npos ? std::string::npos : dot - begin);
+
+        bool found = false;
+        for (auto field : schema.getFields()) {
+            if (field.getProto().getName() == name.c_str()) {
+                fields.push_back(field);
+                found = true;
+                break;
+            }
+        }
+
+        if (!found) {
+            return {};
+        }
+
+        if (dot == std::string::npos) {
+            return fields;
+        }
+
+        auto type = fields.back().getType();
+        if (!type.isStruct()) {
+            return {};
+        }
+
+        schema = type.asStruct();
+        begin = dot + 1;
+    }
+}
+
+// The value at the end of `path`, or false if a field along it is not set
+static bool get_path(::capnp::DynamicStruct::Reader reader,
+    const std::vector<::capnp::StructSchema::Field>& path, ::capnp::DynamicValue::Reader& value)
+{
+    for (size_t i = 0; i < path.size(); ++i) {
+        if (!reader.has(path[i])) {
+            return false;
+        }
+
+        if (i + 1 == path.size()) {
+            value = reader.get(path[i]);
+        } else {
+            reader = reader.get(path[i]).as<::capnp::DynamicStruct>();
+        }
+    }
+
+    return true;
+}
+
+template <typename V>
+static bool compare(Predicate::Op op, const V& a, const V& b)
+{
+    switch (op) {
+        case Predicate::Op::eq: return a == b;
+        case Predicate::Op::ne: return a != b;
+        case Predicate::Op::lt: return a < b;
+        case Predicate::Op::le: return a <= b;
+        case Predicate::Op::gt: return a > b;
+        case Predicate::Op::ge: return a >= b;
+    }
+
+    return false;
+}
+
+static bool parse_signed(const std::string& s, int64_t& value)
+{
+    char * end;
+    errno = 0;
+    value = strtoll(s.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+static bool parse_unsigned(const std::string& s, uint64_t& value)
+{
+    if (s[0] == '-') {
+        return false;
+    }
+
+    char * end;
+    errno = 0;
+    value = strtoull(s.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+static bool parse_double(const std::string& s, double& value)
+{
+    char * end;
+    value = strtod(s.c_str(), &end);
+    return *end == '\0';
+}
+
+Query::Resolved& Query::resolve(::capnp::StructSchema schema)
+{
+    uint64_t id = schema.getProto().getId();
+
+    if (last_ != nullptr && last_id_ == id) {
+        return *last_;
+    }
+
+    auto it = schemas_.find(id);
+
+    if (it == schemas_.end()) {
+        Resolved resolved;
+
+        for (auto&& field : fields_) {
+            auto path = find_path(schema, field);
+            if (!path.empty()) {
+                resolved.fields.emplace_back(&field, std::move(path));
+            }
+        }
+
+        for (auto&& predicate : predicates_) {
+            auto path = find_path(schema, predicate.path);
+            if (path.empty()) {
+                resolved.never = true;
+                continue;
+            }
+
+            Comparison c;
+            c.op = predicate.op;
+
+            auto& literal = predicate.literal;
+            auto type = path.back().getType();
+            bool ordered = predicate.op != Predicate::Op::eq && predicate.op != Predicate::Op::ne;
+
+            switch (type.which()) {
+                case ::capnp::schema::Type::INT8:
+                case ::capnp::schema::Type::INT16:
+                case ::capnp::schema::Type::INT32:
+                case ::capnp::schema::Type::INT64:
+                    c.kind = Kind::signed_integer;
+                    if (!parse_signed(literal, c.i)) {
+                        c.kind = Kind::floating;
+                    }
+                    break;
+                case ::capnp::schema::Type::UINT8:
+                case ::capnp::schema::Type::UINT16:
+                case ::capnp::schema::Type::UINT32:
+                case ::capnp::schema::Type::UINT64:
+                    c.kind = Kind::unsigned_integer;
+                    if (!parse_unsigned(literal, c.u)) {
+                        c.kind = Kind::floating;
+                    }
+                    break;
+                case ::capnp::schema::Type::FLOAT32:
+                case ::capnp::schema::Type::FLOAT64:
+                    c.kind = Kind::floating;
+                    break;
+                case ::capnp::schema::Type::BOOL:
+                    if (ordered || (literal != "true" && literal != "false")) {
+                        throw QueryError("Bad comparison of bool field: " + predicate.path);
+                    }
+                    c.kind = Kind::boolean;
+                    c.b = literal == "true";
+                    break;
+                case ::capnp::schema::Type::TEXT:
+                    c.kind = Kind::text;
+                    c.s = literal;
+                    break;
+                case ::capnp::schema::Type::ENUM: {
+                    if (ordered) {
+                        throw QueryError("Bad comparison of enum field: " + predicate.path);
+                    }
+                    c.kind = Kind::enumerant;
+
+                    bool found = false;
+                    for (auto enumerant : type.asEnum().getEnumerants()) {
+                        if (enumerant.getProto().getName() == literal.c_str()) {
+                            c.e = enumerant.getOrdinal();
+                            found = true;
+                            break;
+                        }
+                    }
+                    if (!found) {
+                        throw QueryError("No enumerant " + literal + " for field: " + predicate.path);
+                    }
+                    break;
+                }
+                default:
+                    throw QueryError("Cannot compare field: " + predicate.path);
+            }
+
+            if (c.kind == Kind::floating && !parse_double(literal, c.d)) {
+                throw QueryError("Not a number: " + literal);
+            }
+
+            c.path = std::move(path);
+            resolved.comparisons.push_back(std::move(c));
+        }
+
+        it = schemas_.emplace(id, std::move(resolved)).first;
+    }
+
+    last_id_ = id;
+    last_ = &it->second;
+
+    return *last_;
+}
+
+bool Query::match(::capnp::DynamicStruct::Reader reader)
+{
+    auto& resolved = resolve(reader.getSchema());
+
+    if (resolved.never) {
+        return false;
+    }
+
+    for (auto&& c : resolved.comparisons) {
+        ::capnp::DynamicValue::Reader value;
+
+        if (!get_path(reader, c.path, value)) {
+            return false;
+        }
+
+        bool result = false;
+
+        switch (c.kind) {
+            case Kind::signed_integer:
+                result = compare(c.op, value.as<int64_t>(), c.i);
+                break;
+            case Kind::unsigned_integer:
+                result = compare(c.op, value.as<uint64_t>(), c.u);
+                break;
+            case Kind::floating:
+                result = compare(c.op, value.as<double>(), c.d);
+                break;
+            case Kind::boolean:
+                result = compare(c.op, value.as<bool>(), c.b);
+                break;
+            case Kind::text: {
+                auto text = value.as<::capnp::Text>();
+                result = compare(c.op, std::string_view(text.cStr(), text.size()), std::string_view(c.s));
+                break;
+            }
+            case Kind::enumerant:
+                result = compare(c.op, value.as<::capnp::DynamicEnum>().getRaw(), c.e);
+                break;
+        }
+
+        if (!result) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Query::project(json::Writer& out, ::capnp::DynamicStruct::Reader reader)
+{
+    auto& codec = json_codec();
+
+    if (fields_.empty()) {
+        auto text = codec.encode(::capnp::DynamicValue::Reader(reader), ::capnp::Type(reader.getSchema()));
+        out.raw(std::string_view(text.cStr(), text.size()));
+        return;
+    }
+
+    auto& resolved = resolve(reader.getSchema());
+
+    out.raw('{');
+
+    bool first = true;
+
+    for (auto&& [name, path] : resolved.fields) {
+        ::capnp::DynamicValue::Reader value;
+
+        if (!get_path(reader, path, value)) {
+            continue;
+        }
+
+        if (!first) {
+            out.raw(',');
+        }
+        first = false;
+
+        out.string(*name);
+        out.raw(':');
+
+        auto text = codec.encode(value, path.back().getType());
+        out.raw(std::string_view(text.cStr(), text.size()));
+    }
+
+    out.raw('}');
+}
+
+} // namespace lt::slipstream
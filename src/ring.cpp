@@ -0,0 +1,146 @@
+#include "lt/slipstream/ring.h"
+
+#include <string.h>
+
+namespace lt::slipstream {
+
+static size_t round_up_pow2(size_t n)
+{
+    size_t p = 64;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+SpscRing::SpscRing(size_t capacity)
+    : capacity_(round_up_pow2(capacity)),
+      mask_(capacity_ - 1),
+      buffer_(new uint8_t[capacity_]),
+      head_(0), cached_tail_(0),
+      tail_(0), cached_head_(0)
+{
+}
+
+SpscRing::~SpscRing()
+{
+}
+
+size_t SpscRing::record_size(size_t length)
+{
+    return record_header_ + ((length + 7) & ~static_cast<size_t>(7));
+}
+
+bool SpscRing::push(const void * data, size_t length)
+{
+    if (length > max_record()) {
+        return false;
+    }
+
+    size_t size = record_size(length);
+
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    size_t offset = head & mask_;
+    size_t contiguous = capacity_ - offset;
+    size_t needed = (size > contiguous) ? contiguous + size : size;
+
+    if (head + needed - cached_tail_ > capacity_) {
+        cached_tail_ = tail_.load(std::memory_order_acquire);
+        if (head + needed - cached_tail_ > capacity_) {
+            return false;
+        }
+    }
+
+    if (size > contiguous) {
+        uint32_t marker = wrap_marker_;
+        memcpy(&buffer_[offset], &marker, sizeof(marker));
+        head += contiguous;
+        offset = 0;
+    }
+
+    uint32_t length32 = length;
+    memcpy(&buffer_[offset], &length32, sizeof(length32));
+    memcpy(&buffer_[offset + record_header_], data, length);
+
+    head_.store(head + size, std::memory_order_release);
+
+    return true;
+}
+
+size_t SpscRing::peek(kj::ArrayPtr<const kj::byte> * records, size_t max)
+{
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+
+    if (tail == cached_head_) {
+        cached_head_ = head_.load(std::memory_order_acquire);
+    }
+
+    size_t n = 0;
+
+    while (n < max && tail != cached_head_) {
+        size_t offset = tail & mask_;
+        uint32_t length;
+        memcpy(&length, &buffer_[offset], sizeof(length));
+
+        if (length == wrap_marker_) {
+            // The producer publishes the wrap marker and the record
+            // following it together, so the record is guaranteed to be
+            // present.
+            tail += capacity_ - offset;
+            offset = 0;
+            memcpy(&length, &buffer_[offset], sizeof(length));
+        }
+
+        records[n++] = kj::arrayPtr(&buffer_[offset + record_header_], length);
+        tail += record_size(length);
+    }
+
+    return n;
+}
+
+void SpscRing::pop(size_t n)
+{
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+
+    while (n-- > 0) {
+        size_t offset = tail & mask_;
+        uint32_t length;
+        memcpy(&length, &buffer_[offset], sizeof(length));
+
+        if (length == wrap_marker_) {
+            tail += capacity_ - offset;
+            offset = 0;
+            memcpy(&length, &buffer_[offset], sizeof(length));
+        }
+
+        tail += record_size(length);
+    }
+
+    tail_.store(tail, std::memory_order_release);
+}
+
+kj::ArrayPtr<const kj::byte> SpscRing::front()
+{
+    kj::ArrayPtr<const kj::byte> record;
+
+    if (peek(&record, 1) == 0) {
+        return nullptr;
+    }
+
+    return record;
+}
+
+bool SpscRing::empty() const
+{
+    return head_.load(std::memory_order_acquire) ==
+        tail_.load(std::memory_order_acquire);
+}
+
+size_t SpscRing::used() const
+{
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    uint64_t head = head_.load(std::memory_order_acquire);
+    return head - tail;
+}
+
+} // namespace lt::slipstream
@@ -0,0 +1,187 @@
+#include "lt/slipstream/rotating_output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <system_error>
+
+#include "lt/slipstream/framing.h"
+
+namespace lt::slipstream {
+
+// Call f(framing, frame) for each whole frame in `frames`, until it returns
+// false
+template <typename F>
+static void for_each_frame(kj::ArrayPtr<const kj::byte> frames, F f)
+{
+    size_t offset = 0;
+
+    while (offset + frame_header_length <= frames.size()) {
+        Framing framing;
+
+        if (!framing.decode(frames.begin() + offset)) {
+            return;
+        }
+
+        size_t length = frame_header_length + framing.envelope_length + framing.payload_length;
+        if (offset + length > frames.size()) {
+            return;
+        }
+
+        if (!f(framing, frames.slice(offset, offset + length))) {
+            return;
+        }
+
+        offset += length;
+    }
+}
+
+// The timestamp of the first frame that has one, or 0
+static uint64_t first_timestamp(kj::ArrayPtr<const kj::ArrayPtr<const kj::byte>> pieces)
+{
+    uint64_t timestamp = 0;
+
+    for (auto&& piece : pieces) {
+        for_each_frame(piece, [&](const Framing& framing, kj::ArrayPtr<const kj::byte>) {
+            timestamp = framing.source_timestamp;
+            return timestamp == 0;
+        });
+
+        if (timestamp != 0) {
+            break;
+        }
+    }
+
+    return timestamp;
+}
+
+std::string RotatingOutputStream::file_path(const std::string& path, uint64_t sequence)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%06lu", static_cast<unsigned long>(sequence));
+    return path + suffix;
+}
+
+RotatingOutputStream::RotatingOutputStream(const std::string& path, const RotationPolicy& policy)
+    : path_(path), policy_(policy), sequence_(0), files_(0),
+      size_(0), headers_size_(0), has_period_(false), period_(0),
+      headers_written_(0)
+{
+    struct stat st;
+    while (stat(file_path(path_, sequence_).c_str(), &st) == 0) {
+        sequence_++;
+    }
+
+    open_next();
+}
+
+RotatingOutputStream::~RotatingOutputStream() noexcept(false)
+{
+}
+
+void RotatingOutputStream::write(const void* buffer, size_t size)
+{
+    auto piece = kj::arrayPtr(static_cast<const kj::byte*>(buffer), size);
+    write(kj::arrayPtr(&piece, 1));
+}
+
+void RotatingOutputStream::write(kj::ArrayPtr<const kj::ArrayPtr<const kj::byte>> pieces)
+{
+    size_t total = 0;
+    for (auto&& piece : pieces) {
+        total += piece.size();
+    }
+
+    uint64_t timestamp = first_timestamp(pieces);
+
+    if (!roll(timestamp) && policy_.header_interval_ns != 0 && timestamp != 0 &&
+            headers_written_ != 0 && timestamp >= headers_written_ + policy_.header_interval_ns) {
+        write_headers();
+    }
+
+    if (timestamp != 0) {
+        if (!has_period_ && policy_.interval_ns != 0) {
+            has_period_ = true;
+            period_ = timestamp / policy_.interval_ns;
+        }
+        if (headers_written_ == 0) {
+            headers_written_ = timestamp;
+        }
+    }
+
+    out_->write(pieces);
+    size_ += total;
+
+    for (auto&& piece : pieces) {
+        remember_headers(piece);
+    }
+}
+
+bool RotatingOutputStream::roll(uint64_t timestamp)
+{
+    bool full = policy_.max_bytes != 0 && size_ > headers_size_ &&
+        size_ >= policy_.max_bytes;
+
+    bool expired = policy_.interval_ns != 0 && timestamp != 0 && has_period_ &&
+        timestamp / policy_.interval_ns > period_;
+
+    if (full || expired) {
+        rotate();
+        return true;
+    }
+
+    return false;
+}
+
+void RotatingOutputStream::rotate()
+{
+    open_next();
+    write_headers();
+    headers_size_ = size_;
+}
+
+void RotatingOutputStream::open_next()
+{
+    current_path_ = file_path(path_, sequence_++);
+
+    int fd = open(current_path_.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    out_ = std::make_unique<kj::FdOutputStream>(kj::AutoCloseFd(fd));
+    files_++;
+    size_ = 0;
+    headers_size_ = 0;
+    has_period_ = false;
+    headers_written_ = 0;
+}
+
+void RotatingOutputStream::write_headers()
+{
+    for (auto&& header : headers_) {
+        out_->write(header.data(), header.size());
+        size_ += header.size();
+    }
+
+    // Taken from the next frame written
+    headers_written_ = 0;
+}
+
+void RotatingOutputStream::remember_headers(kj::ArrayPtr<const kj::byte> frames)
+{
+    for_each_frame(frames, [&](const Framing& framing, kj::ArrayPtr<const kj::byte> frame) {
+        if (framing.source_timestamp == 0 && framing.version == frame_version) {
+            std::string header(reinterpret_cast<const char*>(frame.begin()), frame.size());
+            if (seen_headers_.insert(header).second) {
+                headers_.push_back(std::move(header));
+            }
+        }
+        return true;
+    });
+}
+
+} // namespace lt::slipstream
@@ -1,5 +1,9 @@
 #include "lt/slipstream/scanner.h"
 
+#include <string.h>
+
+#include "lt/slipstream/seek.h"
+
 namespace lt::slipstream {
 
 PeekStream::~PeekStream() noexcept(false) {}
@@ -60,91 +64,270 @@ void PeekStream::skip(size_t bytes)
 }
 
 ScannerWrapper::ScannerWrapper(kj::InputStream& inner)
-    : inner_(PeekStream(inner)), checksum_(0), at_eof_(false)
+    : inner_(inner), buffer_(chunk_size_), begin_(0), end_(0),
+      peeked_(false), frame_(0), source_timestamp_(0), envelope_length_(0),
+      payload_length_(0), version_(frame_version), sync_(false)
 {
     reset();
 }
 
-uint8_t ScannerWrapper::advance() {
-    uint8_t cur = checksum_ & 0xFF;
+size_t ScannerWrapper::fill(size_t bytes)
+{
+    size_t keep = peeked_ ? frame_ : begin_;
 
-    checksum_ >>= 8;
+    if (end_ - begin_ >= bytes) {
+        return end_ - begin_;
+    }
 
-    if (at_eof_ && --buffered_ > 0) {
-        return cur;
+    // Move what is still needed to the front of the buffer, and make room
+    if (keep > 0 && (buffer_.size() - begin_ < bytes || end_ == buffer_.size())) {
+        memmove(buffer_.data(), buffer_.data() + keep, end_ - keep);
+        begin_ -= keep;
+        end_ -= keep;
+        if (peeked_) {
+            frame_ -= keep;
+        }
     }
 
-    try {
-        uint8_t b8;
-        inner_.read(&b8, 1);
-
-        uint32_t b32 = b8;
-        checksum_ += (b32 << 16);
-
-        buffered_++;
-        buffered_ = std::min(buffered_, 3);
-    } catch (const std::exception& e) {
-        if (at_eof_) {
-            throw e;
-        } else {
-            at_eof_ = true;
+    if (buffer_.size() - begin_ < bytes) {
+        buffer_.resize(std::max(2 * buffer_.size(), begin_ + bytes));
+    }
+
+    while (end_ - begin_ < bytes) {
+        size_t n = inner_.tryRead(buffer_.data() + end_, 1, buffer_.size() - end_);
+        if (n == 0) {
+            break;
         }
+        end_ += n;
     }
 
-    return cur;
+    return end_ - begin_;
+}
+
+size_t ScannerWrapper::lookahead() const
+{
+    return end_ - (peeked_ ? frame_ : begin_);
 }
 
 void ScannerWrapper::reset() {
-    checksum_ = 0;
-    buffered_ = 0;
-    at_eof_ = false;
-    source_timestamp_ = 0;
-    envelope_length_ = 0;
+    begin_ = 0;
+    end_ = 0;
+    peeked_ = false;
     next();
 }
 
-void ScannerWrapper::soft_reset() {
-    inner_.cancel_recording();
+bool ScannerWrapper::next() {
+    static constexpr size_t partial = sizeof(frame_marker) - 1;
+
+    peeked_ = false;
+
+    while (true) {
+        size_t avail = end_ - begin_;
+        size_t i = find_frame_marker(buffer_.data() + begin_, avail);
+
+        if (i < avail) {
+            begin_ += i;
+            return true;
+        }
+
+        // Keep any partial marker at the end of the buffer
+        size_t keep = std::min(avail, partial);
+        begin_ = end_ - keep;
+
+        try {
+            if (fill(keep + 1) <= keep) {
+                begin_ = end_;
+                return false;
+            }
+        } catch (const std::exception&) {
+            begin_ = end_;
+            return false;
+        }
+    }
+}
+
+size_t ScannerWrapper::frame_length()
+{
+    uint64_t source_timestamp;
 
-    while (buffered_ < 3) {
-        advance();
+    if (!peek(source_timestamp)) {
+        return 0;
     }
 
-    source_timestamp_ = 0;
-    envelope_length_ = 0;
+    return frame_header_length + envelope_length_ + payload_length_;
 }
 
-bool ScannerWrapper::next() {
-    soft_reset();
+bool ScannerWrapper::valid_frame_at(size_t offset) const
+{
+    if (end_ - offset < frame_header_length) {
+        return false;
+    }
+
+    Framing framing;
+    return framing.decode(buffer_.data() + offset);
+}
+
+bool ScannerWrapper::skip_frame()
+{
+    size_t length = frame_length();
+
+    if (length == 0) {
+        // Not at a valid frame: step past this position and search
+        if (begin_ == end_) {
+            return false;
+        }
+        peeked_ = false;
+        begin_ += 1;
+        return next();
+    }
+
+    peeked_ = false;
+    begin_ = frame_;
+
+    if (end_ - begin_ < length + frame_header_length) {
+        // The frame extends past the buffer. Where the inner stream can
+        // seek, skip the rest of it without reading; otherwise read it, so
+        // that a corrupt length can be recovered from without losing the
+        // frames after it.
+        auto seekable = dynamic_cast<SeekableStream*>(&inner_);
+        int64_t position = seekable != nullptr ? seekable->tell() : -1;
+
+        if (position != -1) {
+            return skip_frame_seeking(*seekable, position - (end_ - begin_), length);
+        }
 
-    while (checksum_ != marker_checksum_) {
         try {
-            advance();
-        } catch (std::exception&) {
+            fill(length + frame_header_length);
+        } catch (const std::exception&) {
+        }
+    }
+
+    size_t start = begin_;
+    size_t avail = end_ - begin_;
+
+    // The last frame in the stream
+    if (avail == length) {
+        begin_ = end_;
+        return false;
+    }
+
+    if (avail > length) {
+        begin_ += length;
+
+        if (valid_frame_at(begin_)) {
+            return true;
+        }
+    }
+
+    // The length was corrupt; rescan from just after the marker
+    begin_ = start + 1;
+    return next();
+}
+
+bool ScannerWrapper::skip_frame_seeking(SeekableStream& seekable, int64_t frame_start, size_t length)
+{
+    try {
+        skip(length);
+
+        if (fill(frame_header_length) == 0) {
             return false;
         }
+
+        if (valid_frame_at(begin_)) {
+            return true;
+        }
+    } catch (const std::exception&) {
     }
 
-    return true;
+    // The length was corrupt; go back to just after the marker and rescan
+    if (seekable.seek(frame_start + 1, SEEK_SET) == -1) {
+        begin_ = end_;
+        return false;
+    }
+
+    begin_ = 0;
+    end_ = 0;
+
+    return next();
 }
 
 size_t ScannerWrapper::copy_frame(kj::OutputStream& out)
 {
+    size_t length = frame_length();
+
+    if (length == 0) {
+        return scan_frame(out);
+    }
+
+    peeked_ = false;
+    begin_ = frame_;
+
+    try {
+        // Check that the frame is followed by another, or by the end of the
+        // stream, before trusting its length.
+        size_t avail = fill(length + frame_header_length);
+
+        if (avail == length || (avail > length && valid_frame_at(begin_ + length))) {
+            out.write(buffer_.data() + begin_, length);
+            begin_ += length;
+            return length;
+        }
+    } catch (const std::exception&) {
+    }
+
+    return scan_frame(out);
+}
+
+size_t ScannerWrapper::scan_frame(kj::OutputStream& out)
+{
+    static constexpr size_t partial = sizeof(frame_marker) - 1;
+
     size_t n = 0;
 
-    soft_reset();
+    peeked_ = false;
 
-    while (true) {
-        try {
-            uint8_t cur = advance();
-            out.write(&cur, 1);
-            ++n;
-            if (checksum_ == marker_checksum_) {
+    try {
+        if (fill(1) == 0) {
+            return 0;
+        }
+
+        // Copy at least one byte, so that a marker at the current position
+        // is copied rather than treated as the end of the frame.
+        size_t from = 1;
+
+        while (true) {
+            size_t avail = end_ - begin_;
+            size_t i = avail;
+
+            if (from < avail) {
+                i = from + find_frame_marker(buffer_.data() + begin_ + from, avail - from);
+            }
+
+            if (i < avail) {
+                out.write(buffer_.data() + begin_, i);
+                n += i;
+                begin_ += i;
+                break;
+            }
+
+            // Write all but a possible partial marker
+            size_t emit = avail > partial ? avail - partial : 0;
+            if (emit > 0) {
+                out.write(buffer_.data() + begin_, emit);
+                n += emit;
+                begin_ += emit;
+                from = from > emit ? from - emit : 0;
+            }
+
+            size_t rest = end_ - begin_;
+            if (fill(rest + 1) <= rest) {
+                out.write(buffer_.data() + begin_, rest);
+                n += rest;
+                begin_ = end_;
                 break;
             }
-        } catch (const std::exception&) {
-            break;
         }
+    } catch (const std::exception&) {
     }
 
     return n;
@@ -152,25 +335,37 @@ size_t ScannerWrapper::copy_frame(kj::OutputStream& out)
 
 bool ScannerWrapper::peek(uint64_t& source_timestamp)
 {
-    if (source_timestamp_) {
+    if (peeked_) {
         source_timestamp = source_timestamp_;
         return true;
     }
 
-    InputStream& in = *this;
-
-    inner_.start_recording();
+    try {
+        if (fill(frame_header_length) < frame_header_length) {
+            return false;
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
 
     Framing framing;
 
-    auto result = framing.read(in);
-    if (!result.first) {
-        inner_.cancel_recording();
+    if (!framing.decode(buffer_.data() + begin_)) {
         return false;
     }
 
+    // As before, the header is consumed: the stream is left positioned at
+    // the envelope, and the frame is rewound to by peek(source_timestamp,
+    // envelope).
+    peeked_ = true;
+    frame_ = begin_;
+    begin_ += frame_header_length;
+
     source_timestamp_ = framing.source_timestamp;
     envelope_length_ = framing.envelope_length;
+    payload_length_ = framing.payload_length;
+    version_ = framing.version;
+    sync_ = framing.sync;
 
     source_timestamp = source_timestamp_;
 
@@ -179,68 +374,113 @@ bool ScannerWrapper::peek(uint64_t& source_timestamp)
 
 bool ScannerWrapper::peek(uint64_t& source_timestamp, Envelope& envelope)
 {
-    InputStream& in = *this;
+    const InternedEnvelope * e;
+
+    if (!peek(source_timestamp, e)) {
+        return false;
+    }
+
+    envelope = e->envelope;
 
-    if (source_timestamp_ == 0) {
+    return true;
+}
+
+bool ScannerWrapper::peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope)
+{
+    while (true) {
         if (!peek(source_timestamp)) {
             return false;
         }
-    }
 
-    source_timestamp = source_timestamp_;
+        begin_ = frame_ + frame_header_length;
 
-    if (!envelope.read(in, envelope_length_)) {
-        inner_.cancel_recording();
-        return false;
-    }
+        // An envelope that is not all there yet, eg. at the end of a file
+        // that is still being written, leaves the frame to be read again
+        try {
+            if (fill(envelope_length_) < envelope_length_) {
+                begin_ = frame_;
+                return false;
+            }
+        } catch (const std::exception&) {
+            begin_ = frame_;
+            return false;
+        }
 
-    inner_.stop_recording_rewind();
+        auto in = kj::ArrayInputStream(kj::arrayPtr(
+            const_cast<const uint8_t*>(buffer_.data()) + begin_, envelope_length_));
 
-    buffered_ = 3;
+        auto framing = Framing {static_cast<uint32_t>(envelope_length_),
+            static_cast<uint32_t>(payload_length_), source_timestamp_, 0, sync_, version_};
 
-    return true;
-}
+        uint16_t channel_id;
 
+        if (!dictionary_.read(in, framing, envelope, channel_id)) {
+            return false;
+        }
+
+        // Rewind to the start of the frame
+        begin_ = frame_;
+
+        if (envelope != nullptr && !framing.registration()) {
+            return true;
+        }
+
+        // A registration, which has been learned from, or a channel id
+        // that has not been registered yet
+        if (!skip_frame()) {
+            return false;
+        }
+    }
+}
 
 size_t ScannerWrapper::tryRead(void* buffer, size_t minBytes, size_t maxBytes)
 {
-    size_t nread = 0;
     uint8_t * b = static_cast<uint8_t*>(buffer);
 
-    while (buffered_ > 0 && maxBytes > 0) {
-        switch (buffered_) {
-            case 1:
-                *b++ = (checksum_ & 0xFF0000) >> 16;
-                break;
-            case 2:
-                *b++ = (checksum_ & 0xFF00) >> 8;
-                break;
-            default:
-                *b++ = checksum_ & 0xFF;
-                break;
+    peeked_ = false;
+
+    size_t n = std::min(maxBytes, end_ - begin_);
+    memcpy(b, buffer_.data() + begin_, n);
+    begin_ += n;
+
+    while (n < minBytes) {
+        size_t want = maxBytes - n;
+
+        // Large reads bypass the buffer
+        if (want >= chunk_size_) {
+            n += inner_.tryRead(b + n, minBytes - n, want);
+            break;
         }
-        nread++;
-        buffered_--;
-        minBytes--;
-        maxBytes--;
-    }
 
-    nread += inner_.tryRead(b, minBytes, maxBytes);
+        size_t avail = fill(minBytes - n);
+        if (avail == 0) {
+            break;
+        }
 
-    return nread;
+        size_t c = std::min(avail, want);
+        memcpy(b + n, buffer_.data() + begin_, c);
+        begin_ += c;
+        n += c;
+    }
+
+    return n;
 }
 
 void ScannerWrapper::skip(size_t bytes)
 {
-    if (bytes <= static_cast<size_t>(buffered_)) {
-        buffered_ -= bytes;
-    } else {
-        inner_.skip(bytes - buffered_);
-        buffered_ = 0;
+    peeked_ = false;
+
+    size_t avail = end_ - begin_;
+
+    if (bytes <= avail) {
+        begin_ += bytes;
+        return;
     }
 
-    source_timestamp_ = 0;
-    envelope_length_ = 0;
+    begin_ = 0;
+    end_ = 0;
+
+    inner_.skip(bytes - avail);
 }
 
 PathScanner::PathScanner(const std::string& path)
@@ -268,6 +508,11 @@ bool PathScanner::next()
     return scanner_->next();
 }
 
+bool PathScanner::skip_frame()
+{
+    return scanner_->skip_frame();
+}
+
 bool PathScanner::peek(uint64_t& source_timestamp)
 {
     return scanner_->peek(source_timestamp);
@@ -278,6 +523,11 @@ bool PathScanner::peek(uint64_t& source_timestamp, Envelope& envelope)
     return scanner_->peek(source_timestamp, envelope);
 }
 
+bool PathScanner::peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope)
+{
+    return scanner_->peek(source_timestamp, envelope);
+}
+
 size_t PathScanner::copy_frame(kj::OutputStream& out)
 {
     return scanner_->copy_frame(out);
@@ -317,6 +567,11 @@ bool PathScannerGroup::next()
     return scanner_group_->next();
 }
 
+bool PathScannerGroup::skip_frame()
+{
+    return scanner_group_->skip_frame();
+}
+
 bool PathScannerGroup::peek(uint64_t& source_timestamp)
 {
     return scanner_group_->peek(source_timestamp);
@@ -327,6 +582,11 @@ bool PathScannerGroup::peek(uint64_t& source_timestamp, Envelope& envelope)
     return scanner_group_->peek(source_timestamp, envelope);
 }
 
+bool PathScannerGroup::peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope)
+{
+    return scanner_group_->peek(source_timestamp, envelope);
+}
+
 size_t PathScannerGroup::copy_frame(kj::OutputStream& out)
 {
     return scanner_group_->copy_frame(out);
@@ -1,8 +1,12 @@
 #include "lt/slipstream/seek.h"
 
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <limits>
+
 #include "lt/slipstream/seek_time.h"
 
 namespace lt::slipstream {
@@ -14,12 +18,17 @@ FdSeeker::~FdSeeker() noexcept(false) {}
 PathSeeker::~PathSeeker() noexcept(false) {}
 PathSeekerGroup::~PathSeekerGroup() noexcept(false) {}
 
-FdSeekableStream::FdSeekableStream(int fd) : kj::FdInputStream(fd), fd_(fd)
+FdSeekableStream::FdSeekableStream(int fd, const std::string& path)
+    : kj::FdInputStream(fd), fd_(fd), path_(path), size_(0)
 {
 }
 
 int64_t FdSeekableStream::seek(int64_t offset, int whence)
 {
+    if (whence == SEEK_END && !path_.empty()) {
+        return lseek64(fd_, limit(std::numeric_limits<int64_t>::max()) + offset, SEEK_SET);
+    }
+
     return lseek64(fd_, offset, whence);
 }
 
@@ -28,8 +37,109 @@ int64_t FdSeekableStream::tell()
     return lseek64(fd_, 0, SEEK_CUR);
 }
 
-FdSeeker::FdSeeker(int fd) : fd_(fd), fdSeekableStream_(fd),
-    scanner_(ScannerWrapper(fdSeekableStream_))
+int64_t FdSeekableStream::end()
+{
+    struct stat st;
+
+    if (fstat(fd_, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return -1;
+    }
+
+    if (!path_.empty()) {
+        return std::min<int64_t>(st.st_size, limit(tell()));
+    }
+
+    return st.st_size;
+}
+
+int64_t FdSeekableStream::limit(int64_t position)
+{
+    if (committed_) {
+        int64_t committed = committed_->get();
+        if (position < committed) {
+            return committed;
+        }
+    } else if (position < size_) {
+        return size_;
+    }
+
+    // The size is taken before looking for the sidecar: a writer creates
+    // its sidecar before preallocating, so if there is none, the file
+    // holds only whole frames
+    struct stat st;
+    if (fstat(fd_, &st) == -1) {
+        return size_;
+    }
+    size_ = st.st_size;
+
+    if (!committed_ || !committed_->current()) {
+        committed_ = CommittedLength::open(path_);
+    }
+
+    return committed_ ? committed_->get() : size_;
+}
+
+void FdSeekableStream::follow(std::unique_ptr<FileWatch> watch)
+{
+    watch_ = std::move(watch);
+}
+
+size_t FdSeekableStream::tryRead(void* buffer, size_t minBytes, size_t maxBytes)
+{
+    auto b = static_cast<uint8_t*>(buffer);
+
+    size_t n = read_available(b, minBytes, maxBytes);
+
+    // Only a regular file can be waited on to grow
+    while (watch_ && n < minBytes && end() != -1) {
+        if (!watch_->wait([this]() { return end() > tell(); })) {
+            break;
+        }
+
+        n += read_available(b + n, minBytes - n, maxBytes - n);
+    }
+
+    return n;
+}
+
+size_t FdSeekableStream::read_available(void* buffer, size_t minBytes, size_t maxBytes)
+{
+    // Stop at the committed length, as if it were the end of the file
+    int64_t here = path_.empty() ? -1 : tell();
+
+    if (here != -1) {
+        int64_t last = limit(here);
+
+        if (here >= last) {
+            return 0;
+        }
+
+        maxBytes = std::min<size_t>(maxBytes, last - here);
+        minBytes = std::min(minBytes, maxBytes);
+    }
+
+    return kj::FdInputStream::tryRead(buffer, minBytes, maxBytes);
+}
+
+void FdSeekableStream::skip(size_t bytes)
+{
+    // Seeking past the end of a file succeeds, so only seek within it; a
+    // short file, pipe or socket is read as usual, which throws at EOF.
+    int64_t here = tell();
+    int64_t last = end();
+
+    if (here != -1 && last != -1 && here + static_cast<int64_t>(bytes) <= last) {
+        seek(bytes, SEEK_CUR);
+        return;
+    }
+
+    kj::FdInputStream::skip(bytes);
+}
+
+FdSeeker::FdSeeker(int fd, std::optional<TimeIndex> index,
+    const std::string& path)
+    : fd_(fd), fdSeekableStream_(fd, path),
+      scanner_(ScannerWrapper(fdSeekableStream_)), index_(std::move(index))
 {
 }
 
@@ -42,14 +152,94 @@ int64_t FdSeeker::seek(int64_t offset, int whence)
 
 int64_t FdSeeker::tell()
 {
-    return fdSeekableStream_.tell() - frame_header_length;
+    // The scanner reads ahead; report the position of the frame it is at
+    return fdSeekableStream_.tell() - scanner_.lookahead();
 }
 
 bool FdSeeker::seek_time(uint64_t timestamp)
 {
+    if (index_ && index_->fresh(fd_)) {
+        uint64_t offset;
+
+        if (!index_->find(timestamp, offset)) {
+            return false;
+        }
+
+        seek(offset, SEEK_SET);
+
+        SeekBounds bounds;
+        bounds.roll<FdSeeker>(*this, timestamp);
+
+        return true;
+    }
+
     return seek_time_bisect<FdSeeker>(*this, timestamp);
 }
 
+// Scan the frames from the one at or after `from` up to and including the
+// one at `to`, for the last keyframe of `identifier`
+static bool last_keyframe(FdSeeker& seeker, const Identifier& identifier,
+    uint64_t from, uint64_t to, uint64_t& keyframe_offset)
+{
+    bool found = false;
+
+    seeker.seek(from, SEEK_SET);
+
+    do {
+        uint64_t timestamp;
+        const InternedEnvelope * envelope;
+
+        if (!seeker.peek(timestamp, envelope)) {
+            continue;
+        }
+
+        uint64_t offset = seeker.tell();
+        if (offset > to) {
+            break;
+        }
+
+        auto pd = std::get_if<PayloadData>(&envelope->envelope.payload_kind);
+        if (pd != nullptr && std::holds_alternative<PayloadKeyframe>(*pd) &&
+                envelope->envelope.identifier == identifier) {
+            keyframe_offset = offset;
+            found = true;
+        }
+    } while (seeker.skip_frame());
+
+    return found;
+}
+
+bool FdSeeker::find_keyframe(const Identifier& identifier, uint64_t offset,
+    uint64_t& keyframe_offset)
+{
+    if (index_ && index_->fresh(fd_) && index_->keyframes(identifier) != nullptr) {
+        uint64_t from;
+
+        if (!index_->find_keyframe(identifier, offset, from)) {
+            return false;
+        }
+
+        return last_keyframe(*this, identifier, from, offset, keyframe_offset);
+    }
+
+    for (uint64_t distance = 64 * 1024; ; distance *= 4) {
+        uint64_t from = offset > distance ? offset - distance : 0;
+
+        if (last_keyframe(*this, identifier, from, offset, keyframe_offset)) {
+            return true;
+        }
+
+        if (from == 0) {
+            return false;
+        }
+    }
+}
+
+void FdSeeker::follow(std::unique_ptr<FileWatch> watch)
+{
+    fdSeekableStream_.follow(std::move(watch));
+}
+
 void FdSeeker::reset()
 {
     return scanner_.reset();
@@ -60,6 +250,11 @@ bool FdSeeker::next()
     return scanner_.next();
 }
 
+bool FdSeeker::skip_frame()
+{
+    return scanner_.skip_frame();
+}
+
 bool FdSeeker::peek(uint64_t& source_timestamp)
 {
     return scanner_.peek(source_timestamp);
@@ -70,6 +265,11 @@ bool FdSeeker::peek(uint64_t& source_timestamp, Envelope& envelope)
     return scanner_.peek(source_timestamp, envelope);
 }
 
+bool FdSeeker::peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope)
+{
+    return scanner_.peek(source_timestamp, envelope);
+}
+
 size_t FdSeeker::copy_frame(kj::OutputStream& out)
 {
     return scanner_.copy_frame(out);
@@ -91,7 +291,7 @@ PathSeeker::PathSeeker(const std::string& path)
     if (fd == -1) {
         throw std::system_error(errno, std::system_category());
     }
-    seeker_ = std::make_unique<FdSeeker>(fd);
+    seeker_ = std::make_unique<FdSeeker>(fd, TimeIndex::load(path), path);
 }
 
 PathSeeker::PathSeeker(PathSeeker&& other)
@@ -114,6 +314,11 @@ bool PathSeeker::next()
     return seeker_->next();
 }
 
+bool PathSeeker::skip_frame()
+{
+    return seeker_->skip_frame();
+}
+
 bool PathSeeker::peek(uint64_t& source_timestamp)
 {
     return seeker_->peek(source_timestamp);
@@ -124,6 +329,11 @@ bool PathSeeker::peek(uint64_t& source_timestamp, Envelope& envelope)
     return seeker_->peek(source_timestamp, envelope);
 }
 
+bool PathSeeker::peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope)
+{
+    return seeker_->peek(source_timestamp, envelope);
+}
+
 size_t PathSeeker::copy_frame(kj::OutputStream& out)
 {
     return seeker_->copy_frame(out);
@@ -168,6 +378,11 @@ bool PathSeekerGroup::next()
     return seeker_group_->next();
 }
 
+bool PathSeekerGroup::skip_frame()
+{
+    return seeker_group_->skip_frame();
+}
+
 bool PathSeekerGroup::peek(uint64_t& source_timestamp)
 {
     return seeker_group_->peek(source_timestamp);
@@ -178,6 +393,11 @@ bool PathSeekerGroup::peek(uint64_t& source_timestamp, Envelope& envelope)
     return seeker_group_->peek(source_timestamp, envelope);
 }
 
+bool PathSeekerGroup::peek(uint64_t& source_timestamp, const InternedEnvelope *& envelope)
+{
+    return seeker_group_->peek(source_timestamp, envelope);
+}
+
 size_t PathSeekerGroup::copy_frame(kj::OutputStream& out)
 {
     return seeker_group_->copy_frame(out);
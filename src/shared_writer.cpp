@@ -0,0 +1,288 @@
+#include "lt/slipstream/shared_writer.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include "lt/slipstream/framing.h"
+
+namespace lt::slipstream {
+
+static std::atomic<uint64_t> next_sink_id{1};
+
+// The timestamp of the first frame in a record, or 0 if it has none
+static uint64_t record_timestamp(kj::ArrayPtr<const kj::byte> record)
+{
+    Framing framing;
+
+    if (record.size() < frame_header_length || !framing.decode(record.begin())) {
+        return 0;
+    }
+
+    return framing.source_timestamp;
+}
+
+OrderedFrameSink::OrderedFrameSink(kj::OutputStream * out,
+    std::chrono::nanoseconds reorder_window, size_t ring_capacity,
+    size_t max_producers)
+    : out_(out), reorder_window_(reorder_window), ring_capacity_(ring_capacity),
+      id_(next_sink_id.fetch_add(1, std::memory_order_relaxed)),
+      producers_(max_producers), nproducers_(0),
+      running_(true), flush_requested_(0), flushed_(0),
+      frames_(0), drops_(0), late_(0), bytes_(0), write_errors_(0)
+{
+    thread_ = std::thread([this] { run(); });
+}
+
+OrderedFrameSink::~OrderedFrameSink() noexcept(false)
+{
+    running_.store(false, std::memory_order_release);
+    thread_.join();
+}
+
+size_t OrderedFrameSink::producer()
+{
+    // The rings this thread has registered, by sink. Sink ids are never
+    // reused, so entries for sinks that have gone are harmless.
+    thread_local std::vector<std::pair<uint64_t, size_t>> registered;
+
+    for (auto&& [id, ix] : registered) {
+        if (id == id_) {
+            return ix;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    size_t ix = nproducers_.load(std::memory_order_relaxed);
+    if (ix >= producers_.size()) {
+        throw std::runtime_error("OrderedFrameSink: too many producer threads");
+    }
+
+    producers_[ix] = std::make_unique<Producer>(ring_capacity_);
+    nproducers_.store(ix + 1, std::memory_order_release);
+
+    registered.emplace_back(id_, ix);
+
+    return ix;
+}
+
+bool OrderedFrameSink::push(const FrameBuffer& frame)
+{
+    auto& p = *producers_[producer()];
+
+    if (!p.ring.push(frame.data(), frame.size())) {
+        drops_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    p.latest.store(record_timestamp(frame.asBytes()), std::memory_order_relaxed);
+
+    frames_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void OrderedFrameSink::push_wait(const FrameBuffer& frame)
+{
+    auto& p = *producers_[producer()];
+
+    if (frame.size() > p.ring.max_record()) {
+        throw std::runtime_error("OrderedFrameSink: frame larger than ring");
+    }
+
+    while (!p.ring.push(frame.data(), frame.size())) {
+        std::this_thread::sleep_for(idle_sleep_);
+    }
+
+    frames_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void OrderedFrameSink::flush()
+{
+    uint64_t ticket = flush_requested_.fetch_add(1) + 1;
+
+    while (flushed_.load(std::memory_order_acquire) < ticket) {
+        std::this_thread::sleep_for(idle_sleep_);
+    }
+}
+
+SharedWriterStats OrderedFrameSink::stats() const
+{
+    return SharedWriterStats {
+        frames_.load(std::memory_order_relaxed),
+        drops_.load(std::memory_order_relaxed),
+        late_.load(std::memory_order_relaxed),
+        bytes_.load(std::memory_order_relaxed),
+        write_errors_.load(std::memory_order_relaxed),
+        nproducers_.load(std::memory_order_relaxed)
+    };
+}
+
+// Raise the timestamp of every frame in a record to at least `floor`,
+// other than header frames, whose timestamp stays 0. Returns the number of
+// frames that were raised.
+static size_t clamp_record(kj::ArrayPtr<const kj::byte> record, uint64_t floor)
+{
+    // The flusher owns the record until it is popped from the ring
+    uint8_t * p = const_cast<uint8_t*>(record.begin());
+    size_t offset = 0;
+    size_t late = 0;
+
+    while (offset + frame_header_length <= record.size()) {
+        Framing framing;
+
+        if (!framing.decode(p + offset)) {
+            break;
+        }
+
+        if (framing.source_timestamp != 0 && framing.source_timestamp < floor) {
+            late++;
+            framing.source_timestamp = floor;
+            framing.encode(p + offset);
+        }
+
+        offset += frame_header_length + framing.envelope_length + framing.payload_length;
+    }
+
+    return late;
+}
+
+void OrderedFrameSink::run()
+{
+    struct Cursor {
+        kj::ArrayPtr<const kj::byte> records[max_batch_];
+        uint64_t timestamps[max_batch_];
+        size_t n;
+        size_t next;
+    };
+
+    std::vector<Cursor> cursors;
+    kj::ArrayPtr<const kj::byte> pieces[max_batch_];
+
+    uint64_t max_seen = 0;
+    uint64_t last_written = 0;
+    uint64_t arrived = 0;
+    auto last_arrival = std::chrono::steady_clock::now();
+
+    while (true) {
+        // Check for shutdown and flushes before looking for work, so that
+        // frames pushed before either was requested are written.
+        bool running = running_.load(std::memory_order_acquire);
+        uint64_t flush_requested = flush_requested_.load(std::memory_order_acquire);
+
+        size_t nproducers = nproducers_.load(std::memory_order_acquire);
+        cursors.resize(nproducers);
+
+        size_t found = 0;
+        bool complete = true; // every ring has a frame waiting
+
+        for (size_t i = 0; i < nproducers; ++i) {
+            auto& p = *producers_[i];
+            auto& c = cursors[i];
+            c.n = p.ring.peek(c.records, max_batch_);
+            c.next = 0;
+
+            for (size_t j = 0; j < c.n; ++j) {
+                c.timestamps[j] = record_timestamp(c.records[j]);
+            }
+
+            max_seen = std::max(max_seen, p.latest.load(std::memory_order_relaxed));
+            found += c.n;
+            complete = complete && c.n != 0;
+        }
+
+        // A thread that registered during the peeks may already have pushed
+        // a frame earlier than those peeked. Threads register before taking
+        // their first timestamp, so any that register later cannot have.
+        if (nproducers_.load(std::memory_order_acquire) != nproducers) {
+            complete = false;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        uint64_t frames = frames_.load(std::memory_order_relaxed);
+        if (frames != arrived) {
+            arrived = frames;
+            last_arrival = now;
+        }
+
+        // Once nothing has arrived for the reorder window, everything
+        // waiting is written
+        bool drain = !running || flush_requested > flushed_.load(std::memory_order_relaxed) ||
+            now - last_arrival >= reorder_window_;
+
+        uint64_t window = reorder_window_.count();
+        size_t npieces = 0;
+
+        while (npieces < max_batch_) {
+            // The earliest waiting frame. There are few producers, so a
+            // linear search is as quick as a heap.
+            Cursor * head = nullptr;
+            for (auto&& c : cursors) {
+                if (c.next < c.n &&
+                    (head == nullptr || c.timestamps[c.next] < head->timestamps[head->next])) {
+                    head = &c;
+                }
+            }
+
+            if (head == nullptr) {
+                break;
+            }
+
+            uint64_t timestamp = head->timestamps[head->next];
+
+            if (!drain && !complete && timestamp + window > max_seen) {
+                break;
+            }
+
+            auto record = head->records[head->next];
+
+            if (timestamp < last_written) {
+                late_.fetch_add(clamp_record(record, last_written), std::memory_order_relaxed);
+            } else {
+                last_written = timestamp;
+            }
+
+            pieces[npieces++] = record;
+            head->next++;
+
+            // A ring whose peeked frames have all been taken may hold more
+            // than a peek returns, so the order is only certain again after
+            // peeking it, even when draining.
+            if (head->next == head->n) {
+                break;
+            }
+        }
+
+        if (npieces == 0) {
+            if (found == 0) {
+                flushed_.store(flush_requested, std::memory_order_release);
+                if (!running) {
+                    break;
+                }
+            }
+
+            std::this_thread::sleep_for(idle_sleep_);
+            continue;
+        }
+
+        size_t total = 0;
+        for (size_t i = 0; i < npieces; ++i) {
+            total += pieces[i].size();
+        }
+
+        try {
+            out_->write(kj::arrayPtr(pieces, npieces));
+            bytes_.fetch_add(total, std::memory_order_relaxed);
+        } catch (const std::exception&) {
+            write_errors_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        for (size_t i = 0; i < nproducers; ++i) {
+            if (cursors[i].next != 0) {
+                producers_[i]->ring.pop(cursors[i].next);
+            }
+        }
+    }
+}
+
+} // namespace lt::slipstream
@@ -0,0 +1,283 @@
+#include "lt/slipstream/shm_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <new>
+#include <stdexcept>
+#include <system_error>
+
+namespace lt::slipstream {
+
+static size_t round_up_pow2(size_t n)
+{
+    size_t p = 64;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+// Numbers the rings of this process, so that writers sharing a name have
+// their own files
+static std::atomic<uint64_t> ring_sequence{0};
+
+static size_t record_size(size_t length)
+{
+    return sizeof(uint64_t) + ((length + 7) & ~static_cast<size_t>(7));
+}
+
+ShmRingWriter::ShmRingWriter(const std::string& name, size_t capacity,
+    const std::string& directory)
+    : capacity_(round_up_pow2(capacity)),
+      mask_(capacity_ - 1),
+      mapped_size_(ShmRingHeader::ring_offset + capacity_),
+      header_(nullptr), buffer_(nullptr),
+      cached_tail_(0), frames_(0), drops_(0)
+{
+    if (name.empty() || name.size() >= ShmRingHeader::name_length ||
+            name.find('/') != std::string::npos) {
+        throw std::runtime_error("ShmRingWriter: invalid ring name");
+    }
+
+    std::string base = directory + "/" + name + "." + std::to_string(getpid()) + "." +
+        std::to_string(ring_sequence.fetch_add(1, std::memory_order_relaxed));
+    std::string temporary = base + ".tmp";
+    path_ = base + shm_ring_suffix;
+
+    int fd = ::open(temporary.c_str(), O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    // The mapping remains valid once the descriptor is closed
+    kj::AutoCloseFd closer(fd);
+
+    if (ftruncate(fd, mapped_size_) == -1) {
+        int e = errno;
+        unlink(temporary.c_str());
+        throw std::system_error(e, std::system_category());
+    }
+
+    void * addr = mmap(nullptr, mapped_size_, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        int e = errno;
+        unlink(temporary.c_str());
+        throw std::system_error(e, std::system_category());
+    }
+
+    header_ = new (addr) ShmRingHeader{};
+    header_->magic = ShmRingHeader::magic_value;
+    header_->version = ShmRingHeader::current_version;
+    header_->pid = getpid();
+    header_->capacity = capacity_;
+    strncpy(header_->name, name.c_str(), ShmRingHeader::name_length - 1);
+
+    buffer_ = static_cast<uint8_t*>(addr) + ShmRingHeader::ring_offset;
+
+    if (rename(temporary.c_str(), path_.c_str()) == -1) {
+        int e = errno;
+        munmap(addr, mapped_size_);
+        unlink(temporary.c_str());
+        throw std::system_error(e, std::system_category());
+    }
+}
+
+ShmRingWriter::~ShmRingWriter()
+{
+    header_->closed.store(1, std::memory_order_release);
+    munmap(header_, mapped_size_);
+}
+
+bool ShmRingWriter::push(const void * data, size_t length)
+{
+    if (length > max_record()) {
+        header_->drops.store(++drops_, std::memory_order_relaxed);
+        return false;
+    }
+
+    size_t size = record_size(length);
+
+    uint64_t head = header_->head.load(std::memory_order_relaxed);
+    size_t offset = head & mask_;
+    size_t contiguous = capacity_ - offset;
+    size_t needed = (size > contiguous) ? contiguous + size : size;
+
+    if (head + needed - cached_tail_ > capacity_) {
+        cached_tail_ = header_->tail.load(std::memory_order_acquire);
+        if (head + needed - cached_tail_ > capacity_) {
+            header_->drops.store(++drops_, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    if (size > contiguous) {
+        uint32_t marker = wrap_marker_;
+        memcpy(&buffer_[offset], &marker, sizeof(marker));
+        head += contiguous;
+        offset = 0;
+    }
+
+    uint32_t length32 = length;
+    memcpy(&buffer_[offset], &length32, sizeof(length32));
+    memcpy(&buffer_[offset + record_header_], data, length);
+
+    header_->head.store(head + size, std::memory_order_release);
+    header_->frames.store(++frames_, std::memory_order_relaxed);
+
+    return true;
+}
+
+ShmRingReader::ShmRingReader(const std::string& path)
+    : path_(path), capacity_(0), mask_(0), mapped_size_(0),
+      header_(nullptr), buffer_(nullptr), bad_(false)
+{
+    int fd = ::open(path.c_str(), O_RDWR);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    kj::AutoCloseFd closer(fd);
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    if (static_cast<size_t>(st.st_size) < ShmRingHeader::ring_offset) {
+        throw std::runtime_error("ShmRingReader: not a ring: " + path);
+    }
+
+    mapped_size_ = st.st_size;
+
+    void * addr = mmap(nullptr, mapped_size_, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    header_ = static_cast<ShmRingHeader*>(addr);
+    capacity_ = header_->capacity;
+    mask_ = capacity_ - 1;
+
+    if (header_->magic != ShmRingHeader::magic_value ||
+            header_->version != ShmRingHeader::current_version ||
+            capacity_ == 0 || (capacity_ & mask_) != 0 ||
+            ShmRingHeader::ring_offset + capacity_ > mapped_size_) {
+        munmap(addr, mapped_size_);
+        throw std::runtime_error("ShmRingReader: not a ring: " + path);
+    }
+
+    name_ = std::string(header_->name, strnlen(header_->name, ShmRingHeader::name_length));
+    buffer_ = static_cast<const uint8_t*>(addr) + ShmRingHeader::ring_offset;
+}
+
+ShmRingReader::~ShmRingReader()
+{
+    munmap(header_, mapped_size_);
+}
+
+bool ShmRingReader::next_record(uint64_t& tail, uint64_t head,
+    kj::ArrayPtr<const kj::byte>& record)
+{
+    size_t offset = tail & mask_;
+
+    if ((offset & 7) != 0 || head - tail < record_header_) {
+        bad_ = true;
+        return false;
+    }
+
+    uint32_t length;
+    memcpy(&length, &buffer_[offset], sizeof(length));
+
+    if (length == wrap_marker_) {
+        size_t skip = capacity_ - offset;
+        if (head - tail < skip + record_header_) {
+            bad_ = true;
+            return false;
+        }
+
+        tail += skip;
+        offset = 0;
+        memcpy(&length, &buffer_[offset], sizeof(length));
+    }
+
+    size_t size = record_size(length);
+
+    if (size > head - tail || offset + size > capacity_) {
+        bad_ = true;
+        return false;
+    }
+
+    record = kj::arrayPtr(&buffer_[offset + record_header_], length);
+    tail += size;
+
+    return true;
+}
+
+size_t ShmRingReader::peek(kj::ArrayPtr<const kj::byte> * records, size_t max)
+{
+    uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    uint64_t head = header_->head.load(std::memory_order_acquire);
+
+    if (bad_ || head - tail > capacity_) {
+        bad_ = true;
+        return 0;
+    }
+
+    size_t n = 0;
+
+    while (n < max && tail != head && next_record(tail, head, records[n])) {
+        n++;
+    }
+
+    return n;
+}
+
+void ShmRingReader::pop(size_t n)
+{
+    uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    uint64_t head = header_->head.load(std::memory_order_acquire);
+
+    if (bad_ || head - tail > capacity_) {
+        bad_ = true;
+        return;
+    }
+
+    kj::ArrayPtr<const kj::byte> record;
+
+    while (n-- > 0) {
+        if (!next_record(tail, head, record)) {
+            return;
+        }
+    }
+
+    header_->tail.store(tail, std::memory_order_release);
+}
+
+bool ShmRingReader::empty() const
+{
+    return used() == 0;
+}
+
+size_t ShmRingReader::used() const
+{
+    uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    uint64_t head = header_->head.load(std::memory_order_acquire);
+    return head - tail;
+}
+
+bool ShmRingReader::abandoned() const
+{
+    if (header_->closed.load(std::memory_order_acquire)) {
+        return true;
+    }
+
+    return kill(header_->pid, 0) == -1 && errno == ESRCH;
+}
+
+} // namespace lt::slipstream
@@ -0,0 +1,78 @@
+#include "lt/slipstream/stats.h"
+
+#include <algorithm>
+
+namespace lt::slipstream {
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+size_t LatencyHistogram::bucket(uint64_t ns)
+{
+    if (ns < sub_buckets_) {
+        return ns;
+    }
+
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - sub_bits_;
+
+    return (shift + 1) * sub_buckets_ + ((ns >> shift) & (sub_buckets_ - 1));
+}
+
+uint64_t LatencyHistogram::bucket_upper(size_t bucket)
+{
+    if (bucket < sub_buckets_) {
+        return bucket;
+    }
+
+    int shift = bucket / sub_buckets_ - 1;
+    uint64_t low = (sub_buckets_ + bucket % sub_buckets_) << shift;
+
+    return low + ((static_cast<uint64_t>(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    counts_[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+
+    if (ns > max_.load(std::memory_order_relaxed)) {
+        max_.store(ns, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto&& c : counts_) {
+        c.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    uint64_t total = count();
+
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * total);
+    rank = std::max(rank, static_cast<uint64_t>(1));
+
+    uint64_t seen = 0;
+
+    for (size_t b = 0; b < buckets_; ++b) {
+        seen += counts_[b].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(bucket_upper(b), max());
+        }
+    }
+
+    return max();
+}
+
+} // namespace lt::slipstream
@@ -0,0 +1,151 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <deque>
+
+#include <boost/test/unit_test.hpp>
+#include <rapidcheck/boost_test.h>
+
+#include "lt/slipstream/async_writer.h"
+#include "lt/slipstream/multichannel_reader.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/reader.h"
+
+using namespace lt::slipstream;
+
+BOOST_AUTO_TEST_CASE(ring_push_pop)
+{
+    SpscRing ring(256);
+
+    BOOST_CHECK(ring.empty());
+    BOOST_CHECK(ring.front().size() == 0);
+
+    // Push and pop enough records to wrap around several times
+    for (int i = 0; i < 100; ++i) {
+        std::string s = "record " + std::to_string(i);
+        BOOST_CHECK(ring.push(s.data(), s.size()));
+
+        auto r = ring.front();
+        BOOST_CHECK(std::string(reinterpret_cast<const char*>(r.begin()), r.size()) == s);
+        ring.pop();
+        BOOST_CHECK(ring.empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ring_full)
+{
+    SpscRing ring(256);
+
+    uint8_t buf[40] = {};
+    int pushed = 0;
+
+    while (ring.push(buf, sizeof(buf))) {
+        ++pushed;
+    }
+
+    BOOST_CHECK(pushed > 0);
+    BOOST_CHECK(!ring.push(buf, sizeof(buf)));
+
+    kj::ArrayPtr<const kj::byte> records[16];
+    size_t n = ring.peek(records, 16);
+    BOOST_CHECK(n == static_cast<size_t>(pushed));
+
+    ring.pop(n);
+    BOOST_CHECK(ring.empty());
+    BOOST_CHECK(ring.push(buf, sizeof(buf)));
+
+    BOOST_CHECK(!ring.push(buf, ring.max_record() + 1));
+}
+
+static void check_front(SpscRing& ring, std::deque<std::string>& expected)
+{
+    auto r = ring.front();
+    RC_ASSERT(!expected.empty());
+    RC_ASSERT(std::string(reinterpret_cast<const char*>(r.begin()), r.size()) == expected.front());
+    ring.pop();
+    expected.pop_front();
+}
+
+RC_BOOST_PROP(ring_roundtrip_rc, (std::vector<std::string> records))
+{
+    SpscRing ring(1024);
+    std::deque<std::string> expected;
+
+    for (auto&& s : records) {
+        while (!ring.push(s.data(), s.size())) {
+            check_front(ring, expected);
+        }
+        expected.push_back(s);
+    }
+
+    while (!ring.empty()) {
+        check_front(ring, expected);
+    }
+
+    RC_ASSERT(expected.empty());
+}
+
+BOOST_AUTO_TEST_CASE(async_plaintext_roundtrip)
+{
+    int fds[2];
+    BOOST_REQUIRE(pipe(fds) == 0);
+
+    auto out = kj::FdOutputStream(kj::AutoCloseFd(fds[1]));
+    auto in = kj::FdInputStream(kj::AutoCloseFd(fds[0]));
+
+    std::vector<std::string> lines;
+    for (int i = 0; i < 200; ++i) {
+        lines.push_back("line " + std::to_string(i));
+    }
+
+    {
+        auto writer = AsyncChannelWriter<PlainText>(&out, "test", "log");
+        auto reader = ChannelReader<PlainText>(&in);
+
+        for (auto&& line : lines) {
+            BOOST_CHECK(writer.write(SerialString{line}));
+        }
+
+        for (auto&& line : lines) {
+            SerialString s;
+            BOOST_CHECK(reader.read(s));
+            BOOST_CHECK(s.str() == line);
+        }
+
+        writer.flush();
+
+        auto stats = writer.stats();
+        BOOST_CHECK(stats.frames == lines.size());
+        BOOST_CHECK(stats.drops == 0);
+        BOOST_CHECK(stats.enqueue_p99_ns <= stats.enqueue_max_ns);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(async_multichannel_roundtrip)
+{
+    using S = SerialString;
+
+    int fds[2];
+    BOOST_REQUIRE(pipe(fds) == 0);
+
+    auto out = kj::FdOutputStream(kj::AutoCloseFd(fds[1]));
+    auto in = kj::FdInputStream(kj::AutoCloseFd(fds[0]));
+
+    auto writer = AsyncMultiChannelWriter<PlainText>(&out, "test");
+    auto reader = MultiChannelReader<PlainText>(&in);
+
+    BOOST_CHECK(writer.write("log1", S{"Hey there"}));
+    BOOST_CHECK(writer.write("log2", S{"Ho there"}));
+
+    MultiChannelReader<PlainText>::data_type data;
+    uint64_t timestamp;
+    Envelope envelope;
+
+    BOOST_CHECK(reader.read(data, timestamp, envelope));
+    BOOST_CHECK(std::get<S>(data) == S{"Hey there"});
+    BOOST_CHECK(envelope.identifier.channel_name == "log1");
+
+    BOOST_CHECK(reader.read(data, timestamp, envelope));
+    BOOST_CHECK(std::get<S>(data) == S{"Ho there"});
+    BOOST_CHECK(envelope.identifier.channel_name == "log2");
+}
@@ -0,0 +1,166 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+#include <rapidcheck/boost_test.h>
+
+#include "lt/slipstream/buffered_output.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/reader.h"
+#include "lt/slipstream/writer.h"
+#include "lt/slipstream/testing/temp_file.h"
+
+using namespace lt::slipstream;
+using namespace lt::slipstream::testing;
+
+static kj::AutoCloseFd open_for_write(const std::string& path)
+{
+    int fd = open(path.c_str(), O_WRONLY|O_TRUNC);
+    BOOST_REQUIRE(fd != -1);
+    return kj::AutoCloseFd(fd);
+}
+
+BOOST_AUTO_TEST_CASE(buffered_size_limit)
+{
+    TempFile file;
+
+    FlushPolicy policy;
+    policy.max_bytes = 64;
+
+    BufferedFdOutputStream out(open_for_write(file.path), policy);
+
+    uint8_t buf[40] = {};
+
+    out.write(buf, sizeof(buf));
+    BOOST_CHECK(file.size() == 0);
+
+    // Exceeding the limit flushes what was already buffered
+    out.write(buf, sizeof(buf));
+    BOOST_CHECK(file.size() == 40);
+
+    out.flush();
+    BOOST_CHECK(file.size() == 80);
+
+    // Writes larger than the buffer go straight through
+    uint8_t big[100] = {};
+    out.write(big, sizeof(big));
+    BOOST_CHECK(file.size() == 180);
+
+    auto stats = out.stats();
+    BOOST_CHECK(stats.flushes == 3);
+    BOOST_CHECK(stats.bytes == 180);
+    BOOST_CHECK(stats.bytes_per_flush() == 60);
+    BOOST_CHECK(stats.syncs == 0);
+    BOOST_CHECK(stats.flush_p99_ns <= stats.flush_max_ns);
+}
+
+BOOST_AUTO_TEST_CASE(buffered_gathered_write)
+{
+    TempFile file;
+
+    FlushPolicy policy;
+    policy.max_bytes = 64;
+
+    BufferedFdOutputStream out(open_for_write(file.path), policy);
+
+    std::string a(20, 'a'), b(30, 'b'), c(30, 'c');
+
+    auto piece = [](const std::string& s) {
+        return kj::ArrayPtr<const kj::byte>(reinterpret_cast<const kj::byte*>(s.data()), s.size());
+    };
+
+    // Pieces that fit are buffered
+    const kj::ArrayPtr<const kj::byte> first[] = { piece(a) };
+    out.write(kj::arrayPtr(first, 1));
+    BOOST_CHECK(file.size() == 0);
+
+    // Pieces that do not fit are written with what was buffered, at once
+    const kj::ArrayPtr<const kj::byte> rest[] = { piece(b), piece(c) };
+    out.write(kj::arrayPtr(rest, 2));
+    BOOST_CHECK(file.contents() == a + b + c);
+
+    auto stats = out.stats();
+    BOOST_CHECK(stats.flushes == 1);
+    BOOST_CHECK(stats.bytes == 80);
+}
+
+BOOST_AUTO_TEST_CASE(buffered_write_through)
+{
+    TempFile file;
+
+    BufferedFdOutputStream out(open_for_write(file.path));
+
+    uint8_t buf[10] = {};
+    out.write(buf, sizeof(buf));
+    BOOST_CHECK(file.size() == 10);
+}
+
+BOOST_AUTO_TEST_CASE(buffered_delay_limit)
+{
+    TempFile file;
+
+    FlushPolicy policy;
+    policy.max_bytes = 4096;
+    policy.max_delay_ns = 1000000;
+
+    BufferedFdOutputStream out(open_for_write(file.path), policy);
+
+    uint8_t buf[10] = {};
+    out.write(buf, sizeof(buf));
+    BOOST_CHECK(!out.flush_if_due());
+    BOOST_CHECK(file.size() == 0);
+
+    usleep(2000);
+    BOOST_CHECK(out.flush_if_due());
+    BOOST_CHECK(file.size() == 10);
+}
+
+BOOST_AUTO_TEST_CASE(buffered_destructor_flushes)
+{
+    TempFile file;
+
+    FlushPolicy policy;
+    policy.max_bytes = 4096;
+
+    {
+        BufferedFdOutputStream out(open_for_write(file.path), policy);
+        uint8_t buf[10] = {};
+        out.write(buf, sizeof(buf));
+        BOOST_CHECK(file.size() == 0);
+    }
+
+    BOOST_CHECK(file.size() == 10);
+}
+
+RC_BOOST_PROP(buffered_path_writer_rc, (std::vector<std::string> lines))
+{
+    TempFile file;
+
+    FlushPolicy policy;
+    policy.max_bytes = 256;
+
+    {
+        auto writer = ChannelPathWriter<PlainText>(file.path, "test", "log", policy);
+        for (auto&& line : lines) {
+            RC_ASSERT(writer.write(SerialString{line}));
+        }
+        writer.flush();
+    }
+
+    int fd = open(file.path.c_str(), O_RDONLY);
+    RC_ASSERT(fd != -1);
+    auto in = kj::FdInputStream(kj::AutoCloseFd(fd));
+    auto reader = ChannelReader<PlainText>(&in);
+
+    for (auto&& line : lines) {
+        SerialString s;
+        RC_ASSERT(reader.read(s));
+        RC_ASSERT(s.str() == line);
+    }
+}
@@ -0,0 +1,320 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <filesystem>
+
+#include <boost/test/unit_test.hpp>
+#include <rapidcheck/boost_test.h>
+
+#include "lt/slipstream/collector.h"
+#include "lt/slipstream/mapped_input.h"
+#include "lt/slipstream/multichannel_reader.h"
+#include "lt/slipstream/rotating_output.h"
+#include "lt/slipstream/shm_ring.h"
+#include "lt/slipstream/testing/biased.h"
+#include "lt/slipstream/testing/temp_file.h"
+
+using namespace lt::slipstream;
+using namespace lt::slipstream::testing;
+
+BOOST_AUTO_TEST_CASE(shm_ring_push_pop)
+{
+    TempDir dir;
+    std::string path;
+
+    {
+        ShmRingWriter writer("test", 256, dir.path);
+        ShmRingReader reader(writer.path());
+        path = writer.path();
+
+        // Another ring of the same name has its own file
+        {
+            ShmRingWriter other("test", 256, dir.path);
+            BOOST_CHECK(other.path() != writer.path());
+            BOOST_CHECK(ShmRingReader(other.path()).name() == "test");
+        }
+
+        BOOST_CHECK(reader.name() == "test");
+        BOOST_CHECK(reader.pid() == static_cast<uint32_t>(getpid()));
+        BOOST_CHECK(reader.empty());
+        BOOST_CHECK(!reader.abandoned());
+
+        // Push and pop enough records to wrap around several times
+        for (int i = 0; i < 100; ++i) {
+            std::string s = "record " + std::to_string(i);
+            BOOST_CHECK(writer.push(s.data(), s.size()));
+
+            kj::ArrayPtr<const kj::byte> record;
+            BOOST_REQUIRE(reader.peek(&record, 1) == 1);
+            BOOST_CHECK(std::string(reinterpret_cast<const char*>(record.begin()), record.size()) == s);
+            reader.pop(1);
+            BOOST_CHECK(reader.empty());
+        }
+
+        uint8_t buf[40] = {};
+        while (writer.push(buf, sizeof(buf))) {
+        }
+
+        BOOST_CHECK(reader.frames() == writer.frames());
+        BOOST_CHECK(reader.drops() == 1);
+        BOOST_CHECK(reader.used() > 0);
+    }
+
+    // The ring outlives its writer, marked closed
+    ShmRingReader reader(path);
+    BOOST_CHECK(reader.abandoned());
+    BOOST_CHECK(!reader.empty());
+
+    BOOST_CHECK_THROW(ShmRingReader(dir.path + "/missing.ssring"), std::system_error);
+}
+
+// Overwrite the 4 bytes at `offset` in the ring buffer of a ring file
+static void corrupt_ring(const std::string& path, size_t offset, uint32_t value)
+{
+    int fd = open(path.c_str(), O_RDWR);
+    BOOST_REQUIRE(fd != -1);
+    BOOST_REQUIRE(pwrite(fd, &value, sizeof(value), ShmRingHeader::ring_offset + offset) == sizeof(value));
+    close(fd);
+}
+
+BOOST_AUTO_TEST_CASE(shm_ring_corrupt)
+{
+    TempDir dir;
+
+    // A length running past the head
+    {
+        ShmRingWriter writer("test", 256, dir.path);
+        ShmRingReader reader(writer.path());
+
+        std::string s = "record";
+        BOOST_REQUIRE(writer.push(s.data(), s.size()));
+        BOOST_REQUIRE(writer.push(s.data(), s.size()));
+
+        corrupt_ring(writer.path(), 16, 0x7fffffff);
+
+        kj::ArrayPtr<const kj::byte> records[4];
+        BOOST_CHECK(reader.peek(records, 4) == 1);
+        BOOST_CHECK(records[0].size() == s.size());
+        BOOST_CHECK(reader.bad());
+
+        // Nothing more is read from a bad ring
+        reader.pop(1);
+        BOOST_CHECK(reader.peek(records, 4) == 0);
+        BOOST_CHECK(!reader.empty());
+    }
+
+    // A wrap marker where the ring does not wrap
+    {
+        ShmRingWriter writer("test", 256, dir.path);
+        ShmRingReader reader(writer.path());
+
+        std::string s = "record";
+        BOOST_REQUIRE(writer.push(s.data(), s.size()));
+        corrupt_ring(writer.path(), 0, 0xffffffff);
+
+        kj::ArrayPtr<const kj::byte> record;
+        BOOST_CHECK(reader.peek(&record, 1) == 0);
+        BOOST_CHECK(reader.bad());
+    }
+
+    // The collector drops a corrupt ring, and removes its file
+    {
+        TempDir collector_dir;
+        FrameBuffer out;
+        auto collector = RingCollector(&out, collector_dir.path, std::chrono::nanoseconds(0));
+
+        ShmRingWriter writer("corrupt", 256, collector_dir.path);
+        std::string s = "record";
+        BOOST_REQUIRE(writer.push(s.data(), s.size()));
+        corrupt_ring(writer.path(), 0, 1000);
+
+        collector.poll();
+        BOOST_CHECK(collector.producers() == 1);
+        BOOST_CHECK(out.empty());
+
+        collector.poll();
+        BOOST_CHECK(collector.producers() == 0);
+        BOOST_CHECK(!std::filesystem::exists(writer.path()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(collector_rotation)
+{
+    static constexpr int per_producer = 200;
+
+    TempDir dir;
+    auto out = RotatingOutputStream(dir.path + "/out", RotationPolicy{4096});
+    auto collector = RingCollector(&out, dir.path, std::chrono::nanoseconds(0));
+    std::string alpha_path;
+
+    {
+        MultiChannelWriter<BiasedInt64Stream>::header_map headers;
+        headers.emplace_back("s", SerialInt64(100));
+
+        auto alpha = ShmMultiChannelWriter<BiasedInt64Stream>("alpha", headers, 1 << 16, dir.path);
+        auto beta = ShmMultiChannelWriter<BiasedInt64Stream>("beta", headers, 1 << 16, dir.path);
+        alpha_path = alpha.ring().path();
+
+        for (int i = 0; i < per_producer; ++i) {
+            BOOST_CHECK(alpha.write("s", SerialInt64(i), 1000 + 2 * i));
+            BOOST_CHECK(beta.write("s", SerialInt64(i), 1001 + 2 * i));
+        }
+
+        while (collector.poll() != 0) {
+        }
+
+        auto stats = collector.stats();
+        BOOST_REQUIRE(stats.size() == 2);
+        for (auto&& s : stats) {
+            BOOST_CHECK(s.written == per_producer + 1);
+            BOOST_CHECK(s.frames == per_producer + 1);
+            BOOST_CHECK(s.drops == 0);
+            BOOST_CHECK(s.lag_bytes == 0);
+        }
+    }
+
+    // Closed rings are removed once drained
+    collector.poll();
+    BOOST_CHECK(collector.producers() == 0);
+    BOOST_CHECK(!std::filesystem::exists(alpha_path));
+
+    BOOST_REQUIRE(out.files() > 1);
+
+    // Each file is readable on its own
+    size_t n = 0;
+    uint64_t previous = 0;
+
+    for (uint64_t f = 0; f < out.files(); ++f) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/out.%06lu", dir.path.c_str(), static_cast<unsigned long>(f));
+
+        auto in = MappedInputStream(path);
+        auto reader = MultiChannelReader<BiasedInt64Stream>(&in);
+        decltype(reader)::data_type data;
+        uint64_t timestamp;
+        Envelope envelope;
+        size_t in_file = 0;
+
+        while (reader.read(data, timestamp, envelope)) {
+            BOOST_CHECK(timestamp >= previous);
+            BOOST_CHECK(std::get<SerialInt64>(data).value() ==
+                static_cast<int64_t>((timestamp - 1000) / 2));
+            previous = timestamp;
+            in_file++;
+        }
+
+        BOOST_CHECK(in_file > 0);
+        n += in_file;
+    }
+
+    BOOST_CHECK(n == 2 * per_producer);
+}
+
+// The number of frames in a file with a timestamp of 0, ie. header frames
+static size_t count_headers(const std::string& path)
+{
+    auto in = MappedInputStream(path);
+    auto bytes = in.tryGetReadBuffer();
+    size_t offset = 0;
+    size_t n = 0;
+
+    while (offset + frame_header_length <= bytes.size()) {
+        Framing framing;
+        BOOST_REQUIRE(framing.decode(bytes.begin() + offset));
+        n += (framing.source_timestamp == 0);
+        offset += frame_header_length + framing.envelope_length + framing.payload_length;
+    }
+
+    return n;
+}
+
+static MultiChannelWriter<BiasedDeltaInt64Stream>::header_map delta_headers()
+{
+    MultiChannelWriter<BiasedDeltaInt64Stream>::header_map headers;
+    headers.emplace_back("a", SerialInt64(100));
+    headers.emplace_back("b", SerialInt64(-100));
+    return headers;
+}
+
+BOOST_AUTO_TEST_CASE(rotating_writer_interval)
+{
+    TempDir dir;
+    std::string path = dir.path + "/out";
+
+    RotationPolicy policy;
+    policy.interval_ns = 1000;
+
+    {
+        auto writer = MultiChannelRotatingWriter<BiasedDeltaInt64Stream>(path, "test",
+            delta_headers(), policy);
+
+        for (int i = 0; i < 50; ++i) {
+            BOOST_CHECK(writer.write("a", SerialInt64(i), 10000 + 100 * i));
+            BOOST_CHECK(writer.write("b", SerialInt64(-i), 10000 + 100 * i + 50));
+        }
+    }
+
+    // Every file starts with the headers and a keyframe of each channel, so
+    // it can be read on its own
+    for (int f = 0; f < 5; ++f) {
+        auto file = RotatingOutputStream::file_path(path, f);
+        BOOST_CHECK(count_headers(file) == 2);
+
+        auto in = MappedInputStream(file);
+        auto reader = MultiChannelReader<BiasedDeltaInt64Stream>(&in);
+        decltype(reader)::data_type data;
+        uint64_t timestamp;
+        Envelope envelope;
+        int n = 0;
+
+        while (reader.read(data, timestamp, envelope)) {
+            BOOST_CHECK(timestamp / 1000 == static_cast<uint64_t>(10 + f));
+            int i = (timestamp - 10000) / 100;
+            int64_t expected = envelope.identifier.channel_name == "a" ? i : -i;
+            BOOST_CHECK(std::get<SerialInt64>(data).value() == expected);
+            n++;
+        }
+
+        BOOST_CHECK(n == 20);
+    }
+
+    BOOST_CHECK(!std::filesystem::exists(RotatingOutputStream::file_path(path, 5)));
+}
+
+BOOST_AUTO_TEST_CASE(rotating_writer_header_interval)
+{
+    TempDir dir;
+    std::string path = dir.path + "/out";
+
+    RotationPolicy policy;
+    policy.header_interval_ns = 1000;
+
+    {
+        auto writer = MultiChannelRotatingWriter<BiasedDeltaInt64Stream>(path, "test",
+            delta_headers(), policy);
+
+        for (int i = 0; i < 50; ++i) {
+            BOOST_CHECK(writer.write("a", SerialInt64(i), 10000 + 100 * i));
+        }
+    }
+
+    // Headers are repeated at 11000, 12000, 13000 and 14000
+    auto file = RotatingOutputStream::file_path(path, 0);
+    BOOST_CHECK(count_headers(file) == 2 + 4 * 2);
+
+    auto in = MappedInputStream(file);
+    auto reader = MultiChannelReader<BiasedDeltaInt64Stream>(&in);
+    decltype(reader)::data_type data;
+
+    for (int i = 0; i < 50; ++i) {
+        BOOST_REQUIRE(reader.read(data));
+        BOOST_CHECK(std::get<SerialInt64>(data).value() == i);
+    }
+
+    BOOST_CHECK(!reader.read(data));
+}
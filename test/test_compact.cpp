@@ -0,0 +1,195 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+#include <rapidcheck/boost_test.h>
+
+#include "lt/slipstream/channel_dictionary.h"
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/multichannel_reader.h"
+#include "lt/slipstream/multichannel_writer.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/reader.h"
+#include "lt/slipstream/scanner.h"
+#include "lt/slipstream/writer.h"
+#include "lt/slipstream/testing/integer.h"
+#include "lt/slipstream/testing/temp_file.h"
+
+using namespace lt::slipstream;
+using namespace lt::slipstream::testing;
+
+static kj::ArrayInputStream input(const FrameBuffer& frames, size_t offset = 0)
+{
+    return kj::ArrayInputStream(kj::arrayPtr(frames.data() + offset, frames.size() - offset));
+}
+
+BOOST_AUTO_TEST_CASE(compact_roundtrip)
+{
+    TempFile compact;
+    TempFile full;
+
+    {
+        auto c = ChannelPathWriter<PlainText>(compact.path, "test", "log", {}, FrameFormat::compact);
+        auto f = ChannelPathWriter<PlainText>(full.path, "test", "log");
+        for (int i = 0; i < 1000; ++i) {
+            BOOST_REQUIRE(c.write(SerialString{"line " + std::to_string(i)}, 1000 + i));
+            BOOST_REQUIRE(f.write(SerialString{"line " + std::to_string(i)}, 1000 + i));
+        }
+    }
+
+    BOOST_CHECK(compact.size() < full.size() / 2);
+
+    auto reader = ChannelPathReader<PlainText>(compact.path);
+
+    SerialString s;
+    uint64_t timestamp;
+    Envelope envelope;
+
+    for (int i = 0; i < 1000; ++i) {
+        BOOST_REQUIRE(reader.read(s, timestamp, envelope));
+        BOOST_CHECK(s.str() == "line " + std::to_string(i));
+        BOOST_CHECK(timestamp == 1000u + i);
+        BOOST_CHECK(envelope.identifier.application_name == "test");
+        BOOST_CHECK(envelope.identifier.channel_name == "log");
+    }
+
+    BOOST_CHECK(!reader.read(s, timestamp, envelope));
+}
+
+BOOST_AUTO_TEST_CASE(compact_multichannel_roundtrip)
+{
+    TempFile file;
+
+    {
+        auto writer = MultiChannelPathWriter<Headerless<SerialInt64>, PlainText>(
+            file.path, "test", {}, {}, FrameFormat::compact);
+        for (int i = 0; i < 100; ++i) {
+            BOOST_REQUIRE(writer.write("int", SerialInt64(i)));
+            BOOST_REQUIRE(writer.write("log", SerialString{std::to_string(i)}));
+        }
+    }
+
+    auto reader = MultiChannelMappedReader<Headerless<SerialInt64>, PlainText>(file.path);
+    decltype(reader)::data_type data;
+    uint64_t timestamp;
+    Envelope envelope;
+
+    for (int i = 0; i < 100; ++i) {
+        BOOST_REQUIRE(reader.read(data, timestamp, envelope));
+        BOOST_CHECK(envelope.identifier.channel_name == "int");
+        BOOST_CHECK(std::get<SerialInt64>(data) == SerialInt64(i));
+
+        BOOST_REQUIRE(reader.read(data));
+        BOOST_CHECK(std::get<SerialString>(data).str() == std::to_string(i));
+    }
+
+    BOOST_CHECK(!reader.read(data));
+}
+
+BOOST_AUTO_TEST_CASE(compact_registration_sync)
+{
+    FrameBuffer frames;
+    ChannelRegistry registry(4096);
+
+    {
+        auto a = ChannelWriter<PlainText>(&frames, "test", "a", &registry);
+        auto b = ChannelWriter<PlainText>(&frames, "test", "b", &registry);
+        for (int i = 0; i < 2000; ++i) {
+            BOOST_REQUIRE(a.write(SerialString{"a"}, 1000 + 2 * i));
+            BOOST_REQUIRE(b.write(SerialString{"b"}, 1001 + 2 * i));
+        }
+    }
+
+    // Registrations are repeated
+    int registrations = 0;
+    for (size_t offset = 0; offset < frames.size();) {
+        Framing framing;
+        BOOST_REQUIRE(framing.decode(frames.data() + offset));
+        registrations += framing.registration();
+        offset += frame_header_length + framing.envelope_length + framing.payload_length;
+    }
+
+    BOOST_CHECK(registrations > 10);
+
+    // A scanner learns the channels from them, and passes over them
+    auto in = input(frames);
+    auto scanner = ScannerWrapper(in);
+    int peeked = 0;
+    do {
+        uint64_t timestamp;
+        Envelope envelope;
+        BOOST_REQUIRE(scanner.peek(timestamp, envelope));
+        Framing framing;
+        framing.decode(frames.data() + (frames.size() - in.tryGetReadBuffer().size() - scanner.lookahead()));
+        BOOST_CHECK(!framing.registration());
+        peeked++;
+    } while (scanner.skip_frame());
+
+    BOOST_CHECK(peeked == 4000);
+
+    // A scanner that starts part way through learns the channels again
+    auto middle = input(frames, frames.size() / 2);
+    auto resumed = ScannerWrapper(middle);
+
+    uint64_t timestamp;
+    Envelope envelope;
+    BOOST_REQUIRE(resumed.peek(timestamp, envelope));
+    BOOST_CHECK(envelope.identifier.channel_name == (timestamp % 2 ? "b" : "a"));
+}
+
+BOOST_AUTO_TEST_CASE(compact_remap)
+{
+    // Two streams whose channel ids collide
+    FrameBuffer first;
+    FrameBuffer second;
+
+    {
+        ChannelRegistry r1;
+        ChannelRegistry r2;
+        auto a = ChannelWriter<PlainText>(&first, "test", "a", &r1);
+        auto b = ChannelWriter<PlainText>(&second, "test", "b", &r2);
+        for (int i = 0; i < 10; ++i) {
+            BOOST_REQUIRE(a.write(SerialString{"a"}, 1000 + i));
+            BOOST_REQUIRE(b.write(SerialString{"b"}, 2000 + i));
+        }
+    }
+
+    FrameBuffer merged;
+    ChannelRegistry registry;
+    int copied = 0;
+
+    for (auto frames : {&first, &second}) {
+        auto in = input(*frames);
+        auto scanner = ScannerWrapper(in);
+        FrameBuffer frame;
+
+        uint64_t timestamp;
+        Envelope envelope;
+
+        while (scanner.peek(timestamp, envelope)) {
+            frame.clear();
+            scanner.copy_frame(frame);
+            copied += registry.copy_frame(merged,
+                kj::arrayPtr(frame.data(), frame.size()), envelope);
+        }
+    }
+
+    BOOST_CHECK(copied == 20);
+
+    auto in = input(merged);
+    auto reader = MultiChannelReader<PlainText>(&in);
+    decltype(reader)::data_type data;
+    uint64_t timestamp;
+    Envelope envelope;
+
+    for (int i = 0; i < 20; ++i) {
+        BOOST_REQUIRE(reader.read(data, timestamp, envelope));
+        BOOST_CHECK(envelope.identifier.channel_name == (i < 10 ? "a" : "b"));
+        BOOST_CHECK(std::get<SerialString>(data).str() == envelope.identifier.channel_name);
+    }
+
+    BOOST_CHECK(!reader.read(data));
+}
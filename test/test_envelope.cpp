@@ -2,6 +2,7 @@
 #define BOOST_TEST_MODULE Main
 
 #include "lt/slipstream/envelope.h"
+#include "lt/slipstream/frame_buffer.h"
 
 #include <boost/test/unit_test.hpp>
 #include <rapidcheck/boost_test.h>
@@ -104,3 +105,87 @@ RC_BOOST_PROP(envelope_roundtrip_rw_rc, (std::string h, std::string a, std::stri
     }
     roundtrip_rw_rc(Envelope{Identifier{h, a, c}, e, payload_kind});
 }
+
+RC_BOOST_PROP(envelope_cache_rc, (std::string h, std::string a, std::string c, std::string e)) {
+    const auto p = *rc::gen::inRange(0, 3);
+    PayloadKind payload_kind = PayloadHeader{};
+    if (p == 1) {
+        payload_kind = PayloadKeyframe{};
+    } else if (p == 2) {
+        payload_kind = PayloadDelta{};
+    }
+
+    auto envelope = Envelope{Identifier{h, a, c}, e, payload_kind};
+    auto cache = EnvelopeCache(envelope.identifier);
+
+    FrameBuffer expected;
+    envelope.write(expected);
+
+    auto bytes = cache.get(payload_kind, e);
+    RC_ASSERT(bytes.size() == envelope.size());
+    RC_ASSERT(std::equal(bytes.begin(), bytes.end(), expected.data()));
+
+    // Other combinations do not disturb the cached bytes
+    cache.get(PayloadHeader{}, "other");
+    cache.get(PayloadDelta{}, e);
+
+    auto again = cache.get(payload_kind, e);
+    RC_ASSERT(again.begin() == bytes.begin());
+}
+
+BOOST_AUTO_TEST_CASE(identifier_table_intern)
+{
+    IdentifierTable table;
+
+    auto& a = table.intern("host", "app", "a");
+    auto& b = table.intern(Identifier{"host", "app", "b"});
+
+    BOOST_CHECK(&table.intern(Identifier{"host", "app", "a"}) == &a);
+    BOOST_CHECK(&table.intern("host", "app", "b") == &b);
+    BOOST_CHECK(table.size() == 2);
+
+    BOOST_CHECK(a.index == 0 && b.index == 1);
+    BOOST_CHECK(&table[1] == &b);
+    BOOST_CHECK(a.hash == std::hash<Identifier>()(a.identifier));
+}
+
+RC_BOOST_PROP(envelope_decoder_rc, (std::string h, std::string a, std::string c, std::string e)) {
+    auto keyframe = Envelope{Identifier{h, a, c}, e, PayloadData{PayloadKeyframe{}}};
+    auto delta = Envelope{Identifier{h, a, c}, e, PayloadData{PayloadDelta{}}};
+
+    FrameBuffer frames;
+    keyframe.write(frames);
+    delta.write(frames);
+    keyframe.write(frames);
+
+    EnvelopeDecoder decoder;
+    uint16_t channel_id;
+
+    // Unbuffered reads go through the decoder's scratch buffer
+    int fds[2];
+    BOOST_REQUIRE(pipe(fds) == 0);
+    {
+        auto out = kj::FdOutputStream(kj::AutoCloseFd(fds[1]));
+        out.write(frames.data(), frames.size());
+    }
+    auto in = kj::FdInputStream(kj::AutoCloseFd(fds[0]));
+
+    auto first = decoder.read(in, keyframe.size(), channel_id);
+    RC_ASSERT(first != nullptr);
+    RC_ASSERT(first->envelope == keyframe);
+    RC_ASSERT(channel_id == 0);
+
+    auto second = decoder.read(in, delta.size(), channel_id);
+    RC_ASSERT(second != nullptr);
+    RC_ASSERT(second->envelope == delta);
+    RC_ASSERT(second->identifier == first->identifier);
+
+    // The same envelope is interned once
+    auto third = decoder.read(in, keyframe.size(), channel_id);
+    RC_ASSERT(third == first);
+
+    // Buffered reads share the interned envelopes
+    auto buffered = kj::ArrayInputStream(frames.asBytes());
+    RC_ASSERT(decoder.read(buffered, keyframe.size(), channel_id) == first);
+    RC_ASSERT(decoder.identifiers().size() == 1);
+}
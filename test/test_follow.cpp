@@ -0,0 +1,199 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+#include <rapidcheck/boost_test.h>
+
+#include "lt/slipstream/follow.h"
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/mapped_output.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/seek.h"
+#include "lt/slipstream/writer.h"
+#include "lt/slipstream/testing/temp_file.h"
+
+using namespace lt::slipstream;
+using namespace lt::slipstream::testing;
+
+static constexpr int nframes = 200;
+
+static void append(const std::string& path, const uint8_t * data, size_t size)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+    BOOST_REQUIRE(fd != -1);
+    BOOST_REQUIRE(::write(fd, data, size) == static_cast<ssize_t>(size));
+    close(fd);
+}
+
+BOOST_AUTO_TEST_CASE(follow_partial_frames)
+{
+    TempFile file;
+
+    FrameBuffer frames;
+    {
+        auto writer = ChannelWriter<PlainText>(&frames, "test", "log");
+        for (int i = 0; i < nframes; ++i) {
+            BOOST_REQUIRE(writer.write(SerialString{std::to_string(i)}, 1000 + i));
+        }
+    }
+
+    // Start with the first frame and part of the second
+    size_t initial = 50;
+    append(file.path, frames.data(), initial);
+
+    auto seeker = ChannelPathSeeker<PlainText>(file.path);
+
+    FollowPolicy policy;
+    policy.timeout_ms = 5000;
+    seeker.follow(policy);
+
+    // Write the rest in pieces that split frames, and their headers
+    std::thread writer([&]() {
+        for (size_t offset = initial; offset < frames.size(); offset += 7) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            append(file.path, frames.data() + offset, std::min<size_t>(7, frames.size() - offset));
+        }
+    });
+
+    SerialString s;
+    uint64_t timestamp;
+    Envelope envelope;
+
+    for (int i = 0; i < nframes; ++i) {
+        BOOST_REQUIRE(seeker.read(s, timestamp, envelope));
+        BOOST_CHECK(s.str() == std::to_string(i));
+        BOOST_CHECK(timestamp == static_cast<uint64_t>(1000 + i));
+    }
+
+    writer.join();
+}
+
+BOOST_AUTO_TEST_CASE(follow_timeout)
+{
+    TempFile file;
+
+    {
+        auto writer = ChannelPathWriter<PlainText>(file.path, "test", "log");
+        BOOST_REQUIRE(writer.write(SerialString{"only"}, 1000));
+    }
+
+    auto seeker = ChannelPathSeeker<PlainText>(file.path);
+
+    FollowPolicy policy;
+    policy.timeout_ms = 50;
+    seeker.follow(policy);
+
+    SerialString s;
+    BOOST_REQUIRE(seeker.read(s));
+    BOOST_CHECK(s.str() == "only");
+
+    auto start = std::chrono::steady_clock::now();
+    BOOST_CHECK(!seeker.read(s));
+    BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+}
+
+BOOST_AUTO_TEST_CASE(follow_mapped_append)
+{
+    TempFile file;
+
+    auto writer = ChannelMappedWriter<PlainText>(file.path, "test", "log");
+    BOOST_REQUIRE(writer.write(SerialString{"0"}, 1000));
+
+    auto seeker = ChannelPathSeeker<PlainText>(file.path);
+
+    // Writes through the mapping are found by the recheck
+    FollowPolicy policy;
+    policy.recheck_ms = 1;
+    policy.timeout_ms = 5000;
+    seeker.follow(policy);
+
+    std::thread appender([&]() {
+        for (int i = 1; i < nframes; ++i) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            writer.write(SerialString{std::to_string(i)}, 1000 + i);
+        }
+    });
+
+    SerialString s;
+
+    for (int i = 0; i < nframes; ++i) {
+        BOOST_REQUIRE(seeker.read(s));
+        BOOST_CHECK(s.str() == std::to_string(i));
+    }
+
+    appender.join();
+}
+
+BOOST_AUTO_TEST_CASE(follow_mapped_reopen)
+{
+    TempFile file;
+
+    // Opened before any writer, so before there is a sidecar
+    auto seeker = ChannelPathSeeker<PlainText>(file.path);
+
+    FollowPolicy policy;
+    policy.recheck_ms = 1;
+    policy.timeout_ms = 5000;
+    seeker.follow(policy);
+
+    // Each writer closes cleanly, removing its sidecar, and the next
+    // appends to the file with a new one
+    std::thread appender([&]() {
+        for (int w = 0; w < 4; ++w) {
+            auto writer = ChannelMappedWriter<PlainText>(file.path, "test", "log");
+            for (int i = w * nframes / 4; i < (w + 1) * nframes / 4; ++i) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                writer.write(SerialString{std::to_string(i)}, 1000 + i);
+            }
+        }
+    });
+
+    SerialString s;
+
+    for (int i = 0; i < nframes; ++i) {
+        BOOST_REQUIRE(seeker.read(s));
+        BOOST_CHECK(s.str() == std::to_string(i));
+    }
+
+    appender.join();
+}
+
+BOOST_AUTO_TEST_CASE(file_watch_spin)
+{
+    TempFile file;
+
+    FollowPolicy policy;
+    policy.max_spin_ns = 50 * 1000 * 1000;
+    policy.timeout_ms = 200;
+
+    auto watch = FileWatch(file.path, policy);
+    BOOST_CHECK(watch.spin_ns() == 0);
+
+    // Data that arrives soon after a wait begins turns on spinning
+    std::atomic<bool> ready{false};
+    std::thread writer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ready = true;
+        uint8_t byte = 0;
+        append(file.path, &byte, 1);
+    });
+
+    BOOST_CHECK(watch.wait([&]() { return ready.load(); }));
+    writer.join();
+
+    uint64_t spin = watch.spin_ns();
+    BOOST_CHECK(spin > 0);
+    BOOST_CHECK(spin <= policy.max_spin_ns);
+
+    // A spin that finds nothing is halved
+    BOOST_CHECK(!watch.wait([]() { return false; }));
+    BOOST_CHECK(watch.spin_ns() == spin / 2);
+}
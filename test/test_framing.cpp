@@ -156,3 +156,43 @@ static void roundtrip_rw_rc(const Framing& input)
 RC_BOOST_PROP(framing_roundtrip_rw_rc, (Framing framing)) {
     roundtrip_rw_rc(framing);
 }
+
+static size_t find_frame_marker_naive(const std::vector<uint8_t>& data)
+{
+    for (size_t i = 0; i + 2 < data.size(); ++i) {
+        if (data[i] == frame_marker[0] && data[i+1] == frame_marker[1] &&
+            data[i+2] == frame_marker[2]) {
+            return i;
+        }
+    }
+    return data.size();
+}
+
+RC_BOOST_PROP(find_frame_marker_rc, ())
+{
+    // Draw bytes mostly from the marker itself, so that partial and
+    // overlapping markers are common
+    auto data = *rc::gen::container<std::vector<uint8_t>>(
+        rc::gen::weightedOneOf<uint8_t>({
+            {3, rc::gen::element(frame_marker[0], frame_marker[1], frame_marker[2])},
+            {1, rc::gen::arbitrary<uint8_t>()}}));
+
+    RC_ASSERT(find_frame_marker(data.data(), data.size()) == find_frame_marker_naive(data));
+}
+
+BOOST_AUTO_TEST_CASE(find_frame_marker_positions)
+{
+    // A single marker at every position of a buffer longer than one vector
+    for (size_t size = 0; size < 100; ++size) {
+        for (size_t pos = 0; pos + 3 <= size; ++pos) {
+            std::vector<uint8_t> data(size, 0xff);
+            data[pos] = frame_marker[0];
+            data[pos+1] = frame_marker[1];
+            data[pos+2] = frame_marker[2];
+            BOOST_CHECK(find_frame_marker(data.data(), size) == pos);
+        }
+
+        std::vector<uint8_t> data(size, 0xff);
+        BOOST_CHECK(find_frame_marker(data.data(), size) == size);
+    }
+}
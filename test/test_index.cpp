@@ -0,0 +1,173 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+#include <rapidcheck/boost_test.h>
+
+#include "lt/slipstream/index.h"
+#include "lt/slipstream/multichannel_writer.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/testing/biased.h"
+#include "lt/slipstream/seek.h"
+#include "lt/slipstream/writer.h"
+#include "lt/slipstream/testing/temp_file.h"
+
+using namespace lt::slipstream;
+using namespace lt::slipstream::testing;
+
+static constexpr int nframes = 5000;
+static constexpr uint64_t first_timestamp = 1000;
+
+static void write_frames(const std::string& path)
+{
+    auto writer = MultiChannelPathWriter<PlainText>(path, "test");
+
+    for (int i = 0; i < nframes; ++i) {
+        std::string line = "line " + std::to_string(i) + std::string(i % 50, '.');
+        BOOST_REQUIRE(writer.write(i < 100 ? "a" : (i % 2 ? "a" : "b"),
+            SerialString{line}, first_timestamp + 2 * i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(index_build_load)
+{
+    TempFile file;
+    write_frames(file.path);
+
+    BOOST_CHECK(!TimeIndex::load(file.path));
+
+    auto index = TimeIndex::build(file.path, 4096);
+    BOOST_REQUIRE(!index.empty());
+    BOOST_CHECK(index.entries().size() > 10);
+    BOOST_CHECK(index.entries().front().offset == 0);
+    BOOST_CHECK(index.entries().front().timestamp == first_timestamp);
+    BOOST_CHECK(index.last().timestamp == first_timestamp + 2 * (nframes - 1));
+
+    index.write(file.path);
+
+    auto loaded = TimeIndex::load(file.path);
+    BOOST_REQUIRE(loaded);
+    BOOST_CHECK(loaded->entries().size() == index.entries().size());
+    BOOST_CHECK(loaded->channels().size() == 2);
+
+    auto b = loaded->channel({index.channels()[0].identifier.host_name, "test", "b"});
+    BOOST_REQUIRE(b != nullptr);
+    BOOST_CHECK(b->timestamp == first_timestamp + 2 * 100);
+
+    // Channels without deltas need no keyframe table
+    BOOST_CHECK(loaded->keyframes().empty());
+}
+
+BOOST_AUTO_TEST_CASE(index_seek_time)
+{
+    TempFile file;
+    write_frames(file.path);
+
+    TimeIndex::build(file.path, 4096).write(file.path);
+
+    auto seeker = PathSeeker(file.path);
+
+    for (uint64_t target : {first_timestamp, first_timestamp + 2 * 1234,
+             first_timestamp + 2 * 1234 + 1, first_timestamp + 2 * (nframes - 1)}) {
+        BOOST_REQUIRE(seeker.seek_time(target));
+
+        uint64_t timestamp = 0;
+        BOOST_REQUIRE(seeker.peek(timestamp));
+        BOOST_CHECK(timestamp == target - (target - first_timestamp) % 2);
+    }
+
+    BOOST_CHECK(!seeker.seek_time(first_timestamp - 1));
+    BOOST_CHECK(!seeker.seek_time(first_timestamp + 2 * nframes));
+}
+
+BOOST_AUTO_TEST_CASE(index_stale)
+{
+    TempFile file;
+    write_frames(file.path);
+
+    TimeIndex::build(file.path, 4096).write(file.path);
+    BOOST_REQUIRE(TimeIndex::load(file.path));
+
+    // Append a frame
+    {
+        TempFile more;
+        {
+            auto writer = ChannelPathWriter<PlainText>(more.path, "test", "a");
+            BOOST_REQUIRE(writer.write(SerialString{"more"}, first_timestamp + 2 * nframes));
+        }
+
+        int in = open(more.path.c_str(), O_RDONLY);
+        int out = open(file.path.c_str(), O_WRONLY | O_APPEND);
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(in, buf, sizeof(buf))) > 0) {
+            BOOST_REQUIRE(write(out, buf, n) == n);
+        }
+        close(in);
+        close(out);
+    }
+
+    BOOST_CHECK(!TimeIndex::load(file.path));
+
+    // Seeking falls back to searching the file
+    auto seeker = PathSeeker(file.path);
+    BOOST_REQUIRE(seeker.seek_time(first_timestamp + 2 * nframes));
+
+    uint64_t timestamp = 0;
+    BOOST_REQUIRE(seeker.peek(timestamp));
+    BOOST_CHECK(timestamp == first_timestamp + 2 * nframes);
+}
+
+// A delta channel with a keyframe every `every` frames
+static void write_delta_frames(const std::string& path, uint64_t every)
+{
+    auto writer = ChannelPathWriter<BiasedDeltaInt64Stream>(path, "test", "s", SerialInt64(100));
+    writer.set_keyframe_policy(KeyframePolicy{every});
+
+    for (int i = 0; i < nframes; ++i) {
+        BOOST_REQUIRE(writer.write(SerialInt64(7 * i), first_timestamp + 2 * i));
+    }
+}
+
+static void check_delta_seek(const std::string& path)
+{
+    auto seeker = ChannelPathSeeker<BiasedDeltaInt64Stream>(path);
+    SerialInt64 data;
+
+    for (int i : {1234, 0, 4998, 17, 2500, 2501, 1000, 999}) {
+        BOOST_REQUIRE(seeker.seek_time(first_timestamp + 2 * i + (i % 2)));
+
+        BOOST_REQUIRE(seeker.read(data));
+        BOOST_CHECK(data.value() == 7 * i);
+
+        if (i + 1 < nframes) {
+            BOOST_REQUIRE(seeker.read(data));
+            BOOST_CHECK(data.value() == 7 * (i + 1));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(index_seek_keyframe)
+{
+    for (uint64_t every : {2, 16, 1000}) {
+        TempFile file;
+        write_delta_frames(file.path, every);
+
+        // Searching back through the file for a keyframe
+        check_delta_seek(file.path);
+
+        auto index = TimeIndex::build(file.path, 4096);
+        index.write(file.path);
+
+        BOOST_REQUIRE(index.keyframes().size() == 1);
+        auto& keyframes = index.keyframes()[0].entries;
+        BOOST_CHECK(keyframes.front().timestamp == first_timestamp);
+        BOOST_CHECK(keyframes.size() > 1);
+
+        // Starting from the keyframe table
+        check_delta_seek(file.path);
+    }
+}
@@ -4,135 +4,18 @@
 #include <boost/test/unit_test.hpp>
 #include <rapidcheck/boost_test.h>
 
-#include <capnp/message.h>
-#include <capnp/serialize.h>
-
-#include "lt/slipstream/capnp/test_delta.capnp.h"
-
-#include "lt/slipstream/capnp.h"
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/keyframe_policy.h"
+#include "lt/slipstream/plaintext.h"
 #include "lt/slipstream/serialize.h"
+#include "lt/slipstream/testing/biased.h"
+#include "lt/slipstream/testing/integer.h"
 #include "lt/slipstream/testing/roundtrip.h"
 #include "lt/slipstream/testing/multichannel_roundtrip.h"
 
-namespace lt::slipstream {
-
-class SerialInt64 : public SlipstreamCapnp<SerialInt64, capnp::SerialInt64, SerialInt64> {
-   public:
-    static constexpr auto encoding = "capnp/int64";
-
-    SerialInt64(int64_t i=0) : i_(i) {}
-
-    int64_t value() const {
-        return i_;
-    };
-
-    bool operator==(const SerialInt64& other) const {
-        return i_ == other.i_;
-    }
-
-    friend std::ostream& operator<<(std::ostream& os, const SerialInt64& s) {
-        return os << s.i_;
-    }
-
-    static SerialInt64 decode(const reader_type& reader)
-    {
-        return SerialInt64(reader.getValue());
-    }
-
-    static void encode(builder_type& builder, const SerialInt64& value)
-    {
-        builder.setValue(value.value());
-    }
-
-   private:
-    int64_t i_;
-};
-
-class BiasedInt64 {
-   public:
-    using header_type = SerialInt64;
-    using data_type = SerialInt64;
-
-    BiasedInt64(SerialInt64 bias) : bias_(bias)
-    {
-    }
-
-    const SerialInt64& header() {
-        return bias_;
-    }
-
-    SerialInt64 encode(const SerialInt64& input) {
-        return {input.value() - bias_.value()};
-    }
-
-    SerialInt64 decode(const SerialInt64& input) {
-        return {input.value() + bias_.value()};
-    }
-
-   private:
-    SerialInt64 bias_;
-};
-
-class BiasedDeltaInt64 {
-   public:
-    using header_type = SerialInt64;
-    using data_type = SerialInt64;
-    using delta_type = SerialInt64;
-
-    BiasedDeltaInt64(SerialInt64 bias) : bias_(bias)
-    {
-    }
-
-    const SerialInt64& header() {
-        return bias_;
-    }
-
-    SerialInt64 encode(const SerialInt64& input) {
-        keyframe_ = input;
-        return {input.value() - bias_.value()};
-    }
-
-    SerialInt64 decode(const SerialInt64& input) {
-        keyframe_ = {input.value() + bias_.value()};
-        return keyframe_;
-    }
-
-    SerialInt64 encode_delta(const SerialInt64& input) {
-        int64_t d = input.value() - keyframe_.value();
-        return {d - bias_.value()};
-    }
-
-    SerialInt64 decode_delta(const SerialInt64& input) {
-        int64_t d = input.value() + keyframe_.value();
-        return {d + bias_.value()};
-    }
-
-   private:
-    SerialInt64 bias_;
-    SerialInt64 keyframe_; //unbiased
-};
-
-
-using BiasedInt64Stream = HeaderStream<BiasedInt64>;
-using BiasedDeltaInt64ValueStream = HeaderStream<BiasedDeltaInt64>;
-
-using BiasedDeltaInt64Stream = HeaderDeltaStream<BiasedDeltaInt64>;
-
-} // namespace lt::slipstream
-
 using namespace lt::slipstream;
 using namespace lt::slipstream::testing;
 
-namespace rc {
-
-template <>
-struct Arbitrary<SerialInt64> {
-    static Gen<SerialInt64> arbitrary() {
-        return gen::construct<SerialInt64>(gen::arbitrary<int64_t>());
-    }
-};
-
-} // namespace rc
 BOOST_AUTO_TEST_CASE(biased_int64_stream_roundtrip_rw)
 {
     int64_t header = 100;
@@ -209,3 +92,219 @@ RC_BOOST_PROP(multichannel_biased_delta_int64_stream_roundtrip_rw_rc, ())
     headers.emplace_back("s2", SerialInt64(1000));
     RC_MultiChannelRoundtrip<BiasedDeltaInt64Stream>::run(headers);
 }
+
+BOOST_AUTO_TEST_CASE(multichannel_channel_handle)
+{
+    FrameBuffer frames;
+
+    {
+        auto writer = MultiChannelWriter<BiasedInt64Stream, PlainText>(&frames, "test");
+
+        auto biased = writer.channel<BiasedInt64Stream>("biased", SerialInt64(100));
+        auto plain = writer.channel<PlainText>("plain");
+
+        BOOST_CHECK(biased && plain);
+
+        // The same channel is found again, by handle or by name
+        BOOST_CHECK(writer.channel<BiasedInt64Stream>("biased"));
+        BOOST_CHECK_THROW(writer.channel<PlainText>("biased"), std::runtime_error);
+        BOOST_CHECK_THROW(writer.channel<BiasedInt64Stream>("missing"), std::runtime_error);
+
+        for (int i = 0; i < 10; ++i) {
+            BOOST_CHECK(biased.write(SerialInt64(i), 1000 + i));
+            BOOST_CHECK(plain.write(SerialString{std::to_string(i)}, 1000 + i));
+        }
+
+        decltype(writer)::data_type data;
+        data.emplace<1>(SerialInt64(7));
+        BOOST_CHECK(writer.write("biased", data, 2000));
+    }
+
+    auto in = kj::ArrayInputStream(frames.asBytes());
+    auto reader = MultiChannelReader<BiasedInt64Stream, PlainText>(&in);
+    decltype(reader)::data_type data;
+    uint64_t timestamp;
+    Envelope envelope;
+
+    for (int i = 0; i < 10; ++i) {
+        BOOST_REQUIRE(reader.read(data, timestamp, envelope));
+        BOOST_CHECK(envelope.identifier.channel_name == "biased");
+        BOOST_CHECK(std::get<1>(data) == SerialInt64(i));
+
+        BOOST_REQUIRE(reader.read(data, timestamp, envelope));
+        BOOST_CHECK(envelope.identifier.channel_name == "plain");
+        BOOST_CHECK(std::get<2>(data).str() == std::to_string(i));
+    }
+
+    BOOST_REQUIRE(reader.read(data, timestamp, envelope));
+    BOOST_CHECK(std::get<1>(data) == SerialInt64(7));
+    BOOST_CHECK(!reader.read(data));
+}
+
+BOOST_AUTO_TEST_CASE(keyframe_schedule)
+{
+    // The first frame is always a keyframe
+    KeyframeSchedule none(KeyframePolicy{0});
+    BOOST_CHECK(none.due(1000));
+    none.keyframe(1000, 16);
+    for (int i = 0; i < 100; ++i) {
+        BOOST_CHECK(!none.due(2000 + i));
+        none.delta();
+    }
+
+    KeyframeSchedule frames(KeyframePolicy{3});
+    frames.keyframe(1000, 16);
+    BOOST_CHECK(!frames.due(1001));
+    frames.delta();
+    BOOST_CHECK(!frames.due(1002));
+    frames.delta();
+    BOOST_CHECK(frames.due(1003));
+
+    KeyframePolicy interval;
+    interval.every_frames = 0;
+    interval.every_ns = 100;
+    KeyframeSchedule timed(interval);
+    timed.keyframe(1000, 16);
+    BOOST_CHECK(!timed.due(1099));
+    BOOST_CHECK(timed.due(1100));
+
+    KeyframePolicy adaptive;
+    adaptive.every_frames = 0;
+    adaptive.max_delta_ratio = 0.5;
+    KeyframeSchedule sized(adaptive);
+    sized.keyframe(1000, 16);
+    BOOST_CHECK(!sized.oversized(8));
+    BOOST_CHECK(sized.oversized(9));
+    BOOST_CHECK(!frames.oversized(1000));
+}
+
+BOOST_AUTO_TEST_CASE(channel_writer_keyframe_policy)
+{
+    FrameBuffer frames;
+
+    {
+        auto writer = ChannelWriter<BiasedDeltaInt64Stream>(&frames, "test", "s", SerialInt64(100));
+        writer.set_keyframe_policy(KeyframePolicy{4});
+
+        for (int i = 0; i < 10; ++i) {
+            BOOST_CHECK(writer.write(SerialInt64(i * 3), 1000 + i));
+        }
+
+        // A forced keyframe restarts the count
+        BOOST_CHECK(writer.write(SerialInt64(30), 1010, true));
+        BOOST_CHECK(writer.write(SerialInt64(33), 1011));
+    }
+
+    auto in = kj::ArrayInputStream(frames.asBytes());
+    auto reader = ChannelReader<BiasedDeltaInt64Stream>(&in);
+    SerialInt64 data;
+    uint64_t timestamp;
+    Envelope envelope;
+
+    for (int i = 0; i < 12; ++i) {
+        BOOST_REQUIRE(reader.read(data, timestamp, envelope));
+        BOOST_CHECK(data == SerialInt64(i * 3));
+
+        bool keyframe = std::holds_alternative<PayloadKeyframe>(
+            std::get<PayloadData>(envelope.payload_kind));
+        BOOST_CHECK(keyframe == (i == 0 || i == 4 || i == 8 || i == 10));
+    }
+
+    BOOST_CHECK(!reader.read(data));
+}
+
+BOOST_AUTO_TEST_CASE(multichannel_read_batch)
+{
+    static constexpr int nframes = 100;
+
+    MultiChannelWriter<BiasedDeltaInt64Stream>::header_map headers;
+    headers.emplace_back("a", SerialInt64(100));
+    headers.emplace_back("b", SerialInt64(-100));
+
+    FrameBuffer frames;
+
+    {
+        auto writer = MultiChannelWriter<BiasedDeltaInt64Stream>(&frames, "test", headers);
+
+        for (int i = 0; i < nframes; ++i) {
+            BOOST_CHECK(writer.write(i % 2 ? "a" : "b", SerialInt64(i), 1000 + i));
+        }
+    }
+
+    using Reader = MultiChannelReader<BiasedDeltaInt64Stream>;
+
+    {
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = Reader(&in);
+        std::vector<Reader::slot_type> slots(16);
+        int i = 0;
+
+        while (size_t n = reader.read_batch(kj::arrayPtr(slots.data(), slots.size()))) {
+            BOOST_CHECK(n == std::min<size_t>(slots.size(), nframes - i));
+
+            for (size_t j = 0; j < n; ++j, ++i) {
+                BOOST_CHECK(slots[j].source_timestamp == static_cast<uint64_t>(1000 + i));
+                BOOST_CHECK(slots[j].envelope->envelope.identifier.channel_name == (i % 2 ? "a" : "b"));
+                BOOST_CHECK(std::get<SerialInt64>(slots[j].data).value() == i);
+            }
+        }
+
+        BOOST_CHECK(i == nframes);
+    }
+
+    {
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = Reader(&in);
+        const InternedIdentifier * a = nullptr;
+        int i = 0;
+
+        // Stop part way through
+        size_t n = reader.for_each_frame([&](const Reader::slot_type& slot) {
+            if (slot.envelope->envelope.identifier.channel_name == "a") {
+                // The same channel always has the same handle
+                BOOST_CHECK(a == nullptr || a == slot.envelope->identifier);
+                a = slot.envelope->identifier;
+            }
+            BOOST_CHECK(std::get<SerialInt64>(slot.data).value() == i);
+            return ++i < 50;
+        });
+
+        BOOST_CHECK(n == 50);
+
+        // And carry on to the end
+        n = reader.for_each_frame([&](const Reader::slot_type& slot) {
+            BOOST_CHECK(std::get<SerialInt64>(slot.data).value() == i++);
+        });
+
+        BOOST_CHECK(n == nframes - 50);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(channel_read_batch)
+{
+    FrameBuffer frames;
+
+    {
+        auto writer = ChannelWriter<BiasedDeltaInt64Stream>(&frames, "test", "s", SerialInt64(100));
+
+        for (int i = 0; i < 10; ++i) {
+            BOOST_CHECK(writer.write(SerialInt64(i), 1000 + i));
+        }
+    }
+
+    auto in = kj::ArrayInputStream(frames.asBytes());
+    auto reader = ChannelReader<BiasedDeltaInt64Stream>(&in);
+    FrameSlot<SerialInt64> slots[4];
+
+    BOOST_CHECK(reader.read_batch(kj::arrayPtr(slots, 4)) == 4);
+    BOOST_CHECK(slots[3].data.value() == 3);
+    BOOST_CHECK(slots[3].source_timestamp == 1003);
+
+    int64_t sum = 0;
+    BOOST_CHECK(reader.for_each_frame([&](const FrameSlot<SerialInt64>& slot) {
+        sum += slot.data.value();
+    }) == 6);
+    BOOST_CHECK(sum == 4 + 5 + 6 + 7 + 8 + 9);
+
+    BOOST_CHECK(reader.read_batch(kj::arrayPtr(slots, 4)) == 0);
+}
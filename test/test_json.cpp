@@ -0,0 +1,279 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+#include <rapidcheck/boost_test.h>
+
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/json.h"
+#include "lt/slipstream/json_writer.h"
+#include "lt/slipstream/multichannel_reader.h"
+#include "lt/slipstream/multichannel_writer.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/reader.h"
+#include "lt/slipstream/writer.h"
+#include "lt/slipstream/testing/integer.h"
+#include "lt/slipstream/testing/rc_plaintext.h"
+#include "lt/slipstream/testing/temp_file.h"
+
+using namespace lt::slipstream;
+using namespace lt::slipstream::testing;
+
+// One character at a time
+static std::string escape_reference(const std::string& input)
+{
+    std::string out;
+
+    for (unsigned char c : input) {
+        switch (c) {
+            case '\\': out += "\\\\"; break;
+            case '"': out += "\\\""; break;
+            case '/': out += "\\/"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char u[7];
+                    snprintf(u, sizeof(u), "\\u%04x", c);
+                    out += u;
+                } else {
+                    out += c;
+                }
+                break;
+        }
+    }
+
+    return out;
+}
+
+static std::string escaped(const std::string& s)
+{
+    std::string out;
+    json::append_escaped(out, s);
+    return out;
+}
+
+BOOST_AUTO_TEST_CASE(json_escape_cases)
+{
+    BOOST_CHECK(escaped("") == "");
+    BOOST_CHECK(escaped("plain") == "plain");
+    BOOST_CHECK(escaped("a \"quoted\" path/to\\file") == "a \\\"quoted\\\" path\\/to\\\\file");
+    BOOST_CHECK(escaped("tab\there\nnewline\r\b\f") == "tab\\there\\nnewline\\r\\b\\f");
+    BOOST_CHECK(escaped(std::string("nul\0bell\x07", 9)) == "nul\\u0000bell\\u0007");
+    BOOST_CHECK(escaped("caf\xc3\xa9 \x7f") == "caf\xc3\xa9 \x7f");
+
+    // Escapes at and around the edges of each block
+    for (size_t length : {15, 16, 17, 31, 32, 33, 64, 100}) {
+        for (size_t at = 0; at < length; ++at) {
+            std::string s(length, 'x');
+            s[at] = '"';
+            BOOST_CHECK(escaped(s) == escape_reference(s));
+        }
+    }
+
+    // json_escape is as it was, for valid text
+    BOOST_CHECK(json_escape("say \"hi\"\n") == "say \\\"hi\\\"\\n");
+}
+
+RC_BOOST_PROP(json_escape_rc, (std::string s))
+{
+    RC_ASSERT(escaped(s) == escape_reference(s));
+
+    // Appending leaves what is there
+    std::string out = "prefix";
+    json::append_escaped(out, s);
+    RC_ASSERT(out == "prefix" + escape_reference(s));
+}
+
+BOOST_AUTO_TEST_CASE(json_timestamp)
+{
+    json::Writer writer;
+
+    // Within a second, across seconds, and back again
+    uint64_t base = 1700000000ull * 1000000000;
+    std::vector<uint64_t> timestamps = {base, base + 1, base + 999999999, base + 1000000000,
+        base + 86400ull * 1000000000 + 5, base + 7, 0, 123456789};
+
+    for (uint64_t timestamp : timestamps) {
+        writer.clear();
+        writer.timestamp(timestamp);
+        BOOST_CHECK(writer.str() == "\"" + format_timestamp(timestamp) + "\"");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(json_frame)
+{
+    Envelope envelope;
+    envelope.identifier = {"host", "app", "chan\"nel"};
+
+    uint64_t timestamp = 1700000000123456789ull;
+
+    json::Writer writer;
+    writer.frame(timestamp, envelope.identifier, "{\"x\":1}");
+
+    BOOST_CHECK(writer.str() ==
+        "{\"timestamp\":\"2023-11-14T22:13:20.123456789\",\"epochMillis\":1700000000123,"
+        "\"nanos\":456789,\"host\":\"host\",\"app\":\"app\",\"channel\":\"chan\\\"nel\","
+        "\"data\":{\"x\":1}}");
+
+    BOOST_CHECK(json::frame("{\"x\":1}", timestamp, envelope) == writer.str());
+
+    // Records are appended
+    size_t size = writer.size();
+    writer.frame(timestamp, envelope.identifier, [](json::Writer& w) {
+        json::data(w, SerialString{"a/b"});
+    });
+    BOOST_CHECK(writer.str().substr(size).find("\"data\":{\"text\":\"a\\/b\"}}") != std::string::npos);
+
+    writer.truncate(size);
+    BOOST_CHECK(writer.size() == size);
+}
+
+BOOST_AUTO_TEST_CASE(json_read)
+{
+    FrameBuffer frames;
+
+    {
+        auto writer = ChannelWriter<PlainText>(&frames, "test", "log");
+        for (int i = 0; i < 100; ++i) {
+            BOOST_REQUIRE(writer.write(SerialString{"line \"" + std::to_string(i) + "\"\n"}, 1000 + i * 1000000));
+        }
+    }
+
+    auto a = kj::ArrayInputStream(frames.asBytes());
+    auto strings = ChannelReader<PlainText>(&a);
+
+    auto b = kj::ArrayInputStream(frames.asBytes());
+    auto writers = ChannelReader<PlainText>(&b);
+
+    json::Writer out;
+    std::string expected;
+    uint64_t timestamp;
+    int n = 0;
+
+    while (auto o = strings.read_json(timestamp)) {
+        expected += *o + "\n";
+
+        uint64_t t;
+        BOOST_REQUIRE(writers.read_json(out, t));
+        BOOST_CHECK(t == timestamp);
+        out.raw('\n');
+        n++;
+    }
+
+    BOOST_CHECK(n == 100);
+    BOOST_CHECK(!writers.read_json(out, timestamp));
+    BOOST_CHECK(out.str() == expected);
+}
+
+static_assert(ChannelReader<Headerless<SerialInt64>>::json_direct);
+static_assert(!ChannelReader<PlainText>::json_direct);
+
+// Read every frame as JSON, one record per line
+template <typename R>
+static std::string read_all_json(R& reader)
+{
+    json::Writer out;
+    uint64_t timestamp;
+
+    while (reader.read_json(out, timestamp)) {
+        out.raw('\n');
+    }
+
+    return out.str();
+}
+
+RC_BOOST_PROP(json_capnp_direct_rc, (std::vector<SerialInt64> values, std::vector<SerialString> lines))
+{
+    FrameBuffer frames;
+    FrameBuffer ints;
+
+    {
+        auto writer = MultiChannelWriter<Headerless<SerialInt64>, PlainText>(&frames, "test");
+        auto int_writer = ChannelWriter<Headerless<SerialInt64>>(&ints, "test", "int");
+
+        for (size_t i = 0; i < values.size(); ++i) {
+            RC_ASSERT(writer.write("int", values[i], 1000 + 2 * i));
+            RC_ASSERT(int_writer.write(values[i], 1000 + 2 * i));
+
+            // Variable length text between messages, so that some are not
+            // word-aligned
+            if (i < lines.size()) {
+                RC_ASSERT(writer.write("log", lines[i], 1001 + 2 * i));
+            }
+        }
+    }
+
+    // Capnp payloads are written from the message as read; the records are
+    // as from decoding each frame and encoding it again
+    std::string expected;
+    {
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = MultiChannelReader<Headerless<SerialInt64>, PlainText>(&in);
+        decltype(reader)::data_type data;
+        uint64_t timestamp;
+        Envelope envelope;
+
+        while (reader.read(data, timestamp, envelope)) {
+            auto data_json = std::visit([](auto&& d) -> std::string {
+                using D = std::decay_t<decltype(d)>;
+                if constexpr (std::is_same_v<D, std::monostate>) {
+                    return "";
+                } else {
+                    return D::to_json(d);
+                }
+            }, data);
+            expected += json::frame(data_json, timestamp, envelope) + "\n";
+        }
+    }
+
+    std::string expected_ints;
+    {
+        auto in = kj::ArrayInputStream(ints.asBytes());
+        auto reader = ChannelReader<Headerless<SerialInt64>>(&in);
+        SerialInt64 data;
+        uint64_t timestamp;
+        Envelope envelope;
+
+        while (reader.read(data, timestamp, envelope)) {
+            expected_ints += json::frame(SerialInt64::to_json(data), timestamp, envelope) + "\n";
+        }
+    }
+
+    auto a = kj::ArrayInputStream(ints.asBytes());
+    auto channel = ChannelReader<Headerless<SerialInt64>>(&a);
+    RC_ASSERT(read_all_json(channel) == expected_ints);
+
+    auto b = kj::ArrayInputStream(frames.asBytes());
+    auto multi = MultiChannelReader<Headerless<SerialInt64>, PlainText>(&b);
+    RC_ASSERT(read_all_json(multi) == expected);
+
+    // Through an unbuffered stream
+    TempFile file;
+    {
+        FILE * f = fopen(file.path.c_str(), "wb");
+        RC_ASSERT(f != nullptr);
+        RC_ASSERT(fwrite(frames.data(), 1, frames.size(), f) == frames.size());
+        fclose(f);
+    }
+
+    auto path_reader = MultiChannelPathReader<Headerless<SerialInt64>, PlainText>(file.path);
+    RC_ASSERT(read_all_json(path_reader) == expected);
+
+    // The string form matches
+    auto c = kj::ArrayInputStream(ints.asBytes());
+    auto strings = ChannelReader<Headerless<SerialInt64>>(&c);
+    std::string joined;
+    uint64_t timestamp;
+    while (auto o = strings.read_json(timestamp)) {
+        joined += *o + "\n";
+    }
+    RC_ASSERT(joined == expected_ints);
+}
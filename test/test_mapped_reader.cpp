@@ -0,0 +1,217 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+#include <rapidcheck/boost_test.h>
+
+#include "lt/slipstream/mapped_input.h"
+#include "lt/slipstream/mapped_output.h"
+#include "lt/slipstream/multichannel_reader.h"
+#include "lt/slipstream/multichannel_writer.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/reader.h"
+#include "lt/slipstream/seek.h"
+#include "lt/slipstream/writer.h"
+#include "lt/slipstream/testing/integer.h"
+#include "lt/slipstream/testing/rc_plaintext.h"
+#include "lt/slipstream/testing/temp_file.h"
+
+using namespace lt::slipstream;
+using namespace lt::slipstream::testing;
+
+BOOST_AUTO_TEST_CASE(mapped_input_read)
+{
+    TempFile file;
+
+    {
+        auto out = kj::FdOutputStream(kj::AutoCloseFd(open(file.path.c_str(), O_WRONLY)));
+        out.write("0123456789", 10);
+    }
+
+    MappedInputStream in(file.path);
+    BOOST_CHECK(in.size() == 10);
+
+    char buf[4];
+    in.read(buf, 4);
+    BOOST_CHECK(std::string(buf, 4) == "0123");
+
+    in.skip(2);
+    BOOST_CHECK(in.position() == 6);
+
+    auto rest = in.tryGetReadBuffer();
+    BOOST_CHECK(std::string(reinterpret_cast<const char*>(rest.begin()), rest.size()) == "6789");
+
+    BOOST_CHECK(in.tryRead(buf, 1, 4) == 4);
+    BOOST_CHECK(in.tryRead(buf, 1, 4) == 0);
+    BOOST_CHECK_THROW(in.skip(1), std::exception);
+}
+
+BOOST_AUTO_TEST_CASE(mapped_input_empty)
+{
+    TempFile file;
+
+    MappedInputStream in(file.path);
+    BOOST_CHECK(in.size() == 0);
+    BOOST_CHECK(in.tryGetReadBuffer().size() == 0);
+
+    auto reader = ChannelReader<PlainText>(&in);
+    SerialString s;
+    BOOST_CHECK(!reader.read(s));
+}
+
+RC_BOOST_PROP(mapped_plaintext_roundtrip_rc, (std::vector<SerialString> lines))
+{
+    TempFile file;
+
+    {
+        auto writer = ChannelPathWriter<PlainText>(file.path, "test", "log");
+        for (auto&& line : lines) {
+            RC_ASSERT(writer.write(line));
+        }
+    }
+
+    auto reader = ChannelMappedReader<PlainText>(file.path);
+
+    for (auto&& line : lines) {
+        SerialString s;
+        RC_ASSERT(reader.read(s));
+        RC_ASSERT(s == line);
+    }
+
+    SerialString s;
+    RC_ASSERT(!reader.read(s));
+}
+
+RC_BOOST_PROP(mapped_capnp_roundtrip_rc, (std::vector<SerialInt64> values, std::vector<SerialString> lines))
+{
+    // Interleave variable length plaintext frames, so that capnp messages
+    // land at both aligned and unaligned offsets in the mapping
+    TempFile file;
+
+    {
+        auto writer = MultiChannelPathWriter<Headerless<SerialInt64>, PlainText>(file.path, "test");
+        for (size_t i = 0; i < values.size(); ++i) {
+            RC_ASSERT(writer.write("int", values[i]));
+            if (i < lines.size()) {
+                RC_ASSERT(writer.write("log", lines[i]));
+            }
+        }
+    }
+
+    auto reader = MultiChannelMappedReader<Headerless<SerialInt64>, PlainText>(file.path);
+    decltype(reader)::data_type data;
+
+    for (size_t i = 0; i < values.size(); ++i) {
+        RC_ASSERT(reader.read(data));
+        RC_ASSERT(std::get<SerialInt64>(data) == values[i]);
+        if (i < lines.size()) {
+            RC_ASSERT(reader.read(data));
+            RC_ASSERT(std::get<SerialString>(data) == lines[i]);
+        }
+    }
+
+    RC_ASSERT(!reader.read(data));
+}
+
+static uint64_t file_size(const std::string& path)
+{
+    struct stat st;
+    BOOST_REQUIRE(stat(path.c_str(), &st) == 0);
+    return st.st_size;
+}
+
+BOOST_AUTO_TEST_CASE(mapped_append_tail)
+{
+    TempFile file;
+
+    auto writer = ChannelMappedWriter<PlainText>(file.path, "test", "log");
+    auto seeker = ChannelPathSeeker<PlainText>(file.path);
+    auto committed = CommittedLength::open(file.path);
+    BOOST_REQUIRE(committed);
+
+    SerialString s;
+    uint64_t timestamp;
+    Envelope envelope;
+
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 10; ++i) {
+            BOOST_CHECK(writer.write(SerialString{std::to_string(i)}, 1000 + i));
+        }
+
+        // The preallocated space beyond the committed length is not read
+        BOOST_CHECK(file_size(file.path) > committed->get());
+
+        for (int i = 0; i < 10; ++i) {
+            BOOST_REQUIRE(seeker.read(s, timestamp, envelope));
+            BOOST_CHECK(s.str() == std::to_string(i));
+        }
+
+        BOOST_CHECK(!seeker.read(s, timestamp, envelope));
+    }
+
+    auto reader = ChannelMappedReader<PlainText>(file.path);
+    size_t n = 0;
+    while (reader.read(s)) {
+        n++;
+    }
+    BOOST_CHECK(n == 30);
+}
+
+BOOST_AUTO_TEST_CASE(mapped_append_recover)
+{
+    TempFile file;
+
+    // A writer that dies without cleaning up leaves preallocated space
+    pid_t pid = fork();
+    BOOST_REQUIRE(pid != -1);
+
+    if (pid == 0) {
+        auto writer = ChannelMappedWriter<PlainText>(file.path, "test", "log");
+        for (int i = 0; i < 10; ++i) {
+            writer.write(SerialString{std::to_string(i)}, 1000 + i);
+        }
+        _exit(0);
+    }
+
+    int status;
+    BOOST_REQUIRE(waitpid(pid, &status, 0) == pid);
+
+    auto committed = CommittedLength::open(file.path);
+    BOOST_REQUIRE(committed);
+    BOOST_CHECK(file_size(file.path) > committed->get());
+
+    SerialString s;
+
+    {
+        auto reader = ChannelMappedReader<PlainText>(file.path);
+        for (int i = 0; i < 10; ++i) {
+            BOOST_REQUIRE(reader.read(s));
+            BOOST_CHECK(s.str() == std::to_string(i));
+        }
+        BOOST_CHECK(!reader.read(s));
+    }
+
+    // A new writer carries on from the committed length
+    {
+        auto writer = ChannelMappedWriter<PlainText>(file.path, "test", "log");
+        for (int i = 10; i < 15; ++i) {
+            BOOST_CHECK(writer.write(SerialString{std::to_string(i)}, 1000 + i));
+        }
+    }
+
+    BOOST_CHECK(!CommittedLength::open(file.path));
+
+    auto reader = ChannelPathReader<PlainText>(file.path);
+    uint64_t timestamp;
+    Envelope envelope;
+    for (int i = 0; i < 15; ++i) {
+        BOOST_REQUIRE(reader.read(s, timestamp, envelope));
+        BOOST_CHECK(s.str() == std::to_string(i));
+    }
+    BOOST_CHECK(!reader.read(s, timestamp, envelope));
+}
@@ -0,0 +1,303 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <stdexcept>
+#include <tuple>
+
+#include <boost/test/unit_test.hpp>
+#include <rapidcheck/boost_test.h>
+
+#include "lt/slipstream/keyframe_policy.h"
+#include "lt/slipstream/multichannel_writer.h"
+#include "lt/slipstream/parallel_reader.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/testing/biased.h"
+#include "lt/slipstream/testing/temp_file.h"
+
+using namespace lt::slipstream;
+using namespace lt::slipstream::testing;
+
+static constexpr int nframes = 20000;
+
+using Reader = ParallelReader<BiasedDeltaInt64Stream, PlainText>;
+
+// Timestamp, channel and value of a frame
+using Frame = std::tuple<uint64_t, std::string, std::string>;
+
+static Frame frame(const Reader::slot_type& slot)
+{
+    std::string value;
+
+    if (auto i = std::get_if<SerialInt64>(&slot.data)) {
+        value = std::to_string(i->value());
+    } else if (auto s = std::get_if<SerialString>(&slot.data)) {
+        value = s->str();
+    }
+
+    return {slot.source_timestamp, slot.envelope->envelope.identifier.channel_name, value};
+}
+
+// Delta channels keyframed rarely and often, and a plain text channel
+// whose first frame is far from the start
+static void write_frames(const std::string& path, FrameFormat format = FrameFormat::envelope)
+{
+    MultiChannelPathWriter<BiasedDeltaInt64Stream, PlainText>::header_map headers;
+    headers.emplace_back("rare", SerialInt64(100));
+    headers.emplace_back("often", SerialInt64(-100));
+
+    auto writer = MultiChannelPathWriter<BiasedDeltaInt64Stream, PlainText>(path, "test", headers, {}, format);
+
+    KeyframePolicy rare;
+    rare.every_frames = 5000;
+    writer.set_keyframe_policy("rare", rare);
+
+    KeyframePolicy often;
+    often.every_frames = 3;
+    writer.set_keyframe_policy("often", often);
+
+    for (int i = 0; i < nframes; ++i) {
+        if (i % 3 == 0) {
+            BOOST_REQUIRE(writer.write("rare", SerialInt64(i), 1000 + i));
+        } else if (i % 3 == 1 || i < nframes / 2) {
+            BOOST_REQUIRE(writer.write("often", SerialInt64(-i), 1000 + i));
+        } else {
+            BOOST_REQUIRE(writer.write("log", SerialString{std::to_string(i)}, 1000 + i));
+        }
+    }
+}
+
+static std::vector<Frame> read_sequential(const std::string& path)
+{
+    auto reader = MultiChannelMappedReader<BiasedDeltaInt64Stream, PlainText>(path);
+    std::vector<Frame> frames;
+
+    reader.for_each_frame([&](const Reader::slot_type& slot) {
+        frames.push_back(frame(slot));
+    });
+
+    return frames;
+}
+
+BOOST_AUTO_TEST_CASE(parallel_matches_sequential)
+{
+    TempFile file;
+    write_frames(file.path);
+
+    auto expected = read_sequential(file.path);
+    BOOST_REQUIRE(expected.size() == nframes);
+
+    for (size_t ranges : {1, 2, 7, 64}) {
+        auto reader = Reader(file.path, 3, ranges);
+        BOOST_CHECK(reader.ranges().size() == ranges);
+
+        std::vector<Frame> frames;
+        size_t n = reader.transform(frame, [&](Frame&& f) { frames.push_back(f); });
+
+        BOOST_CHECK(n == expected.size());
+        BOOST_CHECK(frames == expected);
+
+        // Slots are handed out in order too
+        size_t i = 0;
+        reader.for_each_frame([&](const Reader::slot_type& slot) {
+            BOOST_CHECK(frame(slot) == expected[i++]);
+        });
+        BOOST_CHECK(i == expected.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(parallel_blocks)
+{
+    TempFile file;
+    write_frames(file.path);
+
+    auto expected = read_sequential(file.path);
+
+    auto reader = Reader(file.path, 3, 7);
+
+    // Blocks are gathered per range, and handed over in file order
+    std::vector<Frame> frames;
+    size_t n = reader.transform_blocks<std::vector<Frame>>(
+        [](std::vector<Frame>& block, const Reader::slot_type& slot) {
+            block.push_back(frame(slot));
+        }, [&](std::vector<Frame>&& block) {
+            BOOST_CHECK(!block.empty() && block.size() <= Reader::chunk_frames);
+            frames.insert(frames.end(), block.begin(), block.end());
+        });
+
+    BOOST_CHECK(frames == expected);
+    BOOST_CHECK(n >= expected.size() / Reader::chunk_frames);
+
+    // Stopped by the consumer
+    size_t blocks = 0;
+    n = reader.transform_blocks<std::vector<Frame>>(
+        [](std::vector<Frame>& block, const Reader::slot_type& slot) {
+            block.push_back(frame(slot));
+        }, [&](std::vector<Frame>&&) { return ++blocks < 3; });
+
+    BOOST_CHECK(n == 3);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_first_keyframe)
+{
+    TempFile file;
+
+    // Only the first frame is a keyframe, so every later range starts with
+    // a delta from it
+    {
+        MultiChannelPathWriter<BiasedDeltaInt64Stream>::header_map headers;
+        headers.emplace_back("s", SerialInt64(100));
+
+        auto writer = MultiChannelPathWriter<BiasedDeltaInt64Stream>(file.path, "test", headers);
+
+        KeyframePolicy never;
+        never.every_frames = 0;
+        writer.set_keyframe_policy("s", never);
+
+        for (int i = 0; i < nframes; ++i) {
+            BOOST_REQUIRE(writer.write("s", SerialInt64(i), 1000 + i));
+        }
+    }
+
+    auto reader = ParallelReader<BiasedDeltaInt64Stream>(file.path, 4, 16);
+    BOOST_REQUIRE(reader.ranges().size() == 16);
+
+    // The preamble is the header, the keyframe and every frame since, read
+    // in place
+    auto first = reader.ranges().front().frames;
+    size_t before = 0;
+    for (size_t i = 1; i < reader.ranges().size(); ++i) {
+        auto& prev = reader.ranges()[i - 1];
+        auto& range = reader.ranges()[i];
+        before += prev.frames.size();
+        BOOST_REQUIRE(range.preamble.size() == range.preamble_frames + 1);
+        BOOST_CHECK(range.preamble[0].begin() >= first.begin() &&
+            range.preamble[0].end() <= first.end());
+        BOOST_CHECK(range.preamble.back().end() == range.frames.begin());
+
+        size_t bytes = 0;
+        for (auto&& frame : range.preamble) {
+            bytes += frame.size();
+        }
+        BOOST_CHECK(bytes == before);
+    }
+
+    int64_t i = 0;
+    reader.for_each_frame([&](const auto& slot) {
+        BOOST_CHECK(std::get<SerialInt64>(slot.data).value() == i);
+        BOOST_CHECK(slot.source_timestamp == static_cast<uint64_t>(1000 + i));
+        i++;
+    });
+    BOOST_CHECK(i == nframes);
+}
+
+// Deltas from the previous frame rather than from the last keyframe
+class ChainedDeltaInt64 {
+   public:
+    using header_type = SerialInt64;
+    using data_type = SerialInt64;
+    using delta_type = SerialInt64;
+
+    ChainedDeltaInt64(SerialInt64 header) : header_(header)
+    {
+    }
+
+    const SerialInt64& header() {
+        return header_;
+    }
+
+    SerialInt64 encode(const SerialInt64& input) {
+        prev_ = input;
+        return input;
+    }
+
+    SerialInt64 decode(const SerialInt64& input) {
+        prev_ = input;
+        return input;
+    }
+
+    SerialInt64 encode_delta(const SerialInt64& input) {
+        SerialInt64 d{input.value() - prev_.value()};
+        prev_ = input;
+        return d;
+    }
+
+    SerialInt64 decode_delta(const SerialInt64& input) {
+        prev_ = {prev_.value() + input.value()};
+        return prev_;
+    }
+
+   private:
+    SerialInt64 header_;
+    SerialInt64 prev_;
+};
+
+BOOST_AUTO_TEST_CASE(parallel_chained_deltas)
+{
+    using Stream = HeaderDeltaStream<ChainedDeltaInt64>;
+
+    TempFile file;
+
+    {
+        MultiChannelPathWriter<Stream>::header_map headers;
+        headers.emplace_back("s", SerialInt64(0));
+
+        auto writer = MultiChannelPathWriter<Stream>(file.path, "test", headers);
+
+        KeyframePolicy rare;
+        rare.every_frames = 7000;
+        writer.set_keyframe_policy("s", rare);
+
+        for (int i = 0; i < nframes; ++i) {
+            BOOST_REQUIRE(writer.write("s", SerialInt64(i * i), 1000 + i));
+        }
+    }
+
+    for (size_t ranges : {2, 7, 64}) {
+        auto reader = ParallelReader<Stream>(file.path, 4, ranges);
+
+        int64_t i = 0;
+        reader.for_each_frame([&](const auto& slot) {
+            BOOST_CHECK(std::get<SerialInt64>(slot.data).value() == i * i);
+            i++;
+        });
+        BOOST_CHECK(i == nframes);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(parallel_stop)
+{
+    TempFile file;
+    write_frames(file.path);
+
+    auto reader = Reader(file.path, 4, 16);
+
+    size_t i = 0;
+    size_t n = reader.transform(frame, [&](Frame&&) { return ++i < 12345; });
+    BOOST_CHECK(n == 12345);
+
+    // An exception in map stops the workers and reaches the caller
+    BOOST_CHECK_THROW(reader.transform([](const Reader::slot_type& slot) {
+        if (slot.source_timestamp == 1000 + nframes / 2) {
+            throw std::runtime_error("map");
+        }
+        return slot.source_timestamp;
+    }, [](uint64_t) {}), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_compact)
+{
+    TempFile file;
+    write_frames(file.path, FrameFormat::compact);
+
+    auto expected = read_sequential(file.path);
+    BOOST_REQUIRE(expected.size() == nframes);
+
+    // Compact frames depend on registrations at the start of the stream,
+    // so the file is read as one range
+    auto reader = Reader(file.path, 4, 16);
+    BOOST_CHECK(reader.ranges().size() == 1);
+
+    std::vector<Frame> frames;
+    reader.transform(frame, [&](Frame&& f) { frames.push_back(f); });
+    BOOST_CHECK(frames == expected);
+}
@@ -0,0 +1,476 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <boost/test/unit_test.hpp>
+#include <rapidcheck/boost_test.h>
+
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/multichannel_reader.h"
+#include "lt/slipstream/multichannel_writer.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/query.h"
+#include "lt/slipstream/reader.h"
+#include "lt/slipstream/writer.h"
+#include "lt/slipstream/testing/biased.h"
+#include "lt/slipstream/testing/integer.h"
+#include "lt/slipstream/testing/rc_plaintext.h"
+#include "lt/slipstream/testing/sample.h"
+
+using namespace lt::slipstream;
+
+BOOST_AUTO_TEST_CASE(predicate_parse)
+{
+    auto p = Predicate::parse("value > 100");
+    BOOST_CHECK(p.path == "value");
+    BOOST_CHECK(p.op == Predicate::Op::gt);
+    BOOST_CHECK(p.literal == "100");
+
+    p = Predicate::parse("pos.x<=-1.5");
+    BOOST_CHECK(p.path == "pos.x");
+    BOOST_CHECK(p.op == Predicate::Op::le);
+    BOOST_CHECK(p.literal == "-1.5");
+
+    p = Predicate::parse("name == \"a <b\"");
+    BOOST_CHECK(p.path == "name");
+    BOOST_CHECK(p.op == Predicate::Op::eq);
+    BOOST_CHECK(p.literal == "a <b");
+
+    BOOST_CHECK(Predicate::parse("a = 1").op == Predicate::Op::eq);
+    BOOST_CHECK(Predicate::parse("a != 1").op == Predicate::Op::ne);
+    BOOST_CHECK(Predicate::parse("a >= 1").op == Predicate::Op::ge);
+    BOOST_CHECK(Predicate::parse("a < 1").op == Predicate::Op::lt);
+
+    BOOST_CHECK_THROW(Predicate::parse("value"), QueryError);
+    BOOST_CHECK_THROW(Predicate::parse("> 1"), QueryError);
+    BOOST_CHECK_THROW(Predicate::parse("value >"), QueryError);
+    BOOST_CHECK_THROW(Predicate::parse("value ! 1"), QueryError);
+}
+
+// Read every frame that matches `query` as JSON, one record per line
+template <typename R>
+static std::string read_all_json(R& reader, Query& query)
+{
+    json::Writer out;
+    uint64_t timestamp;
+
+    while (reader.read_json(out, timestamp, query)) {
+        out.raw('\n');
+    }
+
+    return out.str();
+}
+
+// The records for `values` as written by ChannelReader::read_json, with
+// their data replaced by `data(value)`
+template <typename F>
+static std::string expected_json(const FrameBuffer& frames, F&& data)
+{
+    auto in = kj::ArrayInputStream(frames.asBytes());
+    auto reader = ChannelReader<Headerless<SerialInt64>>(&in);
+
+    std::string expected;
+    SerialInt64 value;
+    uint64_t timestamp;
+    Envelope envelope;
+
+    while (reader.read(value, timestamp, envelope)) {
+        auto d = data(value);
+        if (d) {
+            expected += json::frame(*d, timestamp, envelope) + "\n";
+        }
+    }
+
+    return expected;
+}
+
+RC_BOOST_PROP(query_capnp_rc, (std::vector<SerialInt64> values, int64_t threshold))
+{
+    FrameBuffer frames;
+    {
+        auto writer = ChannelWriter<Headerless<SerialInt64>>(&frames, "test", "int");
+        for (size_t i = 0; i < values.size(); ++i) {
+            RC_ASSERT(writer.write(values[i], 1000 + i));
+        }
+    }
+
+    auto t = std::to_string(threshold);
+
+    // Predicates select frames; their data is written whole
+    {
+        Query query({}, {"value > " + t});
+
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = ChannelReader<Headerless<SerialInt64>>(&in);
+
+        RC_ASSERT(read_all_json(reader, query) == expected_json(frames,
+            [&](const SerialInt64& v) -> std::optional<std::string> {
+                if (v.value() > threshold) {
+                    return SerialInt64::to_json(v);
+                }
+                return {};
+            }));
+    }
+
+    // Projected fields are written by path, and fields the schema does not
+    // have are left out
+    {
+        Query query({"value", "missing"}, {"value <= " + t, "value != 0"});
+
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = ChannelReader<Headerless<SerialInt64>>(&in);
+
+        RC_ASSERT(read_all_json(reader, query) == expected_json(frames,
+            [&](const SerialInt64& v) -> std::optional<std::string> {
+                if (v.value() <= threshold && v.value() != 0) {
+                    return "{\"value\":\"" + std::to_string(v.value()) + "\"}";
+                }
+                return {};
+            }));
+    }
+
+    // A predicate on a field the schema does not have never holds
+    {
+        Query query({}, {"missing == 1"});
+
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = ChannelReader<Headerless<SerialInt64>>(&in);
+
+        RC_ASSERT(read_all_json(reader, query).empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(query_literals)
+{
+    FrameBuffer frames;
+    {
+        auto writer = ChannelWriter<Headerless<SerialInt64>>(&frames, "test", "int");
+        for (int64_t i = -3; i <= 3; ++i) {
+            BOOST_REQUIRE(writer.write(SerialInt64(i), 1000));
+        }
+    }
+
+    auto count = [&](const std::string& predicate) {
+        Query query({"value"}, {predicate});
+
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = ChannelReader<Headerless<SerialInt64>>(&in);
+
+        json::Writer out;
+        uint64_t timestamp;
+        int n = 0;
+        while (reader.read_json(out, timestamp, query)) {
+            n++;
+        }
+        return n;
+    };
+
+    BOOST_CHECK(count("value >= -1") == 5);
+    BOOST_CHECK(count("value < 1.5") == 5);
+    BOOST_CHECK(count("value == 2") == 1);
+    BOOST_CHECK(count("value == 2.5") == 0);
+    BOOST_CHECK(count("value != 0") == 6);
+
+    BOOST_CHECK_THROW(count("value > ten"), QueryError);
+}
+
+BOOST_AUTO_TEST_CASE(query_multichannel)
+{
+    FrameBuffer frames;
+    {
+        auto writer = MultiChannelWriter<Headerless<SerialInt64>, PlainText>(&frames, "test");
+        for (int i = 0; i < 10; ++i) {
+            BOOST_REQUIRE(writer.write("int", SerialInt64(i), 1000 + i));
+            BOOST_REQUIRE(writer.write("log", SerialString{"line " + std::to_string(i)}, 1000 + i));
+        }
+    }
+
+    json::Writer out;
+    uint64_t timestamp;
+
+    // Text frames have no schema, so match no predicate
+    {
+        Query query({"value"}, {"value >= 7"});
+
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = MultiChannelReader<Headerless<SerialInt64>, PlainText>(&in);
+
+        out.clear();
+        int n = 0;
+        while (reader.read_json(out, timestamp, query)) {
+            BOOST_CHECK(timestamp >= 1007);
+            n++;
+        }
+        BOOST_CHECK(n == 3);
+        BOOST_CHECK(out.str().find("line") == std::string::npos);
+        BOOST_CHECK(out.str().find("\"data\":{\"value\":\"9\"}}") != std::string::npos);
+    }
+
+    // With only a projection, they are written whole
+    {
+        Query query({"value"}, {});
+
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = MultiChannelReader<Headerless<SerialInt64>, PlainText>(&in);
+
+        out.clear();
+        int n = 0;
+        while (reader.read_json(out, timestamp, query)) {
+            n++;
+        }
+        BOOST_CHECK(n == 20);
+        BOOST_CHECK(out.str().find("\"data\":{\"text\":\"line 3\"}}") != std::string::npos);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(query_end)
+{
+    FrameBuffer frames;
+    {
+        auto writer = MultiChannelWriter<Headerless<SerialInt64>, PlainText>(&frames, "test");
+        for (int i = 0; i < 100; ++i) {
+            BOOST_REQUIRE(writer.write("int", SerialInt64(i), 1000 + i));
+            BOOST_REQUIRE(writer.write("log", SerialString{"line " + std::to_string(i)}, 1000 + i));
+        }
+    }
+
+    // No frame after the first few matches, but the read still stops at
+    // the first frame after the end, with nothing written for it
+    Query query({}, {"value < 3"});
+
+    auto in = kj::ArrayInputStream(frames.asBytes());
+    auto reader = MultiChannelReader<Headerless<SerialInt64>, PlainText>(&in);
+
+    json::Writer out;
+    uint64_t timestamp;
+    int n = 0;
+
+    while (reader.read_json(out, timestamp, query, 1010)) {
+        if (timestamp > 1010) {
+            break;
+        }
+        n++;
+    }
+
+    BOOST_CHECK(n == 3);
+    BOOST_CHECK(timestamp == 1011);
+    BOOST_CHECK(out.str().find("\"value\":\"2\"") != std::string::npos);
+    BOOST_CHECK(out.str().find("\"value\":\"11\"") == std::string::npos);
+
+    // The rest of the stream is left unread
+    Query all;
+    BOOST_REQUIRE(reader.read_json(out, timestamp, all));
+    BOOST_CHECK(timestamp == 1011);
+
+    // The same for a single channel
+    FrameBuffer single;
+    {
+        auto writer = ChannelWriter<Headerless<SerialInt64>>(&single, "test", "int");
+        for (int i = 0; i < 100; ++i) {
+            BOOST_REQUIRE(writer.write(SerialInt64(i), 1000 + i));
+        }
+    }
+
+    auto single_in = kj::ArrayInputStream(single.asBytes());
+    auto single_reader = ChannelReader<Headerless<SerialInt64>>(&single_in);
+
+    out.clear();
+    n = 0;
+    while (single_reader.read_json(out, timestamp, query, 1010) && timestamp <= 1010) {
+        n++;
+    }
+
+    BOOST_CHECK(n == 3);
+    BOOST_CHECK(timestamp == 1011);
+    BOOST_REQUIRE(single_reader.read_json(out, timestamp, all));
+    BOOST_CHECK(timestamp == 1012);
+}
+
+// Frames of `samples`, one per millisecond from 1000
+static FrameBuffer write_samples(const std::vector<Sample>& samples)
+{
+    FrameBuffer frames;
+    auto writer = ChannelWriter<Headerless<Sample>>(&frames, "test", "sample");
+
+    for (size_t i = 0; i < samples.size(); ++i) {
+        BOOST_REQUIRE(writer.write(samples[i], 1000 + i));
+    }
+
+    return frames;
+}
+
+// The ids of the samples that match `predicates`
+static std::vector<uint32_t> match_ids(const FrameBuffer& frames,
+    const std::vector<std::string>& predicates)
+{
+    Query query({"id"}, predicates);
+
+    auto in = kj::ArrayInputStream(frames.asBytes());
+    auto reader = ChannelReader<Headerless<Sample>>(&in);
+
+    std::vector<uint32_t> ids;
+    json::Writer out;
+    uint64_t timestamp;
+
+    static const std::string prefix = "\"data\":{\"id\":";
+
+    while (reader.read_json(out, timestamp, query)) {
+        auto record = out.str();
+        auto at = record.find(prefix);
+        BOOST_REQUIRE(at != std::string::npos);
+        ids.push_back(std::stoul(record.substr(at + prefix.size())));
+        out.clear();
+    }
+
+    return ids;
+}
+
+RC_BOOST_PROP(query_sample_rc, (std::vector<Sample> samples))
+{
+    for (size_t i = 0; i < samples.size(); ++i) {
+        samples[i].id = i;
+    }
+
+    auto frames = write_samples(samples);
+
+    // The ids of the samples for which f holds
+    auto expected = [&](auto&& f) {
+        std::vector<uint32_t> ids;
+        for (auto&& s : samples) {
+            if (f(s)) {
+                ids.push_back(s.id);
+            }
+        }
+        return ids;
+    };
+
+    // A nested struct
+    RC_ASSERT(match_ids(frames, {"pos.x > 1.5"}) ==
+        expected([](const Sample& s) { return s.x > 1.5; }));
+
+    // An enum, by enumerant name
+    RC_ASSERT(match_ids(frames, {"level == high"}) ==
+        expected([](const Sample& s) { return s.level == Sample::Level::HIGH; }));
+
+    // Text, quoted or not
+    RC_ASSERT(match_ids(frames, {"name == \"sample 1\""}) ==
+        expected([](const Sample& s) { return s.name == "sample 1"; }));
+    RC_ASSERT(match_ids(frames, {"name != sample 1"}) ==
+        expected([](const Sample& s) { return s.name != "sample 1"; }));
+
+    // A bool, with other predicates
+    RC_ASSERT(match_ids(frames, {"valid == true", "level != low"}) ==
+        expected([](const Sample& s) { return s.valid && s.level != Sample::Level::LOW; }));
+
+    // A union member that is not set holds no value, so even != fails
+    RC_ASSERT(match_ids(frames, {"reading.temperature != 1000"}) ==
+        expected([](const Sample& s) { return std::holds_alternative<double>(s.reading); }));
+    RC_ASSERT(match_ids(frames, {"reading.label == \"label 2\""}) ==
+        expected([](const Sample& s) {
+            auto l = std::get_if<std::string>(&s.reading);
+            return l != nullptr && *l == "label 2";
+        }));
+}
+
+BOOST_AUTO_TEST_CASE(query_sample_project)
+{
+    Sample a;
+    a.id = 1;
+    a.name = "eth0";
+    a.level = Sample::Level::MEDIUM;
+    a.valid = true;
+    a.x = 1.5;
+    a.y = -0.5;
+    a.reading = std::string("warm");
+
+    Sample b = a;
+    b.id = 2;
+    b.reading = 21.5;
+
+    auto frames = write_samples({a, b});
+
+    // Unset union members are left out
+    Query query({"id", "name", "level", "valid", "pos.y", "reading.label"}, {});
+
+    auto in = kj::ArrayInputStream(frames.asBytes());
+    auto reader = ChannelReader<Headerless<Sample>>(&in);
+
+    json::Writer out;
+    uint64_t timestamp;
+
+    BOOST_REQUIRE(reader.read_json(out, timestamp, query));
+    BOOST_CHECK(out.str().find("\"data\":{\"id\":1,\"name\":\"eth0\",\"level\":\"medium\","
+        "\"valid\":true,\"pos.y\":-0.5,\"reading.label\":\"warm\"}}") != std::string::npos);
+
+    out.clear();
+    BOOST_REQUIRE(reader.read_json(out, timestamp, query));
+    BOOST_CHECK(out.str().find("\"data\":{\"id\":2,\"name\":\"eth0\",\"level\":\"medium\","
+        "\"valid\":true,\"pos.y\":-0.5}}") != std::string::npos);
+
+    // Comparisons that do not suit the field's type
+    for (auto&& predicate : {"level > low", "level == lowest", "valid == yes", "valid < true", "pos > 1"}) {
+        Query bad({}, {predicate});
+
+        auto in = kj::ArrayInputStream(frames.asBytes());
+        auto reader = ChannelReader<Headerless<Sample>>(&in);
+
+        BOOST_CHECK_THROW(reader.read_json(out, timestamp, bad), QueryError);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(query_header_stream)
+{
+    FrameBuffer frames;
+    {
+        auto writer = ChannelWriter<BiasedInt64Stream>(&frames, "test", "int", SerialInt64(1000));
+        for (int64_t i = 0; i < 10; ++i) {
+            BOOST_REQUIRE(writer.write(SerialInt64(i), 1000 + i));
+        }
+    }
+
+    static_assert(reads_dynamic<BiasedInt64Stream>::value);
+    static_assert(!reads_dynamic<PlainText>::value);
+
+    // Only queries are evaluated on the message; records without a query
+    // are written from the reader's slot
+    static_assert(ChannelReader<BiasedInt64Stream>::query_direct);
+    static_assert(!ChannelReader<BiasedInt64Stream>::json_direct);
+
+    // Predicates and projections see the decoded values, not the biased
+    // ones in the stream
+    Query query({"value"}, {"value >= 7"});
+
+    auto in = kj::ArrayInputStream(frames.asBytes());
+    auto reader = ChannelReader<BiasedInt64Stream>(&in);
+
+    json::Writer out;
+    uint64_t timestamp;
+    int n = 0;
+
+    while (reader.read_json(out, timestamp, query)) {
+        n++;
+    }
+
+    BOOST_CHECK(n == 3);
+    BOOST_CHECK(out.str().find("\"data\":{\"value\":\"7\"}}") != std::string::npos);
+
+    // Without a query, records are as decoded
+    auto all = kj::ArrayInputStream(frames.asBytes());
+    auto all_reader = ChannelReader<BiasedInt64Stream>(&all);
+
+    out.clear();
+    BOOST_REQUIRE(all_reader.read_json(out, timestamp));
+    BOOST_CHECK(out.str().find("\"data\":{\"value\":\"0\"}}") != std::string::npos);
+
+    // The same through a MultiChannelReader
+    auto multi = kj::ArrayInputStream(frames.asBytes());
+    auto multi_reader = MultiChannelReader<BiasedInt64Stream>(&multi);
+
+    out.clear();
+    n = 0;
+    while (multi_reader.read_json(out, timestamp, query)) {
+        n++;
+    }
+
+    BOOST_CHECK(n == 3);
+    BOOST_CHECK(out.str().find("\"data\":{\"value\":\"9\"}}") != std::string::npos);
+}
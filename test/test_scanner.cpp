@@ -0,0 +1,301 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <functional>
+
+#include <boost/test/unit_test.hpp>
+#include <rapidcheck/boost_test.h>
+
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/scanner.h"
+#include "lt/slipstream/seek.h"
+#include "lt/slipstream/writer.h"
+#include "lt/slipstream/testing/temp_file.h"
+
+using namespace lt::slipstream;
+using namespace lt::slipstream::testing;
+
+// Enough frames to span several of the scanner's read chunks
+static constexpr int nframes = 5000;
+static constexpr uint64_t first_timestamp = 1000;
+
+static void write_frames(const std::string& path)
+{
+    auto writer = ChannelPathWriter<PlainText>(path, "test", "log");
+
+    for (int i = 0; i < nframes; ++i) {
+        std::string line = "line " + std::to_string(i) + std::string(i % 50, '.');
+        BOOST_REQUIRE(writer.write(SerialString{line}, first_timestamp + i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scanner_count)
+{
+    TempFile file;
+    write_frames(file.path);
+
+    auto scanner = PathScanner(file.path);
+
+    int c = 0;
+
+    do {
+        try {
+            scanner.next();
+            scanner.skip(1);
+            c++;
+        } catch (const std::exception&) {
+            break;
+        }
+    } while (true);
+
+    BOOST_CHECK(c == nframes);
+}
+
+BOOST_AUTO_TEST_CASE(scanner_peek_copy)
+{
+    TempFile file;
+    write_frames(file.path);
+
+    auto scanner = PathScanner(file.path);
+    FrameBuffer copy;
+
+    for (int i = 0; i < nframes; ++i) {
+        uint64_t timestamp = 0;
+        Envelope envelope;
+
+        BOOST_REQUIRE(scanner.peek(timestamp));
+        BOOST_CHECK(timestamp == first_timestamp + i);
+
+        BOOST_REQUIRE(scanner.peek(timestamp, envelope));
+        BOOST_CHECK(timestamp == first_timestamp + i);
+        BOOST_CHECK(envelope.identifier.channel_name == "log");
+
+        BOOST_CHECK(scanner.copy_frame(copy) > frame_header_length);
+    }
+
+    uint64_t timestamp;
+    BOOST_CHECK(!scanner.peek(timestamp));
+    BOOST_CHECK(scanner.copy_frame(copy) == 0);
+
+    BOOST_CHECK(std::string(reinterpret_cast<const char*>(copy.data()), copy.size())
+        == file.contents());
+}
+
+BOOST_AUTO_TEST_CASE(seeker_tell_seek_time)
+{
+    TempFile file;
+    write_frames(file.path);
+
+    auto seeker = PathSeeker(file.path);
+
+    for (uint64_t target : {first_timestamp, first_timestamp + 1234,
+             first_timestamp + nframes - 1}) {
+        BOOST_REQUIRE(seeker.seek_time(target));
+
+        uint64_t timestamp = 0;
+        BOOST_REQUIRE(seeker.peek(timestamp));
+        BOOST_CHECK(timestamp == target);
+    }
+
+    BOOST_CHECK(!seeker.seek_time(first_timestamp + nframes + 1));
+}
+
+BOOST_AUTO_TEST_CASE(seeker_read_after_seek)
+{
+    TempFile file;
+    write_frames(file.path);
+
+    auto seeker = ChannelPathSeeker<PlainText>(file.path);
+
+    BOOST_REQUIRE(seeker.seek_time(first_timestamp + 100));
+
+    SerialString s;
+    uint64_t timestamp;
+    Envelope envelope;
+
+    BOOST_REQUIRE(seeker.read(s, timestamp, envelope));
+    BOOST_CHECK(timestamp == first_timestamp + 100);
+    BOOST_CHECK(s.str().rfind("line 100", 0) == 0);
+
+    BOOST_REQUIRE(seeker.read(s, timestamp, envelope));
+    BOOST_CHECK(timestamp == first_timestamp + 101);
+}
+
+BOOST_AUTO_TEST_CASE(scanner_skip_frame)
+{
+    TempFile file;
+    write_frames(file.path);
+
+    auto scanner = PathScanner(file.path);
+
+    int c = 0;
+    uint64_t timestamp = 0;
+
+    BOOST_REQUIRE(scanner.next());
+    do {
+        BOOST_REQUIRE(scanner.peek(timestamp));
+        BOOST_CHECK(timestamp == first_timestamp + c);
+        c++;
+    } while (scanner.skip_frame());
+
+    BOOST_CHECK(c == nframes);
+}
+
+BOOST_AUTO_TEST_CASE(scanner_skip_frame_embedded_marker)
+{
+    TempFile file;
+
+    // Payloads that contain a well-formed frame header
+    Framing fake = {0, 0, 42, 0, false};
+    uint8_t header[frame_header_length];
+    fake.encode(header);
+    std::string embedded(reinterpret_cast<const char*>(header), sizeof(header));
+
+    {
+        auto writer = ChannelPathWriter<PlainText>(file.path, "test", "log");
+        for (int i = 0; i < 100; ++i) {
+            BOOST_REQUIRE(writer.write(SerialString{embedded + embedded}, first_timestamp + i));
+        }
+    }
+
+    auto scanner = PathScanner(file.path);
+
+    int c = 0;
+    uint64_t timestamp = 0;
+
+    BOOST_REQUIRE(scanner.next());
+    do {
+        BOOST_REQUIRE(scanner.peek(timestamp));
+        BOOST_CHECK(timestamp == first_timestamp + c);
+        c++;
+    } while (scanner.skip_frame());
+
+    BOOST_CHECK(c == 100);
+
+    auto copier = PathScanner(file.path);
+    FrameBuffer copy;
+
+    for (int i = 0; i < 100; ++i) {
+        BOOST_REQUIRE(copier.peek(timestamp));
+        BOOST_CHECK(timestamp == first_timestamp + i);
+        BOOST_CHECK(copier.copy_frame(copy) > 2 * frame_header_length);
+    }
+
+    BOOST_CHECK(std::string(reinterpret_cast<const char*>(copy.data()), copy.size())
+        == file.contents());
+}
+
+// Rewrite `path` with the payload length of its 11th frame replaced by
+// `length(original)`
+template <typename F>
+static void corrupt_length(const std::string& path, const std::string& data, F&& length)
+{
+    std::string corrupt = data;
+    size_t offset = 0;
+    for (int i = 0; i < 10; ++i) {
+        Framing framing;
+        BOOST_REQUIRE(framing.decode(reinterpret_cast<const uint8_t*>(&corrupt[offset])));
+        offset += frame_header_length + framing.envelope_length + framing.payload_length;
+    }
+
+    Framing framing;
+    uint8_t * header = reinterpret_cast<uint8_t*>(&corrupt[offset]);
+    BOOST_REQUIRE(framing.decode(header));
+    framing.payload_length = length(framing.payload_length);
+    framing.encode(header);
+
+    int fd = open(path.c_str(), O_WRONLY | O_TRUNC);
+    BOOST_REQUIRE(write(fd, corrupt.data(), corrupt.size()) == static_cast<ssize_t>(corrupt.size()));
+    close(fd);
+}
+
+// Walk every frame with skip_frame(), checking that none is lost
+static void check_skip_all(Scanner& scanner)
+{
+    int c = 0;
+    uint64_t timestamp = 0;
+
+    BOOST_REQUIRE(scanner.next());
+    do {
+        BOOST_REQUIRE(scanner.peek(timestamp));
+        BOOST_CHECK(timestamp == first_timestamp + c);
+        c++;
+    } while (scanner.skip_frame());
+
+    BOOST_CHECK(c == nframes);
+}
+
+BOOST_AUTO_TEST_CASE(scanner_skip_frame_resync)
+{
+    TempFile file;
+    write_frames(file.path);
+    std::string data = file.contents();
+
+    // A length that lands just past the next frame's header, and ones that
+    // land beyond the scanner's buffer, within the file and past its end
+    std::vector<std::function<uint32_t(uint32_t)>> lengths = {
+        [](uint32_t l) { return l + 7; },
+        [](uint32_t l) { return l + 200000; },
+        [](uint32_t l) { return 0xfffff; },
+    };
+
+    BOOST_REQUIRE(data.size() > 300000);
+    BOOST_REQUIRE(data.size() < 0xfffff);
+
+    for (auto&& length : lengths) {
+        corrupt_length(file.path, data, length);
+
+        // Read through a stream that cannot seek, and one that can
+        auto scanner = PathScanner(file.path);
+        check_skip_all(scanner);
+
+        auto seeker = PathSeeker(file.path);
+        check_skip_all(seeker);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scanner_group_merge)
+{
+    static constexpr int ninputs = 3;
+    static constexpr int per_input = 500;
+
+    TempFile files[ninputs];
+    std::vector<std::string> paths;
+
+    for (int f = 0; f < ninputs; ++f) {
+        auto writer = ChannelPathWriter<PlainText>(files[f].path, "test", "c" + std::to_string(f));
+        for (int i = 0; i < per_input; ++i) {
+            // Overlapping ranges, with timestamps repeated across inputs
+            BOOST_REQUIRE(writer.write(SerialString{"x"}, first_timestamp + 2 * i + (f == 2)));
+        }
+        paths.push_back(files[f].path);
+    }
+
+    auto group = PathScannerGroup(paths);
+
+    int c = 0;
+    uint64_t prev_timestamp = 0;
+    std::string prev_channel;
+
+    uint64_t timestamp;
+    Envelope envelope;
+
+    while (group.peek(timestamp, envelope)) {
+        BOOST_REQUIRE(timestamp >= prev_timestamp);
+        if (timestamp == prev_timestamp) {
+            // Equal timestamps come in input order
+            BOOST_CHECK(envelope.identifier.channel_name > prev_channel);
+        }
+        prev_timestamp = timestamp;
+        prev_channel = envelope.identifier.channel_name;
+
+        c++;
+        group.skip_frame();
+    }
+
+    BOOST_CHECK(c == ninputs * per_input);
+}
@@ -0,0 +1,160 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+#include <rapidcheck/boost_test.h>
+
+#include "lt/slipstream/frame_buffer.h"
+#include "lt/slipstream/multichannel_reader.h"
+#include "lt/slipstream/plaintext.h"
+#include "lt/slipstream/scanner.h"
+#include "lt/slipstream/shared_writer.h"
+#include "lt/slipstream/testing/biased.h"
+
+using namespace lt::slipstream;
+
+// Read back every frame, checking that timestamps never decrease
+static size_t check_ordered(const FrameBuffer& frames, size_t& late_frames)
+{
+    auto in = kj::ArrayInputStream(frames.asBytes());
+    auto reader = MultiChannelReader<PlainText>(&in);
+    decltype(reader)::data_type data;
+    uint64_t timestamp;
+    uint64_t previous = 0;
+    Envelope envelope;
+    size_t n = 0;
+
+    late_frames = 0;
+
+    while (reader.read(data, timestamp, envelope)) {
+        BOOST_CHECK(timestamp >= previous);
+        if (std::get<SerialString>(data).str() == "late") {
+            late_frames++;
+        }
+        previous = timestamp;
+        n++;
+    }
+
+    return n;
+}
+
+BOOST_AUTO_TEST_CASE(shared_writer_ordered)
+{
+    static constexpr int nthreads = 4;
+    static constexpr int per_thread = 5000;
+
+    FrameBuffer frames;
+
+    {
+        auto writer = SharedMultiChannelWriter<PlainText>(&frames, "test", {},
+            std::chrono::seconds(1));
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nthreads; ++t) {
+            threads.emplace_back([&, t] {
+                auto channel = "thread-" + std::to_string(t);
+                for (int i = 0; i < per_thread; ++i) {
+                    while (!writer.write(channel, SerialString{"frame"})) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+
+        for (auto&& t : threads) {
+            t.join();
+        }
+
+        writer.flush();
+
+        auto stats = writer.stats();
+        BOOST_CHECK(stats.producers == nthreads);
+        BOOST_CHECK(stats.late == 0);
+    }
+
+    size_t late;
+    BOOST_CHECK(check_ordered(frames, late) == nthreads * per_thread);
+}
+
+BOOST_AUTO_TEST_CASE(shared_writer_late_frame)
+{
+    FrameBuffer frames;
+
+    {
+        auto writer = SharedMultiChannelWriter<PlainText>(&frames, "test");
+
+        BOOST_CHECK(writer.write("a", SerialString{"on time"}, 2000));
+        writer.flush();
+
+        // Earlier than a frame that has already been written
+        std::thread([&] {
+            BOOST_CHECK(writer.write("b", SerialString{"late"}, 1000));
+        }).join();
+        writer.flush();
+
+        BOOST_CHECK(writer.stats().late == 1);
+    }
+
+    size_t late;
+    BOOST_CHECK(check_ordered(frames, late) == 2);
+    BOOST_CHECK(late == 1);
+}
+
+BOOST_AUTO_TEST_CASE(shared_writer_late_header)
+{
+    FrameBuffer frames;
+
+    {
+        SharedMultiChannelWriter<BiasedInt64Stream>::header_map headers;
+        headers.emplace_back("a", SerialInt64(10));
+        headers.emplace_back("b", SerialInt64(20));
+
+        auto writer = SharedMultiChannelWriter<BiasedInt64Stream>(&frames, "test", headers);
+
+        BOOST_CHECK(writer.write("a", SerialInt64(1), 2000));
+        writer.flush();
+
+        // A second thread writes its header frames after a data frame
+        std::thread([&] {
+            BOOST_CHECK(writer.write("b", SerialInt64(2), 3000));
+        }).join();
+        writer.flush();
+
+        BOOST_CHECK(writer.stats().late == 0);
+    }
+
+    // Header frames keep their timestamp of 0
+    auto in = kj::ArrayInputStream(frames.asBytes());
+    auto scanner = ScannerWrapper(in);
+
+    uint64_t timestamp;
+    Envelope envelope;
+    size_t nheaders = 0;
+
+    while (scanner.peek(timestamp, envelope)) {
+        if (std::holds_alternative<PayloadData>(envelope.payload_kind)) {
+            BOOST_CHECK(timestamp >= 2000);
+        } else {
+            BOOST_CHECK(timestamp == 0);
+            nheaders++;
+        }
+
+        if (!scanner.skip_frame()) {
+            break;
+        }
+    }
+
+    BOOST_CHECK(nheaders == 4);
+
+    auto reader_in = kj::ArrayInputStream(frames.asBytes());
+    auto reader = MultiChannelReader<BiasedInt64Stream>(&reader_in);
+    decltype(reader)::data_type data;
+
+    BOOST_REQUIRE(reader.read(data, timestamp, envelope));
+    BOOST_CHECK(std::get<SerialInt64>(data).value() == 1);
+    BOOST_REQUIRE(reader.read(data, timestamp, envelope));
+    BOOST_CHECK(std::get<SerialInt64>(data).value() == 2);
+    BOOST_CHECK(timestamp == 3000);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "lt/slipstream/serialize.h"
+#include "lt/slipstream/testing/integer.h"
+
+namespace lt::slipstream {
+
+class BiasedInt64 {
+   public:
+    using header_type = SerialInt64;
+    using data_type = SerialInt64;
+
+    BiasedInt64(SerialInt64 bias) : bias_(bias)
+    {
+    }
+
+    const SerialInt64& header() {
+        return bias_;
+    }
+
+    SerialInt64 encode(const SerialInt64& input) {
+        return {input.value() - bias_.value()};
+    }
+
+    SerialInt64 decode(const SerialInt64& input) {
+        return {input.value() + bias_.value()};
+    }
+
+   private:
+    SerialInt64 bias_;
+};
+
+class BiasedDeltaInt64 {
+   public:
+    using header_type = SerialInt64;
+    using data_type = SerialInt64;
+    using delta_type = SerialInt64;
+
+    BiasedDeltaInt64(SerialInt64 bias) : bias_(bias)
+    {
+    }
+
+    const SerialInt64& header() {
+        return bias_;
+    }
+
+    SerialInt64 encode(const SerialInt64& input) {
+        keyframe_ = input;
+        return {input.value() - bias_.value()};
+    }
+
+    SerialInt64 decode(const SerialInt64& input) {
+        keyframe_ = {input.value() + bias_.value()};
+        return keyframe_;
+    }
+
+    SerialInt64 encode_delta(const SerialInt64& input) {
+        int64_t d = input.value() - keyframe_.value();
+        return {d - bias_.value()};
+    }
+
+    SerialInt64 decode_delta(const SerialInt64& input) {
+        int64_t d = input.value() + keyframe_.value();
+        return {d + bias_.value()};
+    }
+
+   private:
+    SerialInt64 bias_;
+    SerialInt64 keyframe_; //unbiased
+};
+
+using BiasedInt64Stream = HeaderStream<BiasedInt64>;
+using BiasedDeltaInt64ValueStream = HeaderStream<BiasedDeltaInt64>;
+
+using BiasedDeltaInt64Stream = HeaderDeltaStream<BiasedDeltaInt64>;
+
+} // namespace lt::slipstream
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <ostream>
+
+#include <rapidcheck.h>
+
+#include "lt/slipstream/capnp/test_delta.capnp.h"
+
+#include "lt/slipstream/capnp.h"
+
+namespace lt::slipstream {
+
+class SerialInt64 : public SlipstreamCapnp<SerialInt64, capnp::SerialInt64, SerialInt64> {
+   public:
+    static constexpr auto encoding = "capnp/int64";
+
+    SerialInt64(int64_t i=0) : i_(i) {}
+
+    int64_t value() const {
+        return i_;
+    };
+
+    bool operator==(const SerialInt64& other) const {
+        return i_ == other.i_;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const SerialInt64& s) {
+        return os << s.i_;
+    }
+
+    static SerialInt64 decode(const reader_type& reader)
+    {
+        return SerialInt64(reader.getValue());
+    }
+
+    static void encode(builder_type& builder, const SerialInt64& value)
+    {
+        builder.setValue(value.value());
+    }
+
+   private:
+    int64_t i_;
+};
+
+} // namespace lt::slipstream
+
+namespace rc {
+
+template <>
+struct Arbitrary<lt::slipstream::SerialInt64> {
+    static Gen<lt::slipstream::SerialInt64> arbitrary() {
+        return gen::construct<lt::slipstream::SerialInt64>(gen::arbitrary<int64_t>());
+    }
+};
+
+} // namespace rc
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <variant>
+
+#include <rapidcheck.h>
+
+#include "lt/slipstream/capnp/test_query.capnp.h"
+
+#include "lt/slipstream/capnp.h"
+
+namespace lt::slipstream {
+
+class Sample : public SlipstreamCapnp<Sample, capnp::Sample, Sample> {
+    // A capnp payload with a field of each kind that a Query handles: a
+    // nested struct, an enum, text, a bool, and a union in a group
+   public:
+    static constexpr auto encoding = "capnp/sample";
+
+    using Level = capnp::Sample::Level;
+
+    // The members of the reading union: none, a temperature or a label
+    using Reading = std::variant<std::monostate, double, std::string>;
+
+    uint32_t id = 0;
+    std::string name;
+    Level level = Level::LOW;
+    bool valid = false;
+    double x = 0;
+    double y = 0;
+    Reading reading;
+
+    bool operator==(const Sample& other) const {
+        return id == other.id && name == other.name && level == other.level &&
+            valid == other.valid && x == other.x && y == other.y &&
+            reading == other.reading;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const Sample& s) {
+        return os << s.id << " " << s.name;
+    }
+
+    static Sample decode(const reader_type& reader)
+    {
+        Sample s;
+        s.id = reader.getId();
+
+        auto name = reader.getName();
+        s.name = std::string(name.cStr(), name.size());
+
+        s.level = reader.getLevel();
+        s.valid = reader.getValid();
+
+        if (reader.hasPos()) {
+            s.x = reader.getPos().getX();
+            s.y = reader.getPos().getY();
+        }
+
+        auto reading = reader.getReading();
+        switch (reading.which()) {
+            case capnp::Sample::Reading::TEMPERATURE:
+                s.reading = reading.getTemperature();
+                break;
+            case capnp::Sample::Reading::LABEL: {
+                auto label = reading.getLabel();
+                s.reading = std::string(label.cStr(), label.size());
+                break;
+            }
+            default:
+                break;
+        }
+
+        return s;
+    }
+
+    static void encode(builder_type& builder, const Sample& value)
+    {
+        builder.setId(value.id);
+        builder.setName(value.name.c_str());
+        builder.setLevel(value.level);
+        builder.setValid(value.valid);
+
+        auto pos = builder.initPos();
+        pos.setX(value.x);
+        pos.setY(value.y);
+
+        auto reading = builder.getReading();
+        if (auto t = std::get_if<double>(&value.reading)) {
+            reading.setTemperature(*t);
+        } else if (auto l = std::get_if<std::string>(&value.reading)) {
+            reading.setLabel(l->c_str());
+        } else {
+            reading.setNone();
+        }
+    }
+};
+
+} // namespace lt::slipstream
+
+namespace rc {
+
+template <>
+struct Arbitrary<lt::slipstream::Sample> {
+    static Gen<lt::slipstream::Sample> arbitrary() {
+        using lt::slipstream::Sample;
+
+        return gen::apply([](uint32_t id, int level, bool valid, int x, int which, int t) {
+            Sample s;
+            s.id = id;
+            s.name = "sample " + std::to_string(id % 4);
+            s.level = static_cast<Sample::Level>(level);
+            s.valid = valid;
+            s.x = x / 2.0;
+            s.y = -x / 4.0;
+            if (which == 1) {
+                s.reading = t / 2.0;
+            } else if (which == 2) {
+                s.reading = "label " + std::to_string(t % 3);
+            }
+            return s;
+        }, gen::arbitrary<uint32_t>(), gen::inRange(0, 3), gen::arbitrary<bool>(),
+            gen::inRange(-100, 100), gen::inRange(0, 3), gen::inRange(-100, 100));
+    }
+};
+
+} // namespace rc
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+#include "lt/slipstream/index.h"
+#include "lt/slipstream/mapped_output.h"
+
+namespace lt::slipstream::testing {
+
+struct TempFile {
+    // An empty file under /tmp, removed along with any sidecar files
+    // written next to it
+
+    TempFile()
+    {
+        char tmpl[] = "/tmp/slipstream-test-XXXXXX";
+        int fd = mkstemp(tmpl);
+        BOOST_REQUIRE(fd != -1);
+        close(fd);
+        path = tmpl;
+    }
+
+    ~TempFile()
+    {
+        unlink(path.c_str());
+        unlink(CommittedLength::sidecar_path(path).c_str());
+        unlink(TimeIndex::sidecar_path(path).c_str());
+    }
+
+    size_t size() const
+    {
+        struct stat st;
+        stat(path.c_str(), &st);
+        return st.st_size;
+    }
+
+    std::string contents() const
+    {
+        std::string s;
+        char buf[4096];
+        int fd = open(path.c_str(), O_RDONLY);
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            s.append(buf, n);
+        }
+        close(fd);
+        return s;
+    }
+
+    std::string path;
+};
+
+struct TempDir {
+    // An empty directory under /tmp, removed with everything in it
+
+    TempDir()
+    {
+        char tmpl[] = "/tmp/slipstream-test-XXXXXX";
+        BOOST_REQUIRE(mkdtemp(tmpl) != nullptr);
+        path = tmpl;
+    }
+
+    ~TempDir()
+    {
+        std::filesystem::remove_all(path);
+    }
+
+    std::string path;
+};
+
+} // namespace lt::slipstream::testing
@@ -9,3 +9,17 @@ def slipstream_test(name, timeout = "short", srcs = [], deps = []):
             "testing-support",
         ],
     )
+
+def slipstream_bench(name, srcs = [], deps = []):
+    native.cc_binary(
+        name = "bench/" + name,
+        copts = [
+            "-O2",
+        ],
+        srcs = srcs + [
+            "bench/" + name + ".cpp",
+        ],
+        deps = deps + [
+            "testing-support",
+        ],
+    )